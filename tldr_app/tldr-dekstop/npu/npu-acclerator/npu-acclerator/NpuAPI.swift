@@ -1,5 +1,6 @@
 import Foundation
 import CoreML
+import Accelerate
 
 // MARK: - Constants
 
@@ -181,6 +182,46 @@ func computeCosineSimilarity(
     return results
 }
 
+/// Scores the rows of a normalized dump by their inner product with the unit-length query,
+/// which equals cosine similarity: one matrix-vector product over the mapped rows, with no
+/// per-row norms and no copy into an MLMultiArray
+/// - Parameters:
+///   - rows: Row-major vectors of the dump
+///   - count: Number of rows
+///   - queryVector: Query vector as MLMultiArray
+///   - hashes: Hash values corresponding to the rows
+/// - Returns: Array of similarity results sorted by descending score
+func computeInnerProducts(
+    rows: UnsafePointer<Float>,
+    count: Int,
+    queryVector: MLMultiArray,
+    hashes: [UInt64]
+) -> [VectorSimilarityResult] {
+    let dimensions = queryVector.count
+    var query = [Float](UnsafeBufferPointer(
+        start: queryVector.dataPointer.bindMemory(to: Float32.self, capacity: dimensions),
+        count: dimensions))
+    var normSquared: Float = 0
+    vDSP_svesq(query, 1, &normSquared, vDSP_Length(dimensions))
+    guard normSquared > 0 else { return [] }
+    let scale = 1 / normSquared.squareRoot()
+    query = query.map { $0 * scale }
+
+    let startTime = Date()
+    var scores = [Float](repeating: 0, count: count)
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, Int32(count), Int32(dimensions),
+                1.0, rows, Int32(dimensions), query, 1, 0.0, &scores, 1)
+    print("Inner product calculation time: \(Date().timeIntervalSince(startTime) * 1000) milliseconds")
+
+    var results: [VectorSimilarityResult] = []
+    results.reserveCapacity(count)
+    for i in 0..<count {
+        results.append((i, scores[i], hashes[safe: i] ?? UInt64(i)))
+    }
+    results.sort { $0.score > $1.score }
+    return results
+}
+
 // Extension to safely access array elements
 extension Array {
     subscript(safe index: Index) -> Element? {
@@ -441,6 +482,48 @@ return UnsafeMutableRawPointer(ptr)
    - resultCountPtr: Pointer to store the number of results
  - Returns: Pointer to array of SimilarityResult structures (must be freed by free_similarity_results)
 */
+/**
+ Lists the vector files of a corpus. The C++ library records the live dumps and merged
+ segments in <corpus>/_vecdump/MANIFEST.json; corpora without a manifest are walked for
+ .vecdump files.
+ */
+func listCorpusVectorFiles(corpusDir: String) -> [URL] {
+    let fileManager = FileManager.default
+    let corpusURL = URL(fileURLWithPath: corpusDir)
+    let manifestURL = corpusURL.appendingPathComponent("_vecdump/MANIFEST.json")
+    
+    if let data = try? Data(contentsOf: manifestURL),
+       let manifest = try? JSONSerialization.jsonObject(with: data) as? [String: Any],
+       let entries = manifest["entries"] as? [[String: Any]] {
+        return entries.compactMap { $0["path"] as? String }.map { corpusURL.appendingPathComponent($0) }
+    }
+    
+    // Get all files with .vecdump extension recursively
+    let resourceKeys: [URLResourceKey] = [.isRegularFileKey, .isDirectoryKey]
+    let enumerator = fileManager.enumerator(
+        at: corpusURL,
+        includingPropertiesForKeys: resourceKeys,
+        options: [.skipsHiddenFiles],
+        errorHandler: { (url, error) -> Bool in
+            print("Error accessing \(url.path): \(error.localizedDescription)")
+            return true
+        }
+    )
+    
+    var dumpFiles: [URL] = []
+    while let fileURL = enumerator?.nextObject() as? URL {
+        do {
+            let resourceValues = try fileURL.resourceValues(forKeys: Set(resourceKeys))
+            if resourceValues.isRegularFile == true && fileURL.pathExtension == "vecdump" {
+                dumpFiles.append(fileURL)
+            }
+        } catch {
+            print("Error getting resource values for \(fileURL): \(error.localizedDescription)")
+        }
+    }
+    return dumpFiles
+}
+
 /**
  Retrieves the most similar vectors from a corpus directory using a CoreML model.
  - Parameters:
@@ -480,33 +563,8 @@ public func retrieve_similar_vectors_from_corpus(
         // Step 2: Create query vector MLMultiArray
         let queryVector = try createVectorFromPointer(pointer: queryVectorPtr, dimensions: queryVectorDimensions)
         
-        // Step 3: List all vector dump files in the corpus directory
-        let fileManager = FileManager.default
-        let corpusURL = URL(fileURLWithPath: corpusDir)
-        
-        // Get all files with .vecdump extension recursively
-        let resourceKeys: [URLResourceKey] = [.isRegularFileKey, .isDirectoryKey]
-        let enumerator = fileManager.enumerator(
-            at: corpusURL,
-            includingPropertiesForKeys: resourceKeys,
-            options: [.skipsHiddenFiles],
-            errorHandler: { (url, error) -> Bool in
-                print("Error accessing \(url.path): \(error.localizedDescription)")
-                return true
-            }
-        )
-        
-        var dumpFiles: [URL] = []
-        while let fileURL = enumerator?.nextObject() as? URL {
-            do {
-                let resourceValues = try fileURL.resourceValues(forKeys: Set(resourceKeys))
-                if resourceValues.isRegularFile == true && fileURL.pathExtension == "vecdump" {
-                    dumpFiles.append(fileURL)
-                }
-            } catch {
-                print("Error getting resource values for \(fileURL): \(error.localizedDescription)")
-            }
-        }
+        // Step 3: List the vector files of the corpus (segmented index manifest, or a directory walk)
+        let dumpFiles = listCorpusVectorFiles(corpusDir: corpusDir)
         
         print("Found \(dumpFiles.count) vector dump files in corpus directory")
         
@@ -621,18 +679,21 @@ if let existingModel = model {
     _ = min(BATCH_SIZE, totalVectors)
     var results: [VectorSimilarityResult] = []
     
-    // Process in a single batch for now, can be optimized to use multiple batches if needed
-    if let vectors = reader.getAllVectorsAsMLMultiArray() {
-        // Prepare array of hashes
-        var hashes: [UInt64] = []
-        for i in 0..<totalVectors {
-            if let hash = reader.getHash(at: i) {
-                hashes.append(hash)
-            } else {
-                hashes.append(UInt64(i))
-            }
+    // Prepare array of hashes
+    var hashes: [UInt64] = []
+    for i in 0..<totalVectors {
+        if let hash = reader.getHash(at: i) {
+            hashes.append(hash)
+        } else {
+            hashes.append(UInt64(i))
         }
-        
+    }
+    
+    // Normalized dumps are scored by plain inner products, bypassing the cosine model
+    if reader.isNormalized, reader.dimensions == queryVector.count, let rows = reader.getVectorPointer(at: 0) {
+        results = computeInnerProducts(rows: rows, count: totalVectors, queryVector: queryVector, hashes: hashes)
+    } else if let vectors = reader.getAllVectorsAsMLMultiArray() {
+        // Process in a single batch for now, can be optimized to use multiple batches if needed
         // Compute similarity
         let batchResults = try computeCosineSimilarity(
             using: similarityModel,
@@ -12,6 +12,10 @@ import CoreML
 ///     uint32_t vectorSizeBytes;
 ///     uint32_t vectorDimensions;
 /// };
+/// Self-describing (v2/v3) files start with the "TVEC" magic and a VectorDumpHeader holding
+/// section offsets (see vec_dump.h); v3 adds aligned sections, flags and CRC32C checksums.
+/// Float32 vectors or the float32 rescore section are mapped directly; files without
+/// either are dequantized into a buffer owned by the reader.
 public class VecDumpReader {
     
     // MARK: - Header Structure
@@ -29,6 +33,48 @@ public class VecDumpReader {
             vectorSizeBytes = data.load(fromByteOffset: 8, as: UInt32.self)
             vectorDimensions = data.load(fromByteOffset: 12, as: UInt32.self)
         }
+
+        init(numEntries: UInt32, hashSizeBytes: UInt32, vectorDimensions: UInt32) {
+            self.numEntries = numEntries
+            self.hashSizeBytes = hashSizeBytes
+            self.vectorSizeBytes = vectorDimensions * 4
+            self.vectorDimensions = vectorDimensions
+        }
+    }
+
+    /// Swift representation of the C++ VectorDumpHeader structure (v2-v4 files)
+    struct VectorDumpHeaderV2 {
+        static let magic: UInt32 = 0x43455654 // "TVEC"
+        static let size = 72 // v2 prefix; v3 appends alignment and checksums, v4 the coarse prefix section
+        static let flagNormalized: UInt32 = 1
+
+        let version: UInt32
+        let numEntries: UInt32
+        let vectorDimensions: UInt32
+        let elementType: UInt32   // 0 float32, 1 fp16, 2 int8
+        let int8Scaling: UInt32   // 0 per vector, 1 per dimension
+        let hashSizeBytes: UInt32
+        let flags: UInt32         // Always 0 in v2
+        let vectorsOffset: UInt64
+        let scalesOffset: UInt64
+        let normsOffset: UInt64
+        let hashesOffset: UInt64
+        let rescoreOffset: UInt64 // 0 if the file has no float32 section
+
+        init(data: UnsafeRawPointer) {
+            version = data.load(fromByteOffset: 4, as: UInt32.self)
+            numEntries = data.load(fromByteOffset: 8, as: UInt32.self)
+            vectorDimensions = data.load(fromByteOffset: 12, as: UInt32.self)
+            elementType = data.load(fromByteOffset: 16, as: UInt32.self)
+            int8Scaling = data.load(fromByteOffset: 20, as: UInt32.self)
+            hashSizeBytes = data.load(fromByteOffset: 24, as: UInt32.self)
+            flags = data.load(fromByteOffset: 28, as: UInt32.self)
+            vectorsOffset = data.load(fromByteOffset: 32, as: UInt64.self)
+            scalesOffset = data.load(fromByteOffset: 40, as: UInt64.self)
+            normsOffset = data.load(fromByteOffset: 48, as: UInt64.self)
+            hashesOffset = data.load(fromByteOffset: 56, as: UInt64.self)
+            rescoreOffset = data.load(fromByteOffset: 64, as: UInt64.self)
+        }
     }
     
     // MARK: - Properties
@@ -38,6 +84,8 @@ public class VecDumpReader {
     private var header: VectorCacheDumpHeader?
     private var vectorsBasePtr: UnsafePointer<Float>?
     private var hashesBasePtr: UnsafePointer<UInt64>?
+    private var decodedVectors: UnsafeMutablePointer<Float>? // Dequantized copy of quantized-only files
+    private var flags: UInt32 = 0
     
     // MARK: - Initialization
     public init() {}
@@ -83,6 +131,11 @@ public class VecDumpReader {
                 return false
             }
 
+            if fileSize >= UInt64(VectorDumpHeaderV2.size) &&
+               mappedData.load(fromByteOffset: 0, as: UInt32.self) == VectorDumpHeaderV2.magic {
+                return openQuantized(mappedData: mappedData, fileSize: Int(fileSize))
+            }
+
             // Read the header
             header = VectorCacheDumpHeader(data: mappedData)
 
@@ -107,6 +160,94 @@ public class VecDumpReader {
         }
     }
     
+    /// Sets up the sections of a quantized (v2) file
+    private func openQuantized(mappedData: UnsafeMutableRawPointer, fileSize: Int) -> Bool {
+        let v2 = VectorDumpHeaderV2(data: mappedData)
+        let rows = Int(v2.numEntries)
+        let dims = Int(v2.vectorDimensions)
+        let elementSize = v2.elementType == 2 ? 1 : (v2.elementType == 1 ? 2 : 4)
+
+        func inFile(_ offset: UInt64, _ bytes: Int) -> Bool {
+            return offset != 0 && offset <= UInt64(fileSize) && UInt64(bytes) <= UInt64(fileSize) - offset
+        }
+        guard (2...4).contains(v2.version), v2.hashSizeBytes == 8, v2.elementType <= 2,
+              inFile(v2.vectorsOffset, rows * dims * elementSize),
+              inFile(v2.hashesOffset, rows * 8) else {
+            print("Error: Unsupported or truncated vector dump (version \(v2.version))")
+            close()
+            return false
+        }
+
+        header = VectorCacheDumpHeader(numEntries: v2.numEntries, hashSizeBytes: v2.hashSizeBytes,
+                                       vectorDimensions: v2.vectorDimensions)
+        flags = v2.version >= 3 ? v2.flags : 0
+        hashesBasePtr = UnsafePointer<UInt64>(mappedData.advanced(by: Int(v2.hashesOffset))
+            .assumingMemoryBound(to: UInt64.self))
+
+        if v2.rescoreOffset != 0 || v2.elementType == 0 {
+            let offset = v2.rescoreOffset != 0 ? v2.rescoreOffset : v2.vectorsOffset
+            guard inFile(offset, rows * dims * 4) else {
+                print("Error: Truncated float32 section in vector dump")
+                close()
+                return false
+            }
+            vectorsBasePtr = UnsafePointer<Float>(mappedData.advanced(by: Int(offset)).assumingMemoryBound(to: Float.self))
+            return true
+        }
+
+        // No float32 copy: dequantize once so CoreML can consume a float32 matrix
+        let scaleCount = v2.elementType == 2 ? (v2.int8Scaling == 1 ? 2 * dims : rows) : 0
+        guard scaleCount == 0 || inFile(v2.scalesOffset, scaleCount * 4) else {
+            print("Error: Truncated scales section in vector dump")
+            close()
+            return false
+        }
+        let decoded = UnsafeMutablePointer<Float>.allocate(capacity: max(rows * dims, 1))
+        let quantized = UnsafeRawPointer(mappedData.advanced(by: Int(v2.vectorsOffset)))
+        if v2.elementType == 1 {
+            let halves = quantized.assumingMemoryBound(to: UInt16.self)
+            for i in 0..<(rows * dims) {
+                decoded[i] = VecDumpReader.halfToFloat(halves[i])
+            }
+        } else {
+            let codes = quantized.assumingMemoryBound(to: Int8.self)
+            let scales = UnsafeRawPointer(mappedData.advanced(by: Int(v2.scalesOffset))).assumingMemoryBound(to: Float.self)
+            for row in 0..<rows {
+                for d in 0..<dims {
+                    let code = Float(codes[row * dims + d])
+                    decoded[row * dims + d] = v2.int8Scaling == 1
+                        ? scales[2 * d] * code + scales[2 * d + 1]
+                        : scales[row] * code
+                }
+            }
+        }
+        decodedVectors = decoded
+        vectorsBasePtr = UnsafePointer<Float>(decoded)
+        return true
+    }
+
+    /// IEEE half to float, without relying on Float16 (unavailable on Intel Macs)
+    private static func halfToFloat(_ half: UInt16) -> Float {
+        let sign: UInt32 = UInt32(half & 0x8000) << 16
+        var exponent = UInt32(half >> 10) & 0x1F
+        var mantissa = UInt32(half & 0x3FF)
+        if exponent == 0x1F {
+            return Float(bitPattern: sign | 0x7F80_0000 | (mantissa << 13))
+        }
+        if exponent == 0 {
+            if mantissa == 0 {
+                return Float(bitPattern: sign)
+            }
+            exponent = 127 - 15 + 1
+            while mantissa & 0x400 == 0 {
+                mantissa <<= 1
+                exponent -= 1
+            }
+            return Float(bitPattern: sign | (exponent << 23) | ((mantissa & 0x3FF) << 13))
+        }
+        return Float(bitPattern: sign | ((exponent + 127 - 15) << 23) | (mantissa << 13))
+    }
+
     /// Closes the file and unmaps the memory
     public func close() {
         if let mappedData = mappedData, mappedLength > 0 {
@@ -120,7 +261,13 @@ public class VecDumpReader {
             self.fileHandle = nil
         }
         
+        if let decodedVectors = decodedVectors {
+            decodedVectors.deallocate()
+            self.decodedVectors = nil
+        }
+
         header = nil
+        flags = 0
         vectorsBasePtr = nil
         hashesBasePtr = nil
     }
@@ -130,6 +277,11 @@ public class VecDumpReader {
         return Int(header?.numEntries ?? 0)
     }
     
+    /// Whether every vector has unit norm (v3 files), so cosine similarity is a plain dot product
+    public var isNormalized: Bool {
+        return flags & VectorDumpHeaderV2.flagNormalized != 0
+    }
+
     /// Gets the dimensions of each vector
     public var dimensions: Int {
         return Int(header?.vectorDimensions ?? 0)
@@ -0,0 +1,578 @@
+// Vector search benchmark: recall@k, throughput, latency percentiles and memory
+// of every search backend over the same corpus, with exact ground truth.
+//
+//   tldr_bench [--rows N] [--dims D] [--corpus DIR] [--queries Q] [--k K] [--out FILE]
+//              [--work DIR] [--file-rows N] [--seed S] [--npu-model PATH] [--pg CONNINFO]
+//
+// The corpus is either synthesized (clustered Gaussian vectors) or decoded from
+// the live files of an existing corpus (--corpus), then written into one work
+// corpus per dump format, so every backend and sweep sees identical vectors.
+// Results are printed as a table and written as JSON to --out.
+//
+//   tldr_bench --self-test
+//
+// runs the self-tests instead (dump formats, SIMD kernels, quantized search).
+
+#include "lib_tldr/vec_dump.h"
+#include "lib_tldr/constants.h"
+#include "lib_tldr/task_pool.h"
+#include "lib_tldr/search/cpu_similarity.h"
+#include "lib_tldr/search/segmented_index.h"
+#include "lib_tldr/search/hnsw_index.h"
+#include "lib_tldr/search/ivfpq_index.h"
+#include "lib_tldr/search/simd_dot.h"
+#include "lib_tldr/db/postgres_database.h"
+#include "npu_accelerator.h"
+
+#include <nlohmann/json.hpp>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_set>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+namespace {
+
+using json = nlohmann::json;
+using clock_type = std::chrono::steady_clock;
+
+struct BenchConfig {
+    size_t rows = 100000;     // Synthetic corpus size
+    size_t dims = EMBEDDING_SIZE_INT;
+    size_t file_rows = 10000; // Rows per vecdump file of the work corpora
+    size_t queries = 200;
+    size_t k = 10;
+    uint32_t seed = 42;
+    std::string corpus;       // Existing corpus to load instead of synthesizing
+    std::string work = "tldr_bench_work";
+    std::string out = "bench_results.json";
+    std::string npu_model;    // CoreML model for the NPU backend, skipped if empty
+    std::string pg;           // Postgres connection for the pgvector backend, skipped if empty
+};
+
+// Row-major unit vectors with their embedding hashes
+struct Corpus {
+    std::vector<float> vectors;
+    std::vector<uint64_t> hashes;
+    size_t rows = 0;
+    size_t dims = 0;
+    std::string source;
+};
+
+// Discards whatever the search paths print per query
+class QuietStdout {
+public:
+    QuietStdout() : saved_(std::cout.rdbuf(&sink_)) {}
+    ~QuietStdout() { std::cout.rdbuf(saved_); }
+
+private:
+    struct NullBuffer : std::streambuf {
+        int overflow(int c) override { return c; }
+    };
+    NullBuffer sink_;
+    std::streambuf *saved_;
+};
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Resident set size of the process
+size_t resident_bytes() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info{};
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) ==
+        KERN_SUCCESS) {
+        return info.resident_size;
+    }
+    return 0;
+#else
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+size_t directory_bytes(const std::string &path) {
+    size_t bytes = 0;
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::recursive_directory_iterator(path, ec)) {
+        if (entry.is_regular_file(ec)) bytes += entry.file_size(ec);
+    }
+    return bytes;
+}
+
+// Clustered Gaussian vectors, roughly the shape of sentence embeddings of a few topics
+Corpus synthesize_corpus(const BenchConfig &config, std::vector<float> &centers, size_t &num_centers) {
+    Corpus corpus;
+    corpus.rows = config.rows;
+    corpus.dims = config.dims;
+    corpus.source = "synthetic";
+    std::mt19937 rng(config.seed);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+
+    num_centers = std::max<size_t>(16, config.rows / 1000);
+    centers.resize(num_centers * config.dims);
+    for (auto &x: centers) x = normal(rng);
+
+    corpus.vectors.resize(config.rows * config.dims);
+    corpus.hashes.resize(config.rows);
+    for (size_t r = 0; r < config.rows; ++r) {
+        const float *center = centers.data() + (rng() % num_centers) * config.dims;
+        float *row = corpus.vectors.data() + r * config.dims;
+        for (size_t d = 0; d < config.dims; ++d) row[d] = center[d] + 0.8f * normal(rng);
+        tldr::normalize_vector(row, config.dims);
+        corpus.hashes[r] = splitmix64(r);
+    }
+    return corpus;
+}
+
+// Every row of the live files of an existing corpus, decoded to float32
+bool load_corpus(const std::string &dir, Corpus &corpus) {
+    auto index = tldr::SegmentedIndex::open(dir);
+    if (!index) {
+        std::cerr << "Corpus directory does not exist: " << dir << std::endl;
+        return false;
+    }
+    corpus.source = dir;
+    for (const auto &entry: index->live_entries()) {
+        const tldr::MappedVectorData &dump = *entry.data;
+        const size_t dims = dump.header->vector_dimensions;
+        if (corpus.dims == 0) corpus.dims = dims;
+        if (dims != corpus.dims) {
+            std::cerr << "Skipping " << entry.rel_path << ": " << dims << " dimensions" << std::endl;
+            continue;
+        }
+        const size_t rows = dump.header->num_entries;
+        corpus.vectors.resize((corpus.rows + rows) * dims);
+        for (size_t r = 0; r < rows; ++r) {
+            float *row = corpus.vectors.data() + (corpus.rows + r) * dims;
+            tldr::decode_vector(dump, r, row);
+            tldr::normalize_vector(row, dims);
+        }
+        corpus.hashes.insert(corpus.hashes.end(), dump.hashes, dump.hashes + rows);
+        corpus.rows += rows;
+    }
+    return corpus.rows > 0;
+}
+
+// Queries near the corpus: cluster centers (synthetic) or perturbed corpus rows
+std::vector<float> make_queries(const BenchConfig &config, const Corpus &corpus, const std::vector<float> &centers,
+                                size_t num_centers) {
+    std::mt19937 rng(config.seed + 1);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::vector<float> queries(config.queries * corpus.dims);
+    for (size_t q = 0; q < config.queries; ++q) {
+        float *query = queries.data() + q * corpus.dims;
+        if (num_centers > 0) {
+            const float *center = centers.data() + (rng() % num_centers) * corpus.dims;
+            for (size_t d = 0; d < corpus.dims; ++d) query[d] = center[d] + 0.8f * normal(rng);
+        } else {
+            const float *row = corpus.vectors.data() + (rng() % corpus.rows) * corpus.dims;
+            for (size_t d = 0; d < corpus.dims; ++d) query[d] = row[d] + 0.02f * normal(rng);
+        }
+        tldr::normalize_vector(query, corpus.dims);
+    }
+    return queries;
+}
+
+// Exact top-k hashes of every query by a float32 brute-force scan
+std::vector<std::vector<uint64_t> > ground_truth(const Corpus &corpus, const std::vector<float> &queries,
+                                                 size_t num_queries, size_t k) {
+    std::vector<std::vector<uint64_t> > truth(num_queries);
+    tldr::parallel_for(num_queries, 1, [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; ++q) {
+            for (const auto &result: tldr::cpu_search_vectors(queries.data() + q * corpus.dims, corpus.dims,
+                                                              corpus.vectors.data(), corpus.hashes.data(),
+                                                              corpus.rows, k)) {
+                truth[q].push_back(result.hash);
+            }
+        }
+    });
+    return truth;
+}
+
+// Write the corpus as vecdump files of one format and register them with a fresh segmented index
+bool write_work_corpus(const Corpus &corpus, const std::string &root, size_t file_rows,
+                       const tldr::VectorDumpFormat &format) {
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    auto index = tldr::SegmentedIndex::open(root);
+    if (!index) return false;
+    QuietStdout quiet;
+    for (size_t begin = 0, file = 0; begin < corpus.rows; begin += file_rows, ++file) {
+        const size_t end = std::min(begin + file_rows, corpus.rows);
+        std::vector<std::vector<float> > rows;
+        rows.reserve(end - begin);
+        for (size_t r = begin; r < end; ++r) {
+            rows.emplace_back(corpus.vectors.data() + r * corpus.dims, corpus.vectors.data() + (r + 1) * corpus.dims);
+        }
+        const std::string file_hash = "bench" + std::to_string(file);
+        const std::string source = root + "/" + file_hash + ".pdf";
+        std::vector<uint64_t> hashes(corpus.hashes.begin() + begin, corpus.hashes.begin() + end);
+        if (!tldr::dump_vectors_to_file(source, rows, hashes, file_hash, format) ||
+            !index->register_dump(tldr::vector_dump_path_for(source, file_hash), file_hash)) {
+            return false;
+        }
+    }
+    index->compact_now();
+    return true;
+}
+
+// One backend configuration measured over every query
+struct Run {
+    std::string backend;
+    json params;
+    double build_ms = 0.0;
+    size_t index_bytes = 0;
+};
+
+using SearchFn = std::function<std::vector<uint64_t>(const float *query)>;
+
+json measure(const Run &run, const SearchFn &search, const std::vector<float> &queries, size_t dims,
+             const std::vector<std::vector<uint64_t> > &truth, size_t k) {
+    const size_t num_queries = truth.size();
+    std::vector<double> latencies(num_queries);
+    size_t found = 0, expected = 0;
+    double total_ms = 0.0;
+    {
+        QuietStdout quiet;
+        for (size_t q = 0; q < num_queries; ++q) {
+            const auto start = clock_type::now();
+            std::vector<uint64_t> hashes = search(queries.data() + q * dims);
+            latencies[q] = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+            total_ms += latencies[q];
+
+            const std::unordered_set<uint64_t> exact(truth[q].begin(), truth[q].end());
+            hashes.resize(std::min(hashes.size(), k));
+            for (uint64_t hash: hashes) found += exact.count(hash);
+            expected += truth[q].size();
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * num_queries));
+        return latencies[std::min(num_queries - 1, rank > 0 ? rank - 1 : 0)];
+    };
+
+    json result = {
+        {"backend", run.backend},
+        {"params", run.params},
+        {"recall_at_k", expected ? static_cast<double>(found) / expected : 1.0},
+        {"qps", total_ms > 0.0 ? 1000.0 * num_queries / total_ms : 0.0},
+        {
+            "latency_ms", {
+                {"mean", total_ms / num_queries}, {"p50", percentile(0.50)}, {"p95", percentile(0.95)},
+                {"p99", percentile(0.99)}
+            }
+        },
+        {"build_ms", run.build_ms},
+        {"index_bytes", run.index_bytes},
+        {"rss_bytes", resident_bytes()}
+    };
+    std::cout << std::left << std::setw(10) << run.backend << std::setw(34) << run.params.dump() << std::right
+              << std::fixed << std::setprecision(4) << std::setw(9) << result["recall_at_k"].get<double>()
+              << std::setprecision(1) << std::setw(10) << result["qps"].get<double>() << std::setprecision(3)
+              << std::setw(10) << percentile(0.50) << std::setw(10) << percentile(0.95) << std::setw(10)
+              << percentile(0.99) << std::setw(10) << resident_bytes() / (1024 * 1024) << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    return result;
+}
+
+std::vector<uint64_t> hashes_of(const std::vector<SimilarityResult> &results) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve(results.size());
+    for (const auto &result: results) hashes.push_back(result.hash);
+    return hashes;
+}
+
+double elapsed_ms(clock_type::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+// Insert the corpus into pgvector under one synthetic document; false if the database is unavailable
+bool load_postgres(tldr::PostgresDatabase &db, const Corpus &corpus, const std::string &file_hash) {
+    if (!db.initialize() ||
+        !db.saveDocumentMetadata(file_hash, "tldr_bench", "tldr_bench", "tldr_bench", "", "", "", "", "", 0)) {
+        return false;
+    }
+    db.deleteEmbeddings(file_hash);
+    constexpr size_t batch = 1000;
+    std::vector<std::string> texts;
+    for (size_t begin = 0; begin < corpus.rows; begin += batch) {
+        const size_t end = std::min(begin + batch, corpus.rows);
+        json embeddings = {{"embeddings", json::array()}};
+        texts.clear();
+        for (size_t r = begin; r < end; ++r) {
+            embeddings["embeddings"].push_back(std::vector<float>(corpus.vectors.data() + r * corpus.dims,
+                                                                  corpus.vectors.data() + (r + 1) * corpus.dims));
+            texts.push_back("bench chunk " + std::to_string(r));
+        }
+        std::vector<std::string_view> chunks(texts.begin(), texts.end());
+        std::vector<uint64_t> hashes(corpus.hashes.begin() + begin, corpus.hashes.begin() + end);
+        if (db.saveEmbeddings(chunks, embeddings, hashes, std::vector<int>(chunks.size(), 0), file_hash) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_args(int argc, char **argv, BenchConfig &config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        try {
+            if (arg == "--rows") config.rows = std::stoul(value);
+            else if (arg == "--dims") config.dims = std::stoul(value);
+            else if (arg == "--file-rows") config.file_rows = std::max<size_t>(1, std::stoul(value));
+            else if (arg == "--queries") config.queries = std::stoul(value);
+            else if (arg == "--k") config.k = std::stoul(value);
+            else if (arg == "--seed") config.seed = static_cast<uint32_t>(std::stoul(value));
+            else if (arg == "--corpus") config.corpus = value;
+            else if (arg == "--work") config.work = value;
+            else if (arg == "--out") config.out = value;
+            else if (arg == "--npu-model") config.npu_model = value;
+            else if (arg == "--pg") config.pg = value;
+            else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        } catch (const std::exception &) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+    return config.queries > 0 && config.k > 0 && config.dims > 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc == 2 && std::string(argv[1]) == "--self-test") {
+        bool passed = tldr::test_vector_cache();
+        passed = tldr::test_vector_dump_formats() && passed;
+        passed = tldr::simd::test_kernels() && passed;
+        passed = tldr::test_quantized_search() && passed;
+        std::cout << "\nSelf-tests: " << (passed ? "PASSED" : "FAILED") << std::endl;
+        return passed ? 0 : 1;
+    }
+
+    BenchConfig config;
+    if (!parse_args(argc, argv, config)) {
+        std::cerr << "Usage: tldr_bench [--rows N] [--dims D] [--corpus DIR] [--queries Q] [--k K] [--out FILE]\n"
+                     "                  [--work DIR] [--file-rows N] [--seed S] [--npu-model PATH] [--pg CONNINFO]\n"
+                     "       tldr_bench --self-test"
+                  << std::endl;
+        return 1;
+    }
+
+    // Corpus and queries
+    Corpus corpus;
+    std::vector<float> centers;
+    size_t num_centers = 0;
+    if (!config.corpus.empty()) {
+        if (!load_corpus(config.corpus, corpus)) {
+            std::cerr << "No vectors found in " << config.corpus << std::endl;
+            return 1;
+        }
+    } else {
+        corpus = synthesize_corpus(config, centers, num_centers);
+    }
+    const size_t dims = corpus.dims;
+    const size_t k = config.k;
+    const std::vector<float> queries = make_queries(config, corpus, centers, num_centers);
+
+    auto start = clock_type::now();
+    const auto truth = ground_truth(corpus, queries, config.queries, k);
+    const double truth_ms = elapsed_ms(start);
+    std::cout << "Corpus: " << corpus.rows << " x " << dims << " (" << corpus.source << "), " << config.queries
+              << " queries, k=" << k << ", ground truth in " << truth_ms << " ms" << std::endl;
+
+    json report = {
+        {
+            "config", {
+                {"rows", corpus.rows}, {"dims", dims}, {"queries", config.queries}, {"k", k},
+                {"file_rows", config.file_rows}, {"seed", config.seed}, {"source", corpus.source},
+                {"simd", tldr::simd::active_isa()}
+            }
+        },
+        {"ground_truth_ms", truth_ms},
+        {"runs", json::array()}
+    };
+    std::cout << std::left << std::setw(10) << "backend" << std::setw(34) << "params" << std::right << std::setw(9)
+              << "recall" << std::setw(10) << "qps" << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "rss MiB" << std::endl;
+
+    // Exhaustive CPU scan over every dump format (quantization sweep)
+    struct FormatCase {
+        const char *name;
+        tldr::VectorElementType type;
+        tldr::Int8Scaling scaling;
+        bool rescore;
+    };
+    const FormatCase formats[] = {
+        {"float32", tldr::VectorElementType::Float32, tldr::Int8Scaling::PerVector, false},
+        {"float16", tldr::VectorElementType::Float16, tldr::Int8Scaling::PerVector, false},
+        {"int8", tldr::VectorElementType::Int8, tldr::Int8Scaling::PerVector, false},
+        {"int8_per_dim", tldr::VectorElementType::Int8, tldr::Int8Scaling::PerDimension, false},
+        {"int8_rescore", tldr::VectorElementType::Int8, tldr::Int8Scaling::PerVector, true},
+    };
+    const std::string default_root = config.work + "/default";
+    for (const FormatCase &format_case: formats) {
+        tldr::VectorDumpFormat format;
+        format.element_type = format_case.type;
+        format.int8_scaling = format_case.scaling;
+        format.rescore_section = format_case.rescore;
+        format.prefix_dimensions = 0;
+        format.binary_codes = false;
+        const std::string root = config.work + "/" + format_case.name;
+        Run run{"cpu", {{"format", format_case.name}}};
+        start = clock_type::now();
+        if (!write_work_corpus(corpus, root, config.file_rows, format)) {
+            std::cerr << "Failed to write the " << format_case.name << " corpus" << std::endl;
+            return 1;
+        }
+        run.build_ms = elapsed_ms(start);
+        run.index_bytes = directory_bytes(root + "/_vecdump");
+        report["runs"].push_back(measure(run, [&](const float *query) {
+            return hashes_of(tldr::cpu_search_corpus(root, query, dims, k));
+        }, queries, dims, truth, k));
+    }
+
+    // The remaining backends share one corpus in the default format (with prefix section and sign-bit tier)
+    tldr::VectorDumpFormat default_format;
+    default_format.binary_codes = true;
+    start = clock_type::now();
+    if (!write_work_corpus(corpus, default_root, config.file_rows, default_format)) {
+        std::cerr << "Failed to write the default corpus" << std::endl;
+        return 1;
+    }
+    const double default_build_ms = elapsed_ms(start);
+    const size_t default_bytes = directory_bytes(default_root + "/_vecdump");
+
+    for (size_t factor: {4, 8, 16, 32, 64}) {
+        const size_t candidates = k * factor;
+        Run run{"prefix", {{"candidates", candidates}}, default_build_ms, default_bytes};
+        report["runs"].push_back(measure(run, [&](const float *query) {
+            return hashes_of(tldr::cpu_search_corpus_prefix(default_root, query, dims, k, candidates));
+        }, queries, dims, truth, k));
+    }
+    for (size_t factor: {4, 8, 16, 32, 64}) {
+        const size_t candidates = k * factor;
+        Run run{"binary", {{"candidates", candidates}}, default_build_ms, default_bytes};
+        report["runs"].push_back(measure(run, [&](const float *query) {
+            return hashes_of(tldr::cpu_search_corpus_binary(default_root, query, dims, k, candidates));
+        }, queries, dims, truth, k));
+    }
+
+    // HNSW efSearch sweep
+    start = clock_type::now();
+    std::shared_ptr<tldr::HnswIndex> hnsw;
+    {
+        QuietStdout quiet;
+        hnsw = tldr::HnswIndex::open(default_root, dims, true);
+    }
+    if (hnsw) {
+        const double build_ms = elapsed_ms(start);
+        for (size_t ef: {16, 32, 64, 128, 256}) {
+            Run run{"hnsw", {{"ef_search", ef}, {"M", HNSW_M}}, build_ms,
+                    std::filesystem::file_size(default_root + "/_vecdump/" HNSW_INDEX_FILE)};
+            report["runs"].push_back(measure(run, [&](const float *query) {
+                return hashes_of(hnsw->search(query, k, ef));
+            }, queries, dims, truth, k));
+        }
+    } else {
+        std::cerr << "HNSW index could not be built, skipping" << std::endl;
+    }
+
+    // IVF-PQ nprobe sweep, with and without exact re-ranking
+    start = clock_type::now();
+    std::shared_ptr<tldr::IvfPqIndex> ivfpq;
+    {
+        QuietStdout quiet;
+        ivfpq = tldr::IvfPqIndex::open(default_root, dims, true);
+    }
+    if (ivfpq) {
+        const double build_ms = elapsed_ms(start);
+        const size_t bytes = std::filesystem::file_size(default_root + "/_vecdump/" IVFPQ_INDEX_FILE);
+        for (bool rerank: {false, true}) {
+            for (size_t nprobe: {1, 4, 16, 64}) {
+                Run run{"ivfpq", {{"nprobe", nprobe}, {"rerank", rerank}}, build_ms, bytes};
+                report["runs"].push_back(measure(run, [&](const float *query) {
+                    return hashes_of(ivfpq->search(query, k, nprobe, rerank ? k * IVFPQ_RERANK_FACTOR : 0));
+                }, queries, dims, truth, k));
+            }
+        }
+    } else {
+        std::cerr << "IVF-PQ index could not be built, skipping" << std::endl;
+    }
+
+    // CoreML (or the portable CPU implementation behind npu_accelerator.h)
+    if (!config.npu_model.empty()) {
+        Run run{"npu", {{"model", config.npu_model}}, default_build_ms, default_bytes};
+        report["runs"].push_back(measure(run, [&](const float *query) {
+            int32_t count = 0;
+            SimilarityResult *results = retrieve_similar_vectors_from_corpus(
+                config.npu_model.c_str(), default_root.c_str(), query, static_cast<int32_t>(dims),
+                static_cast<int32_t>(k), &count);
+            std::vector<uint64_t> hashes;
+            for (int32_t i = 0; results && i < count; ++i) hashes.push_back(results[i].hash);
+            if (results) free_similarity_results(results);
+            return hashes;
+        }, queries, dims, truth, k));
+    }
+
+    // pgvector (searchSimilarVectors, ivfflat lists=100). Other documents in the
+    // database compete for the top k, so use a dedicated database.
+    if (!config.pg.empty()) {
+        tldr::PostgresDatabase db(config.pg);
+        const std::string file_hash = "tldr_bench_" + std::to_string(config.seed);
+        start = clock_type::now();
+        if (load_postgres(db, corpus, file_hash)) {
+            Run run{"pgvector", {{"index", "ivfflat"}, {"lists", 100}}, elapsed_ms(start), 0};
+            report["runs"].push_back(measure(run, [&](const float *query) {
+                std::vector<uint64_t> hashes;
+                for (const auto &chunk: db.searchSimilarVectors(std::vector<float>(query, query + dims),
+                                                                static_cast<int>(k))) {
+                    hashes.push_back(chunk.hash);
+                }
+                return hashes;
+            }, queries, dims, truth, k));
+            db.deleteEmbeddings(file_hash);
+        } else {
+            std::cerr << "Could not load the corpus into Postgres, skipping pgvector" << std::endl;
+        }
+    }
+
+    tldr::HnswIndex::close_all();
+    tldr::IvfPqIndex::close_all();
+    tldr::SegmentedIndex::close_all();
+
+    std::ofstream out(config.out);
+    out << report.dump(2) << std::endl;
+    if (!out) {
+        std::cerr << "Failed to write " << config.out << std::endl;
+        return 1;
+    }
+    std::cout << "Results written to " << config.out << std::endl;
+    return 0;
+}
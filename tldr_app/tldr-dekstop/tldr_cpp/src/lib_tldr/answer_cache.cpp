@@ -0,0 +1,101 @@
+#include "answer_cache.h"
+#include "vec_dump.h"
+#include "search/simd_dot.h"
+#include "constants.h"
+#include <algorithm>
+
+namespace tldr {
+
+AnswerCache &AnswerCache::instance() {
+    static AnswerCache cache(ANSWER_CACHE_SIZE);
+    return cache;
+}
+
+AnswerCache::AnswerCache(size_t capacity) : capacity_(capacity) {
+}
+
+bool AnswerCache::lookup(const std::string &corpus, const std::vector<float> &query,
+                         const std::vector<uint64_t> &chunk_hashes, float min_similarity, RagResult &out) {
+    std::vector<float> unit_query(query);
+    std::vector<uint64_t> chunks(chunk_hashes);
+    std::sort(chunks.begin(), chunks.end());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!normalize_vector(unit_query.data(), unit_query.size()) || chunks.empty()) {
+        ++stats_.misses;
+        return false;
+    }
+    auto best = lru_.end();
+    float best_similarity = min_similarity;
+    for (auto it = lru_.begin(); it != lru_.end(); ++it) {
+        if (it->corpus != corpus || it->chunk_hashes != chunks || it->query.size() != unit_query.size()) {
+            continue;
+        }
+        const float similarity = simd::dot_f32(unit_query.data(), it->query.data(), unit_query.size());
+        if (similarity >= best_similarity) {
+            best_similarity = similarity;
+            best = it;
+        }
+    }
+    if (best == lru_.end()) {
+        ++stats_.misses;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, best);
+    out = best->result;
+    ++stats_.hits;
+    return true;
+}
+
+void AnswerCache::insert(const std::string &corpus, const std::vector<float> &query, const RagResult &result) {
+    if (capacity_ == 0 || result.context_chunks.empty()) {
+        return;
+    }
+    Entry entry;
+    entry.corpus = corpus;
+    entry.query = query;
+    if (!normalize_vector(entry.query.data(), entry.query.size())) {
+        return;
+    }
+    for (const auto &chunk: result.context_chunks) {
+        entry.chunk_hashes.push_back(chunk.hash);
+        if (!chunk.file_hash.empty()) entry.file_hashes.push_back(chunk.file_hash);
+        if (!chunk.file_path.empty()) entry.file_paths.push_back(chunk.file_path);
+    }
+    std::sort(entry.chunk_hashes.begin(), entry.chunk_hashes.end());
+    for (auto *names: {&entry.file_hashes, &entry.file_paths}) {
+        std::sort(names->begin(), names->end());
+        names->erase(std::unique(names->begin(), names->end()), names->end());
+    }
+    entry.result = result;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.push_front(std::move(entry));
+    while (lru_.size() > capacity_) {
+        lru_.pop_back();
+    }
+}
+
+void AnswerCache::invalidate_document(const std::string &file_hash, const std::string &file_path) {
+    auto references = [](const std::vector<std::string> &names, const std::string &name) {
+        return !name.empty() && std::binary_search(names.begin(), names.end(), name);
+    };
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.invalidated += lru_.remove_if([&](const Entry &entry) {
+        return references(entry.file_hashes, file_hash) || references(entry.file_paths, file_path);
+    });
+}
+
+void AnswerCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+}
+
+AnswerCache::Stats AnswerCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.entries = lru_.size();
+    return stats;
+}
+
+} // namespace tldr
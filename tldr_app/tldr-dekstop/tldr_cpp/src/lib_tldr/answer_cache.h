@@ -0,0 +1,76 @@
+#ifndef TLDR_CPP_ANSWER_CACHE_H
+#define TLDR_CPP_ANSWER_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <cstdint>
+#include "definitions.h"
+
+namespace tldr {
+
+/**
+ * Process-wide cache of generated answers (semantic answer cache).
+ *
+ * An entry holds the unit query embedding, the sorted hashes of the chunks
+ * retrieved for it and the RagResult. A new query is answered from the cache
+ * when it is asked of the same corpus, its retrieved chunk set is identical and
+ * its embedding is within a cosine threshold of the cached one, so the LLM is
+ * skipped only when it would have been given the very same context.
+ *
+ * Entries remember the documents (file hash and source path) of their chunks
+ * and are dropped as soon as one of them is re-ingested or deleted. The least
+ * recently used entry is evicted beyond ANSWER_CACHE_SIZE entries.
+ */
+class AnswerCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t invalidated = 0; // Entries dropped because a document changed
+        size_t entries = 0;
+    };
+
+    static AnswerCache &instance();
+
+    explicit AnswerCache(size_t capacity);
+
+    /**
+     * Find the cached answer of a near-duplicate query
+     * @param chunk_hashes Hashes of the chunks retrieved for the query, in any order
+     * @param min_similarity Minimum cosine between the query embeddings
+     * @return false if no cached query of the corpus qualifies
+     */
+    bool lookup(const std::string &corpus, const std::vector<float> &query,
+                const std::vector<uint64_t> &chunk_hashes, float min_similarity, RagResult &out);
+
+    // Cache the answer of a query; its chunk set and documents are taken from result.context_chunks
+    void insert(const std::string &corpus, const std::vector<float> &query, const RagResult &result);
+
+    // Drop every answer that used a chunk of the document (matched by file hash or by source path)
+    void invalidate_document(const std::string &file_hash, const std::string &file_path = "");
+
+    void clear();
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string corpus;
+        std::vector<float> query;          // Unit length
+        std::vector<uint64_t> chunk_hashes; // Sorted
+        std::vector<std::string> file_hashes;
+        std::vector<std::string> file_paths;
+        RagResult result;
+    };
+
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // Most recently used first
+    Stats stats_;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_ANSWER_CACHE_H
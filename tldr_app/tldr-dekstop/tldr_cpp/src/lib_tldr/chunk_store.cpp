@@ -0,0 +1,259 @@
+#include "chunk_store.h"
+#include "constants.h"
+
+#include <iostream>
+#include <filesystem>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+namespace tldr {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[8] = {'T', 'L', 'D', 'R', 'C', 'H', 'K', '1'};
+constexpr uint32_t kVersion = 1;
+
+struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dimensions;
+    uint64_t model_hash; // Embedding model the vectors come from
+    uint64_t reserved;
+};
+
+std::mutex g_store_registry_mutex;
+std::map<std::string, std::shared_ptr<ChunkEmbeddingStore> > g_store_registry;
+
+// First 128 bits of the MD5 of some bytes
+void md5_128(const void *data, size_t size, uint64_t &lo, uint64_t &hi) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    if (EVP_Digest(data, size, digest, &digest_size, EVP_md5(), nullptr) != 1 || digest_size < 16) {
+        lo = hi = 0;
+        return;
+    }
+    std::memcpy(&lo, digest, 8);
+    std::memcpy(&hi, digest + 8, 8);
+}
+
+bool read_fully(int fd, void *buffer, size_t size, uint64_t offset) {
+    auto *bytes = static_cast<char *>(buffer);
+    while (size > 0) {
+        ssize_t n = pread(fd, bytes, size, static_cast<off_t>(offset));
+        if (n <= 0) return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool write_fully(int fd, const void *buffer, size_t size, uint64_t offset) {
+    const auto *bytes = static_cast<const char *>(buffer);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, bytes, size, static_cast<off_t>(offset));
+        if (n <= 0) return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+ChunkKey ChunkKey::of(std::string_view text) {
+    ChunkKey key;
+    md5_128(text.data(), text.size(), key.lo, key.hi);
+    return key;
+}
+
+std::shared_ptr<ChunkEmbeddingStore> ChunkEmbeddingStore::open(const std::string &corpus_root,
+                                                               const std::string &model_id, size_t dimensions) {
+    std::error_code ec;
+    std::string root = fs::weakly_canonical(corpus_root, ec).string();
+    uint64_t model_hash, unused;
+    md5_128(model_id.data(), model_id.size(), model_hash, unused);
+
+    std::lock_guard<std::mutex> lock(g_store_registry_mutex);
+    auto it = g_store_registry.find(root);
+    if (it != g_store_registry.end()) {
+        if (it->second->switch_model(model_hash, dimensions)) {
+            return it->second;
+        }
+        g_store_registry.erase(it);
+        return nullptr;
+    }
+
+    fs::path dir = fs::path(root) / "_vecdump";
+    fs::create_directories(dir, ec);
+    std::shared_ptr<ChunkEmbeddingStore> store(
+        new ChunkEmbeddingStore((dir / CHUNK_STORE_FILE).string(), model_hash, dimensions));
+    if (!store->load_or_reset()) {
+        return nullptr;
+    }
+    g_store_registry[root] = store;
+    return store;
+}
+
+void ChunkEmbeddingStore::close_all() {
+    std::lock_guard<std::mutex> lock(g_store_registry_mutex);
+    g_store_registry.clear();
+}
+
+ChunkEmbeddingStore::ChunkEmbeddingStore(std::string path, uint64_t model_hash, size_t dimensions)
+    : path_(std::move(path)), model_hash_(model_hash), dimensions_(dimensions) {}
+
+ChunkEmbeddingStore::~ChunkEmbeddingStore() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool ChunkEmbeddingStore::load_or_reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Chunk store: could not open " << path_ << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st{};
+    StoreHeader header{};
+    if (fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(header) ||
+        !read_fully(fd_, &header, sizeof(header), 0) || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion || header.dimensions != dimensions_ || header.model_hash != model_hash_) {
+        return reset_locked();
+    }
+
+    // Records are (lo, hi, vector); a torn record at the end (interrupted append) is dropped
+    const uint64_t record_size = 2 * sizeof(uint64_t) + dimensions_ * sizeof(float);
+    const uint64_t count = (static_cast<uint64_t>(st.st_size) - sizeof(header)) / record_size;
+    records_.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint64_t offset = sizeof(header) + i * record_size;
+        ChunkKey key;
+        uint64_t words[2];
+        if (!read_fully(fd_, words, sizeof(words), offset)) {
+            break;
+        }
+        key.lo = words[0];
+        key.hi = words[1];
+        records_.emplace(key, offset + sizeof(words));
+        end_ = offset + record_size;
+    }
+    if (end_ == 0) {
+        end_ = sizeof(header);
+    }
+    if (static_cast<uint64_t>(st.st_size) != end_ && ftruncate(fd_, static_cast<off_t>(end_)) != 0) {
+        std::cerr << "Chunk store: could not drop the torn tail of " << path_ << std::endl;
+    }
+    std::cout << "Chunk store: " << records_.size() << " chunk embeddings in " << path_ << std::endl;
+    return true;
+}
+
+bool ChunkEmbeddingStore::reset_locked() {
+    records_.clear();
+    StoreHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.dimensions = static_cast<uint32_t>(dimensions_);
+    header.model_hash = model_hash_;
+    if (ftruncate(fd_, 0) != 0 || !write_fully(fd_, &header, sizeof(header), 0)) {
+        std::cerr << "Chunk store: could not initialize " << path_ << std::endl;
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    end_ = sizeof(header);
+    return true;
+}
+
+bool ChunkEmbeddingStore::switch_model(uint64_t model_hash, size_t dimensions) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0 && model_hash_ == model_hash && dimensions_ == dimensions) {
+        return true;
+    }
+    if (fd_ < 0) {
+        return false;
+    }
+    model_hash_ = model_hash;
+    dimensions_ = dimensions;
+    ++resets_;
+    return reset_locked();
+}
+
+bool ChunkEmbeddingStore::lookup(const ChunkKey &key, std::vector<float> &embedding) {
+    uint64_t offset, resets;
+    size_t dimensions;
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = records_.find(key);
+        if (it == records_.end()) {
+            ++stats_.misses;
+            return false;
+        }
+        offset = it->second;
+        resets = resets_;
+        dimensions = dimensions_;
+        fd = fd_;
+    }
+    // Records are only rewritten by a reset, the read needs no lock
+    embedding.resize(dimensions);
+    const bool read = read_fully(fd, embedding.data(), dimensions * sizeof(float), offset);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!read || resets != resets_) {
+        ++stats_.misses;
+        return false;
+    }
+    ++stats_.hits;
+    return true;
+}
+
+void ChunkEmbeddingStore::insert(const std::vector<ChunkKey> &keys, const std::vector<std::vector<float> > &embeddings) {
+    const size_t record_size = 2 * sizeof(uint64_t) + dimensions_ * sizeof(float);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<char> buffer;
+    std::vector<ChunkKey> added;
+    buffer.reserve(keys.size() * record_size);
+    for (size_t i = 0; i < keys.size() && i < embeddings.size(); ++i) {
+        if (embeddings[i].size() != dimensions_ || records_.count(keys[i]) ||
+            std::find(added.begin(), added.end(), keys[i]) != added.end()) {
+            continue;
+        }
+        const uint64_t words[2] = {keys[i].lo, keys[i].hi};
+        buffer.insert(buffer.end(), reinterpret_cast<const char *>(words), reinterpret_cast<const char *>(words + 2));
+        buffer.insert(buffer.end(), reinterpret_cast<const char *>(embeddings[i].data()),
+                      reinterpret_cast<const char *>(embeddings[i].data() + dimensions_));
+        added.push_back(keys[i]);
+    }
+    if (added.empty()) {
+        return;
+    }
+    if (!write_fully(fd_, buffer.data(), buffer.size(), end_)) {
+        std::cerr << "Chunk store: could not append to " << path_ << std::endl;
+        return;
+    }
+    for (const auto &key: added) {
+        records_.emplace(key, end_ + 2 * sizeof(uint64_t));
+        end_ += record_size;
+    }
+}
+
+ChunkEmbeddingStore::Stats ChunkEmbeddingStore::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.entries = records_.size();
+    return stats;
+}
+
+} // namespace tldr
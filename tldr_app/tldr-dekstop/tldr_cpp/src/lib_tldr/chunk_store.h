@@ -0,0 +1,90 @@
+#ifndef TLDR_CPP_CHUNK_STORE_H
+#define TLDR_CPP_CHUNK_STORE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+namespace tldr {
+
+// 128-bit content hash of a chunk's text
+struct ChunkKey {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const ChunkKey &other) const { return lo == other.lo && hi == other.hi; }
+
+    static ChunkKey of(std::string_view text);
+};
+
+struct ChunkKeyHash {
+    size_t operator()(const ChunkKey &key) const { return static_cast<size_t>(key.lo ^ (key.hi * 0x9E3779B97F4A7C15ULL)); }
+};
+
+/**
+ * Persistent chunk text -> embedding store of one corpus root, used to embed
+ * every distinct chunk only once across documents (headers, footers, legal
+ * notices, duplicated appendices).
+ *
+ * Records (content hash, vector) are appended to <root>/_vecdump/CHUNK_STORE_FILE,
+ * whose header names the embedding model; a store written by another model or
+ * with another dimension is discarded. Only the content hashes and record
+ * positions are held in memory, a hit reads its vector back from the file.
+ */
+class ChunkEmbeddingStore {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+    };
+
+    /**
+     * Get the process-wide store of a corpus root for the given embedding model.
+     * A store open for another model is reset in place, so a file only ever has one writer.
+     * @return nullptr if the store file cannot be opened
+     */
+    static std::shared_ptr<ChunkEmbeddingStore> open(const std::string &corpus_root, const std::string &model_id,
+                                                     size_t dimensions);
+
+    static void close_all();
+
+    ~ChunkEmbeddingStore();
+
+    // Stored embedding of a chunk, false on a miss
+    bool lookup(const ChunkKey &key, std::vector<float> &embedding);
+
+    // Append the embeddings of new chunks; keys already present are skipped
+    void insert(const std::vector<ChunkKey> &keys, const std::vector<std::vector<float> > &embeddings);
+
+    Stats stats() const;
+
+private:
+    ChunkEmbeddingStore(std::string path, uint64_t model_hash, size_t dimensions);
+
+    // Load the records of a store written for this model, or start a new file
+    bool load_or_reset();
+    bool reset_locked();
+
+    // Discard the records and start over for another embedding model
+    bool switch_model(uint64_t model_hash, size_t dimensions);
+
+    std::string path_;
+    uint64_t model_hash_;
+    size_t dimensions_;
+
+    mutable std::mutex mutex_;
+    int fd_ = -1;
+    std::unordered_map<ChunkKey, uint64_t, ChunkKeyHash> records_; // Key -> byte offset of the vector
+    uint64_t end_ = 0; // Byte offset of the next record
+    uint64_t resets_ = 0; // Lookups reading across a reset are misses
+    Stats stats_;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_CHUNK_STORE_H
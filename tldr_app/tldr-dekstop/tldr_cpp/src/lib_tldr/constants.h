@@ -12,13 +12,14 @@
 #define MAX_CHARS_PER_BATCH 512
 #define MAX_CHUNK_SIZE (MAX_CHARS_PER_BATCH-(CHUNK_N_OVERLAP*2))
 #define BATCH_SIZE 10
+#define EMBEDDING_CHUNK_TOKENS 256 // Token budget of a chunk including the model's special tokens (capped at its training context)
+#define EMBEDDING_CHUNK_OVERLAP_TOKENS 32 // Tokens of whole sentences repeated at the start of the next chunk
+#define EMBEDDING_BATCH_TOKENS 2048 // Tokens per embedding decode (n_batch)
 
 #define DB_HASH_PRESENT_UPSERT 1
 #define DB_HASH_PRESENT_DO_NOTHING 2
 #define DB_HASH_PRESENT_ACTION DB_HASH_PRESENT_DO_NOTHING
 
-#define EMB_PROC_NUM_THREADS 2
-#define ADD_CORPUS_N_THREADS (3)  // Maximum number of threads for processing PDFs in parallel
 #define DB_CONN_POOL_SIZE 2
 
 // LLM context pool constants
@@ -28,10 +29,84 @@
 // Embedding model context pool sizes - can have more contexts since embedding operations are faster
 #define EMBEDDING_MIN_CONTEXTS (4)
 #define EMBEDDING_MAX_CONTEXTS (2+4)
+#define LLM_ERROR_RESPONSE "Error obtaining result from the LLM!" // Chat response on failure (never cached)
+#define QUERY_EMBEDDING_CACHE_SIZE 1024 // Query embeddings kept by LlmManager (LRU), 0 disables the cache
 
-#define CORPUS_FILE_PROC_TYPE_PARALLEL 1
-#define CORPUS_FILE_PROC_TYPE_SEQUENTIAL 2
-#define CORPUS_FILE_PROC_TYPE CORPUS_FILE_PROC_TYPE_SEQUENTIAL
+// Ingestion pipeline defaults: concurrent tasks per stage (IngestConfig overrides them per addCorpus call)
+#define INGEST_EXTRACT_WORKERS 2 // poppler extraction
+#define INGEST_CHUNK_WORKERS 1
+#define INGEST_EMBED_BATCH_SIZE (EMBEDDING_BATCH_TOKENS / EMBEDDING_CHUNK_TOKENS) // Chunks per embedding task: one full decode
+#define INGEST_EMBED_WORKERS EMBEDDING_MAX_CONTEXTS // One per embedding context, so batches never wait on the context pool
+#define INGEST_PERSIST_WORKERS 1 // Database and index writes
+#define INGEST_DOCUMENTS_IN_FLIGHT 8 // Extracted documents not yet persisted (bounds memory)
+#define TASK_POOL_THREADS 0 // Workers of the shared work-stealing pool, 0 uses one per core
+#define FILE_HASH_BLOCK_SIZE (1 << 20) // Bytes fed to SHA-256 per update when hashing a file
+#define CORPUS_MANIFEST_NAME "FILES.json" // Ingested files by (size, mtime, inode), in <corpus root>/_vecdump/
+#define PDF_PARALLEL_MIN_PAGES 64 // PDFs with at least this many pages are extracted in page ranges on the pool
+#define CHUNK_STORE_FILE "chunks.emb" // Chunk text hash -> embedding store, in <corpus root>/_vecdump/ (cross-document dedup)
+
+// CPU similarity search backend
+#define CPU_SEARCH_SHARD_ROWS 16384 // Rows of a vecdump scanned per work item
+#define CPU_SEARCH_RESCORE_FACTOR 8 // Quantized scans keep k * factor candidates for float32 rescoring
+#define CPU_BATCH_ROW_TILE 64 // Corpus rows scored against a query tile at once (kept in L2)
+#define CPU_BATCH_QUERY_TILE 32 // Queries of a batch scored against each row tile
+
+// Format of new vector dumps (int8 scan section, ~0.4x the size of a v1 float32 dump with the prefix section)
+#define VECDUMP_ELEMENT_TYPE tldr::VectorElementType::Int8
+#define VECDUMP_INT8_SCALING tldr::Int8Scaling::PerVector
+#define VECDUMP_RESCORE_SECTION false // A float32 copy for exact rescoring; makes dumps ~1.3x the size of v1 dumps
+#define VECDUMP_NORMALIZE true // Store unit-length vectors so cosine search reduces to inner products
+#define VECDUMP_SECTION_ALIGNMENT 64 // Byte alignment of the sections of v3 dumps (a cache line)
+#define VECDUMP_VERIFY_ON_READ false // Verify section checksums whenever a dump is mapped
+#define VECDUMP_BINARY_CODES true // Write the 1-bit sign tier (.vecbin) next to every dump and segment
+#define BINARY_PREFILTER_CANDIDATES 256 // Hamming survivors rescored by the binary backend (at least k * 4)
+#define VECDUMP_PREFIX_DIMS 192 // Leading dimensions kept in the coarse prefix section (v4), 0 for none
+#define PREFIX_SEARCH_CANDIDATES 256 // Shortlist of the prefix scan rescored with all dimensions (at least k * 4)
+#define SEARCH_FILTER_CACHE_SIZE 8 // Compiled filters reused by the HNSW, IVF-PQ and BM25 backends until the corpus changes
+
+// Process-wide cache of mapped vector dumps
+#define DUMP_CACHE_BUDGET_BYTES (4ULL << 30) // Resident bytes of scanned sections before LRU eviction or page release
+#define DUMP_CACHE_PREFETCH true // madvise(MADV_WILLNEED / MADV_HUGEPAGE) the scanned sections of new mappings
+#define DUMP_CACHE_MLOCK false // Pin cached mappings in RAM (needs a sufficient RLIMIT_MEMLOCK)
+
+// Segmented corpus index (<corpus root>/_vecdump/)
+#define SEGMENT_MANIFEST_NAME "MANIFEST.json"
+#define SEGMENT_MERGE_MIN_DUMPS 8 // Per-document dumps accumulated before they are merged into a segment
+#define SEGMENT_MERGE_FANOUT 4 // Number of small segments merged together
+#define SEGMENT_MAX_ENTRIES (1u << 21) // Segments with this many vectors are not merged further
+#define SEGMENT_MERGE_RETRY_MS 1000 // Wait after a failed background merge, doubled on each further failure
+#define SEGMENT_MERGE_RETRY_MAX_MS 60000
+
+// HNSW approximate search index (<corpus root>/_vecdump/index.hnsw)
+#define HNSW_INDEX_FILE "index.hnsw"
+#define HNSW_M 16 // Links per node (level 0 keeps 2*M)
+#define HNSW_EF_CONSTRUCTION 200
+#define HNSW_EF_SEARCH 64
+#define HNSW_BUILD_ON_INGEST true // Insert new embeddings into the corpus' HNSW index while adding files
+
+// IVF-PQ compressed index (<corpus root>/_vecdump/index.ivfpq), trained on first use
+#define IVFPQ_INDEX_FILE "index.ivfpq"
+#define IVFPQ_NLIST 256 // Coarse lists (reduced for small corpora)
+#define IVFPQ_M 48 // Sub-quantizers; 48 bytes per 384-dim vector (32x smaller than float32)
+#define IVFPQ_NPROBE 16 // Lists scanned per query
+#define IVFPQ_TRAIN_SAMPLE 32768
+#define IVFPQ_KMEANS_ITERS 12
+#define IVFPQ_RERANK_FACTOR 8 // Exact re-rank scores k * factor candidates
+#define IVFPQ_TASK_ROWS 4096 // Vectors per pool task when training and encoding
+
+// BM25 lexical index (<corpus root>/_vecdump/lexical/<file hash>.lex) and hybrid fusion
+#define LEXICAL_INDEX_DIR "lexical"
+#define LEXICAL_BM25_K1 1.2f
+#define LEXICAL_BM25_B 0.75f
+#define LEXICAL_SKIP_INTERVAL 128 // Postings between skip entries of a posting list
+#define LEXICAL_MAX_TOKEN_LENGTH 64 // Longer tokens are not indexed
+#define LEXICAL_REBUILD_DEAD_FRACTION 0.25 // Rebuild once this share of indexed chunks was replaced
+#define HYBRID_CANDIDATES 50 // Results taken from each retriever before fusion
+#define HYBRID_RRF_K 60 // Rank offset of reciprocal-rank fusion
+
+// Semantic answer cache of queryRag (see AnswerCache)
+#define ANSWER_CACHE_SIZE 256 // Cached answers, 0 disables the cache
+#define ANSWER_CACHE_MIN_SIMILARITY 0.95f // Query embedding cosine needed to reuse an answer
 
 // Directory name for storing vector cache files
 constexpr const char* VECDUMP_DIR = "_vecdumps";
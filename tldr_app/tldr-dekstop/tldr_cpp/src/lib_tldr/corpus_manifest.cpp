@@ -0,0 +1,193 @@
+#include "corpus_manifest.h"
+#include "constants.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <unordered_set>
+#include <sys/stat.h>
+#include <nlohmann/json.hpp>
+
+namespace tldr {
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+static std::mutex g_manifest_registry_mutex;
+static std::map<std::string, std::shared_ptr<CorpusManifest> > g_manifest_registry;
+
+bool read_file_signature(const std::string &path, FileSignature &signature) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    signature.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    signature.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    signature.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    signature.inode = static_cast<uint64_t>(st.st_ino);
+    return true;
+}
+
+std::shared_ptr<CorpusManifest> CorpusManifest::open(const std::string &corpus_root) {
+    std::error_code ec;
+    if (!fs::is_directory(corpus_root, ec)) {
+        return nullptr;
+    }
+    std::string root = fs::weakly_canonical(corpus_root, ec).string();
+
+    std::lock_guard<std::mutex> lock(g_manifest_registry_mutex);
+    auto it = g_manifest_registry.find(root);
+    if (it != g_manifest_registry.end()) {
+        return it->second;
+    }
+
+    std::shared_ptr<CorpusManifest> manifest(new CorpusManifest(root));
+    manifest->load();
+    g_manifest_registry[root] = manifest;
+    return manifest;
+}
+
+CorpusManifest::CorpusManifest(std::string corpus_root)
+    : root_(std::move(corpus_root)) {
+    manifest_path_ = (fs::path(root_) / "_vecdump" / CORPUS_MANIFEST_NAME).string();
+    root_prefix_ = root_.ends_with('/') ? root_ : root_ + "/";
+}
+
+std::string CorpusManifest::key_for(const std::string &path) const {
+    if (path.size() > root_prefix_.size() && path.compare(0, root_prefix_.size(), root_prefix_) == 0) {
+        return path.substr(root_prefix_.size());
+    }
+
+    // Spelled differently from the canonical root (symlink, "..", relative input): canonicalize the directory once
+    fs::path file(path);
+    std::string dir = file.parent_path().string();
+    auto it = canonical_dirs_.find(dir);
+    if (it == canonical_dirs_.end()) {
+        std::error_code ec;
+        it = canonical_dirs_.emplace(dir, fs::weakly_canonical(file.parent_path(), ec).string()).first;
+    }
+    return (fs::path(it->second) / file.filename()).lexically_relative(root_).string();
+}
+
+bool CorpusManifest::load() {
+    std::ifstream in(manifest_path_);
+    if (!in) {
+        return false;
+    }
+
+    try {
+        json manifest = json::parse(in);
+        for (const auto &item: manifest.at("files")) {
+            FileEntry entry;
+            entry.signature.size = item.at("size").get<uint64_t>();
+            entry.signature.mtime_ns = item.at("mtime_ns").get<int64_t>();
+            entry.signature.inode = item.at("inode").get<uint64_t>();
+            entry.file_hash = item.at("hash").get<std::string>();
+            files_.emplace(item.at("path").get<std::string>(), std::move(entry));
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Corpus manifest: ignoring unreadable " << manifest_path_ << ": " << e.what() << std::endl;
+        files_.clear();
+        return false;
+    }
+
+    std::cout << "Corpus manifest: " << files_.size() << " ingested files recorded for " << root_ << std::endl;
+    return true;
+}
+
+std::vector<std::string> CorpusManifest::changed_files(const std::vector<std::string> &paths,
+                                                       std::map<std::string, FileSignature> &signatures) const {
+    std::vector<std::string> changed;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &path: paths) {
+        FileSignature signature;
+        if (!read_file_signature(path, signature)) {
+            changed.push_back(path); // Let the hashing report why it cannot be read
+            continue;
+        }
+        auto it = files_.find(key_for(path));
+        if (it != files_.end() && it->second.signature == signature) {
+            continue;
+        }
+        changed.push_back(path);
+        signatures[path] = signature;
+    }
+    return changed;
+}
+
+void CorpusManifest::record(const std::string &path, const FileSignature &signature, const std::string &file_hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FileEntry &entry = files_[key_for(path)];
+    if (entry.signature == signature && entry.file_hash == file_hash) {
+        return;
+    }
+    entry.signature = signature;
+    entry.file_hash = file_hash;
+    dirty_ = true;
+}
+
+void CorpusManifest::retain(const std::vector<std::string> &paths) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_set<std::string> keep;
+    keep.reserve(paths.size());
+    for (const auto &path: paths) {
+        keep.insert(key_for(path));
+    }
+    for (auto it = files_.begin(); it != files_.end();) {
+        if (keep.count(it->first)) {
+            ++it;
+        } else {
+            it = files_.erase(it);
+            dirty_ = true;
+        }
+    }
+}
+
+bool CorpusManifest::save() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!dirty_) {
+        return true;
+    }
+
+    json manifest;
+    manifest["version"] = 1;
+    manifest["files"] = json::array();
+    for (const auto &[path, entry]: files_) {
+        manifest["files"].push_back({
+            {"path", path},
+            {"size", entry.signature.size},
+            {"mtime_ns", entry.signature.mtime_ns},
+            {"inode", entry.signature.inode},
+            {"hash", entry.file_hash}
+        });
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(manifest_path_).parent_path(), ec);
+    std::string tmp_path = manifest_path_ + ".tmp";
+    {
+        std::ofstream out(tmp_path);
+        if (!out) {
+            std::cerr << "Corpus manifest: could not write " << tmp_path << std::endl;
+            return false;
+        }
+        out << manifest.dump();
+    }
+    fs::rename(tmp_path, manifest_path_, ec);
+    if (ec) {
+        std::cerr << "Corpus manifest: could not replace " << manifest_path_ << ": " << ec.message() << std::endl;
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+size_t CorpusManifest::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.size();
+}
+
+} // namespace tldr
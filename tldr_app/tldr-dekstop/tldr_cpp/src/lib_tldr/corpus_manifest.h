@@ -0,0 +1,88 @@
+#ifndef TLDR_CPP_CORPUS_MANIFEST_H
+#define TLDR_CPP_CORPUS_MANIFEST_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace tldr {
+
+// What a stat() tells about a source file; a file whose signature is unchanged is not read again
+struct FileSignature {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t inode = 0;
+
+    bool operator==(const FileSignature &other) const {
+        return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode;
+    }
+};
+
+// Signature of a file from a single stat(), false if it cannot be stat'ed
+bool read_file_signature(const std::string &path, FileSignature &signature);
+
+/**
+ * Record of the source files of one corpus root that are fully ingested:
+ * relative path -> (size, mtime, inode) signature and SHA-256 content hash,
+ * kept in <root>/_vecdump/CORPUS_MANIFEST_NAME.
+ *
+ * addCorpus stats every file it finds and only hashes and looks up the ones
+ * whose signature differs from the recorded one, so re-scanning an unchanged
+ * tree costs one stat() per file. A file is recorded once its document is
+ * persisted (or its content is found to be indexed already), so files that
+ * failed to ingest are retried by the next scan.
+ */
+class CorpusManifest {
+public:
+    struct FileEntry {
+        FileSignature signature;
+        std::string file_hash;
+    };
+
+    /**
+     * Get the process-wide manifest of a corpus root, loading it from disk
+     * @return nullptr if the root does not exist
+     */
+    static std::shared_ptr<CorpusManifest> open(const std::string &corpus_root);
+
+    /**
+     * The files whose signature differs from the recorded one (or that are not recorded), in input order
+     * @param signatures Filled with the current signature of every returned file that could be stat'ed
+     */
+    std::vector<std::string> changed_files(const std::vector<std::string> &paths,
+                                           std::map<std::string, FileSignature> &signatures) const;
+
+    // Record an ingested file with the signature it had when it was hashed
+    void record(const std::string &path, const FileSignature &signature, const std::string &file_hash);
+
+    // Drop the entries of files not in paths (the result of a full scan of the root)
+    void retain(const std::vector<std::string> &paths);
+
+    // Write the manifest if it changed since it was loaded or last saved
+    bool save();
+
+    size_t size() const;
+
+private:
+    explicit CorpusManifest(std::string corpus_root);
+
+    bool load();
+    // Path relative to the root; the caller holds mutex_
+    std::string key_for(const std::string &path) const;
+
+    std::string root_;
+    std::string root_prefix_; // root_ with a trailing separator
+    std::string manifest_path_;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, FileEntry> files_; // By path relative to the root
+    mutable std::map<std::string, std::string> canonical_dirs_; // Directory as passed in -> canonical directory
+    bool dirty_ = false;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_CORPUS_MANIFEST_H
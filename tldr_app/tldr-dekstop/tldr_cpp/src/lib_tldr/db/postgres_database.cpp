@@ -1,10 +1,23 @@
 #include "postgres_database.h"
 #include <iostream>
 #include <atomic>
+#include <cmath>
 #include <pqxx/pqxx>
 #include "../constants.h"
 
 namespace tldr {
+    // Embeddings are stored and queried at unit length, so the inner product
+    // (`<#>`, served by a vector_ip_ops index) ranks exactly like cosine similarity
+    static std::vector<float> unit_length(std::vector<float> values) {
+        double norm_sq = 0.0;
+        for (float v: values) norm_sq += static_cast<double>(v) * v;
+        if (norm_sq > 0.0) {
+            const float inv = static_cast<float>(1.0 / std::sqrt(norm_sq));
+            for (float &v: values) v *= inv;
+        }
+        return values;
+    }
+
     PostgresDatabase::PostgresDatabase(const std::string &connection_string)
         : connection_string_(connection_string),
           conn_pool(
@@ -114,6 +127,18 @@ namespace tldr {
                 std::cerr << "Note: page_number column might already exist or couldn't be added: " << e.what() << std::endl;
             }
 
+            // Documents holding a chunk whose embedding row belongs to another document
+            // (identical chunk text is embedded and stored once per corpus)
+            txn.exec(
+                "CREATE TABLE IF NOT EXISTS chunk_refs ("
+                "embedding_hash TEXT NOT NULL,"
+                "document_id UUID REFERENCES documents(id) ON DELETE CASCADE,"
+                "page_number INTEGER DEFAULT 0,"
+                "PRIMARY KEY (embedding_hash, document_id, page_number)"
+                ")"
+            );
+            txn.exec("CREATE INDEX IF NOT EXISTS chunk_refs_document_id_idx ON chunk_refs (document_id)");
+
             // Create indexes for documents table
             txn.exec("CREATE INDEX IF NOT EXISTS documents_file_hash_idx ON documents (file_hash)");
             txn.exec("CREATE INDEX IF NOT EXISTS documents_created_at_idx ON documents (created_at)");
@@ -123,9 +148,22 @@ namespace tldr {
             txn.exec("CREATE UNIQUE INDEX IF NOT EXISTS embeddings_hash_idx ON embeddings (embedding_hash)");
             txn.exec("CREATE INDEX IF NOT EXISTS embeddings_document_id_idx ON embeddings (document_id)");
 
-            // Create index for vector similarity search
+            // Databases created with the former cosine index hold embeddings that may not be
+            // normalized: normalize them once (l2_normalize needs pgvector 0.7+) and drop it
             txn.exec(
-                "CREATE INDEX IF NOT EXISTS embeddings_vector_idx ON embeddings USING ivfflat (embedding vector_cosine_ops) WITH (lists = 100)");
+                "DO $$\n"
+                "BEGIN\n"
+                "    IF EXISTS (SELECT 1 FROM pg_class WHERE relname = 'embeddings_vector_idx') THEN\n"
+                "        UPDATE embeddings SET embedding = l2_normalize(embedding);\n"
+                "        DROP INDEX embeddings_vector_idx;\n"
+                "    END IF;\n"
+                "END\n"
+                "$$;"
+            );
+
+            // Create index for vector similarity search (inner product over unit vectors)
+            txn.exec(
+                "CREATE INDEX IF NOT EXISTS embeddings_vector_ip_idx ON embeddings USING ivfflat (embedding vector_ip_ops) WITH (lists = 100)");
 
             // Create a function to update the updated_at column
             txn.exec(
@@ -214,20 +252,34 @@ namespace tldr {
 
             std::string document_id = doc_result[0][0].as<std::string>();
 
-            // Prepare statement with updated column names and document_id
+            // Prepare statement with updated column names and document_id. A chunk whose text is
+            // already stored has the same embedding hash: keep one row, referenced from chunk_refs
             conn->prepare(
                 stmt_name,
                 "INSERT INTO embeddings (document_id, chunk_text, embedding, embedding_hash, page_number) "
-                "VALUES ($1, $2, $3, $4, $5) RETURNING id"
+                "VALUES ($1, $2, $3, $4, $5) "
+#if DB_HASH_PRESENT_ACTION == DB_HASH_PRESENT_UPSERT
+                "ON CONFLICT (embedding_hash) DO UPDATE SET document_id = EXCLUDED.document_id, "
+                "chunk_text = EXCLUDED.chunk_text, page_number = EXCLUDED.page_number "
+#else
+                "ON CONFLICT (embedding_hash) DO NOTHING "
+#endif
+                "RETURNING id"
+            );
+            const std::string ref_stmt_name = stmt_name + "_ref";
+            conn->prepare(
+                ref_stmt_name,
+                "INSERT INTO chunk_refs (embedding_hash, document_id, page_number) VALUES ($1, $2, $3) "
+                "ON CONFLICT DO NOTHING"
             );
 
             for (size_t i = 0; i < chunks.size(); ++i) {
-                // Convert embedding to string
+                // Convert the normalized embedding to string
                 std::string vector_str = "[";
-                const auto &embedding = embeddings_response["embeddings"][i];
+                const auto embedding = unit_length(embeddings_response["embeddings"][i].get<std::vector<float> >());
                 for (size_t j = 0; j < embedding.size(); ++j) {
                     if (j > 0) vector_str += ",";
-                    vector_str += std::to_string(embedding[j].get<float>());
+                    vector_str += std::to_string(embedding[j]);
                 }
                 vector_str += "]";
 
@@ -246,6 +298,7 @@ namespace tldr {
 
                 // Execute the prepared statement with the new parameter order
                 auto result = txn.exec_prepared(stmt_name, params);
+                txn.exec_prepared(ref_stmt_name, pqxx::params{hash_str, document_id, page_num});
 
                 // Get the last inserted id
                 if (!result.empty()) {
@@ -307,21 +360,23 @@ namespace tldr {
         try {
             pqxx::work txn(*conn);
 
-            // Convert vector to PostgreSQL array string
+            // Convert the normalized vector to PostgreSQL array string
+            const std::vector<float> unit_query = unit_length(query_vector);
             std::string vector_str = "ARRAY[";
-            for (size_t i = 0; i < query_vector.size(); ++i) {
+            for (size_t i = 0; i < unit_query.size(); ++i) {
                 if (i > 0) vector_str += ",";
-                vector_str += std::to_string(query_vector[i]);
+                vector_str += std::to_string(unit_query[i]);
             }
             vector_str += "]::vector";
 
-            // Perform similarity search using cosine distance with document metadata
+            // Perform similarity search using the (negative) inner product with document metadata;
+            // for unit vectors it equals the cosine similarity
             std::string query =
-                "SELECT e.chunk_text, 1 - (e.embedding <=> " + vector_str + ") as similarity, e.embedding_hash, "
-                "d.file_path, d.file_name, d.title, d.author, d.page_count, e.page_number "
+                "SELECT e.chunk_text, -(e.embedding <#> " + vector_str + ") as similarity, e.embedding_hash, "
+                "d.file_hash, d.file_path, d.file_name, d.title, d.author, d.page_count, e.page_number "
                 "FROM embeddings e "
                 "JOIN documents d ON e.document_id = d.id "
-                "ORDER BY e.embedding <=> " + vector_str + " "
+                "ORDER BY e.embedding <#> " + vector_str + " "
                 "LIMIT " + std::to_string(k);
 
             auto result = txn.exec(query);
@@ -339,6 +394,7 @@ namespace tldr {
                 chunk.hash = hash;
                 
                 // Include document metadata
+                chunk.file_hash = row["file_hash"].as<std::string>();
                 chunk.file_path = row["file_path"].as<std::string>();
                 chunk.file_name = row["file_name"].as<std::string>();
                 
@@ -393,7 +449,7 @@ namespace tldr {
             // to get document metadata in a single query
             std::string query = 
                 "SELECT e.embedding_hash, e.chunk_text, "
-                "d.file_path, d.file_name, d.title, d.author, d.page_count, e.page_number "
+                "d.file_hash, d.file_path, d.file_name, d.title, d.author, d.page_count, e.page_number "
                 "FROM embeddings e "
                 "JOIN documents d ON e.document_id = d.id "
                 "WHERE e.embedding_hash IN (";
@@ -420,6 +476,7 @@ namespace tldr {
                 // Create CtxChunkMeta and populate fields
                 CtxChunkMeta chunk_data;
                 chunk_data.text = row["chunk_text"].as<std::string>();
+                chunk_data.file_hash = row["file_hash"].as<std::string>();
                 chunk_data.file_path = row["file_path"].as<std::string>();
                 chunk_data.file_name = row["file_name"].as<std::string>();
                 chunk_data.hash = hash; // Set the hash field
@@ -676,6 +733,15 @@ namespace tldr {
 
             std::string document_id = doc_result[0][0].as<std::string>();
 
+            // Embedding rows this document shares with other documents move to one of them
+            txn.exec(
+                "UPDATE embeddings e SET document_id = r.document_id, page_number = r.page_number "
+                "FROM chunk_refs r WHERE e.document_id = $1 AND r.embedding_hash = e.embedding_hash "
+                "AND r.document_id <> $1",
+                pqxx::params{document_id}
+            );
+            txn.exec("DELETE FROM chunk_refs WHERE document_id = $1", pqxx::params{document_id});
+
             // Delete all embeddings for the given document_id
             std::string delete_sql = "DELETE FROM embeddings WHERE document_id = $1";
             auto result = txn.exec(delete_sql, pqxx::params{document_id});
@@ -2,6 +2,9 @@
 #define TLDR_CPP_DEFINITIONS_H
 #include <vector>
 #include <string>
+#include <string_view>
+#include <span>
+#include <cstdint>
 
 // Structure for operation results
 struct WorkResult {
@@ -31,6 +34,7 @@ struct CtxChunkMeta {
     uint64_t hash;
 
     // Document metadata
+    std::string file_hash; // SHA-256 of the source document
     std::string file_path;
     std::string file_name;
     std::string title;
@@ -41,6 +45,59 @@ struct CtxChunkMeta {
     int page_number = 0;
 };
 
+// Vector search backend used to retrieve context chunks
+enum class SearchBackend {
+    Exhaustive, // Score every vector of the corpus (NPU accelerator or CPU SIMD backend)
+    Hnsw,       // Approximate search over the corpus' HNSW graph index
+    IvfPq,      // Compressed inverted-file / product-quantization index
+    Binary,     // Hamming prefilter over 1-bit sign codes, survivors scored exactly
+    Prefix      // Cosine of the leading dimensions (dump prefix section), survivors scored exactly
+};
+
+// Lexical (BM25) retrieval combined with the vector results by queryRag
+enum class FusionMethod {
+    None,           // Vector results only
+    ReciprocalRank, // Sum of 1 / (HYBRID_RRF_K + rank) over the vector and the lexical ranking
+    Weighted        // Blend of min-max normalized cosine and BM25 scores by lexical_weight
+};
+
+// Restricts retrieval to chunks matching every field that is set
+struct SearchFilter {
+    std::vector<std::string> file_hashes; // Documents to search, empty for all
+    std::string author;                   // Exact author, empty for any
+    std::string title;                    // Exact title, empty for any
+    int page_min = 0;                     // Inclusive page range of the chunk, 0 for unbounded
+    int page_max = 0;
+
+    bool empty() const {
+        return file_hashes.empty() && author.empty() && title.empty() && page_min <= 0 && page_max <= 0;
+    }
+};
+
+// Per-query retrieval options
+struct SearchOptions {
+    SearchBackend backend = SearchBackend::Exhaustive;
+    int ef_search = 0; // HNSW candidate list size, 0 uses HNSW_EF_SEARCH
+    int nprobe = 0; // IVF-PQ lists scanned, 0 uses IVFPQ_NPROBE
+    bool rerank = true; // Re-score IVF-PQ candidates against the full-precision vectors
+    int binary_candidates = 0; // Hamming survivors rescored, 0 uses BINARY_PREFILTER_CANDIDATES
+    int prefix_candidates = 0; // Prefix survivors rescored, 0 uses PREFIX_SEARCH_CANDIDATES
+    SearchFilter filter; // Applied inside the scan, so k results are returned whenever k chunks match
+    FusionMethod fusion = FusionMethod::ReciprocalRank;
+    float lexical_weight = 0.3f; // Share of the BM25 score with FusionMethod::Weighted
+    float answer_cache_similarity = 0.0f; // Query cosine reusing a cached answer, 0 uses ANSWER_CACHE_MIN_SIMILARITY, > 1 disables
+};
+
+// Stage parallelism of corpus ingestion (concurrent tasks on the shared task pool), 0 uses the INGEST_* defaults
+struct IngestConfig {
+    int extract_workers = 0; // PDF text extraction
+    int chunk_workers = 0; // Chunking of extracted documents
+    int embed_workers = 0; // Embedding batches, each holds one embedding context while it runs
+    int persist_workers = 0; // Database rows, vector dump, docstore and corpus indexes
+    int embed_batch_size = 0; // Chunks per embedding call, 0 uses INGEST_EMBED_BATCH_SIZE
+    int documents_in_flight = 0; // Documents extracted but not yet persisted
+};
+
 // Wrapper function for NPU similarity search
 std::vector<CtxChunkMeta> searchSimilarVectorsNPU(
     const std::vector<float> &query_vector,
@@ -59,15 +116,62 @@ struct PdfMetadata {
     int pageCount;
 };
 
-// Structure to hold document data including metadata and page texts
+// A chunk of DocumentData::text
+struct TextSpan {
+    size_t offset = 0;
+    size_t length = 0;
+    int page = 0; // 1-based page the chunk starts on
+    size_t token_offset = 0; // Token ids of the chunk in DocumentData::chunkTokens
+    size_t token_count = 0;
+};
+
+// Structure to hold document data including metadata and page texts.
+// The text of all pages is held once, in one buffer; pages and chunks are views of it.
 struct DocumentData {
     PdfMetadata metadata;
-    std::vector<std::string> pageTexts; // Index N-1 contains text of page N
-    std::vector<std::string> chunks; // Text chunks for processing
-    std::vector<int> chunkPageNums; // Page number for each chunk
+    std::string text; // Text of all pages back to back
+    std::vector<size_t> pageEnds; // Index N-1 contains the end offset in text of page N
+    std::vector<TextSpan> chunks; // Text chunks for processing
+    std::vector<int32_t> chunkTokens; // Embedding model token ids of the chunks, empty when chunked by characters
+
+    size_t pageCount() const { return pageEnds.size(); }
+
+    std::string_view page(size_t index) const {
+        const size_t begin = index == 0 ? 0 : pageEnds[index - 1];
+        return std::string_view(text).substr(begin, pageEnds[index] - begin);
+    }
+
+    std::string_view chunk(size_t index) const {
+        return std::string_view(text).substr(chunks[index].offset, chunks[index].length);
+    }
+
+    // Token ids of a chunk, without the model's special tokens
+    std::span<const int32_t> chunkTokenIds(size_t index) const {
+        return std::span<const int32_t>(chunkTokens).subspan(chunks[index].token_offset, chunks[index].token_count);
+    }
+
+    // Views of chunks [begin, end)
+    std::vector<std::string_view> chunkViews(size_t begin, size_t end) const {
+        std::vector<std::string_view> views;
+        views.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            views.push_back(chunk(i));
+        }
+        return views;
+    }
 };
 
 
+// Per-stage latency of one queryRag call
+struct RetrievalTimings {
+    double embed_ms = 0;    // Query embedding
+    double vector_ms = 0;   // Vector search
+    double lexical_ms = 0;  // BM25 search
+    double fusion_ms = 0;   // Rank fusion
+    double hydrate_ms = 0;  // Chunk text and metadata lookup
+    double generate_ms = 0; // LLM response
+};
+
 // Structure to hold RAG query results
 struct RagResult {
     // The generated response from the LLM
@@ -78,6 +182,12 @@ struct RagResult {
 
     // Number of documents referenced in the result
     int referenced_document_count = 0;
+
+    // Latency of each retrieval stage in milliseconds
+    RetrievalTimings timings;
+
+    // Response reused from the answer cache for a near-duplicate question over the same chunks
+    bool cached_answer = false;
 };
 
 struct embeddings_request {
@@ -0,0 +1,212 @@
+#include "docstore.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+namespace tldr {
+
+std::string docstore_path_for(const std::string& dump_path) {
+    return std::filesystem::path(dump_path).replace_extension(".vecdoc").string();
+}
+
+std::string_view MappedDocstore::string(const DocstoreString& s) const {
+    if (s.offset > header->strings_size || s.length > header->strings_size - s.offset) {
+        return {};
+    }
+    return {strings + s.offset, s.length};
+}
+
+bool MappedDocstore::hydrate(size_t row, CtxChunkMeta& out) const {
+    if (row >= header->num_chunks) {
+        return false;
+    }
+    const DocstoreChunkRecord& chunk = chunks[row];
+    if (chunk.document == DOCSTORE_NO_DOCUMENT || chunk.document >= header->num_documents) {
+        return false;
+    }
+    const DocstoreDocumentRecord& document = documents[chunk.document];
+    out.hash = chunk.hash;
+    out.text = string(chunk.text);
+    out.page_number = chunk.page_number;
+    out.file_hash = string(document.file_hash);
+    out.file_path = string(document.file_path);
+    out.file_name = string(document.file_name);
+    out.title = string(document.title);
+    out.author = string(document.author);
+    out.page_count = document.page_count;
+    return true;
+}
+
+bool write_docstore(const std::string& path, const std::vector<DocstoreDocument>& documents, size_t num_chunks,
+                    const std::function<DocstoreChunk(size_t row)>& chunk_source) {
+    if (num_chunks > UINT32_MAX || documents.size() >= DOCSTORE_NO_DOCUMENT) {
+        std::cerr << "Error: Invalid docstore shape (" << num_chunks << " chunks)" << std::endl;
+        return false;
+    }
+
+    DocstoreHeader header{};
+    header.magic = DOCSTORE_MAGIC;
+    header.version = 1;
+    header.num_chunks = static_cast<uint32_t>(num_chunks);
+    header.num_documents = static_cast<uint32_t>(documents.size());
+    header.documents_offset = sizeof(DocstoreHeader);
+    header.chunks_offset = header.documents_offset + documents.size() * sizeof(DocstoreDocumentRecord);
+    header.strings_offset = header.chunks_offset + num_chunks * sizeof(DocstoreChunkRecord);
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << tmp_path << " for writing" << std::endl;
+        return false;
+    }
+
+    // Strings are laid out in write order: document fields, then chunk texts
+    uint64_t strings_size = 0;
+    auto place = [&](std::string_view s) {
+        DocstoreString ref{strings_size, static_cast<uint32_t>(s.size()), 0};
+        strings_size += s.size();
+        return ref;
+    };
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& document: documents) {
+        DocstoreDocumentRecord record{};
+        record.file_hash = place(document.file_hash);
+        record.file_path = place(document.file_path);
+        record.file_name = place(document.file_name);
+        record.title = place(document.title);
+        record.author = place(document.author);
+        record.page_count = document.page_count;
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    for (size_t row = 0; row < num_chunks; ++row) {
+        DocstoreChunk chunk = chunk_source(row);
+        DocstoreChunkRecord record{};
+        record.hash = chunk.hash;
+        record.text = place(chunk.text);
+        record.page_number = chunk.page_number;
+        record.document = chunk.document;
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+
+    for (const auto& document: documents) {
+        for (const std::string* s: {&document.file_hash, &document.file_path, &document.file_name,
+                                    &document.title, &document.author}) {
+            out.write(s->data(), s->size());
+        }
+    }
+    for (size_t row = 0; row < num_chunks; ++row) {
+        DocstoreChunk chunk = chunk_source(row);
+        out.write(chunk.text.data(), chunk.text.size());
+    }
+
+    header.strings_size = strings_size;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed writing " << tmp_path << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "Error: Could not move " << tmp_path << " into place: " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<MappedDocstore> read_docstore_file(const std::string& path) {
+    auto result = std::make_unique<MappedDocstore>();
+    result->fd = open(path.c_str(), O_RDONLY);
+    if (result->fd == -1) {
+        return nullptr; // Files ingested before the docstore existed have none
+    }
+    struct stat sb;
+    if (fstat(result->fd, &sb) == -1 || static_cast<size_t>(sb.st_size) < sizeof(DocstoreHeader)) {
+        return nullptr;
+    }
+    result->file_size = sb.st_size;
+    result->mapped_memory = mmap(NULL, result->file_size, PROT_READ, MAP_PRIVATE, result->fd, 0);
+    if (result->mapped_memory == MAP_FAILED) {
+        std::cerr << "Error memory mapping " << path << std::endl;
+        return nullptr;
+    }
+    const char* base = static_cast<const char*>(result->mapped_memory);
+    result->header = reinterpret_cast<const DocstoreHeader*>(base);
+    const auto* h = result->header;
+    const uint64_t documents_end = h->documents_offset + uint64_t{h->num_documents} * sizeof(DocstoreDocumentRecord);
+    const uint64_t chunks_end = h->chunks_offset + uint64_t{h->num_chunks} * sizeof(DocstoreChunkRecord);
+    if (h->magic != DOCSTORE_MAGIC || h->version != 1 ||
+        h->documents_offset < sizeof(DocstoreHeader) || documents_end > h->chunks_offset ||
+        chunks_end > h->strings_offset || h->strings_offset > result->file_size ||
+        h->strings_size > result->file_size - h->strings_offset) {
+        std::cerr << "Error: Docstore " << path << " is truncated or malformed" << std::endl;
+        return nullptr;
+    }
+    result->documents = reinterpret_cast<const DocstoreDocumentRecord*>(base + h->documents_offset);
+    result->chunks = reinterpret_cast<const DocstoreChunkRecord*>(base + h->chunks_offset);
+    result->strings = base + h->strings_offset;
+    return result;
+}
+
+bool merge_docstores(const std::vector<const MappedDocstore*>& inputs,
+                     const std::vector<const MappedVectorData*>& dumps, const std::string& out_path) {
+    if (inputs.size() != dumps.size()) {
+        return false;
+    }
+
+    // Documents of every input, with the offset of each input's document indices
+    std::vector<DocstoreDocument> documents;
+    std::vector<uint32_t> document_base(inputs.size(), 0);
+    std::vector<size_t> row_base(inputs.size(), 0);
+    size_t num_chunks = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const MappedDocstore* input = inputs[i];
+        row_base[i] = num_chunks;
+        num_chunks += dumps[i]->header->num_entries;
+        document_base[i] = static_cast<uint32_t>(documents.size());
+        if (!input) continue;
+        if (input->header->num_chunks != dumps[i]->header->num_entries) {
+            std::cerr << "Docstore merge: row count mismatch, input " << i << " dropped" << std::endl;
+            continue;
+        }
+        for (uint32_t d = 0; d < input->header->num_documents; ++d) {
+            const DocstoreDocumentRecord& record = input->documents[d];
+            documents.push_back({std::string(input->string(record.file_hash)),
+                                 std::string(input->string(record.file_path)),
+                                 std::string(input->string(record.file_name)),
+                                 std::string(input->string(record.title)),
+                                 std::string(input->string(record.author)),
+                                 record.page_count});
+        }
+    }
+
+    return write_docstore(out_path, documents, num_chunks, [&](size_t row) {
+        // Inputs are few, a linear walk finds the one holding the row
+        size_t i = 0;
+        while (i + 1 < inputs.size() && row >= row_base[i + 1]) ++i;
+        const size_t local = row - row_base[i];
+        DocstoreChunk chunk;
+        chunk.hash = dumps[i]->hashes[local];
+        const MappedDocstore* input = inputs[i];
+        if (input && input->header->num_chunks == dumps[i]->header->num_entries) {
+            const DocstoreChunkRecord& record = input->chunks[local];
+            if (record.hash != chunk.hash) {
+                return chunk; // Stale docstore of a rewritten dump
+            }
+            chunk.text = input->string(record.text);
+            chunk.page_number = record.page_number;
+            if (record.document < input->header->num_documents) {
+                chunk.document = document_base[i] + record.document;
+            }
+        }
+        return chunk;
+    });
+}
+
+} // namespace tldr
@@ -0,0 +1,126 @@
+#ifndef TLDR_CPP_DOCSTORE_H
+#define TLDR_CPP_DOCSTORE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "definitions.h"
+#include "vec_dump.h"
+
+namespace tldr {
+
+constexpr uint32_t DOCSTORE_MAGIC = 0x434F4454;        // "TDOC"
+constexpr uint32_t DOCSTORE_NO_DOCUMENT = UINT32_MAX; // Row without a stored chunk
+
+// Location of a string inside the string section
+struct DocstoreString {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+/**
+ * Header of a .vecdoc file, the chunk store written next to every .vecdump /
+ * .vecseg. Layout: header, document records, chunk records, strings.
+ * Chunk record N describes row N of the vector file, so a row found through
+ * the vector file's hashes is hydrated without any lookup of its own.
+ */
+struct DocstoreHeader {
+    uint32_t magic;         // "TDOC"
+    uint32_t version;       // 1
+    uint32_t num_chunks;    // Rows of the vector file
+    uint32_t num_documents;
+    uint64_t documents_offset;
+    uint64_t chunks_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct DocstoreDocumentRecord {
+    DocstoreString file_hash;
+    DocstoreString file_path;
+    DocstoreString file_name;
+    DocstoreString title;
+    DocstoreString author;
+    int32_t page_count;
+    uint32_t reserved;
+};
+
+struct DocstoreChunkRecord {
+    uint64_t hash;        // Embedding hash, same as the row of the vector file
+    DocstoreString text;
+    int32_t page_number;
+    uint32_t document;    // Index of the document record, DOCSTORE_NO_DOCUMENT if unknown
+};
+
+// Document metadata to write
+struct DocstoreDocument {
+    std::string file_hash;
+    std::string file_path;
+    std::string file_name;
+    std::string title;
+    std::string author;
+    int page_count = 0;
+};
+
+// One row to write; the text only has to stay valid during write_docstore
+struct DocstoreChunk {
+    uint64_t hash = 0;
+    std::string_view text;
+    int page_number = 0;
+    uint32_t document = DOCSTORE_NO_DOCUMENT;
+};
+
+// Memory-mapped .vecdoc file
+struct MappedDocstore {
+    void* mapped_memory = nullptr;
+    size_t file_size = 0;
+    int fd = -1;
+    const DocstoreHeader* header = nullptr;
+    const DocstoreDocumentRecord* documents = nullptr;
+    const DocstoreChunkRecord* chunks = nullptr;
+    const char* strings = nullptr;
+
+    // String of the string section, empty if out of bounds
+    std::string_view string(const DocstoreString& s) const;
+
+    // Fill text, page and document metadata of a row (similarity is left alone);
+    // false if the row has no stored chunk
+    bool hydrate(size_t row, CtxChunkMeta& out) const;
+
+    ~MappedDocstore() {
+        if (mapped_memory && mapped_memory != MAP_FAILED) {
+            munmap(mapped_memory, file_size);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+};
+
+// Path of the docstore belonging to a .vecdump / .vecseg file
+std::string docstore_path_for(const std::string& dump_path);
+
+// Write num_chunks rows pulled through chunk_source (twice), atomically (temp file + rename)
+bool write_docstore(const std::string& path, const std::vector<DocstoreDocument>& documents, size_t num_chunks,
+                    const std::function<DocstoreChunk(size_t row)>& chunk_source);
+
+// Map a .vecdoc file, nullptr if it is missing or malformed
+std::unique_ptr<MappedDocstore> read_docstore_file(const std::string& path);
+
+/**
+ * Docstore of vector files concatenated by merge_vector_dumps: rows follow the
+ * dumps in order. Inputs may be null (files written without a docstore), their
+ * rows are then stored without a chunk and keep being hydrated from the database.
+ */
+bool merge_docstores(const std::vector<const MappedDocstore*>& inputs,
+                     const std::vector<const MappedVectorData*>& dumps, const std::string& out_path);
+
+} // namespace tldr
+
+#endif // TLDR_CPP_DOCSTORE_H
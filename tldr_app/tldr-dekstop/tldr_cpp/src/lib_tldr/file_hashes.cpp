@@ -1,83 +1,111 @@
 #include "lib_tldr.h"
-#include <array>
+#include "task_pool.h"
 #include <memory>
-#include <stdexcept>
-#include <cstdio>
-#include <algorithm>
-#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
 
-// Helper function to execute a shell command and get its output
-static std::string exec(const std::string& cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
-    if (!pipe) {
-        throw std::runtime_error("popen() failed!");
+// Feeds a digest from a file: mapped and consumed block by block, or read into a buffer where mmap is not possible
+static bool digestFile(int fd, size_t size, EVP_MD_CTX *ctx, std::string &error) {
+    if (size > 0) {
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, size, MADV_SEQUENTIAL);
+            const auto *bytes = static_cast<const unsigned char *>(mapped);
+            bool ok = true;
+            for (size_t offset = 0; ok && offset < size; offset += FILE_HASH_BLOCK_SIZE) {
+                ok = EVP_DigestUpdate(ctx, bytes + offset, std::min<size_t>(FILE_HASH_BLOCK_SIZE, size - offset)) == 1;
+            }
+            munmap(mapped, size);
+            if (!ok) error = "SHA-256 update failed";
+            return ok;
+        }
     }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
+
+    std::vector<unsigned char> buffer(FILE_HASH_BLOCK_SIZE);
+    while (true) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            error = std::strerror(errno);
+            return false;
+        }
+        if (n == 0) return true;
+        if (EVP_DigestUpdate(ctx, buffer.data(), static_cast<size_t>(n)) != 1) {
+            error = "SHA-256 update failed";
+            return false;
+        }
     }
-    return result;
 }
 
-bool computeFileHashes(const std::vector<std::string>& file_paths, std::map<std::string, std::string> &file_hashes, WorkResult &result) {
+std::string computeFileHash(const std::string &file_path, std::string &error) {
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return "";
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        error = "not a regular file";
+        close(fd);
+        return "";
+    }
 
-    // Check if shasum is available
-    if (system("which shasum > /dev/null 2>&1") != 0) {
-        result = WorkResult::Error("shasum command not found. Please install shasum utility.");
-        return false;
+    // EVP picks the SHA-NI / ARMv8 crypto extension implementation when the CPU has one
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    bool ok = ctx && EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) == 1;
+    if (!ok) {
+        error = "SHA-256 init failed";
     }
-    
-    // Process files in chunks to avoid command line length limits
-    const size_t chunk_size = 50;
-    for (size_t i = 0; i < file_paths.size(); i += chunk_size) {
-        auto start = file_paths.begin() + i;
-        auto end = (i + chunk_size <= file_paths.size()) ? start + chunk_size : file_paths.end();
-        
-        // Build the command
-        std::string cmd = "shasum -a 256 ";
-        for (auto it = start; it != end; ++it) {
-            // Escape special characters in file paths
-            std::string escaped_path = "\"" + *it + "\" ";
-            cmd += escaped_path;
-        }
-        
-        // Execute the command and get the output
-        std::string output;
-        try {
-            output = exec(cmd);
-        } catch (const std::exception& e) {
-            result = WorkResult::Error(std::string("Failed to execute shasum command: ") + e.what());
-            return false;
+    ok = ok && digestFile(fd, static_cast<size_t>(st.st_size), ctx.get(), error);
+    close(fd);
+    if (ok && EVP_DigestFinal_ex(ctx.get(), digest, &digest_size) != 1) {
+        error = "SHA-256 final failed";
+        ok = false;
+    }
+    if (!ok) {
+        return "";
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    std::string hash(digest_size * 2, '0');
+    for (unsigned int i = 0; i < digest_size; ++i) {
+        hash[2 * i] = hex[digest[i] >> 4];
+        hash[2 * i + 1] = hex[digest[i] & 0x0F];
+    }
+    return hash;
+}
+
+bool computeFileHashes(const std::vector<std::string>& file_paths, std::map<std::string, std::string> &file_hashes, WorkResult &result) {
+    std::vector<std::string> hashes(file_paths.size());
+    std::vector<std::string> errors(file_paths.size());
+
+    // One task per file on the shared pool
+    tldr::parallel_for(file_paths.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            hashes[i] = computeFileHash(file_paths[i], errors[i]);
         }
-        
-        // Parse the output
-        std::istringstream iss(output);
-        std::string line;
-        size_t current_idx = i;
-        
-        while (std::getline(iss, line) && current_idx < file_paths.size()) {
-            // Split the line into hash and filename
-            size_t space_pos = line.find(' ');
-            if (space_pos == std::string::npos) continue;
-            
-            std::string hash = line.substr(0, 64); // SHA-256 is 64 chars
-            std::string file_path = file_paths[current_idx];
-            
-            // Verify the hash is valid (64 hex chars)
-            if (hash.length() == 64 && 
-                std::all_of(hash.begin(), hash.end(), [](char c) {
-                    return std::isxdigit(static_cast<unsigned char>(c));
-                })) {
-                file_hashes[file_path] = hash;
-            } else {
-                result = WorkResult::Error("Invalid hash format for file: " + file_path);
-                return false;
-            }
-            
-            current_idx++;
+    });
+
+    size_t failed = 0;
+    for (size_t i = 0; i < file_paths.size(); ++i) {
+        if (hashes[i].empty()) {
+            std::cerr << "Warning: Could not hash " << file_paths[i] << ": " << errors[i] << std::endl;
+            ++failed;
+            continue;
         }
+        file_hashes[file_paths[i]] = hashes[i];
+    }
+
+    if (failed > 0 && failed == file_paths.size()) {
+        result = WorkResult::Error("Could not hash any of the " + std::to_string(failed) + " files");
+        return false;
     }
-    
     return true;
 }
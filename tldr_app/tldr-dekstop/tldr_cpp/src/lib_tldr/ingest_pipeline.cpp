@@ -0,0 +1,489 @@
+#include "ingest_pipeline.h"
+#include "lib_tldr.h"
+#include "constants.h"
+#include "task_pool.h"
+#include "token_chunker.h"
+#include "chunk_store.h"
+#include "llm/llm-wrapper.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <set>
+#include <filesystem>
+#include <unordered_map>
+#include <iomanip>
+#include <iostream>
+#include <functional>
+#include <condition_variable>
+
+namespace tldr {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t elapsed_ns(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+/**
+ * One stage of the pipeline: runs its work items as pool tasks, at most `slots`
+ * at a time. Items posted while every slot is taken wait in FIFO order and are
+ * started by the task that frees a slot, so nothing blocks a pool worker.
+ *
+ * The queue of a stage holds at most `capacity` items: a stage feeding another
+ * one only starts an item while the next stage's queue has room, and the next
+ * stage resumes it whenever it takes an item off its queue. Backpressure thus
+ * defers work instead of blocking the (pool) task that posts it. A started item
+ * may still post several items at once (the embedding batches of a document),
+ * so a queue can exceed its capacity by the output of one item per slot.
+ */
+class Stage {
+public:
+    Stage(const char *name, int slots, size_t capacity) : name_(name), slots_(slots), capacity_(capacity) {}
+
+    // Items of this stage post their output to next
+    void feeds(Stage &next) {
+        next_ = &next;
+        next.upstream_ = this;
+    }
+
+    void post(std::function<void()> work) {
+        bool started;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back({std::move(work), Clock::now()});
+            peak_queued_ = std::max(peak_queued_, pending_.size());
+            queued_ = pending_.size();
+            started = start_locked();
+        }
+        if (started && upstream_) {
+            upstream_->resume();
+        }
+    }
+
+    // Wait for the running tasks of the stage to return
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return running_ == 0; });
+    }
+
+    IngestStageStats stats(double wall_ms) const {
+        IngestStageStats stats;
+        stats.name = name_;
+        stats.workers = slots_;
+        stats.items = items_;
+        stats.peak_queued = peak_queued_;
+        stats.busy_ms = busy_ns_ / 1e6;
+        stats.queued_ms = queued_ns_ / 1e6;
+        stats.utilization = wall_ms > 0 && slots_ > 0 ? stats.busy_ms / (wall_ms * slots_) : 0;
+        return stats;
+    }
+
+private:
+    struct Item {
+        std::function<void()> work;
+        Clock::time_point posted;
+    };
+
+    // The queue of the next stage has room again: start the items held back for it
+    void resume() {
+        bool started;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            started = start_locked();
+        }
+        if (started && upstream_) {
+            upstream_->resume();
+        }
+    }
+
+    // Start pending items while a slot is free and the next stage has room; true if any was started.
+    // The next stage's queue length is read without its lock, so stages never lock each other while
+    // holding their own.
+    bool start_locked() {
+        bool started = false;
+        while (running_ < slots_ && !pending_.empty() && !(next_ && next_->queued_ >= next_->capacity_)) {
+            ++running_;
+            launch_locked();
+            started = true;
+        }
+        return started;
+    }
+
+    // Start the oldest pending item on the pool; the caller holds mutex_ and a slot
+    void launch_locked() {
+        Item item = std::move(pending_.front());
+        pending_.pop_front();
+        queued_ = pending_.size();
+        TaskPool::instance().submit([this, item = std::move(item)] {
+            queued_ns_ += elapsed_ns(item.posted);
+            const auto since = Clock::now();
+            try {
+                item.work();
+            } catch (const std::exception &e) {
+                std::cerr << "Ingest " << name_ << " task failed: " << e.what() << std::endl;
+            }
+            busy_ns_ += elapsed_ns(since);
+            ++items_;
+
+            bool started;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --running_;
+                started = start_locked();
+                if (running_ == 0) {
+                    idle_.notify_all();
+                }
+            }
+            if (started && upstream_) {
+                upstream_->resume();
+            }
+        });
+    }
+
+    const char *name_;
+    int slots_;
+    size_t capacity_;
+    Stage *next_ = nullptr;
+    Stage *upstream_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::deque<Item> pending_;
+    std::atomic<size_t> queued_{0}; // pending_.size(), read by the stage feeding this one
+    size_t peak_queued_ = 0;
+    int running_ = 0;
+    std::atomic<int64_t> busy_ns_{0};
+    std::atomic<int64_t> queued_ns_{0};
+    std::atomic<uint64_t> items_{0};
+};
+
+// A document on its way through the stages
+struct PendingDocument {
+    size_t index = 0; // In the input files
+    std::string path;
+    std::string file_hash;
+    DocumentData data;
+    std::vector<std::vector<float> > embeddings; // One slot per chunk, filled by the store or the embedding batches
+    std::vector<ChunkKey> keys; // Content hash of every chunk
+    std::vector<size_t> to_embed; // Chunks not seen before, embedded by the batches
+    std::vector<std::pair<size_t, size_t> > copies; // (chunk, earlier chunk of the document with the same text)
+    std::shared_ptr<ChunkEmbeddingStore> store; // nullptr if the corpus store cannot be opened
+    std::atomic<size_t> batches_left{0};
+    std::atomic<bool> failed{false};
+};
+
+using DocumentPtr = std::shared_ptr<PendingDocument>;
+
+class Pipeline {
+public:
+    Pipeline(const std::vector<std::pair<std::string, std::string> > &files, const std::string &corpus_root,
+             const IngestConfig &config)
+        : files_(files), corpus_root_(corpus_root), config_(config),
+          extract_("extract", config.extract_workers, config.documents_in_flight),
+          chunk_("chunk", config.chunk_workers, config.documents_in_flight),
+          embed_("embed", config.embed_workers, config.documents_in_flight),
+          persist_("persist", config.persist_workers, config.documents_in_flight) {
+        extract_.feeds(chunk_);
+        chunk_.feeds(embed_);
+        embed_.feeds(persist_);
+    }
+
+    IngestStats run() {
+        const auto start = Clock::now();
+        for (int i = 0; i < config_.documents_in_flight; ++i) {
+            admit_next();
+        }
+
+        std::unique_lock<std::mutex> lock(done_mutex_);
+        all_done_.wait(lock, [this] { return finished_ == files_.size(); });
+        lock.unlock();
+        // Tasks still return through their stage after the last document finished
+        for (Stage *stage: {&extract_, &chunk_, &embed_, &persist_}) {
+            stage->drain();
+        }
+        // The ANN index additions of the run are written once, not per document
+        std::set<std::string> roots;
+        for (size_t index: persisted_) {
+            roots.insert(root_of(translatePath(files_[index].first)));
+        }
+        for (const auto &root: roots) {
+            saveCorpusIndexes(root);
+        }
+
+        IngestStats stats;
+        stats.files = files_.size();
+        stats.failed = failed_;
+        stats.chunks = chunks_;
+        stats.embeddings_reused = reused_;
+        stats.wall_ms = elapsed_ns(start) / 1e6;
+        stats.last_error = last_error_;
+        stats.persisted = std::move(persisted_);
+        stats.stages = {extract_.stats(stats.wall_ms), chunk_.stats(stats.wall_ms),
+                        embed_.stats(stats.wall_ms), persist_.stats(stats.wall_ms)};
+        return stats;
+    }
+
+private:
+    // Start extracting the next file, if any is left
+    void admit_next() {
+        const size_t index = next_file_++;
+        if (index >= files_.size()) {
+            return;
+        }
+        extract_.post([this, index] { extract(index); });
+    }
+
+    // A document left the pipeline (persisted or failed): make room for the next file
+    void finish_document() {
+        admit_next();
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        if (++finished_ == files_.size()) {
+            all_done_.notify_all();
+        }
+    }
+
+    void fail(const std::string &path, const std::string &reason) {
+        std::cerr << "Error processing " << path << ": " << reason << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(results_mutex_);
+            ++failed_;
+            last_error_ = "Error processing " + path + ": " + reason;
+        }
+        finish_document();
+    }
+
+    // Corpus root a file is added to; without one, the directory holding the file (as saveDocumentToCorpus)
+    std::string root_of(const std::string &path) const {
+        return corpus_root_.empty() ? std::filesystem::path(path).parent_path().string() : corpus_root_;
+    }
+
+    void extract(size_t index) {
+        auto document = std::make_shared<PendingDocument>();
+        document->index = index;
+        document->path = translatePath(files_[index].first);
+        document->file_hash = files_[index].second;
+        std::cout << "Processing file: " << document->path << std::endl;
+        try {
+            document->data = extractDocumentDataFromPDF(document->path);
+        } catch (const std::exception &e) {
+            fail(document->path, e.what());
+            return;
+        }
+        if (document->data.pageEnds.empty()) {
+            fail(document->path, "No text extracted from PDF");
+            return;
+        }
+        chunk_.post([this, document] { chunk(document); });
+    }
+
+    void chunk(const DocumentPtr &document) {
+        const size_t batch_size = static_cast<size_t>(config_.embed_batch_size);
+        try {
+            // Sentences packed up to the embedding model's token budget, by characters when no model is loaded
+            LlmManager &llm = get_llm_manager();
+            const size_t token_budget = llm.chunk_token_budget();
+            if (token_budget > 0) {
+                split_into_token_chunks(document->data, [&llm](std::string_view text) {
+                    return llm.tokenize_for_embedding(text);
+                }, token_budget, EMBEDDING_CHUNK_OVERLAP_TOKENS);
+            } else {
+                splitTextIntoChunks(document->data, MAX_CHUNK_SIZE, CHUNK_N_OVERLAP);
+            }
+        } catch (const std::exception &e) {
+            fail(document->path, e.what());
+            return;
+        }
+
+        const size_t num_chunks = document->data.chunks.size();
+        std::cout << "Extracted " << document->data.pageCount() << " pages with "
+                << num_chunks << " chunks from " << document->path << std::endl;
+        if (num_chunks == 0) {
+            fail(document->path, "No chunks in the extracted text");
+            return;
+        }
+        chunks_ += num_chunks;
+        document->embeddings.resize(num_chunks);
+        deduplicate(*document);
+
+        const size_t num_new = document->to_embed.size();
+        if (num_new == 0) {
+            hand_off(document);
+            return;
+        }
+        document->batches_left = (num_new + batch_size - 1) / batch_size;
+        for (size_t begin = 0; begin < num_new; begin += batch_size) {
+            const size_t end = std::min(begin + batch_size, num_new);
+            embed_.post([this, document, begin, end] { embed(document, begin, end); });
+        }
+    }
+
+    // Take the embedding of every chunk whose text was seen before from the corpus store or
+    // from an earlier chunk of the document; only the others are left to embed
+    void deduplicate(PendingDocument &document) {
+        const DocumentData &data = document.data;
+        const size_t num_chunks = data.chunks.size();
+        document.keys.resize(num_chunks);
+        for (size_t i = 0; i < num_chunks; ++i) {
+            document.keys[i] = ChunkKey::of(data.chunk(i));
+        }
+        document.store = ChunkEmbeddingStore::open(root_of(document.path), get_llm_manager().embedding_model_id(),
+                                                   EMBEDDING_SIZE_INT);
+
+        std::unordered_map<ChunkKey, size_t, ChunkKeyHash> first_seen;
+        first_seen.reserve(num_chunks);
+        size_t reused = 0;
+        for (size_t i = 0; i < num_chunks; ++i) {
+            auto [it, inserted] = first_seen.emplace(document.keys[i], i);
+            if (!inserted) {
+                document.copies.emplace_back(i, it->second);
+                ++reused;
+            } else if (document.store && document.store->lookup(document.keys[i], document.embeddings[i])) {
+                ++reused;
+            } else {
+                document.to_embed.push_back(i);
+            }
+        }
+        reused_ += reused;
+    }
+
+    // Embed the chunks to_embed[begin, end)
+    void embed(const DocumentPtr &document, size_t begin, size_t end) {
+        if (!document->failed) {
+            const DocumentData &data = document->data;
+            const std::vector<size_t> &chunks = document->to_embed;
+            try {
+                std::vector<std::vector<float> > embeddings;
+                if (data.chunkTokens.empty()) {
+                    std::vector<std::string_view> texts;
+                    texts.reserve(end - begin);
+                    for (size_t i = begin; i < end; ++i) {
+                        texts.push_back(data.chunk(chunks[i]));
+                    }
+                    embeddings = get_llm_manager().get_document_embeddings(texts);
+                } else {
+                    // Token ids from the chunker, not tokenized again
+                    std::vector<std::span<const int32_t> > tokens;
+                    tokens.reserve(end - begin);
+                    for (size_t i = begin; i < end; ++i) {
+                        tokens.push_back(data.chunkTokenIds(chunks[i]));
+                    }
+                    embeddings = get_llm_manager().get_document_embeddings(tokens);
+                }
+                if (embeddings.size() == end - begin) {
+                    if (document->store) {
+                        std::vector<ChunkKey> batch_keys;
+                        batch_keys.reserve(end - begin);
+                        for (size_t i = begin; i < end; ++i) {
+                            batch_keys.push_back(document->keys[chunks[i]]);
+                        }
+                        document->store->insert(batch_keys, embeddings);
+                    }
+                    for (size_t i = begin; i < end; ++i) {
+                        document->embeddings[chunks[i]] = std::move(embeddings[i - begin]);
+                    }
+                } else {
+                    document->failed = true;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Error embedding chunks of " << document->path << ": " << e.what() << std::endl;
+                document->failed = true;
+            }
+        }
+
+        // The last batch of the document hands it on
+        if (--document->batches_left == 0) {
+            hand_off(document);
+        }
+    }
+
+    // Every chunk has its embedding (or the document failed): fill in the repeated chunks and persist
+    void hand_off(const DocumentPtr &document) {
+        if (document->failed) {
+            fail(document->path, "Failed to embed all chunks");
+            return;
+        }
+        for (const auto &[chunk, original]: document->copies) {
+            document->embeddings[chunk] = document->embeddings[original];
+        }
+        persist_.post([this, document] { persist(document); });
+    }
+
+    void persist(const DocumentPtr &document) {
+        if (!saveDocumentToCorpus(document->path, document->file_hash, corpus_root_, document->data,
+                                  document->embeddings)) {
+            fail(document->path, "Failed to save the document");
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(results_mutex_);
+            persisted_.push_back(document->index);
+        }
+        finish_document();
+    }
+
+    const std::vector<std::pair<std::string, std::string> > &files_;
+    std::string corpus_root_;
+    IngestConfig config_;
+
+    Stage extract_, chunk_, embed_, persist_;
+
+    std::atomic<size_t> next_file_{0};
+    std::atomic<size_t> chunks_{0};
+    std::atomic<size_t> reused_{0};
+    std::mutex results_mutex_;
+    size_t failed_ = 0;
+    std::string last_error_;
+    std::vector<size_t> persisted_;
+
+    std::mutex done_mutex_;
+    std::condition_variable all_done_;
+    size_t finished_ = 0;
+};
+
+} // namespace
+
+IngestConfig resolve_ingest_config(const IngestConfig &config) {
+    auto or_default = [](int value, int fallback) { return value > 0 ? value : fallback; };
+    IngestConfig resolved;
+    resolved.extract_workers = or_default(config.extract_workers, INGEST_EXTRACT_WORKERS);
+    resolved.chunk_workers = or_default(config.chunk_workers, INGEST_CHUNK_WORKERS);
+    resolved.embed_workers = or_default(config.embed_workers, INGEST_EMBED_WORKERS);
+    resolved.persist_workers = or_default(config.persist_workers, INGEST_PERSIST_WORKERS);
+    resolved.embed_batch_size = or_default(config.embed_batch_size, INGEST_EMBED_BATCH_SIZE);
+    resolved.documents_in_flight = or_default(config.documents_in_flight, INGEST_DOCUMENTS_IN_FLIGHT);
+    return resolved;
+}
+
+IngestStats run_ingest_pipeline(const std::vector<std::pair<std::string, std::string> > &files,
+                                const std::string &corpus_root, const IngestConfig &config) {
+    const IngestConfig resolved = resolve_ingest_config(config);
+    std::cout << "Ingesting " << files.size() << " files on " << TaskPool::instance().concurrency()
+            << " pool threads with up to " << resolved.extract_workers << " extract, " << resolved.chunk_workers
+            << " chunk, " << resolved.embed_workers << " embed and " << resolved.persist_workers
+            << " persist tasks" << std::endl;
+    if (files.empty()) {
+        return {};
+    }
+    return Pipeline(files, corpus_root, resolved).run();
+}
+
+void print_ingest_stats(const IngestStats &stats) {
+    std::cout << std::fixed << std::setprecision(1)
+            << "Ingested " << stats.files << " files (" << stats.failed << " failed, " << stats.chunks
+            << " chunks, " << stats.embeddings_reused << " embeddings reused) in " << stats.wall_ms / 1000 << "s" << std::endl;
+    std::cout << "  " << std::left << std::setw(8) << "stage" << std::right << std::setw(8) << "workers"
+            << std::setw(8) << "items" << std::setw(8) << "peak q" << std::setw(12) << "busy ms"
+            << std::setw(12) << "queued ms" << std::setw(7) << "util" << std::endl;
+    for (const auto &stage: stats.stages) {
+        std::cout << "  " << std::left << std::setw(8) << stage.name << std::right << std::setw(8) << stage.workers
+                << std::setw(8) << stage.items << std::setw(8) << stage.peak_queued << std::setw(12) << stage.busy_ms
+                << std::setw(12) << stage.queued_ms << std::setw(6) << stage.utilization * 100 << "%" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+} // namespace tldr
@@ -0,0 +1,65 @@
+#ifndef TLDR_CPP_INGEST_PIPELINE_H
+#define TLDR_CPP_INGEST_PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "definitions.h"
+
+namespace tldr {
+
+// Time split of the tasks of one stage over a pipeline run
+struct IngestStageStats {
+    std::string name;
+    int workers = 0; // Tasks of the stage allowed to run at once
+    uint64_t items = 0;
+    size_t peak_queued = 0; // Longest the stage's queue got
+    double busy_ms = 0; // Running tasks
+    double queued_ms = 0; // Tasks waiting for one of the stage's slots, or for room in the next stage's queue
+    double utilization = 0; // busy_ms / (wall_ms * workers)
+};
+
+struct IngestStats {
+    size_t files = 0;
+    size_t failed = 0;
+    size_t chunks = 0;
+    size_t embeddings_reused = 0; // Chunks not embedded: same text as a chunk in the corpus chunk store or earlier in the document
+    double wall_ms = 0;
+    std::string last_error;
+    std::vector<size_t> persisted; // Indexes into the input files of the documents saved, in completion order
+    std::vector<IngestStageStats> stages; // extract, chunk, embed, persist
+};
+
+// config with every unset (0) field replaced by its INGEST_* default
+IngestConfig resolve_ingest_config(const IngestConfig &config);
+
+/**
+ * Ingest (file path, file hash) pairs through a staged pipeline:
+ *
+ *   extract (poppler) -> chunk -> embed (batches) -> persist (DB, vecdump, docstore, indexes)
+ *
+ * A chunk whose text is already in the corpus's ChunkEmbeddingStore, or occurs
+ * earlier in the same document, takes that embedding instead of being embedded
+ * again; newly embedded chunks are added to the store.
+ *
+ * Every step is a task of the shared TaskPool: one per file for extraction,
+ * chunking and persistence, one per embedding batch, so the batches of a large
+ * document spread over the pool instead of pinning a thread. Each stage lets
+ * at most its configured number of tasks run at once and queues the rest, so
+ * poppler, the embedding contexts and the database are busy at the same time
+ * within the pool's CPU budget. Every queue is bounded by documents_in_flight
+ * items: a stage holds back its next task while the queue it feeds is full
+ * (backpressure without blocking a pool thread). A new file is only extracted
+ * while fewer than documents_in_flight documents are between extraction and
+ * persistence, which bounds memory. A file failing in any stage is counted and logged, the
+ * others go on. Call it from outside the pool: it blocks until every file is done.
+ */
+IngestStats run_ingest_pipeline(const std::vector<std::pair<std::string, std::string> > &files,
+                                const std::string &corpus_root, const IngestConfig &config);
+
+// Per-stage utilization table of a run on stdout
+void print_ingest_stats(const IngestStats &stats);
+
+} // namespace tldr
+
+#endif // TLDR_CPP_INGEST_PIPELINE_H
@@ -34,6 +34,18 @@
 #include<set>
 #include <openssl/md5.h> // Include for MD5 hashing
 #include "lib_tldr.h"
+#include "search/segmented_index.h"
+#include "search/hnsw_index.h"
+#include "search/ivfpq_index.h"
+#include "search/cpu_similarity.h"
+#include "search/search_filter.h"
+#include "search/lexical_index.h"
+#include "search/dump_cache.h"
+#include "answer_cache.h"
+#include "ingest_pipeline.h"
+#include "corpus_manifest.h"
+#include "chunk_store.h"
+#include "task_pool.h"
 
 // Helper function to extract content from XML tags
 std::string extract_xml_content(const std::string &xml) {
@@ -59,22 +71,15 @@ std::unique_ptr<tldr::Database> g_db;
 // Global mutex for thread synchronization
 // std::mutex g_mutex;
 #endif
-PdfMetadata getPdfMetadata(const std::string &filename) {
+// Metadata of an open document
+static PdfMetadata readPdfMetadata(const poppler::document &doc) {
     PdfMetadata metadata;
-    std::string expanded_path = translatePath(filename);
-    auto doc = std::unique_ptr<poppler::document>(poppler::document::load_from_file(expanded_path));
-
-    if (!doc) {
-        std::cerr << "Error opening PDF file at path: " << expanded_path << std::endl;
-        metadata.pageCount = -1; // Indicate error with page count -1
-        return metadata;
-    }
 
     // Get page count
-    metadata.pageCount = doc->pages();
+    metadata.pageCount = doc.pages();
 
     // Extract metadata fields
-    poppler::ustring metadata_ustr = doc->metadata();
+    poppler::ustring metadata_ustr = doc.metadata();
     if (!metadata_ustr.empty()) {
         std::string metadata_str = metadata_ustr.to_latin1();
         std::istringstream meta_stream(metadata_str);
@@ -103,6 +108,19 @@ PdfMetadata getPdfMetadata(const std::string &filename) {
     return metadata;
 }
 
+PdfMetadata getPdfMetadata(const std::string &filename) {
+    std::string expanded_path = translatePath(filename);
+    auto doc = std::unique_ptr<poppler::document>(poppler::document::load_from_file(expanded_path));
+
+    if (!doc) {
+        std::cerr << "Error opening PDF file at path: " << expanded_path << std::endl;
+        PdfMetadata metadata;
+        metadata.pageCount = -1; // Indicate error with page count -1
+        return metadata;
+    }
+    return readPdfMetadata(*doc);
+}
+
 std::string translatePath(const std::string &path) {
     std::string result = path;
 
@@ -144,6 +162,41 @@ int calc_batch_chars(const std::vector<std::string_view> &batch) {
     return total_length;
 }
 
+// Text of one page, empty for unreadable pages
+static std::string extractPageText(const poppler::document &doc, int index) {
+    auto page = std::unique_ptr<poppler::page>(doc.create_page(index));
+    if (!page) {
+        return "";
+    }
+    std::string page_text;
+    poppler::byte_array utf8_data = page->text().to_utf8();
+
+    // Only keep ASCII characters for now
+    page_text.reserve(utf8_data.size());
+    for (unsigned char c: utf8_data) {
+        if (c < 128) {
+            // ASCII range
+            page_text += c;
+        }
+    }
+    return page_text;
+}
+
+// Move the page texts into the single text buffer of the document, freeing each page as it is copied
+static void assemblePageTexts(DocumentData &docData, std::vector<std::string> &pageTexts) {
+    size_t total = 0;
+    for (const auto &pageText: pageTexts) {
+        total += pageText.size();
+    }
+    docData.text.reserve(total);
+    docData.pageEnds.reserve(pageTexts.size());
+    for (auto &pageText: pageTexts) {
+        docData.text += pageText;
+        docData.pageEnds.push_back(docData.text.size());
+        std::string().swap(pageText);
+    }
+}
+
 // Extract document data including metadata and page texts from a PDF file
 DocumentData extractDocumentDataFromPDF(const std::string &filename) {
     DocumentData docData;
@@ -157,35 +210,41 @@ DocumentData extractDocumentDataFromPDF(const std::string &filename) {
         return docData;
     }
 
-    // Get metadata
-    docData.metadata = getPdfMetadata(filename);
-
-    // Pre-allocate space for page texts
-    int pageCount = doc->pages();
-    docData.pageTexts.reserve(pageCount);
+    // Metadata comes from the same load as the text
+    docData.metadata = readPdfMetadata(*doc);
+    int pageCount = docData.metadata.pageCount;
+    std::vector<std::string> pageTexts(pageCount);
 
-    // Extract text from each page
-    for (int i = 0; i < pageCount; ++i) {
-        auto page = std::unique_ptr<poppler::page>(doc->create_page(i));
-        if (page) {
-            std::string page_text;
-            poppler::byte_array utf8_data = page->text().to_utf8();
+    if (pageCount < PDF_PARALLEL_MIN_PAGES) {
+        for (int i = 0; i < pageCount; ++i) {
+            pageTexts[i] = extractPageText(*doc, i);
+        }
+        assemblePageTexts(docData, pageTexts);
+        return docData;
+    }
 
-            // Only keep ASCII characters for now
-            page_text.reserve(utf8_data.size());
-            for (unsigned char c: utf8_data) {
-                if (c < 128) {
-                    // ASCII range
-                    page_text += c;
-                }
+    // Large documents: one page range per pool thread. A poppler document is not safe to share
+    // between threads, so every range but the first (which reuses doc) loads its own.
+    size_t ranges = std::max<size_t>(1, tldr::TaskPool::instance().concurrency());
+    size_t pagesPerRange = std::max<size_t>(PDF_PARALLEL_MIN_PAGES / 2, (pageCount + ranges - 1) / ranges);
+    tldr::parallel_for(pageCount, pagesPerRange, [&](size_t begin, size_t end) {
+        std::unique_ptr<poppler::document> own;
+        const poppler::document *rangeDoc = doc.get();
+        if (begin != 0) {
+            own.reset(poppler::document::load_from_file(expanded_path));
+            if (!own) {
+                std::cerr << "Error opening PDF file at path: " << expanded_path << " for pages " << begin + 1
+                        << "-" << end << std::endl;
+                return; // Those pages stay empty
             }
-
-            docData.pageTexts.push_back(page_text);
-        } else {
-            docData.pageTexts.push_back(""); // Push empty string for unreadable pages
+            rangeDoc = own.get();
         }
-    }
+        for (size_t i = begin; i < end; ++i) {
+            pageTexts[i] = extractPageText(*rangeDoc, static_cast<int>(i));
+        }
+    });
 
+    assemblePageTexts(docData, pageTexts);
     return docData;
 }
 
@@ -195,9 +254,11 @@ std::string extractTextFromPDF(const std::string &filename) {
     std::string fullText;
 
     // Concatenate all page texts with delimiters
-    for (const auto &pageText: docData.pageTexts) {
+    for (size_t i = 0; i < docData.pageCount(); ++i) {
+        std::string_view pageText = docData.page(i);
         if (!pageText.empty()) {
-            fullText += pageText + PAGE_DELIMITER;
+            fullText.append(pageText);
+            fullText += PAGE_DELIMITER;
         }
     }
 
@@ -205,25 +266,17 @@ std::string extractTextFromPDF(const std::string &filename) {
 }
 
 
-// Split document text into chunks with page tracking
+// Split document text into chunks with page tracking; chunks are spans of docData.text, nothing is copied
 void splitTextIntoChunks(DocumentData &docData, size_t max_chunk_size, size_t overlap) {
     // Clear any existing chunks
     docData.chunks.clear();
-    docData.chunkPageNums.clear();
-
-    // Concatenate all page texts with delimiters
-    std::string fullText;
-    std::vector<size_t> pageBoundaries;
-    size_t current_pos = 0;
 
-    for (const auto &pageText: docData.pageTexts) {
-        fullText += pageText;
-        current_pos += pageText.length();
-        pageBoundaries.push_back(current_pos);
+    const std::vector<size_t> &pageBoundaries = docData.pageEnds;
+    const size_t text_len = docData.text.length();
+    if (max_chunk_size > overlap) {
+        docData.chunks.reserve(text_len / (max_chunk_size - overlap) + 1);
     }
 
-    const size_t text_len = fullText.length();
-
     size_t pos = 0;
     size_t currentPage = 0;
 
@@ -237,9 +290,8 @@ void splitTextIntoChunks(DocumentData &docData, size_t max_chunk_size, size_t ov
         }
 
         // Add the chunk
-        int num_chars = chunk_end - pos;
-        docData.chunks.push_back(fullText.substr(pos, num_chars));
-        docData.chunkPageNums.push_back(currentPage + 1); // 1-based page numbers
+        size_t num_chars = chunk_end - pos;
+        docData.chunks.push_back({pos, num_chars, static_cast<int>(currentPage + 1)}); // 1-based page numbers
 
         // Move position for next chunk, accounting for overlap
         pos = num_chars > overlap ? chunk_end - overlap : chunk_end;
@@ -461,6 +513,13 @@ void cleanupSystem() {
     // Clean up the LLM manager
     tldr::get_llm_manager().cleanup();
 
+    // Stop index compaction and release the mapped segments and graphs
+    tldr::HnswIndex::close_all();
+    tldr::IvfPqIndex::close_all();
+    tldr::SegmentedIndex::close_all();
+    tldr::DumpMappingCache::instance().clear();
+    tldr::ChunkEmbeddingStore::close_all();
+
     std::cout << "System cleaned up." << std::endl;
 }
 
@@ -468,139 +527,17 @@ void cleanupSystem() {
 
 // Function declarations moved to the top of the file
 
-// Process a block of batches for embedding generation
-void processBatchBlocks(
-    size_t thread_id,
-    size_t start_batch,
-    size_t end_batch,
-    const std::vector<std::string> &chunks,
-    const std::vector<int> &chunkPageNums,
-    const std::string &fileHash,
-    size_t batch_size,
-    std::vector<std::vector<float> > &all_embeddings,
-    std::vector<uint64_t> &all_hashes,
-    std::mutex &result_mutex
-) {
-    // Thread-local vectors to store results
-    std::vector<std::vector<float> > local_embeddings;
-    std::vector<uint64_t> local_hashes;
-
-    std::cout << "Thread " << thread_id << " started, processing batches from "
-            << start_batch << " to " << end_batch << std::endl;
-
-    // Calculate actual chunk indices from batch numbers
-    size_t start_chunk = start_batch * batch_size;
-    size_t end_chunk = std::min(end_batch * batch_size, chunks.size());
-
-    // Process all chunks assigned to this thread
-    for (size_t chunk_idx = start_chunk; chunk_idx < end_chunk; chunk_idx += batch_size) {
-        // Calculate the end of this batch
-        size_t batch_end = std::min(chunk_idx + batch_size, chunks.size());
-
-        // Create a vector of string_view for the current batch
-        std::vector<std::string_view> batch_chunks(
-            chunks.begin() + chunk_idx,
-            chunks.begin() + batch_end
-        );
-
-        // Get the page numbers for this batch
-        std::vector<int> batch_page_nums(
-            chunkPageNums.begin() + chunk_idx,
-            chunkPageNums.begin() + batch_end);
-
-        // std::cout << "Thread " << thread_id << " processing chunks: " << chunk_idx
-        //           << "-" << batch_end << std::endl;
-
-        // Get embeddings for this batch
-        std::vector<std::vector<float> > batch_emb = tldr::get_llm_manager().get_embeddings(batch_chunks);
-
-        // Compute hashes for these embeddings
-        std::vector<uint64_t> batch_hashes = computeEmbeddingHashes(batch_emb);
-
-        // Save to DB
-        saveEmbeddingsThreadSafe(batch_chunks, batch_emb, batch_hashes, batch_page_nums, fileHash);
-
-        // Append to thread-local vectors
-        local_embeddings.insert(local_embeddings.end(), batch_emb.begin(), batch_emb.end());
-        local_hashes.insert(local_hashes.end(), batch_hashes.begin(), batch_hashes.end());
-    }
-
-    // Merge results into the global vectors using mutex for thread safety
-    std::lock_guard<std::mutex> lock(result_mutex);
-    all_embeddings.insert(all_embeddings.end(),
-                          local_embeddings.begin(),
-                          local_embeddings.end());
-    all_hashes.insert(all_hashes.end(),
-                      local_hashes.begin(),
-                      local_hashes.end());
-}
-
-std::pair<std::vector<std::vector<float> >, std::vector<uint64_t> >
-obtainEmbeddings(const std::vector<std::string> &chunks,
-                 const std::vector<int> &chunkPageNums,
-                 const std::string &fileHash,
-                 size_t batch_size, size_t num_threads) {
-    const size_t total_batches = (chunks.size() + batch_size - 1) / batch_size;
-    std::cout << "Processing " << chunks.size() << " chunks in " << total_batches
-            << " batches using " << num_threads << " threads\n";
-
-    // We'll collect all embeddings and hashes
-    std::vector<std::vector<float> > all_embeddings;
-    std::vector<uint64_t> all_hashes;
-    all_embeddings.reserve(chunks.size());
-    all_hashes.reserve(chunks.size());
-
-    // Mutex for thread synchronization when merging results
-    std::mutex result_mutex;
-
-    try {
-        // Calculate how many batches each thread should process
-        size_t batches_per_thread = (total_batches + num_threads - 1) / num_threads;
-
-        // Vector to hold all thread objects
-        std::vector<std::thread> threads;
-
-        // Create and start threads
-        for (size_t t = 0; t < num_threads; ++t) {
-            size_t start_batch = t * batches_per_thread;
-            size_t end_batch = std::min((t + 1) * batches_per_thread, total_batches);
-
-            // Only create a thread if there's work to do
-            if (start_batch < total_batches) {
-                threads.emplace_back(processBatchBlocks, t, start_batch, end_batch,
-                                     std::ref(chunks), std::ref(chunkPageNums), std::ref(fileHash),
-                                     batch_size, std::ref(all_embeddings), std::ref(all_hashes),
-                                     std::ref(result_mutex));
-            }
-        }
-
-        // Wait for all threads to complete
-        for (auto &thread: threads) {
-            if (thread.joinable()) {
-                thread.join();
-            }
-        }
-
-        std::cout << "Completed processing all chunks. Total embeddings: "
-                << all_embeddings.size() << ", total hashes: "
-                << all_hashes.size() << std::endl;
-    } catch (const std::exception &e) {
-        std::cerr << "Error processing chunks: " << e.what() << std::endl;
-        throw; // Re-throw to allow proper cleanup
-    }
-    return {all_embeddings, all_hashes};
-}
-
-bool addFileToCorpus(const std::string &sourcePath, const std::string &fileHash) {
-    std::cout << "Processing file: " << sourcePath << std::endl;
-    auto start = std::chrono::high_resolution_clock::now();
+bool saveDocumentToCorpus(const std::string &filePath, const std::string &fileHash, const std::string &corpusRoot,
+                          const DocumentData &docData, const std::vector<std::vector<float> > &embeddings) {
     try {
-        std::string expanded_path = translatePath(sourcePath);
+        std::string expanded_path = translatePath(filePath);
+        std::string corpus_root = corpusRoot.empty()
+                                      ? std::filesystem::path(expanded_path).parent_path().string()
+                                      : corpusRoot;
 
-        // Extract document data and metadata
-        DocumentData docData = extractDocumentDataFromPDF(expanded_path);
-        if (docData.pageTexts.empty()) {
-            std::cerr << "Error: No text extracted from PDF." << std::endl;
+        if (embeddings.size() != docData.chunks.size()) {
+            std::cerr << "Error: Mismatch between number of chunks (" << docData.chunks.size()
+                    << ") and embeddings (" << embeddings.size() << ")" << std::endl;
             return false;
         }
 
@@ -616,42 +553,103 @@ bool addFileToCorpus(const std::string &sourcePath, const std::string &fileHash)
             // Continue anyway, as we'll try to add new embeddings
         }
 
-        // Split into chunks with page tracking
-        splitTextIntoChunks(docData, MAX_CHUNK_SIZE, CHUNK_N_OVERLAP);
+        std::vector<uint64_t> hashes = computeEmbeddingHashes(embeddings);
+
+        // Database rows in batches of BATCH_SIZE chunks
+        for (size_t begin = 0; begin < docData.chunks.size(); begin += BATCH_SIZE) {
+            const size_t end = std::min(begin + BATCH_SIZE, docData.chunks.size());
+            std::vector<std::string_view> batch = docData.chunkViews(begin, end);
+            std::vector<std::vector<float> > batch_embeddings(embeddings.begin() + begin, embeddings.begin() + end);
+            std::vector<uint64_t> batch_hashes(hashes.begin() + begin, hashes.begin() + end);
+            std::vector<int> batch_page_nums;
+            batch_page_nums.reserve(end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                batch_page_nums.push_back(docData.chunks[i].page);
+            }
+            saveEmbeddingsThreadSafe(batch, batch_embeddings, batch_hashes, batch_page_nums, fileHash);
+        }
 
-        // Print text length and chunk info
-        std::cout << "Extracted " << docData.pageTexts.size() << " pages with "
-                << docData.chunks.size() << " chunks" << std::endl;
+        // A document already in the corpus index (a dump or a merged segment) keeps its vectors
+        // there; a second dump and second HNSW/IVF-PQ entries would only duplicate them
+        auto corpus_index = tldr::SegmentedIndex::open(corpus_root);
+        if (corpus_index && corpus_index->contains_file(fileHash)) {
+            std::cout << "Vectors of " << fileHash << " are already part of the corpus index" << std::endl;
+        } else if (!tldr::dump_vectors_to_file(expanded_path, embeddings, hashes, fileHash)) {
+            // Searches only read the dumps; the file stays unrecorded so the next run retries it
+            std::cerr << "Error: Failed to save vector dump file for " << expanded_path << std::endl;
+            return false;
+        } else {
+            // Chunk text and metadata next to the dump, so queries hydrate results without the database
+            std::string dump_path = tldr::vector_dump_path_for(expanded_path, fileHash);
+            tldr::DocstoreDocument document{fileHash, expanded_path,
+                                            std::filesystem::path(expanded_path).filename().string(),
+                                            docData.metadata.title, docData.metadata.author,
+                                            docData.metadata.pageCount};
+            if (!tldr::write_docstore(tldr::docstore_path_for(dump_path), {document}, hashes.size(),
+                                      [&](size_t row) {
+                                          return tldr::DocstoreChunk{hashes[row], docData.chunk(row),
+                                                                     docData.chunks[row].page, 0};
+                                      })) {
+                std::cerr << "Warning: Failed to save docstore, chunks will be read from the database" << std::endl;
+            }
 
-        // Get embeddings and their hashes, and save them directly in the worker threads
-        auto [embeddings, hashes] = obtainEmbeddings(
-            docData.chunks, docData.chunkPageNums, fileHash,BATCH_SIZE, EMB_PROC_NUM_THREADS);
+            // Add the vectors to the graph index before the dump becomes part of the
+            // corpus, as a newly created graph is populated from the corpus index; saved by saveCorpusIndexes
+            if (auto hnsw = tldr::HnswIndex::open(corpus_root, EMBEDDING_SIZE_INT, HNSW_BUILD_ON_INGEST)) {
+                for (size_t i = 0; i < embeddings.size(); ++i) {
+                    hnsw->insert(embeddings[i].data(), hashes[i]);
+                }
+            }
 
-        // The embeddings are now saved in the database by obtainEmbeddings
-        // We just need to verify that we got the expected number of embeddings
-        if (embeddings.size() != docData.chunks.size()) {
-            std::cerr << "Error: Mismatch between number of chunks (" << docData.chunks.size()
-                    << ") and embeddings (" << embeddings.size() << ")" << std::endl;
-            return false;
-        }
+            // BM25 postings of the chunks, replacing those of an earlier version of the file
+            if (auto lexical = tldr::LexicalIndex::open(corpus_root)) {
+                lexical->add_file(fileHash, docData.chunkViews(0, docData.chunks.size()), hashes);
+            }
 
-        // Dump vectors and hashes to file for memory mapping
-        if (!tldr::dump_vectors_to_file(expanded_path, embeddings, hashes, fileHash)) {
-            // Even if file dump fails, we still have the data in the database
-            std::cerr << "Warning: Failed to save vector dump file, but data is saved in database" << std::endl;
+            // A trained IVF-PQ index only needs the new vectors encoded; saved by saveCorpusIndexes
+            if (auto ivfpq = tldr::IvfPqIndex::open(corpus_root, EMBEDDING_SIZE_INT, false)) {
+                std::vector<float> flat;
+                flat.reserve(embeddings.size() * EMBEDDING_SIZE_INT);
+                for (const auto &embedding: embeddings) {
+                    flat.insert(flat.end(), embedding.begin(), embedding.end());
+                }
+                ivfpq->add(flat.data(), hashes.data(), hashes.size(), fileHash);
+            }
+
+            // Make the new vectors visible to queries without a directory walk
+            if (!corpus_index || !corpus_index->register_dump(dump_path, fileHash)) {
+                std::cerr << "Error: Failed to add " << dump_path << " to the corpus index" << std::endl;
+                return false;
+            }
         }
 
+        // Answers built from an earlier version of the file (same path, possibly another hash) are stale
+        tldr::AnswerCache::instance().invalidate_document(fileHash, expanded_path);
+
         std::cout << "Document added to corpus successfully." << std::endl;
-        auto end = std::chrono::high_resolution_clock::now();
-        std::cout << " Took " << (end - start).count()/1000000000.0 << "s for file " << sourcePath << std::endl;
         return true;
     } catch (const std::exception &e) {
-        std::cerr << "Error processing " << sourcePath << ": " << e.what() << std::endl;
+        std::cerr << "Error saving " << filePath << ": " << e.what() << std::endl;
     }
     return false;
 }
 
+void saveCorpusIndexes(const std::string &corpusRoot) {
+    if (auto hnsw = tldr::HnswIndex::open(corpusRoot, EMBEDDING_SIZE_INT, false)) {
+        hnsw->save();
+    }
+    if (auto ivfpq = tldr::IvfPqIndex::open(corpusRoot, EMBEDDING_SIZE_INT, false)) {
+        ivfpq->save();
+    }
+}
+
+bool addFileToCorpus(const std::string &sourcePath, const std::string &fileHash, const std::string &corpusRoot) {
+    tldr::IngestStats stats = tldr::run_ingest_pipeline({{sourcePath, fileHash}}, corpusRoot, {});
+    return stats.failed == 0 && stats.files == 1;
+}
+
 bool deleteFileEmbeddingsFromDB(const std::string &fileHash) {
+    tldr::AnswerCache::instance().invalidate_document(fileHash);
     if (g_db) {
         return g_db->deleteEmbeddings(fileHash);
     }
@@ -729,31 +727,18 @@ bool getFilesToBeEmbedded(const std::string &sourcePath, std::vector<std::string
         searchPath = sourcePath;
     }
 
-    // Find all existing vecdump files in the search directory
-    std::vector<std::string> existingVecdumps;
-    if (std::filesystem::exists(searchPath) && std::filesystem::is_directory(searchPath)) {
-        findFilesOfTypeRecursively(searchPath, existingVecdumps, ".vecdump");
-        std::cout << "Found " << existingVecdumps.size() << " existing vecdump files in " << searchPath.string() <<
-                std::endl;
-    }
-
-    // Create a set of existing vecdump hashes for faster lookup
-    std::unordered_set<std::string> existingHashes;
-    for (const auto &vecdumpPath: existingVecdumps) {
-        // Extract the hash from the filename (remove path and extension)
-        std::filesystem::path path(vecdumpPath);
-        std::string filename = path.filename().string();
-        // Remove the .vecdump extension
-        std::string hash = filename.substr(0, filename.length() - 8); // Remove ".vecdump"
-        existingHashes.insert(hash);
+    // The corpus index knows every document whose vectors are in a dump or a merged segment
+    std::shared_ptr<tldr::SegmentedIndex> index;
+    if (std::filesystem::is_directory(searchPath)) {
+        index = tldr::SegmentedIndex::open(searchPath.string());
     }
 
     // Process files and check if their hashes already exist
     for (const auto &file: filesToProcess) {
         auto it = fileHashes.find(file);
         if (it != fileHashes.end()) {
-            // Check if this hash already exists in the set of vecdump hashes
-            if (existingHashes.find(it->second) != existingHashes.end()) {
+            // Check if this hash is already part of the corpus index
+            if (index && index->contains_file(it->second)) {
                 std::cout << "Skipping (vecdump exists) for : " << file << " - " << it->second << std::endl;
             } else {
                 filesWithHashes.emplace_back(file, it->second);
@@ -775,82 +760,7 @@ bool getFilesToBeEmbedded(const std::string &sourcePath, std::vector<std::string
     return true;
 }
 
-bool addFilesToCorpusSequential(std::vector<std::pair<std::string, std::string> > filesWithHashes, WorkResult &value1) {
-    try {
-        for (const auto &[filePath, fileHash]: filesWithHashes) {
-            addFileToCorpus(filePath, fileHash);
-        }
-    } catch (const std::exception &e) {
-        std::cerr << "Error in addFilesToCorpusSequence()" << std::endl;
-        value1 = WorkResult{true, e.what(), ""};
-        return false;
-    }
-    value1 = WorkResult{false, "", ""};
-    return true;
-}
-
-bool addFilesToCorpus(std::vector<std::pair<std::string, std::string> > filesWithHashes, WorkResult &value1) {
-    // Determine number of threads to use
-    const size_t numThreads = std::min(filesWithHashes.size(), static_cast<size_t>(ADD_CORPUS_N_THREADS));
-
-    std::cout << "Using " << numThreads << " threads for processing " << filesWithHashes.size() << " files" <<
-            std::endl;
-    // Process files in parallel
-    std::vector<std::thread> threads;
-    std::atomic<bool> has_errors{false};
-    std::string last_error;
-
-    // Split work among threads
-    const size_t filesPerThread = (filesWithHashes.size() + numThreads - 1) / numThreads;
-
-    for (size_t i = 0; i < numThreads; ++i) {
-        const size_t start = i * filesPerThread;
-        if (start >= filesWithHashes.size()) break;
-
-        const size_t end = std::min(start + filesPerThread, filesWithHashes.size());
-
-        threads.emplace_back([&filesWithHashes, start, end, &has_errors, &last_error]() {
-            try {
-                for (size_t j = start; j < end; ++j) {
-                    // if (has_errors) break; // Early exit if another thread failed
-
-                    const auto &[filePath, fileHash] = filesWithHashes[j];
-
-                    try {
-                        // Process the file
-                        addFileToCorpus(filePath, fileHash);
-
-                        // Print progress
-                        std::cout << "Processed: " << filePath << std::endl;
-                    } catch (const std::exception &e) {
-                        has_errors = true;
-                        last_error = std::string("Error processing ") + filePath + ": " + e.what();
-                        std::cerr << last_error << std::endl;
-                    }
-                }
-            } catch (const std::exception &e) {
-                has_errors = true;
-                last_error = std::string("Thread error: ") + e.what();
-                std::cerr << last_error << std::endl;
-            }
-        });
-    }
-
-    // Wait for all threads to complete
-    for (auto &thread: threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
-    }
-
-    if (has_errors) {
-        value1 = WorkResult::Error(last_error.empty() ? "Unknown error during processing" : last_error);
-        return false;
-    }
-    return true;
-}
-
-WorkResult addCorpus(const std::string &sourcePath) {
+WorkResult addCorpus(const std::string &sourcePath, const IngestConfig &config) {
     std::string expanded_path = translatePath(sourcePath);
     try {
         WorkResult result;
@@ -861,28 +771,91 @@ WorkResult addCorpus(const std::string &sourcePath) {
         }
         std::cout << "Found " << pdfFiles.size() << " PDF files to process" << std::endl;
 
+        // All dumps of this run are registered with the index of the corpus root
+        bool fullScan = std::filesystem::is_directory(expanded_path);
+        std::string corpusRoot = fullScan
+                                     ? expanded_path
+                                     : std::filesystem::path(expanded_path).parent_path().string();
+
+        // Only files whose size, mtime or inode changed since they were ingested are hashed and looked up
+        std::shared_ptr<tldr::CorpusManifest> manifest = tldr::CorpusManifest::open(corpusRoot);
+        std::map<std::string, tldr::FileSignature> signatures;
+        std::vector<std::string> changedFiles = manifest ? manifest->changed_files(pdfFiles, signatures) : pdfFiles;
+        if (manifest && fullScan) {
+            manifest->retain(pdfFiles);
+        }
+        std::cout << pdfFiles.size() - changedFiles.size() << " files unchanged since they were ingested, "
+                << changedFiles.size() << " to check" << std::endl;
+        if (changedFiles.empty()) {
+            if (manifest) manifest->save();
+            return WorkResult{false, "", "All files are already processed"};
+        }
+
         std::map<std::string, std::string> fileHashes;
-        if (!computeFileHashes(pdfFiles, fileHashes, result))
+        if (!computeFileHashes(changedFiles, fileHashes, result))
             return result;
 
         std::vector<std::pair<std::string, std::string> > filesToEmbed;
-        if (!getFilesToBeEmbedded(expanded_path, pdfFiles, fileHashes, filesToEmbed, result))
-            return result;
+        bool haveWork = getFilesToBeEmbedded(expanded_path, changedFiles, fileHashes, filesToEmbed, result);
 
-#if CORPUS_FILE_PROC_TYPE==CORPUS_FILE_PROC_TYPE_PARALLEL
-        if (!addFilesToCorpus(filesToEmbed, result))
-            return result;
-#else
-        if (!addFilesToCorpusSequential(filesToEmbed, result))
+        // Record a file once its content is in the index: already there (moved, touched, duplicate) or saved below
+        auto recordFile = [&](const std::string &file, const std::string &fileHash) {
+            auto signature = signatures.find(file);
+            if (manifest && signature != signatures.end()) {
+                manifest->record(file, signature->second, fileHash);
+            }
+        };
+        std::set<std::string> queued;
+        for (const auto &file: filesToEmbed) {
+            queued.insert(file.first);
+        }
+        for (const auto &[file, fileHash]: fileHashes) {
+            if (!queued.count(file)) recordFile(file, fileHash);
+        }
+        if (!haveWork) {
+            if (manifest) manifest->save();
             return result;
-#endif
+        }
 
-        return WorkResult{false, "", std::format("Processed {} files", filesToEmbed.size())}; // Success
+        tldr::IngestStats stats = tldr::run_ingest_pipeline(filesToEmbed, corpusRoot, config);
+        tldr::print_ingest_stats(stats);
+        for (size_t index: stats.persisted) {
+            recordFile(filesToEmbed[index].first, filesToEmbed[index].second);
+        }
+        if (manifest) manifest->save();
+        if (stats.failed == stats.files) {
+            return WorkResult::Error(stats.last_error.empty() ? "No file could be processed" : stats.last_error);
+        }
+
+        return WorkResult{false, "", std::format("Processed {} files ({} failed)", stats.files - stats.failed,
+                                                 stats.failed)}; // Success
     } catch (const std::exception &e) {
         return WorkResult::Error(std::string("Error in addCorpus: ") + e.what());
     }
 }
 
+WorkResult warmupCorpus(const std::string &corpusPath, bool lockInMemory) {
+    std::string corpus_root = translatePath(corpusPath);
+    auto index = tldr::SegmentedIndex::open(corpus_root);
+    if (!index) {
+        return WorkResult::Error("Corpus directory does not exist: " + corpus_root);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tldr::DumpMappingCache &cache = tldr::DumpMappingCache::instance();
+    if (lockInMemory) {
+        cache.set_lock_in_memory(true);
+    }
+    size_t bytes = cache.warm_up(index->live_paths());
+    auto end = std::chrono::high_resolution_clock::now();
+
+    auto stats = cache.stats();
+    std::cout << "Warmed up " << bytes / (1024 * 1024) << " MiB of vector dumps in "
+              << std::chrono::duration<double>(end - start).count() << "s (" << stats.locked_bytes / (1024 * 1024)
+              << " MiB pinned)" << std::endl;
+    return WorkResult{false, "", std::format("Warmed up {} bytes", bytes)};
+}
+
 void deleteCorpus(const std::string &corpusId) {
     // Implement the function
     std::cout << "DELETE_CORPUS action with corpus_id: " << corpusId << std::endl;
@@ -910,7 +883,8 @@ void doRag(const std::string &conversationId) {
     }
 }
 
-RagResult queryRag(const std::string &user_query, const std::string &corpus_dir, const std::string &npu_model_path) {
+RagResult queryRag(const std::string &user_query, const std::string &corpus_dir, const std::string &npu_model_path,
+                   const SearchOptions &options) {
     RagResult result;
 
     if (!g_db) {
@@ -918,9 +892,15 @@ RagResult queryRag(const std::string &user_query, const std::string &corpus_dir,
         return result;
     }
 
+    auto elapsed_ms = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
     try {
         // Get embeddings for the user query using LlmManager
+        auto start = std::chrono::high_resolution_clock::now();
         auto query_embeddings = tldr::get_llm_manager().get_embeddings({user_query});
+        result.timings.embed_ms = elapsed_ms(start);
 
         if (query_embeddings.empty() || query_embeddings[0].empty()) {
             std::cerr << "Failed to get embeddings for the query." << std::endl;
@@ -931,15 +911,26 @@ RagResult queryRag(const std::string &user_query, const std::string &corpus_dir,
 
         // Use NPU-accelerated similarity search instead of database search
         std::cout << "Using NPU model path: " << npu_model_path << std::endl;
-        auto similar_chunks = searchSimilarVectorsNPU(
-            query_embeddings[0], // Query vector
-            translatePath(corpus_dir), // Vector corpus directory
-            K_SIMILAR_CHUNKS_TO_RETRIEVE, // Number of results to return
-            npu_model_path // NPU model path
-        );
+        std::vector<CtxChunkMeta> similar_chunks;
+        if (options.fusion == FusionMethod::None) {
+            start = std::chrono::high_resolution_clock::now();
+            similar_chunks = searchSimilarVectorsNPU(
+                query_embeddings[0], // Query vector
+                translatePath(corpus_dir), // Vector corpus directory
+                K_SIMILAR_CHUNKS_TO_RETRIEVE, // Number of results to return
+                npu_model_path, // NPU model path
+                options // Search backend
+            );
+            result.timings.vector_ms = elapsed_ms(start);
+        } else {
+            // Exact identifiers and error codes are found by BM25 where embeddings miss them
+            similar_chunks = hybridSearch(user_query, query_embeddings[0], translatePath(corpus_dir),
+                                          K_SIMILAR_CHUNKS_TO_RETRIEVE, npu_model_path, options, result.timings);
+        }
 
         // Fallback to traditional database search if NPU search returns no results
-        if (similar_chunks.empty()) {
+        // (not with a filter: the database search would ignore it)
+        if (similar_chunks.empty() && options.filter.empty()) {
             std::cerr << "No results from NPU search, falling back to database search..." << std::endl;
             
             // Get the results from the traditional database search (which now returns ContextChunk objects)
@@ -1007,8 +998,39 @@ RagResult queryRag(const std::string &user_query, const std::string &corpus_dir,
             return result;
         }
 
-        // Generate response using LlmManager's chat model
-        result.response = tldr::get_llm_manager().get_chat_response(context_str, user_query);
+        // A near-duplicate question over the very same chunks reuses the cached answer
+        const std::string corpus_key = translatePath(corpus_dir);
+        const float min_similarity = options.answer_cache_similarity > 0.0f
+                                         ? options.answer_cache_similarity
+                                         : ANSWER_CACHE_MIN_SIMILARITY;
+        const bool use_answer_cache = min_similarity <= 1.0f;
+        std::vector<uint64_t> chunk_hashes;
+        for (const auto &chunk: result.context_chunks) {
+            chunk_hashes.push_back(chunk.hash);
+        }
+        RagResult cached;
+        if (use_answer_cache && tldr::AnswerCache::instance().lookup(corpus_key, query_embeddings[0], chunk_hashes,
+                                                                     min_similarity, cached)) {
+            result.response = std::move(cached.response);
+            result.cached_answer = true;
+            std::cout << "Answered from the answer cache" << std::endl;
+        } else {
+            // Generate response using LlmManager's chat model
+            start = std::chrono::high_resolution_clock::now();
+            result.response = tldr::get_llm_manager().get_chat_response(context_str, user_query);
+            result.timings.generate_ms = elapsed_ms(start);
+            if (use_answer_cache && !result.response.empty() && result.response != LLM_ERROR_RESPONSE) {
+                tldr::AnswerCache::instance().insert(corpus_key, query_embeddings[0], result);
+            }
+        }
+
+        const RetrievalTimings &t = result.timings;
+        std::cout << "Query timings (ms): embed " << t.embed_ms << ", vector " << t.vector_ms << ", lexical "
+                  << t.lexical_ms << ", fusion " << t.fusion_ms << ", hydrate " << t.hydrate_ms << ", generate "
+                  << t.generate_ms << std::endl;
+        const tldr::EmbeddingCache::Stats cache = tldr::get_llm_manager().query_cache_stats();
+        std::cout << "Query embedding cache: " << cache.hits << " hits, " << cache.misses << " misses, "
+                  << cache.entries << "/" << cache.capacity << " entries" << std::endl;
     } catch (const std::exception &e) {
         std::cerr << "RAG Query error: " << e.what() << std::endl;
         result.response = "Error generating response!";
@@ -1051,168 +1073,514 @@ std::map<uint64_t, float> npuCosineSimSearchWrapper(
     return hash_scores;
 }
 
-// Wrapper function for NPU-accelerated vector similarity search
-std::vector<CtxChunkMeta> searchSimilarVectorsNPU(
-    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const std::string &npu_model_path) {
-    std::vector<CtxChunkMeta> similar_chunks;
+// Filter compiled against the corpus' live files, nullptr if there is nothing to filter
+static std::shared_ptr<const tldr::CompiledFilter> compileFilter(const std::string &corpus_dir,
+                                                                 const SearchFilter &filter) {
+    if (filter.empty()) {
+        return nullptr;
+    }
+    auto index = tldr::SegmentedIndex::open(corpus_dir);
+    if (!index) {
+        return std::make_shared<const tldr::CompiledFilter>(filter, std::vector<tldr::SegmentedIndex::Entry>{});
+    }
+    return tldr::CompiledFilter::cached(filter, *index);
+}
 
-    // We'll collect the hashes from the results and only then query the database
-    // This is more efficient than loading all embeddings upfront
+// Chunks of search results read from the docstore rows the search found them at
+static void hydrateFoundRows(const std::vector<SimilarityResult> &results,
+                             const std::vector<tldr::SegmentedIndex::RowRef> &rows,
+                             std::map<uint64_t, CtxChunkMeta> *chunks) {
+    if (!chunks) {
+        return;
+    }
+    for (size_t i = 0; i < results.size() && i < rows.size(); ++i) {
+        CtxChunkMeta chunk;
+        if (rows[i].hydrate(results[i].hash, chunk)) {
+            chunks->emplace(results[i].hash, std::move(chunk));
+        }
+    }
+}
+
+std::map<uint64_t, float> cpuSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const SearchFilter &filter,
+    std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<tldr::SegmentedIndex::RowRef> rows;
+    auto results = tldr::cpu_search_corpus(corpus_dir, query_vector.data(), query_vector.size(), k, &filter,
+                                           chunks ? &rows : nullptr);
+    for (const auto &result: results) {
+        hash_scores[result.hash] = result.score;
+    }
+    hydrateFoundRows(results, rows, chunks);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "CPU search took " << std::chrono::duration<double, std::milli>(end - start).count() << "ms"
+              << std::endl;
+    return hash_scores;
+}
+
+std::map<uint64_t, float> hnswSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, int ef_search,
+    const SearchFilter &filter, std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
+
+    // Builds the graph from the corpus' vector dumps on first use
+    auto index = tldr::HnswIndex::open(corpus_dir, query_vector.size(), true);
+    if (!index) {
+        std::cerr << "HNSW index unavailable for " << corpus_dir << std::endl;
+        return hash_scores;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto compiled = compileFilter(corpus_dir, filter);
+    tldr::HashFilter hash_filter = compiled ? tldr::CompiledFilter::hash_filter(compiled) : nullptr;
+    auto results = index->search(query_vector.data(), k, ef_search > 0 ? ef_search : 0,
+                                 hash_filter ? &hash_filter : nullptr);
+    for (const auto &result: results) {
+        hash_scores[result.hash] = result.score;
+    }
+    // Graph nodes are hashes; a filtered result is read from a row that passes, not any row holding it
+    if (compiled) {
+        std::vector<tldr::SegmentedIndex::RowRef> rows(results.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            compiled->locate(results[i].hash, rows[i]);
+        }
+        hydrateFoundRows(results, rows, chunks);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "HNSW search over " << index->size() << " vectors took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    return hash_scores;
+}
+
+std::map<uint64_t, float> ivfpqSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const SearchOptions &options,
+    std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
+
+    // Trains the quantizers on a sample of the corpus on first use
+    auto index = tldr::IvfPqIndex::open(corpus_dir, query_vector.size(), true);
+    if (!index) {
+        std::cerr << "IVF-PQ index unavailable for " << corpus_dir << std::endl;
+        return hash_scores;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t rerank = options.rerank ? static_cast<size_t>(k) * IVFPQ_RERANK_FACTOR : 0;
+    auto compiled = compileFilter(corpus_dir, options.filter);
+    std::vector<tldr::SegmentedIndex::RowRef> rows;
+    auto results = index->search(query_vector.data(), k, std::max(options.nprobe, 0), rerank, compiled.get(),
+                                 chunks ? &rows : nullptr);
+    for (const auto &result: results) {
+        hash_scores[result.hash] = result.score;
+    }
+    hydrateFoundRows(results, rows, chunks);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "IVF-PQ search over " << index->size() << " vectors took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    return hash_scores;
+}
+
+std::map<uint64_t, float> binarySearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, int candidates,
+    const SearchFilter &filter, std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<tldr::SegmentedIndex::RowRef> rows;
+    auto results = tldr::cpu_search_corpus_binary(corpus_dir, query_vector.data(), query_vector.size(), k,
+                                                  static_cast<size_t>(std::max(candidates, 0)), &filter,
+                                                  chunks ? &rows : nullptr);
+    for (const auto &result: results) {
+        hash_scores[result.hash] = result.score;
+    }
+    hydrateFoundRows(results, rows, chunks);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Binary prefilter search took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    return hash_scores;
+}
+
+std::map<uint64_t, float> prefixSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, int candidates,
+    const SearchFilter &filter, std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<tldr::SegmentedIndex::RowRef> rows;
+    auto results = tldr::cpu_search_corpus_prefix(corpus_dir, query_vector.data(), query_vector.size(), k,
+                                                  static_cast<size_t>(std::max(candidates, 0)), &filter,
+                                                  chunks ? &rows : nullptr);
+    for (const auto &result: results) {
+        hash_scores[result.hash] = result.score;
+    }
+    hydrateFoundRows(results, rows, chunks);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Prefix prefilter search took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    return hash_scores;
+}
+
+std::map<uint64_t, CtxChunkMeta> getChunksFromDocstore(const std::string &corpus_dir,
+                                                      const std::vector<uint64_t> &hashes) {
+    std::map<uint64_t, CtxChunkMeta> hash_to_metadata;
+    auto index = tldr::SegmentedIndex::open(corpus_dir);
+    if (!index) {
+        return hash_to_metadata;
+    }
+    std::vector<tldr::SegmentedIndex::Entry> entries = index->live_entries();
+    for (uint64_t hash: hashes) {
+        for (const auto &entry: entries) {
+            CtxChunkMeta chunk;
+            if (tldr::SegmentedIndex::find_chunk(entry, hash, chunk)) {
+                hash_to_metadata.emplace(hash, std::move(chunk));
+                break;
+            }
+        }
+    }
+    return hash_to_metadata;
+}
+
+std::map<uint64_t, CtxChunkMeta> getChunksByHashes(const std::string &corpus_dir, const std::vector<uint64_t> &hashes) {
+    std::map<uint64_t, CtxChunkMeta> hash_to_metadata = getChunksFromDocstore(corpus_dir, hashes);
+
+    // Postgres stays the system of record for chunks no docstore covers (e.g. older dumps)
+    std::vector<uint64_t> missing;
+    for (uint64_t hash: hashes) {
+        if (!hash_to_metadata.contains(hash)) {
+            missing.push_back(hash);
+        }
+    }
+    if (!missing.empty() && g_db) {
+        hash_to_metadata.merge(g_db->getChunksByHashes(missing));
+    }
+    std::cout << "Hydrated " << hashes.size() - missing.size() << " of " << hashes.size()
+              << " chunks from the docstore" << std::endl;
+    return hash_to_metadata;
+}
+
+static void checkQueryDimensions(const std::vector<float> &query_vector) {
     if (query_vector.size() != EMBEDDING_SIZE_INT) {
         throw std::runtime_error(std::format(
             "Query vector size does not match the pre-defined embedding size! Expected {}, got {}",
             EMBEDDING_SIZE, query_vector.size()));
     }
+}
 
-    try {
-        // Get hash scores from NPU-accelerated search
-        std::map<uint64_t, float> hash_scores = npuCosineSimSearchWrapper(
+std::map<uint64_t, float> vectorSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const std::string &npu_model_path,
+    const SearchOptions &options, std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
+    const bool filtered = !options.filter.empty();
+    if (options.backend == SearchBackend::Hnsw) {
+        hash_scores = hnswSearchWrapper(query_vector, corpus_dir, k, options.ef_search, options.filter, chunks);
+    } else if (options.backend == SearchBackend::IvfPq) {
+        hash_scores = ivfpqSearchWrapper(query_vector, corpus_dir, k, options, chunks);
+    } else if (options.backend == SearchBackend::Binary) {
+        hash_scores = binarySearchWrapper(query_vector, corpus_dir, k, options.binary_candidates, options.filter,
+                                          chunks);
+    } else if (options.backend == SearchBackend::Prefix) {
+        hash_scores = prefixSearchWrapper(query_vector, corpus_dir, k, options.prefix_candidates, options.filter,
+                                          chunks);
+    } else if (filtered) {
+        // The NPU model scores whole dumps, filtered rows are skipped by the CPU scan instead
+        hash_scores = cpuSearchWrapper(query_vector, corpus_dir, k, options.filter, chunks);
+    }
+
+    // Get hash scores from NPU-accelerated search (also the fallback for an empty graph;
+    // an empty filtered result is final, the NPU search cannot apply the filter)
+    if (hash_scores.empty() && !filtered) {
+        hash_scores = npuCosineSimSearchWrapper(
             query_vector.data(),
             query_vector.size(),
             k,
             corpus_dir.c_str(),
             npu_model_path.c_str()
         );
+    }
+    return hash_scores;
+}
 
-        // Print the hash values returned by the NPU search
-        std::cout << "NPU search returned the following hashes:" << std::endl;
-        for (const auto &[hash, score]: hash_scores) {
-            std::cout << "Hash: " << hash << ", Score: " << score << std::endl;
-        }
+std::map<uint64_t, float> lexicalSearchWrapper(
+    const std::string &query_text, const std::string &corpus_dir, int k, const SearchFilter &filter,
+    std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::map<uint64_t, float> hash_scores;
 
-        // Extract hashes for database lookup
-        std::vector<uint64_t> hashes_to_lookup;
-        hashes_to_lookup.reserve(hash_scores.size());
-        for (const auto &[hash, _]: hash_scores) {
-            hashes_to_lookup.push_back(hash);
-        }
+    // Bootstraps the index from the corpus' docstores on first use
+    auto index = tldr::LexicalIndex::open(corpus_dir);
+    if (!index) {
+        std::cerr << "Lexical index unavailable for " << corpus_dir << std::endl;
+        return hash_scores;
+    }
 
-        // Query the database for the text chunks corresponding to these hashes
-        std::map<uint64_t, CtxChunkMeta> hash_to_metadata;
-        if (g_db) {
-            hash_to_metadata = g_db->getChunksByHashes(hashes_to_lookup);
-        }
+    auto start = std::chrono::high_resolution_clock::now();
+    auto compiled = compileFilter(corpus_dir, filter);
+    std::vector<tldr::SegmentedIndex::RowRef> rows;
+    auto results = index->search(query_text, k, compiled.get(), chunks ? &rows : nullptr);
+    for (const auto &result: results) {
+        hash_scores.emplace(result.hash, result.score);
+    }
+    hydrateFoundRows(results, rows, chunks);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "BM25 search over " << index->stats().chunks << " chunks took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    return hash_scores;
+}
 
-        // Process the results
-        for (const auto &[hash, score]: hash_scores) {
-            auto it = hash_to_metadata.find(hash);
-            if (it != hash_to_metadata.end()) {
-                // We already have a CtxChunkMeta, just update the similarity score
-                CtxChunkMeta chunk = it->second;
-                chunk.similarity = score; // Update with the score from our calculation
-                
-                similar_chunks.push_back(chunk);
-                std::cout << "Found match for hash: " << hash << std::endl;
-            } else {
-                // If text not found, use hash as identifier
-                std::cerr << "HASH_NOT_FOUND-" << hash << std::endl;
+// Hashes of a score map ordered by descending score
+static std::vector<uint64_t> rankedHashes(const std::map<uint64_t, float> &hash_scores) {
+    std::vector<std::pair<float, uint64_t> > ranked;
+    ranked.reserve(hash_scores.size());
+    for (const auto &[hash, score]: hash_scores) {
+        ranked.emplace_back(score, hash);
+    }
+    std::sort(ranked.begin(), ranked.end(), std::greater<>());
+    std::vector<uint64_t> hashes;
+    hashes.reserve(ranked.size());
+    for (const auto &[_, hash]: ranked) {
+        hashes.push_back(hash);
+    }
+    return hashes;
+}
+
+std::vector<std::pair<uint64_t, float> > fuseRankings(const std::map<uint64_t, float> &vector_scores,
+                                                     const std::map<uint64_t, float> &lexical_scores, int k,
+                                                     const SearchOptions &options) {
+    std::map<uint64_t, float> fused;
+    if (options.fusion == FusionMethod::Weighted) {
+        // Cosine and BM25 live on different scales; min-max normalize each list first
+        auto blend = [&](const std::map<uint64_t, float> &scores, float weight) {
+            if (scores.empty()) return;
+            auto [lo, hi] = std::minmax_element(scores.begin(), scores.end(),
+                                                [](const auto &a, const auto &b) { return a.second < b.second; });
+            const float range = hi->second - lo->second;
+            for (const auto &[hash, score]: scores) {
+                fused[hash] += weight * (range > 0.0f ? (score - lo->second) / range : 1.0f);
+            }
+        };
+        const float lexical_weight = std::clamp(options.lexical_weight, 0.0f, 1.0f);
+        blend(vector_scores, 1.0f - lexical_weight);
+        blend(lexical_scores, lexical_weight);
+    } else {
+        for (const auto *scores: {&vector_scores, &lexical_scores}) {
+            std::vector<uint64_t> ranked = rankedHashes(*scores);
+            for (size_t rank = 0; rank < ranked.size(); ++rank) {
+                fused[ranked[rank]] += 1.0f / static_cast<float>(HYBRID_RRF_K + rank + 1);
             }
         }
-    } catch (const std::exception &e) {
-        std::cerr << "Error in NPU similarity search: " << e.what() << std::endl;
     }
 
-    return similar_chunks;
+    std::vector<std::pair<uint64_t, float> > results(fused.begin(), fused.end());
+    std::sort(results.begin(), results.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+    if (results.size() > static_cast<size_t>(std::max(k, 0))) {
+        results.resize(std::max(k, 0));
+    }
+    return results;
 }
 
-// Test vector cache dump and read functionality
-bool test_vector_cache() {
-    std::cout << "=== Testing Vector Cache Dump and Read Functionality ===" << std::endl;
+// Chunks of the given (hash, score) results, in result order. Chunks the search already
+// hydrated from the rows it found them at are taken from found, the rest are looked up
+// (in rows passing the filter, as other documents may hold the same chunk).
+static std::vector<CtxChunkMeta> hydrateResults(const std::string &corpus_dir,
+                                                const std::vector<std::pair<uint64_t, float> > &results,
+                                                std::map<uint64_t, CtxChunkMeta> found = {},
+                                                const SearchFilter &filter = {}) {
+    std::vector<uint64_t> hashes;
+    auto compiled = compileFilter(corpus_dir, filter);
+    for (const auto &[hash, _]: results) {
+        if (found.contains(hash)) {
+            continue;
+        }
+        tldr::SegmentedIndex::RowRef row;
+        CtxChunkMeta chunk;
+        if (compiled && !compiled->locate(hash, row)) {
+            continue;
+        }
+        if (row.hydrate(hash, chunk)) {
+            found.emplace(hash, std::move(chunk));
+        } else {
+            hashes.push_back(hash); // Unfiltered, or a passing file without a docstore
+        }
+    }
+    std::map<uint64_t, CtxChunkMeta> hash_to_metadata =
+        hashes.empty() ? std::map<uint64_t, CtxChunkMeta>{} : getChunksByHashes(corpus_dir, hashes);
+    hash_to_metadata.merge(found);
+
+    std::vector<CtxChunkMeta> chunks;
+    for (const auto &[hash, score]: results) {
+        auto it = hash_to_metadata.find(hash);
+        if (it == hash_to_metadata.end()) {
+            std::cerr << "HASH_NOT_FOUND-" << hash << std::endl;
+            continue;
+        }
+        CtxChunkMeta chunk = it->second;
+        chunk.similarity = score;
+        chunks.push_back(chunk);
+    }
+    return chunks;
+}
 
-    // Create sample embeddings and hashes
-    std::vector<std::vector<float> > test_embeddings;
-    std::vector<uint64_t> test_hashes;
+// Wrapper function for NPU-accelerated vector similarity search
+std::vector<CtxChunkMeta> searchSimilarVectorsNPU(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const std::string &npu_model_path,
+    const SearchOptions &options) {
+    std::vector<CtxChunkMeta> similar_chunks;
 
-    // Create 5 test embeddings with 16 dimensions each
-    const size_t num_embeddings = 5;
-    const size_t dimensions = 16;
+    // We'll collect the hashes from the results and only then query the database
+    // This is more efficient than loading all embeddings upfront
+    checkQueryDimensions(query_vector);
 
-    std::cout << "Creating " << num_embeddings << " test embeddings with "
-            << dimensions << " dimensions each" << std::endl;
+    try {
+        std::map<uint64_t, CtxChunkMeta> found;
+        std::map<uint64_t, float> hash_scores = vectorSearchWrapper(query_vector, corpus_dir, k, npu_model_path,
+                                                                    options, &found);
 
-    // Initialize with deterministic values for testing
-    for (size_t i = 0; i < num_embeddings; i++) {
-        std::vector<float> embedding(dimensions);
-        for (size_t j = 0; j < dimensions; j++) {
-            embedding[j] = static_cast<float>((i + 1) * 0.1f + j * 0.01f); // Deterministic pattern
+        // Print the hash values returned by the NPU search
+        std::cout << "NPU search returned the following hashes:" << std::endl;
+        for (const auto &[hash, score]: hash_scores) {
+            std::cout << "Hash: " << hash << ", Score: " << score << std::endl;
         }
-        test_embeddings.push_back(std::move(embedding));
-
-        // Create corresponding hash
-        test_hashes.push_back(1000000 + i * 10000); // Simple deterministic hash for testing
-    }
 
-    // Test file path
-    std::string test_file = "vector_cache_test.bin";
-
-    // Step 1: Dump the test data
-    std::cout << "\nStep 1: Dumping test embeddings to " << test_file << std::endl;
-    if (!tldr::dump_vectors_to_file(test_file, test_embeddings, test_hashes, "test_hash")) {
-        std::cerr << "Error: Failed to dump test embeddings" << std::endl;
-        return false;
-    }
-
-    // Step 2: Read the dumped file
-    std::cout << "\nStep 2: Reading the vector dump file" << std::endl;
-    auto mapped_data = tldr::read_vector_dump_file(test_file);
-    if (!mapped_data) {
-        std::cerr << "Error: Failed to read the vector dump file" << std::endl;
-        return false;
+        // Hydrate the text chunks corresponding to these hashes
+        similar_chunks = hydrateResults(corpus_dir, {hash_scores.begin(), hash_scores.end()}, std::move(found),
+                                        options.filter);
+    } catch (const std::exception &e) {
+        std::cerr << "Error in NPU similarity search: " << e.what() << std::endl;
     }
 
-    // Step 3: Print info about the file
-    print_vector_dump_info(mapped_data.get(), test_file, false);
-
-    // Step 4: Verify contents
-    std::cout << "\nStep 4: Verifying file contents" << std::endl;
+    return similar_chunks;
+}
 
-    // Verify header
-    bool header_verified =
-            (mapped_data->header->num_entries == num_embeddings) &&
-            (mapped_data->header->hash_size_bytes == sizeof(size_t)) &&
-            (mapped_data->header->vector_dimensions == dimensions);
+std::vector<CtxChunkMeta> hybridSearch(
+    const std::string &query_text, const std::vector<float> &query_vector, const std::string &corpus_dir, int k,
+    const std::string &npu_model_path, const SearchOptions &options, RetrievalTimings &timings) {
+    std::vector<CtxChunkMeta> similar_chunks;
+    checkQueryDimensions(query_vector);
 
-    std::cout << "Header verification: " << (header_verified ? "PASSED" : "FAILED") << std::endl;
+    auto elapsed_ms = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
 
-    // Verify contents by checking values at index 1 (second element)
-    bool data_verified = true;
-    size_t test_idx = 1;
+    try {
+        // Both retrievers go deeper than k so fusion can promote results either ranks low
+        const int depth = std::max(k, HYBRID_CANDIDATES);
+        std::map<uint64_t, CtxChunkMeta> found;
+        auto start = std::chrono::high_resolution_clock::now();
+        std::map<uint64_t, float> vector_scores = vectorSearchWrapper(query_vector, corpus_dir, depth,
+                                                                      npu_model_path, options, &found);
+        timings.vector_ms = elapsed_ms(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        std::map<uint64_t, float> lexical_scores = lexicalSearchWrapper(query_text, corpus_dir, depth,
+                                                                        options.filter, &found);
+        timings.lexical_ms = elapsed_ms(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        std::vector<std::pair<uint64_t, float> > fused = fuseRankings(vector_scores, lexical_scores, k, options);
+        timings.fusion_ms = elapsed_ms(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        similar_chunks = hydrateResults(corpus_dir, fused, std::move(found), options.filter);
+        timings.hydrate_ms = elapsed_ms(start);
+
+        std::cout << "Hybrid search fused " << vector_scores.size() << " vector and " << lexical_scores.size()
+                  << " lexical results into " << similar_chunks.size() << " chunks" << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << "Error in hybrid search: " << e.what() << std::endl;
+    }
 
-    if (test_idx < mapped_data->header->num_entries) {
-        std::cout << "\nVerifying element at index " << test_idx << ":" << std::endl;
+    return similar_chunks;
+}
 
-        // Original hash and the one read from file
-        size_t original_hash = test_hashes[test_idx];
-        size_t read_hash = mapped_data->hashes[test_idx];
+std::vector<std::map<uint64_t, float> > batchSearchWrapper(
+    const std::vector<std::vector<float> > &query_vectors, const std::string &corpus_dir, int k,
+    const SearchFilter &filter, std::map<uint64_t, CtxChunkMeta> *chunks) {
+    std::vector<std::map<uint64_t, float> > hash_scores(query_vectors.size());
+    if (query_vectors.empty()) {
+        return hash_scores;
+    }
 
-        std::cout << "Hash verification: Original = " << original_hash
-                << ", Read = " << read_hash
-                << " -> " << (original_hash == read_hash ? "MATCH" : "MISMATCH") << std::endl;
+    // Pack the queries into one row-major matrix for the tiled kernel
+    const size_t dims = query_vectors.front().size();
+    std::vector<float> matrix;
+    matrix.reserve(query_vectors.size() * dims);
+    for (const auto &query: query_vectors) {
+        if (query.size() != dims) {
+            throw std::runtime_error(std::format(
+                "Batched queries must share one dimension! Expected {}, got {}", dims, query.size()));
+        }
+        matrix.insert(matrix.end(), query.begin(), query.end());
+    }
 
-        // Check a few dimensions of the embedding vector
-        const float *read_vector = mapped_data->vectors + (test_idx * mapped_data->header->vector_dimensions);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<tldr::SegmentedIndex::RowRef> > rows;
+    auto results = tldr::cpu_search_corpus_batch(corpus_dir, matrix.data(), query_vectors.size(), dims, k, &filter,
+                                                 chunks ? &rows : nullptr);
+    for (size_t q = 0; q < results.size(); ++q) {
+        for (const auto &result: results[q]) {
+            hash_scores[q][result.hash] = result.score;
+        }
+        if (chunks) {
+            hydrateFoundRows(results[q], rows[q], chunks);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Batched search of " << query_vectors.size() << " queries took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+    return hash_scores;
+}
 
-        std::cout << "Vector verification (first 5 dimensions):" << std::endl;
-        bool vector_matches = true;
-        for (size_t i = 0; i < 5 && i < mapped_data->header->vector_dimensions; i++) {
-            float original_val = test_embeddings[test_idx][i];
-            float read_val = read_vector[i];
-            bool matches = (std::abs(original_val - read_val) < 0.000001f); // Floating point comparison with epsilon
+std::vector<std::vector<CtxChunkMeta> > searchSimilarVectorsBatch(
+    const std::vector<std::vector<float> > &query_vectors, const std::string &corpus_dir, int k,
+    const SearchFilter &filter) {
+    std::vector<std::vector<CtxChunkMeta> > similar_chunks(query_vectors.size());
 
-            std::cout << "  Dim " << i << ": Original = " << original_val
-                    << ", Read = " << read_val
-                    << " -> " << (matches ? "MATCH" : "MISMATCH") << std::endl;
+    for (const auto &query: query_vectors) {
+        checkQueryDimensions(query);
+    }
 
-            if (!matches) vector_matches = false;
+    try {
+        std::map<uint64_t, CtxChunkMeta> hash_to_metadata;
+        std::vector<std::map<uint64_t, float> > hash_scores = batchSearchWrapper(query_vectors, corpus_dir, k, filter,
+                                                                                 &hash_to_metadata);
+
+        // One lookup for the hashes of every query the scan could not hydrate from their rows
+        std::set<uint64_t> unique_hashes;
+        for (const auto &scores: hash_scores) {
+            for (const auto &[hash, _]: scores) {
+                if (!hash_to_metadata.contains(hash)) {
+                    unique_hashes.insert(hash);
+                }
+            }
+        }
+        if (!unique_hashes.empty()) {
+            hash_to_metadata.merge(getChunksByHashes(
+                corpus_dir, std::vector<uint64_t>(unique_hashes.begin(), unique_hashes.end())));
         }
 
-        data_verified = (original_hash == read_hash) && vector_matches;
+        for (size_t q = 0; q < hash_scores.size(); ++q) {
+            for (const auto &[hash, score]: hash_scores[q]) {
+                auto it = hash_to_metadata.find(hash);
+                if (it == hash_to_metadata.end()) {
+                    std::cerr << "HASH_NOT_FOUND-" << hash << std::endl;
+                    continue;
+                }
+                CtxChunkMeta chunk = it->second;
+                chunk.similarity = score;
+                similar_chunks[q].push_back(chunk);
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error in batched similarity search: " << e.what() << std::endl;
     }
 
-    // Print final result
-    std::cout << "\nTest result: " << (header_verified && data_verified ? "PASSED" : "FAILED") << std::endl;
+    return similar_chunks;
+}
 
-    return header_verified && data_verified;
+// Test vector cache dump and read functionality
+bool test_vector_cache() {
+    return tldr::test_vector_cache();
 }
 
 /*void command_loop() {
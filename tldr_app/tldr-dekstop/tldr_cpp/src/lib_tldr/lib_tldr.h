@@ -36,10 +36,7 @@ DocumentData extractDocumentDataFromPDF(const std::string &filename);
 // Kept for backward compatibility
 [[deprecated("Use extractDocumentDataFromPDF instead")]]
 std::string extractTextFromPDF(const std::string &filename);
-// Get page boundaries (end positions) for a document
-std::vector<size_t> getPageBoundaries(const DocumentData &docData);
-
-// Split document text into chunks with page tracking
+// Split document text into chunks with page tracking, as spans of docData.text
 void splitTextIntoChunks(DocumentData &docData, size_t max_chunk_size = 2000, size_t overlap = 20);
 // Database connection management
 bool initializeDatabase(const std::string &conninfo = "");
@@ -64,18 +61,21 @@ int saveEmbeddingsThreadSafe(const std::vector<std::string_view> &batch,
                              const std::vector<int> &chunkPageNums,
                              const std::string &fileHash);
 
-// Returns gathered embeddings and their hashes
-std::pair<std::vector<std::vector<float> >, std::vector<uint64_t> >
-obtainEmbeddings(const std::vector<std::string> &chunks,
-                 const std::vector<int> &chunkPageNums,
-                 const std::string &fileHash,
-                 size_t batch_size, size_t num_threads);
+// Persist an embedded document: database rows, vector dump, docstore and the indexes of corpusRoot
+// (defaults to the directory of the file). embeddings are in chunk order. False if the vectors
+// did not make it into the corpus index, so the file is not recorded as ingested.
+bool saveDocumentToCorpus(const std::string &filePath, const std::string &fileHash, const std::string &corpusRoot,
+                          const DocumentData &docData, const std::vector<std::vector<float> > &embeddings);
+
+// Write the additions made to the ANN indexes of corpusRoot by saveDocumentToCorpus; once per ingest run
+void saveCorpusIndexes(const std::string &corpusRoot);
 
 // Delete all embeddings for a specific file hash
 bool deleteFileEmbeddingsFromDB(const std::string &fileHash);
 
-// Function to add a file to the corpus
-bool addFileToCorpus(const std::string &sourcePath, const std::string &fileHash);
+// Function to add a file to the corpus through the ingestion pipeline. Its vector dump is
+// registered with the segmented index of corpusRoot (defaults to the directory of the file)
+bool addFileToCorpus(const std::string &sourcePath, const std::string &fileHash, const std::string &corpusRoot = "");
 
 // Find all PDF files in a directory recursively
 // Generic function to find files of a specific type recursively
@@ -89,13 +89,79 @@ std::map<uint64_t, float> npuCosineSimSearchWrapper(
     const float *queryVector, const int queryVectorDimensions, const int32_t k,
     const char *corpusDir, const char *modelPath);
 
+// Exhaustive CPU scan restricted to the chunks passing a filter. The search wrappers taking
+// chunks fill it with the chunks of their results, read from the docstore rows they were found at.
+std::map<uint64_t, float> cpuSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const SearchFilter &filter,
+    std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+std::map<uint64_t, float> hnswSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, int ef_search,
+    const SearchFilter &filter = {}, std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+std::map<uint64_t, float> ivfpqSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const SearchOptions &options,
+    std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+std::map<uint64_t, float> binarySearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, int candidates,
+    const SearchFilter &filter = {}, std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+// Prefix-dimension shortlist rescored with every dimension (see tldr::cpu_search_corpus_prefix)
+std::map<uint64_t, float> prefixSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, int candidates,
+    const SearchFilter &filter = {}, std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+// Chunk text and metadata of the given hashes from the docstores (.vecdoc) of a corpus' live files
+std::map<uint64_t, CtxChunkMeta> getChunksFromDocstore(const std::string &corpus_dir,
+                                                      const std::vector<uint64_t> &hashes);
+
+// Docstore hydration, falling back to the database for hashes it does not cover
+std::map<uint64_t, CtxChunkMeta> getChunksByHashes(const std::string &corpus_dir, const std::vector<uint64_t> &hashes);
+
+// Hash scores of the vector backend selected by the options (NPU exhaustive search by default).
+// The NPU and HNSW searches only return hashes and leave chunks alone.
+std::map<uint64_t, float> vectorSearchWrapper(
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const std::string &npu_model_path,
+    const SearchOptions &options = {}, std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+// BM25 scores of the corpus' lexical index
+std::map<uint64_t, float> lexicalSearchWrapper(
+    const std::string &query_text, const std::string &corpus_dir, int k, const SearchFilter &filter = {},
+    std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+// Top-k (hash, fused score) of a vector and a lexical result list, by reciprocal rank or weighted fusion
+std::vector<std::pair<uint64_t, float> > fuseRankings(const std::map<uint64_t, float> &vector_scores,
+                                                     const std::map<uint64_t, float> &lexical_scores, int k,
+                                                     const SearchOptions &options);
+
 std::vector<CtxChunkMeta> searchSimilarVectorsNPU(
-    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const std::string &npu_model_path);
+    const std::vector<float> &query_vector, const std::string &corpus_dir, int k, const std::string &npu_model_path,
+    const SearchOptions &options = {});
+
+// Vector and BM25 retrieval fused by options.fusion, chunks in fused order with the fused score as similarity.
+// Fills the vector, lexical, fusion and hydrate timings.
+std::vector<CtxChunkMeta> hybridSearch(
+    const std::string &query_text, const std::vector<float> &query_vector, const std::string &corpus_dir, int k,
+    const std::string &npu_model_path, const SearchOptions &options, RetrievalTimings &timings);
+
+// Scores a batch of queries in one tiled pass over the corpus (offline evaluation, bursts of queries)
+std::vector<std::map<uint64_t, float> > batchSearchWrapper(
+    const std::vector<std::vector<float> > &query_vectors, const std::string &corpus_dir, int k,
+    const SearchFilter &filter = {}, std::map<uint64_t, CtxChunkMeta> *chunks = nullptr);
+
+// Batched counterpart of searchSimilarVectorsNPU: top-k chunks of every query, in query order
+std::vector<std::vector<CtxChunkMeta> > searchSimilarVectorsBatch(
+    const std::vector<std::vector<float> > &query_vectors, const std::string &corpus_dir, int k,
+    const SearchFilter &filter = {});
 
 bool initializeSystem(const std::string &chat_model_path, const std::string &embeddings_model_path);
 void cleanupSystem();
-WorkResult addCorpus(const std::string &sourcePath);
+// Ingest the PDFs under sourcePath, with the stage parallelism of config (see tldr::run_ingest_pipeline)
+WorkResult addCorpus(const std::string &sourcePath, const IngestConfig &config = {});
 void deleteCorpus(const std::string &corpusId);
+// Map and fault in the vector files of a corpus ahead of the first query, optionally pinning them (mlock)
+WorkResult warmupCorpus(const std::string &corpusPath, bool lockInMemory = false);
 // Structure to hold context chunk information
 
 
@@ -110,14 +176,18 @@ void command_loop();
 std::string printRagResult(const RagResult &result);
 
 /**
- * @brief Compute SHA-256 hash of one or more files using the shasum command-line utility
+ * @brief Compute the SHA-256 hashes of files in-process, one task per file on the shared task pool
  * @param file_paths Vector of file paths to compute hashes for
- * @return std::map<std::string, std::string> Map of file paths to their corresponding SHA-256 hashes
- * @throws std::runtime_error If the shasum command fails or a file cannot be read
+ * @param file_hashes Filled with file path -> lowercase hex SHA-256 for every file that could be read
+ * @return false (with result set) only when none of the files could be hashed; unreadable files are skipped with a warning
  */
 bool computeFileHashes(const std::vector<std::string> &file_paths, std::map<std::string, std::string> &file_hashes,
                        WorkResult &result);
 
-RagResult queryRag(const std::string &user_query, const std::string &corpus_dir, const std::string &npu_model_path);
+// SHA-256 of one file as 64 lowercase hex chars, empty with error set when it cannot be read
+std::string computeFileHash(const std::string &file_path, std::string &error);
+
+RagResult queryRag(const std::string &user_query, const std::string &corpus_dir, const std::string &npu_model_path,
+                   const SearchOptions &options = {});
 
 #endif //TLDR_CPP_MAIN_H
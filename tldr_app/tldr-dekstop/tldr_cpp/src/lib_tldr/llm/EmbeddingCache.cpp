@@ -0,0 +1,81 @@
+#include "EmbeddingCache.h"
+
+namespace tldr {
+
+EmbeddingCache::EmbeddingCache(size_t capacity) : capacity_(capacity) {
+}
+
+std::string EmbeddingCache::normalize_query(std::string_view text) {
+    std::string normalized;
+    normalized.reserve(text.size());
+    bool pending_space = false;
+    for (char c: text) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') {
+            pending_space = !normalized.empty();
+            continue;
+        }
+        if (pending_space) {
+            normalized.push_back(' ');
+            pending_space = false;
+        }
+        // Bytes of multi-byte UTF-8 sequences are left as they are
+        normalized.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+    }
+    return normalized;
+}
+
+std::string EmbeddingCache::key_of(const std::string &model_id, std::string_view text) {
+    return model_id + '\0' + normalize_query(text);
+}
+
+bool EmbeddingCache::get(const std::string &model_id, std::string_view text, std::vector<float> &embedding) {
+    const std::string key = key_of(model_id, text);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        ++misses_;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    embedding = it->second->second;
+    ++hits_;
+    return true;
+}
+
+void EmbeddingCache::put(const std::string &model_id, std::string_view text, const std::vector<float> &embedding) {
+    if (capacity_ == 0 || embedding.empty()) {
+        return;
+    }
+    std::string key = key_of(model_id, text);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        it->second->second = embedding;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    if (lru_.size() >= capacity_) {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    lru_.emplace_front(key, embedding);
+    index_.emplace(std::move(key), lru_.begin());
+}
+
+void EmbeddingCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+}
+
+EmbeddingCache::Stats EmbeddingCache::stats() const {
+    Stats stats;
+    stats.hits = hits_.load();
+    stats.misses = misses_.load();
+    stats.capacity = capacity_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.entries = lru_.size();
+    return stats;
+}
+
+} // namespace tldr
@@ -0,0 +1,68 @@
+#ifndef EMBEDDING_CACHE_H
+#define EMBEDDING_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+namespace tldr {
+
+/**
+ * Bounded LRU cache of query embeddings, safe to share between threads.
+ *
+ * Entries are keyed on the embedding model identity plus the normalized query
+ * text (see normalize_query), so a repeated or trivially different question
+ * skips the encoder, and switching models never returns a stale vector.
+ */
+class EmbeddingCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+        size_t capacity = 0;
+    };
+
+    explicit EmbeddingCache(size_t capacity);
+
+    /**
+     * Query text as cached: surrounding whitespace trimmed, inner whitespace runs
+     * collapsed to one space and ASCII letters lowercased. The embedding model's
+     * uncased WordPiece tokenizer discards the same differences.
+     */
+    static std::string normalize_query(std::string_view text);
+
+    /**
+     * Look up the embedding of a query, counting a hit or a miss
+     * @return false if the query is not cached
+     */
+    bool get(const std::string &model_id, std::string_view text, std::vector<float> &embedding);
+
+    // Cache an embedding, evicting the least recently used entry when full
+    void put(const std::string &model_id, std::string_view text, const std::vector<float> &embedding);
+
+    // Drop every entry (the counters are kept)
+    void clear();
+
+    Stats stats() const;
+
+private:
+    using Entry = std::pair<std::string, std::vector<float> >;
+
+    static std::string key_of(const std::string &model_id, std::string_view text);
+
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+} // namespace tldr
+
+#endif // EMBEDDING_CACHE_H
@@ -39,7 +39,18 @@ std::shared_ptr<ContextHandle> LlmContextPool::acquire_context() {
     while (available_contexts_.empty() && all_contexts_.size() >= max_size_) {
         cv_.wait(lock);
     }
-    
+    return take_context_locked();
+}
+
+std::shared_ptr<ContextHandle> LlmContextPool::try_acquire_context() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (available_contexts_.empty() && all_contexts_.size() >= max_size_) {
+        return nullptr;
+    }
+    return take_context_locked();
+}
+
+std::shared_ptr<ContextHandle> LlmContextPool::take_context_locked() {
     llama_context* ctx = nullptr;
     
     // If we have an available context, use it
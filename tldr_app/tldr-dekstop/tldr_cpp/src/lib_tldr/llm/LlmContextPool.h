@@ -40,6 +40,12 @@ public:
      * @return A handle to a context that will be returned to the pool when it goes out of scope
      */
     std::shared_ptr<ContextHandle> acquire_context();
+
+    /**
+     * Get a context only if one is free or can still be created, without waiting
+     * @return A handle to a context, or nullptr when the pool is exhausted
+     */
+    std::shared_ptr<ContextHandle> try_acquire_context();
     
     /**
      * Return a context to the pool
@@ -72,6 +78,9 @@ private:
      * @return A new context
      */
     llama_context* create_context();
+
+    // Hand out an available or new context; the caller holds mutex_
+    std::shared_ptr<ContextHandle> take_context_locked();
 };
 
 /**
@@ -14,13 +14,17 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
-#include <omp.h>
+#include <mutex>
+#include "../task_pool.h"
 
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
 #endif
 
 
+// Guards the call statistics, embedding calls run concurrently on the task pool
+static std::mutex g_stats_mutex;
+
 static void batch_add_seq(llama_batch &batch, const std::vector<int32_t> &tokens, llama_seq_id seq_id) {
     size_t n_tokens = tokens.size();
     for (size_t i = 0; i < n_tokens; i++) {
@@ -28,6 +32,22 @@ static void batch_add_seq(llama_batch &batch, const std::vector<int32_t> &tokens
     }
 }
 
+// Token ids of a text, with or without the special tokens the model adds around every input
+static std::vector<int32_t> tokenize_text(const llama_vocab *vocab, std::string_view text, bool add_special) {
+    // First get token count (returns negative count when only measuring)
+    const int n_tokens = -llama_tokenize(vocab, text.data(), text.size(), NULL, 0, add_special, true);
+    if (n_tokens <= 0) {
+        return {};
+    }
+
+    // Allocate space and get the actual tokens
+    std::vector<int32_t> tokens(n_tokens);
+    if (llama_tokenize(vocab, text.data(), text.size(), tokens.data(), tokens.size(), add_special, true) < 0) {
+        tokens.clear(); // Mark as failed
+    }
+    return tokens;
+}
+
 static void batch_decode(llama_context *ctx, llama_batch &batch, float *output, int n_seq, int n_embd, int embd_norm) {
     const enum llama_pooling_type pooling_type = llama_pooling_type(ctx);
     
@@ -103,13 +123,23 @@ bool LlmEmbeddings::initialize_model(const std::string& model_path) {
               << ", has_decoder: " << (has_decoder ? "true" : "false")
               << ", is_embedding_model: " << (is_embedding_model ? "true" : "false") << std::endl;
 
-    // Set number of OpenMP threads
-    int max_threads = omp_get_max_threads();
-    std::cout << "Embeddings initialized with " << max_threads << " OpenMP threads available" << std::endl;
+    std::cout << "Embeddings initialized with " << tldr::TaskPool::instance().concurrency()
+              << " task pool threads available" << std::endl;
+
+    // Special tokens the tokenizer wraps every input in, added around pre-tokenized chunks
+    const std::vector<int32_t> plain = tokenize_text(vocab, "a", false);
+    const std::vector<int32_t> wrapped = tokenize_text(vocab, "a", true);
+    auto content = std::search(wrapped.begin(), wrapped.end(), plain.begin(), plain.end());
+    if (!plain.empty() && content != wrapped.end()) {
+        special_prefix.assign(wrapped.begin(), content);
+        special_suffix.assign(content + plain.size(), wrapped.end());
+    }
 
     // Create context parameters for embeddings
+    params.n_batch = EMBEDDING_BATCH_TOKENS;
     llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ubatch = 2048;
+    ctx_params.n_batch = EMBEDDING_BATCH_TOKENS;
+    ctx_params.n_ubatch = EMBEDDING_BATCH_TOKENS;
     ctx_params.embeddings = true;
     
     // Create context pool with sizes defined in constants.h
@@ -119,17 +149,59 @@ bool LlmEmbeddings::initialize_model(const std::string& model_path) {
     return true;
 }
 
-std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<std::string_view> input_batch) {
-    // std::cout<<"Embeddings input batch size:"<<input_batch.size()<<"x"<<input_batch[0].size() <<std::endl;
+std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(const std::vector<std::string_view> &input_batch) {
+    auto call_start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<int32_t>> inputs;
+    inputs.resize(input_batch.size());
+
+    // Tokenize the inputs in parallel
+    tldr::parallel_for(input_batch.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            // The views point into a larger document buffer: tokenize exactly their bytes, without copying
+            inputs[i] = tokenize_text(vocab, input_batch[i], true);
+        }
+    });
+    return embed_tokens(inputs, call_start);
+}
+
+std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(const std::vector<std::span<const int32_t>> &token_batch) {
+    auto call_start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<int32_t>> inputs(token_batch.size());
+    for (size_t i = 0; i < token_batch.size(); i++) {
+        if (token_batch[i].empty()) {
+            continue; // Fails the call like an untokenizable text
+        }
+        inputs[i].reserve(special_prefix.size() + token_batch[i].size() + special_suffix.size());
+        inputs[i].insert(inputs[i].end(), special_prefix.begin(), special_prefix.end());
+        inputs[i].insert(inputs[i].end(), token_batch[i].begin(), token_batch[i].end());
+        inputs[i].insert(inputs[i].end(), special_suffix.begin(), special_suffix.end());
+    }
+    return embed_tokens(inputs, call_start);
+}
+
+std::vector<int32_t> LlmEmbeddings::tokenize(std::string_view text) const {
+    return vocab ? tokenize_text(vocab, text, false) : std::vector<int32_t>();
+}
+
+size_t LlmEmbeddings::chunk_token_budget() const {
+    if (!model) {
+        return 0;
+    }
+    const size_t limit = std::min<size_t>(EMBEDDING_CHUNK_TOKENS, llama_model_n_ctx_train(model));
+    const size_t specials = special_prefix.size() + special_suffix.size();
+    return limit > specials ? limit - specials : 0;
+}
+
+std::vector<std::vector<float>> LlmEmbeddings::embed_tokens(const std::vector<std::vector<int32_t>> &inputs,
+                                                            TimePoint call_start) {
     // max batch size
     const uint64_t n_batch = params.n_batch;
-    auto call_start = std::chrono::high_resolution_clock::now();
-    
+
     // We'll determine if we need multiple contexts based on input size
     // For small batches, a single context is sufficient
     // For large batches, we'll use multiple contexts to parallelize further
-    const bool use_multiple_contexts = input_batch.size() > EMBEDDING_MIN_CONTEXTS * 2;
-    
+    const bool use_multiple_contexts = inputs.size() > EMBEDDING_MIN_CONTEXTS * 2;
+
     // Default to single context first
     auto ctx_handle = context_pool->acquire_context();
     if (!ctx_handle) {
@@ -146,28 +218,6 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
     const struct llama_model *model = llama_get_model(ctx);
     enum llama_pooling_type pooling_type = llama_pooling_type(ctx);
 
-    std::vector<std::vector<int32_t>> inputs;
-    inputs.resize(input_batch.size());
-
-    // Tokenize the inputs in parallel
-    #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < (int) input_batch.size(); i++) {
-        std::string inp = input_batch[i].data();
-        
-        // First get token count (returns negative count when only measuring)
-        const int n_tokens = -llama_tokenize(vocab, inp.c_str(), inp.size(), NULL, 0, true, true);
-        
-        if (n_tokens <= 0) {
-            continue; // Skip this input
-        }
-        
-        // Allocate space and get the actual tokens
-        inputs[i].resize(n_tokens);
-        if (llama_tokenize(vocab, inp.c_str(), inp.size(), inputs[i].data(), inputs[i].size(), true, true) < 0) {
-            inputs[i].clear(); // Mark as failed
-        }
-    }
-    
     // Check if any tokenization failed
     bool tokenization_failed = false;
     for (const auto& tokens : inputs) {
@@ -181,13 +231,11 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
         return std::vector<std::vector<float>>();
     }
 
-    // check if the last token is SEP in parallel
+    // check if the last token is SEP
     // it should be automatically added by the tokenizer when 'tokenizer.ggml.add_eos_token' is set to 'true'
     bool missing_sep = false;
-    #pragma omp parallel for reduction(||:missing_sep)
-    for (size_t i = 0; i < inputs.size(); i++) {
-        auto &inp = inputs[i];
-        missing_sep = (inp.empty() || inp.back() != llama_vocab_sep(vocab));
+    for (const auto &inp: inputs) {
+        missing_sep = missing_sep || inp.empty() || inp.back() != llama_vocab_sep(vocab);
     }
     
     if (missing_sep) {
@@ -197,12 +245,11 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
 
 
     // initialize batch
-    const int n_prompts = input_batch.size();
+    const int n_prompts = inputs.size();
     
-    // count number of embeddings in parallel
+    // count number of embeddings
     int n_embd_count = 0;
     if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
-        #pragma omp parallel for reduction(+:n_embd_count)
         for (int k = 0; k < n_prompts; k++) {
             n_embd_count += inputs[k].size();
         }
@@ -220,8 +267,8 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
         // We'll split the work across multiple contexts for parallel processing
         
         // Determine how many contexts to use
-        const int max_contexts = std::min(EMBEDDING_MAX_CONTEXTS, (int)input_batch.size() / 2);
-        const int contexts_to_use = std::min(max_contexts, omp_get_max_threads());
+        const int max_contexts = std::min(EMBEDDING_MAX_CONTEXTS, (int)inputs.size() / 2);
+        const int contexts_to_use = std::min(max_contexts, (int) tldr::TaskPool::instance().concurrency());
         
         // Only proceed with multi-context if we can get at least 2 contexts
         if (contexts_to_use >= 2) {
@@ -232,9 +279,10 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
             context_handles.push_back(std::move(ctx_handle));
             contexts.push_back(ctx);
             
-            // Acquire additional contexts
+            // Acquire additional contexts, without waiting: a context held here while
+            // waiting for another one could deadlock concurrent batches doing the same
             for (int c = 1; c < contexts_to_use; c++) {
-                auto additional_handle = context_pool->acquire_context();
+                auto additional_handle = context_pool->try_acquire_context();
                 if (!additional_handle || !additional_handle->get()) {
                     // Failed to get enough contexts, we'll use what we have
                     break;
@@ -247,41 +295,39 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
             const int actual_contexts = contexts.size();
             const int prompts_per_context = (n_prompts + actual_contexts - 1) / actual_contexts;
             
-            // Track embedding positions
+            // Embedding position of the first prompt of every context
             std::vector<int> embedding_offsets(actual_contexts + 1, 0);
-            
-            #pragma omp parallel for num_threads(actual_contexts)
             for (int c = 0; c < actual_contexts; c++) {
-                // Calculate range for this context
-                const int start_prompt = c * prompts_per_context;
+                const int start_prompt = std::min(c * prompts_per_context, n_prompts);
                 const int end_prompt = std::min(start_prompt + prompts_per_context, n_prompts);
-                
-                if (start_prompt >= end_prompt) continue;
-                
-                // Initialize batch for this context
-                struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
-                
-                // Calculate embedding offset
-                int local_embd_count = 0;
+                int local_embd_count = end_prompt - start_prompt;
                 if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
+                    local_embd_count = 0;
                     for (int k = start_prompt; k < end_prompt; k++) {
                         local_embd_count += inputs[k].size();
                     }
-                } else {
-                    local_embd_count = end_prompt - start_prompt;
                 }
+                embedding_offsets[c + 1] = embedding_offsets[c] + local_embd_count;
+            }
+
+            // One task per context
+            tldr::parallel_for(actual_contexts, 1, [&](size_t context_begin, size_t) {
+                const int c = (int) context_begin;
+                // Calculate range for this context
+                const int start_prompt = c * prompts_per_context;
+                const int end_prompt = std::min(start_prompt + prompts_per_context, n_prompts);
                 
-                #pragma omp critical
-                {
-                    embedding_offsets[c+1] = embedding_offsets[c] + local_embd_count;
-                }
+                if (start_prompt >= end_prompt) return;
+                
+                // Initialize batch for this context
+                struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
                 
                 // Process batches with this context
                 int e = 0; // local embeddings count
                 int s = 0; // local sequence count
                 
                 for (int k = start_prompt; k < end_prompt; k++) {
-                    auto &inp = inputs[k];
+                    const auto &inp = inputs[k];
                     const uint64_t n_toks = inp.size();
                     
                     // Encode if at capacity
@@ -306,7 +352,7 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
                 
                 // Clean up batch
                 llama_batch_free(batch);
-            }
+            });
             
             // All contexts have been used and can be returned to the pool automatically
             // via RAII when context_handles goes out of scope
@@ -325,7 +371,7 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
         int s = 0; // number of prompts in current batch
         for (int k = 0; k < n_prompts; k++) {
             // clamp to n_batch tokens
-            auto &inp = inputs[k];
+            const auto &inp = inputs[k];
             const uint64_t n_toks = inp.size();
             
             // encode if at capacity
@@ -357,11 +403,10 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
 
     auto call_end = std::chrono::high_resolution_clock::now();
 
-    // convert to 2D vector in parallel
+    // convert to 2D vector
     std::vector<std::vector<float>> embeddings_vec;
-    embeddings_vec.resize(n_embd_count);  // Pre-allocate to avoid race conditions
+    embeddings_vec.resize(n_embd_count);
 
-    #pragma omp parallel for schedule(static)
     for (size_t i = 0; i < n_embd_count; ++i) {
         embeddings_vec[i].assign(
             embeddings.begin() + i * n_embd,
@@ -372,14 +417,11 @@ std::vector<std::vector<float>> LlmEmbeddings::llm_get_embeddings(std::vector<st
     double total_ms = std::chrono::duration<double, std::milli>(call_end - call_start).count();
     
     // Log performance information
-    #pragma omp critical
     {
+        std::lock_guard<std::mutex> lock(g_stats_mutex);
         call_times_ms.push_back(total_ms);
-        batch_sizes.push_back(input_batch.size());
-        prompt_sizes.push_back(input_batch.empty()?0:input_batch[0].size());
-        
-        // Optional: Print thread info for debugging
-        // std::cout << "Processed batch of " << input_batch.size() << " items using " << omp_get_num_threads() << " threads in " << total_ms << "ms" << std::endl;
+        batch_sizes.push_back(inputs.size());
+        prompt_sizes.push_back(inputs.empty()?0:inputs[0].size());
     }
 
     return embeddings_vec;
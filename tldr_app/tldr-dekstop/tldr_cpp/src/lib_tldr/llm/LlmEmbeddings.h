@@ -5,6 +5,9 @@
 #define LLM_EMBEDDING_H
 #include <vector>
 #include <memory>
+#include <span>
+#include <chrono>
+#include <string_view>
 #include "llama.h"
 #include "common.h"
 #include "LlmContextPool.h"
@@ -14,7 +17,15 @@ public:
     LlmEmbeddings();
     bool initialize_model(const std::string& model_path);
     void embedding_cleanup();
-    std::vector<std::vector<float>> llm_get_embeddings(std::vector<std::string_view> input_batch);
+    std::vector<std::vector<float>> llm_get_embeddings(const std::vector<std::string_view> &input_batch);
+    // Embeddings of pre-tokenized chunks (ids without special tokens, see tokenize), nothing is tokenized again
+    std::vector<std::vector<float>> llm_get_embeddings(const std::vector<std::span<const int32_t>> &token_batch);
+
+    // Token ids of a text without the special tokens the model adds around every input
+    std::vector<int32_t> tokenize(std::string_view text) const;
+    // Tokens a chunk may hold besides the special tokens, 0 before the model is loaded
+    size_t chunk_token_budget() const;
+    const std::string& get_model_path() const { return model_path; }
     
     // Model type detection properties - made public for access from batch_decode
     std::string model_name;
@@ -22,9 +33,15 @@ public:
     bool has_decoder = false;
     bool is_embedding_model = false;
 private:
+    using TimePoint = std::chrono::high_resolution_clock::time_point;
+    // Encode tokenized inputs (special tokens included) on pooled contexts
+    std::vector<std::vector<float>> embed_tokens(const std::vector<std::vector<int32_t>> &inputs, TimePoint call_start);
+
     std::string model_path;
-    llama_model * model;
-    const llama_vocab * vocab;
+    llama_model * model = nullptr;
+    const llama_vocab * vocab = nullptr;
+    std::vector<int32_t> special_prefix; // e.g. [CLS], added in front of pre-tokenized chunks
+    std::vector<int32_t> special_suffix; // e.g. [SEP]
     common_params params;
     // store total runtime in milliseconds for each embeddings call
     std::vector<double> call_times_ms;
@@ -58,8 +58,7 @@ namespace tldr {
 
     // --- LlmManager Class Implementation ---
 
-    LlmManager::LlmManager() {
-        // do nothing
+    LlmManager::LlmManager() : query_cache(std::make_unique<EmbeddingCache>(QUERY_EMBEDDING_CACHE_SIZE)) {
     }
 
     bool LlmManager::initialize_chat_model(const std::string& model_path) {
@@ -73,6 +72,7 @@ namespace tldr {
 
     bool LlmManager::initialize_embeddings_model(const std::string& model_path) {
     try {
+        query_cache->clear();
         return embedding.initialize_model(model_path);
     } catch (const std::exception &e) {
         std::cerr << "Error: Failed to load embeddings model: " << e.what() << std::endl;
@@ -81,9 +81,46 @@ namespace tldr {
 }
 
     std::vector<std::vector<float>> LlmManager::get_embeddings(const std::vector<std::string_view> &texts) {
+        if (texts.size() != 1) {
+            return embedding.llm_get_embeddings(texts);
+        }
+        const std::string &model_id = embedding.get_model_path();
+        std::vector<std::vector<float>> result(1);
+        if (query_cache->get(model_id, texts[0], result[0])) {
+            return result;
+        }
+        result = embedding.llm_get_embeddings(texts);
+        if (result.size() == 1) {
+            query_cache->put(model_id, texts[0], result[0]);
+        }
+        return result;
+    }
+
+    std::vector<std::vector<float>> LlmManager::get_document_embeddings(const std::vector<std::string_view> &texts) {
         return embedding.llm_get_embeddings(texts);
     }
 
+    std::vector<std::vector<float>> LlmManager::get_document_embeddings(
+        const std::vector<std::span<const int32_t>> &chunk_tokens) {
+        return embedding.llm_get_embeddings(chunk_tokens);
+    }
+
+    std::vector<int32_t> LlmManager::tokenize_for_embedding(std::string_view text) const {
+        return embedding.tokenize(text);
+    }
+
+    size_t LlmManager::chunk_token_budget() const {
+        return embedding.chunk_token_budget();
+    }
+
+    const std::string& LlmManager::embedding_model_id() const {
+        return embedding.get_model_path();
+    }
+
+    EmbeddingCache::Stats LlmManager::query_cache_stats() const {
+        return query_cache->stats();
+    }
+
     std::string LlmManager::get_chat_response(const std::string &context, const std::string &prompt) {
         std::cout<<"\nGenerating Chat LLM Response ..."<<std::endl;
         const std::string system_prompt =
@@ -98,7 +135,7 @@ namespace tldr {
         auto result = chat.chat_with_llm(formatted_prompt);
         if (result.error) {
             std::cerr << "Error: " << result.error << std::endl;
-            return "Error obtaining result from the LLM!";
+            return LLM_ERROR_RESPONSE;
         }
         return result.chat_response;
     }
@@ -106,6 +143,7 @@ namespace tldr {
     void LlmManager::cleanup() {
         chat.llm_chat_cleanup();
         embedding.embedding_cleanup();
+        query_cache->clear();
     }
 
 } // namespace tldr
@@ -4,10 +4,13 @@
 #include <string>
 #include <vector>
 #include <string_view>
+#include <span>
+#include <memory>
 
 
 #include "LlmChat.h"
 #include "LlmEmbeddings.h"
+#include "EmbeddingCache.h"
 
 namespace tldr {
 
@@ -42,11 +45,27 @@ namespace tldr {
 
     public:
         /**
-         * Get embeddings for a batch of texts
+         * Get embeddings for a batch of texts. A single text (a query) is looked up
+         * in the query embedding cache first and cached after encoding.
          * @param texts The texts to embed
          * @return A vector of embedding vectors
          */
         std::vector<std::vector<float>> get_embeddings(const std::vector<std::string_view>& texts);
+
+        // Embeddings of document chunks, never looked up in or added to the query cache
+        std::vector<std::vector<float>> get_document_embeddings(const std::vector<std::string_view>& texts);
+        // Same for chunks tokenized by tokenize_for_embedding, which are not tokenized again
+        std::vector<std::vector<float>> get_document_embeddings(const std::vector<std::span<const int32_t>>& chunk_tokens);
+
+        // Embedding model token ids of a text, without special tokens (for token-budget chunking)
+        std::vector<int32_t> tokenize_for_embedding(std::string_view text) const;
+        // Tokens a chunk may hold for the embedding model, 0 if no embedding model is loaded
+        size_t chunk_token_budget() const;
+        // Identifies the embedding model, so vectors stored for one model are not reused with another
+        const std::string& embedding_model_id() const;
+
+        // Hit/miss counters and size of the query embedding cache
+        EmbeddingCache::Stats query_cache_stats() const;
         
         /**
          * Get a chat response for a given context and user prompt
@@ -68,6 +87,7 @@ namespace tldr {
     private:
         LlmChat chat;         // Chat model and its context pool
         LlmEmbeddings embedding; // Embeddings model and its context pool
+        std::unique_ptr<EmbeddingCache> query_cache; // Single-query embeddings keyed on the model path
     };
 
     // Initialization function (call once)
@@ -0,0 +1,731 @@
+#include "cpu_similarity.h"
+#include "simd_dot.h"
+#include "segmented_index.h"
+#include "search_filter.h"
+#include "../vec_dump.h"
+#include "../constants.h"
+#include "../task_pool.h"
+
+#include <iostream>
+#include <filesystem>
+#include <mutex>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <iomanip>
+#include <unordered_set>
+#include <atomic>
+#include <unistd.h>
+
+namespace tldr {
+
+std::vector<std::string> find_vector_dump_files(const std::string &corpus_dir) {
+    std::vector<std::string> files;
+    try {
+        if (std::filesystem::exists(corpus_dir)) {
+            for (const auto &entry: std::filesystem::recursive_directory_iterator(corpus_dir)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".vecdump") {
+                    files.push_back(entry.path().string());
+                }
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error scanning corpus directory " << corpus_dir << ": " << e.what() << std::endl;
+    }
+    return files;
+}
+
+void scan_vectors_cosine(const float *query, float query_norm, size_t dims,
+                         const float *vectors, const uint64_t *hashes, size_t count,
+                         BoundedTopK &top) {
+    if (query_norm <= 0.0f) return;
+    for (size_t i = 0; i < count; ++i) {
+        float dot, v_norm_sq;
+        simd::dot_norm_f32(query, vectors + i * dims, dims, &dot, &v_norm_sq);
+        if (v_norm_sq <= 0.0f) continue;
+        top.push(dot / (query_norm * std::sqrt(v_norm_sq)), hashes[i]);
+    }
+}
+
+std::vector<SimilarityResult> cpu_search_vectors(const float *query, size_t dims,
+                                                 const float *vectors, const uint64_t *hashes,
+                                                 size_t count, size_t k) {
+    BoundedTopK top(k);
+    const float query_norm = std::sqrt(simd::dot_f32(query, query, dims));
+    scan_vectors_cosine(query, query_norm, dims, vectors, hashes, count, top);
+    return top.sorted();
+}
+
+// A contiguous range of rows inside one mapped dump file
+struct ScanShard {
+    size_t entry;
+    const MappedVectorData *dump;
+    size_t row_begin;
+    size_t row_end;
+    const uint64_t *allowed; // Row bitset of the search filter, nullptr if every row passes
+};
+
+// Shards start on multiples of 64 rows, so filter words never straddle two shards
+static_assert(CPU_SEARCH_SHARD_ROWS % 64 == 0, "CPU_SEARCH_SHARD_ROWS must be a multiple of 64");
+
+// Call fn(row) for every row of a shard that passes the filter. Filtered
+// shards walk the set bits of their bitset a word at a time, so rows that are
+// filtered out are never loaded.
+template<typename Fn>
+static void for_each_row(const ScanShard &shard, Fn &&fn) {
+    if (!shard.allowed) {
+        for (size_t row = shard.row_begin; row < shard.row_end; ++row) fn(row);
+        return;
+    }
+    for (size_t base = shard.row_begin; base < shard.row_end; base += 64) {
+        uint64_t word = shard.allowed[base / 64];
+        if (shard.row_end - base < 64) word &= (uint64_t{1} << (shard.row_end - base)) - 1;
+        for (; word; word &= word - 1) fn(base + std::countr_zero(word));
+    }
+}
+
+// Query folded into the per-dimension affine int8 decoding of one dump:
+// q . (scale * code + offset) = (q * scale) . code + q . offset
+struct PreparedQuery {
+    std::vector<float> scaled;
+    float bias = 0.0f;
+    std::vector<float> prefix; // Unit query prefix for the coarse prefix section, empty if unused
+};
+
+// First stage of a two-stage search; its survivors are scored exactly
+enum class Prefilter {
+    None,   // Exhaustive scan
+    Binary, // Hamming distance over the 1-bit sign tier
+    Prefix  // Cosine of the leading dimensions over the coarse prefix section
+};
+
+struct ScanMode {
+    Prefilter prefilter = Prefilter::None;
+    size_t candidates = 0; // Survivors of the prefilter
+    bool report = true;    // Print the scan summary
+};
+
+// Reject foreign files before handing their pointers to the kernels
+// (read_vector_dump_file already rejected truncated ones)
+static bool dump_is_scannable(const MappedVectorData &dump, size_t dims, const std::string &path) {
+    const auto *h = dump.header;
+    if (h->vector_dimensions != dims || h->hash_size_bytes != sizeof(uint64_t)) {
+        std::cerr << "Skipping " << path << ": vector layout does not match query ("
+                  << h->vector_dimensions << " dims)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool scans_quantized(const MappedVectorData &dump) {
+    return dump.version >= 2 && dump.element_type != VectorElementType::Float32;
+}
+
+// Approximate cosine scores of the quantized rows of a shard against a unit
+// query. The shortlist is keyed by (entry << 32 | row) so the candidates can be
+// rescored afterwards.
+static void scan_quantized_cosine(const float *query, size_t dims, const ScanShard &shard,
+                                  const PreparedQuery &prepared, BoundedTopK &shortlist) {
+    const MappedVectorData &dump = *shard.dump;
+    const bool normalized = dump.normalized();
+    const uint64_t entry_key = static_cast<uint64_t>(shard.entry) << 32;
+    for_each_row(shard, [&](size_t row) {
+        const float norm = normalized ? 1.0f : dump.norms[row];
+        if (norm <= 0.0f) return;
+        float dot;
+        if (dump.element_type == VectorElementType::Float16) {
+            dot = simd::dot_f32_f16(query, static_cast<const uint16_t *>(dump.quantized) + row * dims, dims);
+        } else if (dump.int8_scaling == Int8Scaling::PerDimension) {
+            dot = simd::dot_f32_i8(prepared.scaled.data(), static_cast<const int8_t *>(dump.quantized) + row * dims,
+                                   dims) + prepared.bias;
+        } else {
+            dot = dump.scales[row] *
+                  simd::dot_f32_i8(query, static_cast<const int8_t *>(dump.quantized) + row * dims, dims);
+        }
+        shortlist.push(normalized ? dot : dot / norm, entry_key | row);
+    });
+}
+
+// Float32 rows of a dump against a unit query, kept under (entry << 32 | row)
+// keys: rows of normalized dumps score their plain inner product, others
+// divide by the stored norm (legacy dumps without norms recompute it)
+static void scan_float_rows(const float *query, size_t dims, const ScanShard &shard, BoundedTopK &top) {
+    const MappedVectorData &dump = *shard.dump;
+    const uint64_t entry_key = static_cast<uint64_t>(shard.entry) << 32;
+    if (dump.normalized()) {
+        for_each_row(shard, [&](size_t row) {
+            top.push(simd::dot_f32(query, dump.vectors + row * dims, dims), entry_key | row);
+        });
+        return;
+    }
+    for_each_row(shard, [&](size_t row) {
+        const float *vector = dump.vectors + row * dims;
+        float dot, norm;
+        if (dump.norms) {
+            dot = simd::dot_f32(query, vector, dims);
+            norm = dump.norms[row];
+        } else {
+            simd::dot_norm_f32(query, vector, dims, &dot, &norm);
+            norm = std::sqrt(norm);
+        }
+        if (norm <= 0.0f) return;
+        top.push(dot / norm, entry_key | row);
+    });
+}
+
+// Hamming distances between the query's sign bits and the binary tier of a
+// shard; the best survivors are kept under (entry << 32 | row) keys
+static void scan_binary_hamming(const uint64_t *query_bits, const MappedBinaryCodes &bits, const ScanShard &shard,
+                                BoundedTopK &survivors) {
+    const size_t words = bits.header->words_per_vector;
+    const uint64_t entry_key = static_cast<uint64_t>(shard.entry) << 32;
+    for_each_row(shard, [&](size_t row) {
+        uint32_t distance = simd::hamming_u64(query_bits, bits.codes + row * words, words);
+        survivors.push(-static_cast<float>(distance), entry_key | row);
+    });
+}
+
+// Prefix cosine of the rows of a shard against the unit query prefix; the best
+// survivors are kept under (entry << 32 | row) keys
+static void scan_prefix_rows(const PreparedQuery &prepared, const ScanShard &shard, BoundedTopK &survivors) {
+    const MappedVectorData &dump = *shard.dump;
+    const size_t prefix_dims = dump.prefix_dimensions;
+    const uint64_t entry_key = static_cast<uint64_t>(shard.entry) << 32;
+    for_each_row(shard, [&](size_t row) {
+        float dot = simd::dot_f32_i8(prepared.prefix.data(), dump.prefix + row * prefix_dims, prefix_dims);
+        survivors.push(dump.prefix_scales[row] * dot, entry_key | row);
+    });
+}
+
+// Cosine similarity of one row with a unit query, from the float32 section when the dump has one
+static float exact_cosine(const MappedVectorData &dump, size_t row, const float *query, size_t dims,
+                          std::vector<float> &buffer) {
+    const float *vector = dump.vectors ? dump.vectors + row * dims : nullptr;
+    if (!vector) {
+        buffer.resize(dims);
+        decode_vector(dump, row, buffer.data());
+        vector = buffer.data();
+    }
+    if (dump.normalized()) {
+        return simd::dot_f32(query, vector, dims);
+    }
+    float dot, norm_sq;
+    simd::dot_norm_f32(query, vector, dims, &dot, &norm_sq);
+    return norm_sq > 0.0f ? dot / std::sqrt(norm_sq) : 0.0f;
+}
+
+// Turn (entry << 32 | row) keys back into hashes, with the rows they were found at if asked for
+static void resolve_rows(const std::vector<SegmentedIndex::Entry> &entries, std::vector<SimilarityResult> &results,
+                         std::vector<SegmentedIndex::RowRef> *rows) {
+    if (rows) {
+        rows->clear();
+    }
+    for (auto &result: results) {
+        const SegmentedIndex::Entry &entry = entries[result.hash >> 32];
+        const auto row = static_cast<uint32_t>(result.hash & 0xFFFFFFFFu);
+        result.hash = entry.data->hashes[row];
+        if (rows) {
+            rows->push_back({entry.data, entry.docs, row});
+        }
+    }
+}
+
+// Shared by the exhaustive, the binary-prefiltered and the prefix-prefiltered search
+static std::vector<SimilarityResult> search_corpus(const std::string &corpus_dir, const float *raw_query,
+                                                   size_t dims, size_t k, const ScanMode &mode,
+                                                   const SearchFilter *filter,
+                                                   std::vector<SegmentedIndex::RowRef> *rows) {
+    // Normalize the query once; against normalized dumps cosine is then a plain dot product
+    std::vector<float> unit_query(raw_query, raw_query + dims);
+    if (!normalize_vector(unit_query.data(), dims)) {
+        return {};
+    }
+    const float *query = unit_query.data();
+
+    // The snapshot keeps every mapping alive even if a compaction swaps files meanwhile
+    std::shared_ptr<SegmentedIndex> index = SegmentedIndex::open(corpus_dir);
+    if (!index) {
+        std::cerr << "Corpus directory does not exist: " << corpus_dir << std::endl;
+        return {};
+    }
+    std::vector<SegmentedIndex::Entry> entries = index->live_entries();
+    std::unique_ptr<CompiledFilter> compiled;
+    if (filter && !filter->empty()) {
+        compiled = std::make_unique<CompiledFilter>(*filter, entries);
+    }
+
+    std::vector<ScanShard> shards;
+    std::vector<PreparedQuery> prepared(entries.size());
+    size_t scanned_files = 0;
+    for (size_t e = 0; e < entries.size(); ++e) {
+        const MappedVectorData &dump = *entries[e].data;
+        if (compiled && compiled->skips(e)) continue;
+        if (!dump_is_scannable(dump, dims, entries[e].rel_path)) continue;
+        const uint64_t *allowed = compiled ? compiled->rows(e) : nullptr;
+
+        if (scans_quantized(dump) && dump.element_type == VectorElementType::Int8 &&
+            dump.int8_scaling == Int8Scaling::PerDimension) {
+            prepared[e].scaled.resize(dims);
+            for (size_t d = 0; d < dims; ++d) {
+                prepared[e].scaled[d] = query[d] * dump.scales[2 * d];
+                prepared[e].bias += query[d] * dump.scales[2 * d + 1];
+            }
+        }
+        if (mode.prefilter == Prefilter::Prefix && dump.prefix) {
+            prepared[e].prefix.assign(query, query + dump.prefix_dimensions);
+            normalize_vector(prepared[e].prefix.data(), dump.prefix_dimensions);
+        }
+
+        const size_t rows = dump.header->num_entries;
+        for (size_t begin = 0; begin < rows; begin += CPU_SEARCH_SHARD_ROWS) {
+            shards.push_back({e, &dump, begin, std::min(begin + CPU_SEARCH_SHARD_ROWS, rows), allowed});
+        }
+        ++scanned_files;
+    }
+
+    if (shards.empty()) {
+        return {};
+    }
+
+    std::vector<uint64_t> query_bits((dims + 63) / 64);
+    sign_bits(query, dims, query_bits.data());
+
+    // Float32 rows are scored exactly; quantized rows go to a wider shortlist first
+    const size_t shortlist_size = k * CPU_SEARCH_RESCORE_FACTOR;
+    const size_t survivor_count = mode.prefilter == Prefilter::None ? 0 : mode.candidates;
+    BoundedTopK merged(k);
+    BoundedTopK merged_shortlist(shortlist_size);
+    BoundedTopK merged_survivors(survivor_count);
+    std::mutex merge_mutex;
+
+    // One pool task per shard, so dense or slow files are spread over idle workers
+    parallel_for(shards.size(), 1, [&](size_t shard_begin, size_t shard_end) {
+        BoundedTopK local(k);
+        BoundedTopK shortlist(shortlist_size);
+        BoundedTopK survivors(survivor_count);
+        for (size_t s = shard_begin; s < shard_end; ++s) {
+            const ScanShard &shard = shards[s];
+            // Files written before the binary tier or the prefix section existed are scanned as usual
+            if (mode.prefilter == Prefilter::Binary && entries[shard.entry].bits) {
+                scan_binary_hamming(query_bits.data(), *entries[shard.entry].bits, shard, survivors);
+                continue;
+            }
+            if (mode.prefilter == Prefilter::Prefix && shard.dump->prefix) {
+                scan_prefix_rows(prepared[shard.entry], shard, survivors);
+                continue;
+            }
+            if (scans_quantized(*shard.dump)) {
+                scan_quantized_cosine(query, dims, shard, prepared[shard.entry], shortlist);
+                continue;
+            }
+            scan_float_rows(query, dims, shard, local);
+        }
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        merged.merge(local);
+        merged_shortlist.merge(shortlist);
+        merged_survivors.merge(survivors);
+    });
+
+    // Rescore the shortlist against the float32 section where the dump has one
+    size_t rescored = 0;
+    for (const SimilarityResult &candidate: merged_shortlist.sorted()) {
+        const MappedVectorData &dump = *entries[candidate.hash >> 32].data;
+        const size_t row = candidate.hash & 0xFFFFFFFFu;
+        float score = candidate.score;
+        if (dump.vectors) {
+            score = simd::dot_f32(query, dump.vectors + row * dims, dims);
+            if (!dump.normalized()) score /= dump.norms[row];
+            ++rescored;
+        }
+        merged.push(score, candidate.hash);
+    }
+
+    // Prefilter survivors are scored exactly
+    std::vector<float> buffer;
+    for (const SimilarityResult &candidate: merged_survivors.sorted()) {
+        const MappedVectorData &dump = *entries[candidate.hash >> 32].data;
+        const size_t row = candidate.hash & 0xFFFFFFFFu;
+        merged.push(exact_cosine(dump, row, query, dims, buffer), candidate.hash);
+    }
+
+    std::vector<SimilarityResult> results = merged.sorted();
+    resolve_rows(entries, results, rows);
+    if (!mode.report) {
+        return results;
+    }
+    std::cout << "CPU search (" << simd::active_isa() << ") scanned " << scanned_files << " index files in "
+              << shards.size() << " shards on " << TaskPool::instance().concurrency() << " pool threads, rescored "
+              << rescored
+              << " quantized candidates"
+              << (mode.prefilter == Prefilter::Binary ? " (binary prefilter)"
+                  : mode.prefilter == Prefilter::Prefix ? " (prefix prefilter)" : "");
+    if (compiled) {
+        std::cout << ", filter passed " << compiled->matches() << " rows";
+    }
+    std::cout << std::endl;
+    return results;
+}
+
+std::vector<SimilarityResult> cpu_search_corpus(const std::string &corpus_dir,
+                                                const float *query, size_t dims, size_t k,
+                                                const SearchFilter *filter,
+                                                std::vector<SegmentedIndex::RowRef> *rows) {
+    return search_corpus(corpus_dir, query, dims, k, ScanMode{}, filter, rows);
+}
+
+// Whether any row of [row_begin, row_end) is set in a filter bitset
+static bool any_row_allowed(const uint64_t *allowed, size_t row_begin, size_t row_end) {
+    for (size_t row = row_begin; row < row_end; row = (row / 64 + 1) * 64) {
+        if (allowed[row / 64] >> (row % 64)) return true;
+    }
+    return false;
+}
+
+// Rows [row_begin, row_end) of a shard as float32: the float32 section when the
+// dump has one, else decoded into the buffer. Norms (needed only for dumps that
+// are not normalized) come from the norms section or are computed here.
+static const float *float_row_tile(const MappedVectorData &dump, size_t row_begin, size_t row_end, size_t dims,
+                                   std::vector<float> &buffer, float *norms) {
+    const size_t rows = row_end - row_begin;
+    const float *tile = dump.vectors ? dump.vectors + row_begin * dims : nullptr;
+    if (!tile) {
+        buffer.resize(rows * dims);
+        for (size_t r = 0; r < rows; ++r) {
+            decode_vector(dump, row_begin + r, buffer.data() + r * dims);
+        }
+        tile = buffer.data();
+    }
+    if (dump.normalized()) {
+        return tile;
+    }
+    for (size_t r = 0; r < rows; ++r) {
+        norms[r] = dump.norms ? dump.norms[row_begin + r]
+                              : std::sqrt(simd::dot_f32(tile + r * dims, tile + r * dims, dims));
+    }
+    return tile;
+}
+
+std::vector<std::vector<SimilarityResult> > cpu_search_corpus_batch(
+    const std::string &corpus_dir, const float *queries, size_t num_queries, size_t dims, size_t k,
+    const SearchFilter *filter, std::vector<std::vector<SegmentedIndex::RowRef> > *rows) {
+    std::vector<std::vector<SimilarityResult> > results(num_queries);
+    if (rows) {
+        rows->assign(num_queries, {});
+    }
+    if (num_queries == 0) {
+        return results;
+    }
+    std::shared_ptr<SegmentedIndex> index = SegmentedIndex::open(corpus_dir);
+    if (!index) {
+        std::cerr << "Corpus directory does not exist: " << corpus_dir << std::endl;
+        return results;
+    }
+    std::vector<SegmentedIndex::Entry> entries = index->live_entries();
+    std::unique_ptr<CompiledFilter> compiled;
+    if (filter && !filter->empty()) {
+        compiled = std::make_unique<CompiledFilter>(*filter, entries);
+    }
+
+    std::vector<ScanShard> shards;
+    for (size_t e = 0; e < entries.size(); ++e) {
+        const MappedVectorData &dump = *entries[e].data;
+        if (compiled && compiled->skips(e)) continue;
+        if (!dump_is_scannable(dump, dims, entries[e].rel_path)) continue;
+        const uint64_t *allowed = compiled ? compiled->rows(e) : nullptr;
+        const size_t rows = dump.header->num_entries;
+        for (size_t begin = 0; begin < rows; begin += CPU_SEARCH_SHARD_ROWS) {
+            shards.push_back({e, &dump, begin, std::min(begin + CPU_SEARCH_SHARD_ROWS, rows), allowed});
+        }
+    }
+    if (shards.empty()) {
+        return results;
+    }
+
+    // Unit queries turn scores against normalized dumps into the raw tile products
+    std::vector<float> unit_queries(queries, queries + num_queries * dims);
+    std::vector<bool> skip_query(num_queries);
+    for (size_t q = 0; q < num_queries; ++q) {
+        skip_query[q] = !normalize_vector(unit_queries.data() + q * dims, dims);
+    }
+
+    std::vector<BoundedTopK> merged(num_queries, BoundedTopK(k));
+    std::mutex merge_mutex;
+
+    parallel_for(shards.size(), 1, [&](size_t shard_begin, size_t shard_end) {
+        std::vector<BoundedTopK> local(num_queries, BoundedTopK(k));
+        std::vector<float> buffer;
+        std::vector<float> row_norms(CPU_BATCH_ROW_TILE);
+        std::vector<float> scores(CPU_BATCH_QUERY_TILE * CPU_BATCH_ROW_TILE);
+        for (size_t s = shard_begin; s < shard_end; ++s) {
+            const ScanShard &shard = shards[s];
+            const MappedVectorData &dump = *shard.dump;
+            const uint64_t entry_key = static_cast<uint64_t>(shard.entry) << 32;
+            for (size_t row = shard.row_begin; row < shard.row_end; row += CPU_BATCH_ROW_TILE) {
+                const size_t row_end = std::min(row + CPU_BATCH_ROW_TILE, shard.row_end);
+                const size_t rows = row_end - row;
+                if (shard.allowed && !any_row_allowed(shard.allowed, row, row_end)) continue;
+                const float *tile = float_row_tile(dump, row, row_end, dims, buffer, row_norms.data());
+                const bool normalized = dump.normalized();
+
+                // The row tile stays cache resident while every query tile is scored against it
+                for (size_t q0 = 0; q0 < num_queries; q0 += CPU_BATCH_QUERY_TILE) {
+                    const size_t nq = std::min(static_cast<size_t>(CPU_BATCH_QUERY_TILE), num_queries - q0);
+                    simd::dot_tile_f32(unit_queries.data() + q0 * dims, nq, tile, rows, dims, scores.data());
+                    for (size_t q = 0; q < nq; ++q) {
+                        if (skip_query[q0 + q]) continue;
+                        const float *query_scores = scores.data() + q * rows;
+                        for (size_t r = 0; r < rows; ++r) {
+                            if (!row_allowed(shard.allowed, row + r)) continue;
+                            if (normalized) {
+                                local[q0 + q].push(query_scores[r], entry_key | (row + r));
+                            } else if (row_norms[r] > 0.0f) {
+                                local[q0 + q].push(query_scores[r] / row_norms[r], entry_key | (row + r));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (size_t q = 0; q < num_queries; ++q) {
+            merged[q].merge(local[q]);
+        }
+    });
+
+    std::cout << "CPU batch search (" << simd::active_isa() << ") scored " << num_queries << " queries over "
+              << shards.size() << " shards on " << TaskPool::instance().concurrency() << " pool threads" << std::endl;
+    for (size_t q = 0; q < num_queries; ++q) {
+        results[q] = merged[q].sorted();
+        resolve_rows(entries, results[q], rows ? &(*rows)[q] : nullptr);
+    }
+    return results;
+}
+
+std::vector<SimilarityResult> cpu_search_corpus_binary(const std::string &corpus_dir, const float *query,
+                                                       size_t dims, size_t k, size_t candidates,
+                                                       const SearchFilter *filter,
+                                                       std::vector<SegmentedIndex::RowRef> *rows) {
+    if (candidates == 0) candidates = BINARY_PREFILTER_CANDIDATES;
+    return search_corpus(corpus_dir, query, dims, k, {Prefilter::Binary, std::max(candidates, k * 4)}, filter,
+                         rows);
+}
+
+std::vector<SimilarityResult> cpu_search_corpus_prefix(const std::string &corpus_dir, const float *query,
+                                                       size_t dims, size_t k, size_t candidates,
+                                                       const SearchFilter *filter,
+                                                       std::vector<SegmentedIndex::RowRef> *rows) {
+    if (candidates == 0) candidates = PREFIX_SEARCH_CANDIDATES;
+    return search_corpus(corpus_dir, query, dims, k, {Prefilter::Prefix, std::max(candidates, k * 4)}, filter,
+                         rows);
+}
+
+bool benchmark_prefix_search(const std::string &corpus_dir, size_t num_queries, size_t k) {
+    std::shared_ptr<SegmentedIndex> index = SegmentedIndex::open(corpus_dir);
+    if (!index || num_queries == 0 || k == 0) {
+        std::cerr << "Prefix benchmark: nothing to search in " << corpus_dir << std::endl;
+        return false;
+    }
+    std::vector<SegmentedIndex::Entry> entries = index->live_entries();
+    size_t total_rows = 0, prefix_rows = 0, dims = 0;
+    uint64_t full_bytes = 0, prefix_bytes = 0;
+    for (const auto &entry: entries) {
+        const MappedVectorData &dump = *entry.data;
+        const size_t rows = dump.header->num_entries;
+        if (dims == 0) dims = dump.header->vector_dimensions;
+        if (dump.header->vector_dimensions != dims) continue;
+        total_rows += rows;
+        // Bytes the first pass reads: the row codes and their per-row scale
+        const size_t row_bytes = dump.version >= 2 && dump.element_type == VectorElementType::Int8
+                                     ? dims + (dump.int8_scaling == Int8Scaling::PerVector ? sizeof(float) : 0)
+                                     : dump.element_type == VectorElementType::Float16 ? dims * 2 : dims * 4;
+        full_bytes += rows * row_bytes;
+        if (dump.prefix) {
+            prefix_rows += rows;
+            prefix_bytes += rows * (dump.prefix_dimensions + sizeof(float));
+        } else {
+            prefix_bytes += rows * row_bytes;
+        }
+    }
+    if (total_rows == 0) {
+        std::cerr << "Prefix benchmark: nothing to search in " << corpus_dir << std::endl;
+        return false;
+    }
+
+    // Queries are corpus rows spread over the whole corpus
+    std::vector<std::vector<float> > queries;
+    const size_t stride = std::max<size_t>(1, total_rows / num_queries);
+    for (size_t q = 0, global = 0; q < num_queries && global < total_rows; ++q, global += stride) {
+        size_t row = global;
+        for (const auto &entry: entries) {
+            const size_t rows = entry.data->header->num_entries;
+            if (entry.data->header->vector_dimensions != dims) continue;
+            if (row < rows) {
+                queries.emplace_back(dims);
+                decode_vector(*entry.data, row, queries.back().data());
+                break;
+            }
+            row -= rows;
+        }
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto run = [&](const ScanMode &mode, std::vector<std::vector<SimilarityResult> > &results) {
+        results.clear();
+        const auto start = clock::now();
+        for (const auto &query: queries) {
+            results.push_back(search_corpus(corpus_dir, query.data(), dims, k, mode, nullptr, nullptr));
+        }
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count() / queries.size();
+    };
+
+    std::vector<std::vector<SimilarityResult> > truth, results;
+    const double exhaustive_ms = run({Prefilter::None, 0, false}, truth);
+
+    std::cout << "Prefix search benchmark: " << queries.size() << " queries, k=" << k << ", " << total_rows
+              << " rows (" << prefix_rows << " with a prefix section)" << std::endl;
+    std::cout << "First pass reads " << prefix_bytes / 1024 << " KiB per query instead of " << full_bytes / 1024
+              << " KiB" << std::endl;
+    std::cout << std::setw(12) << "candidates" << std::setw(12) << "recall@k" << std::setw(14) << "latency ms"
+              << std::setw(10) << "speedup" << std::endl;
+    std::cout << std::setw(12) << "exhaustive" << std::setw(12) << "1.0000" << std::setw(14) << std::fixed
+              << std::setprecision(3) << exhaustive_ms << std::setw(10) << "1.00" << std::endl;
+    for (size_t factor: {4, 8, 16, 32, 64}) {
+        const size_t candidates = k * factor;
+        const double ms = run({Prefilter::Prefix, candidates, false}, results);
+        size_t found = 0, expected = 0;
+        for (size_t q = 0; q < queries.size(); ++q) {
+            std::unordered_set<uint64_t> exact;
+            for (const auto &r: truth[q]) exact.insert(r.hash);
+            for (const auto &r: results[q]) found += exact.count(r.hash);
+            expected += truth[q].size();
+        }
+        std::cout << std::setw(12) << candidates << std::setw(12) << std::setprecision(4)
+                  << (expected ? static_cast<double>(found) / expected : 1.0) << std::setw(14)
+                  << std::setprecision(3) << ms << std::setw(10) << std::setprecision(2)
+                  << (ms > 0.0 ? exhaustive_ms / ms : 0.0) << std::endl;
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    return true;
+}
+
+bool test_quantized_search() {
+    std::cout << "=== Testing Quantized and Prefiltered Search Against Exhaustive float32 Search ===" << std::endl;
+
+    // A small corpus of clustered vectors over three documents, int8 with a prefix section and binary codes
+    const size_t num_documents = 3, rows_per_document = 400, dims = 128, k = 10, num_queries = 30;
+    uint64_t state = 0x2545f4914f6cdd1dull;
+    auto next_float = [&state]() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<float>(static_cast<int32_t>(state >> 32)) / 2147483648.0f;
+    };
+    std::vector<std::vector<float> > centroids(24, std::vector<float>(dims));
+    for (auto &centroid: centroids) {
+        for (auto &value: centroid) value = next_float();
+    }
+    std::vector<std::vector<float> > vectors;
+    std::vector<uint64_t> hashes;
+    for (size_t i = 0; i < num_documents * rows_per_document; ++i) {
+        const auto &centroid = centroids[i % centroids.size()];
+        vectors.emplace_back(dims);
+        for (size_t j = 0; j < dims; ++j) vectors.back()[j] = centroid[j] + 0.6f * next_float();
+        hashes.push_back(0x100000000ull + i * 104729);
+    }
+
+    static std::atomic<uint32_t> run{0};
+    const std::filesystem::path corpus_dir = std::filesystem::temp_directory_path() /
+                                             ("tldr_search_test_" + std::to_string(getpid()) + "_" +
+                                              std::to_string(run++));
+    std::error_code ec;
+    std::filesystem::create_directories(corpus_dir, ec);
+
+    std::cout << "\nStep 1: Dumping " << vectors.size() << " vectors of " << dims << " dimensions in "
+              << num_documents << " documents" << std::endl;
+    VectorDumpFormat format;
+    format.element_type = VectorElementType::Int8;
+    format.rescore_section = false;
+    format.binary_codes = true;
+    format.normalize = true;
+    format.prefix_dimensions = dims / 2;
+    for (size_t d = 0; d < num_documents; ++d) {
+        const auto first = static_cast<std::ptrdiff_t>(d * rows_per_document);
+        std::vector<std::vector<float> > embeddings(vectors.begin() + first,
+                                                    vectors.begin() + first + rows_per_document);
+        std::vector<uint64_t> document_hashes(hashes.begin() + first, hashes.begin() + first + rows_per_document);
+        const std::string source = (corpus_dir / ("document_" + std::to_string(d) + ".pdf")).string();
+        if (!dump_vectors_to_file(source, embeddings, document_hashes, "search_test_" + std::to_string(d), format)) {
+            std::cerr << "Error: Failed to dump the test corpus" << std::endl;
+            std::filesystem::remove_all(corpus_dir, ec);
+            return false;
+        }
+    }
+
+    // Queries near corpus rows; the truth is an exact float32 scan of the original vectors
+    std::vector<std::vector<float> > queries;
+    std::vector<std::unordered_set<uint64_t> > truth;
+    for (size_t q = 0; q < num_queries; ++q) {
+        queries.emplace_back(vectors[(q * 97) % vectors.size()]);
+        for (auto &value: queries.back()) value += 0.2f * next_float();
+        BoundedTopK top(k);
+        for (size_t i = 0; i < vectors.size(); ++i) {
+            float dot = 0.0f, norm = 0.0f;
+            for (size_t j = 0; j < dims; ++j) {
+                dot += queries.back()[j] * vectors[i][j];
+                norm += vectors[i][j] * vectors[i][j];
+            }
+            top.push(dot / std::sqrt(norm), hashes[i]);
+        }
+        truth.emplace_back();
+        for (const auto &result: top.sorted()) truth.back().insert(result.hash);
+    }
+
+    auto recall_of = [&](const std::vector<std::vector<SimilarityResult> > &results) {
+        size_t found = 0;
+        for (size_t q = 0; q < num_queries; ++q) {
+            for (const auto &result: results[q]) found += truth[q].count(result.hash);
+        }
+        return static_cast<double>(found) / (num_queries * k);
+    };
+    auto run_each = [&](auto &&search) {
+        std::vector<std::vector<SimilarityResult> > results;
+        for (const auto &query: queries) results.push_back(search(query.data()));
+        return results;
+    };
+
+    std::cout << "\nStep 2: Comparing recall@" << k << " over " << num_queries << " queries" << std::endl;
+    std::vector<float> flat_queries;
+    for (const auto &query: queries) flat_queries.insert(flat_queries.end(), query.begin(), query.end());
+    struct Check {
+        const char *name;
+        std::vector<std::vector<SimilarityResult> > results;
+        double min_recall;
+    };
+    const std::vector<Check> checks = {
+        {"int8 scan", run_each([&](const float *query) {
+            return cpu_search_corpus(corpus_dir.string(), query, dims, k);
+        }), 0.95},
+        {"int8 batch scan", cpu_search_corpus_batch(corpus_dir.string(), flat_queries.data(), num_queries, dims, k),
+         0.95},
+        {"prefix prefilter", run_each([&](const float *query) {
+            return cpu_search_corpus_prefix(corpus_dir.string(), query, dims, k, k * 16);
+        }), 0.9},
+        {"binary prefilter", run_each([&](const float *query) {
+            return cpu_search_corpus_binary(corpus_dir.string(), query, dims, k, k * 32);
+        }), 0.85},
+    };
+    bool all_passed = true;
+    for (const auto &check: checks) {
+        const double recall = recall_of(check.results);
+        const bool passed = check.results.size() == num_queries && recall >= check.min_recall;
+        std::cout << "  " << check.name << ": recall " << recall << " (at least " << check.min_recall << ") -> "
+                  << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+
+    std::filesystem::remove_all(corpus_dir, ec);
+    std::cout << "\nTest result: " << (all_passed ? "PASSED" : "FAILED") << std::endl;
+    return all_passed;
+}
+
+} // namespace tldr
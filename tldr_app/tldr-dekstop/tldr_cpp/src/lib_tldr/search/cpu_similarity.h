@@ -0,0 +1,86 @@
+#ifndef TLDR_CPP_CPU_SIMILARITY_H
+#define TLDR_CPP_CPU_SIMILARITY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "npu_accelerator.h"
+#include "top_k.h"
+#include "segmented_index.h"
+
+struct SearchFilter;
+
+namespace tldr {
+
+// Collect every .vecdump file under a corpus directory (recursive)
+std::vector<std::string> find_vector_dump_files(const std::string &corpus_dir);
+
+// Score rows [0, count) of a row-major float32 matrix against the query by
+// cosine similarity and feed them into the caller's top-k collector
+void scan_vectors_cosine(const float *query, float query_norm, size_t dims,
+                         const float *vectors, const uint64_t *hashes, size_t count,
+                         BoundedTopK &top);
+
+// Top-k cosine search over an in-memory block of vectors
+std::vector<SimilarityResult> cpu_search_vectors(const float *query, size_t dims,
+                                                 const float *vectors, const uint64_t *hashes,
+                                                 size_t count, size_t k);
+
+// Top-k cosine search over the live files of a corpus' segmented index.
+// Dumps and segments are split into row shards that are scanned as tasks of
+// the shared TaskPool, each keeping its own bounded heap. Quantized (v2) dumps
+// are scanned approximately into a shortlist of k * CPU_SEARCH_RESCORE_FACTOR
+// candidates, which are then rescored against their float32 section if any.
+// The query is normalized once, so rows of normalized dumps (VECDUMP_FLAG_NORMALIZED)
+// score their plain inner product without any per-row norm or division.
+// A filter is compiled to a row bitset per file (see CompiledFilter): files
+// without a passing row are skipped and filtered rows are never scored.
+// rows, if given, receives the row each result was found at (same order), so
+// its chunk is hydrated from the file's docstore without a lookup by hash.
+std::vector<SimilarityResult> cpu_search_corpus(const std::string &corpus_dir,
+                                                const float *query, size_t dims, size_t k,
+                                                const SearchFilter *filter = nullptr,
+                                                std::vector<SegmentedIndex::RowRef> *rows = nullptr);
+
+// Top-k cosine search of a batch of queries (row-major, num_queries x dims)
+// over the live files of a corpus. Rows are scored in tiles of
+// CPU_BATCH_ROW_TILE rows against tiles of CPU_BATCH_QUERY_TILE queries, so
+// each row is streamed from memory once for the whole batch. Quantized rows
+// are scored against their float32 section when the dump has one, otherwise
+// against their decoded values. Returns one result list per query (and one
+// list of rows per query, see cpu_search_corpus).
+std::vector<std::vector<SimilarityResult> > cpu_search_corpus_batch(
+    const std::string &corpus_dir, const float *queries, size_t num_queries, size_t dims, size_t k,
+    const SearchFilter *filter = nullptr, std::vector<std::vector<SegmentedIndex::RowRef> > *rows = nullptr);
+
+// Two-stage search for very large corpora: the 1-bit sign tier (.vecbin) of
+// every live file is scanned by Hamming distance, and only the best
+// `candidates` rows (0 uses BINARY_PREFILTER_CANDIDATES) are scored exactly.
+// Files without a binary tier are scanned as in cpu_search_corpus.
+std::vector<SimilarityResult> cpu_search_corpus_binary(const std::string &corpus_dir, const float *query,
+                                                       size_t dims, size_t k, size_t candidates = 0,
+                                                       const SearchFilter *filter = nullptr,
+                                                       std::vector<SegmentedIndex::RowRef> *rows = nullptr);
+
+// Two-stage coarse-to-fine search: the prefix section of every live file (the
+// first VECDUMP_PREFIX_DIMS dimensions, unit length, int8) is scored by cosine,
+// and the best `candidates` rows (0 uses PREFIX_SEARCH_CANDIDATES) are scored
+// with every dimension. Reads about half the bytes of cpu_search_corpus per
+// query; recall rises with the candidate count. Files without a prefix section
+// are scanned as in cpu_search_corpus.
+std::vector<SimilarityResult> cpu_search_corpus_prefix(const std::string &corpus_dir, const float *query,
+                                                       size_t dims, size_t k, size_t candidates = 0,
+                                                       const SearchFilter *filter = nullptr,
+                                                       std::vector<SegmentedIndex::RowRef> *rows = nullptr);
+
+// Recall@k and mean latency of cpu_search_corpus_prefix against the exhaustive
+// search for a range of candidate counts, using corpus rows as queries
+bool benchmark_prefix_search(const std::string &corpus_dir, size_t num_queries = 100, size_t k = 10);
+
+// Recall of the int8 scan, the batch scan and the prefix and binary prefilters
+// against an exhaustive float32 search, on a small corpus in a temp directory
+bool test_quantized_search();
+
+} // namespace tldr
+
+#endif // TLDR_CPP_CPU_SIMILARITY_H
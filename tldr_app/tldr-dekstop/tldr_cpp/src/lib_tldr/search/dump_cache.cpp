@@ -0,0 +1,282 @@
+#include "dump_cache.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tldr {
+
+DumpMappingCache &DumpMappingCache::instance() {
+    static DumpMappingCache cache;
+    return cache;
+}
+
+bool DumpMappingCache::identify(const std::string &path, FileIdentity &identity) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0) {
+        return false;
+    }
+    identity.device = sb.st_dev;
+    identity.inode = sb.st_ino;
+    identity.size = sb.st_size;
+#if defined(__APPLE__)
+    identity.mtime_ns = static_cast<int64_t>(sb.st_mtimespec.tv_sec) * 1000000000 + sb.st_mtimespec.tv_nsec;
+#else
+    identity.mtime_ns = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+std::vector<DumpMappingCache::Range> DumpMappingCache::hot_ranges(const MappedVectorData &data) {
+    const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto base = reinterpret_cast<uintptr_t>(data.mapped_memory);
+    const uintptr_t end = base + data.file_size;
+    const size_t rows = data.header ? data.header->num_entries : 0;
+    const size_t dims = data.header ? data.header->vector_dimensions : 0;
+
+    std::vector<std::pair<const void *, size_t> > sections = {{data.mapped_memory, 1}};
+    sections.emplace_back(data.hashes, rows * sizeof(uint64_t));
+    if (data.quantized) {
+        const size_t element_size = data.element_type == VectorElementType::Int8 ? 1
+                                    : data.element_type == VectorElementType::Float16 ? 2 : sizeof(float);
+        sections.emplace_back(data.quantized, rows * dims * element_size);
+        const size_t scales = data.int8_scaling == Int8Scaling::PerDimension ? 2 * dims : rows;
+        sections.emplace_back(data.scales, scales * sizeof(float));
+    } else {
+        sections.emplace_back(data.vectors, rows * dims * sizeof(float)); // v1: the float32 rows are scanned
+    }
+    sections.emplace_back(data.norms, rows * sizeof(float));
+    sections.emplace_back(data.prefix, rows * data.prefix_dimensions);
+    sections.emplace_back(data.prefix_scales, rows * sizeof(float));
+
+    // Whole pages, in file order, with touching ranges merged
+    std::vector<Range> ranges;
+    std::sort(sections.begin(), sections.end());
+    for (const auto &[pointer, bytes]: sections) {
+        if (!pointer || bytes == 0) continue;
+        const uintptr_t first = reinterpret_cast<uintptr_t>(pointer) & ~(page_size - 1);
+        const uintptr_t last = std::min(end, (reinterpret_cast<uintptr_t>(pointer) + bytes + page_size - 1) &
+                                             ~(page_size - 1));
+        if (!ranges.empty() && reinterpret_cast<uintptr_t>(ranges.back().begin) + ranges.back().size >= first) {
+            const uintptr_t begin = reinterpret_cast<uintptr_t>(ranges.back().begin);
+            ranges.back().size = std::max<uintptr_t>(begin + ranges.back().size, last) - begin;
+        } else if (last > first) {
+            ranges.push_back({reinterpret_cast<void *>(first), last - first});
+        }
+    }
+    return ranges;
+}
+
+// Ask the kernel to read the scanned sections ahead (and back them with huge pages where supported)
+void DumpMappingCache::prefetch(const std::vector<Range> &ranges) {
+    if (!DUMP_CACHE_PREFETCH) return;
+    for (const auto &range: ranges) {
+        madvise(range.begin, range.size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        if (range.size >= (2u << 20)) {
+            madvise(range.begin, range.size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+}
+
+std::shared_ptr<MappedVectorData> DumpMappingCache::acquire(const std::string &path) {
+    FileIdentity identity;
+    if (!identify(path, identity)) {
+        std::cerr << "Error opening file: " << path << std::endl;
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = by_path_.find(path);
+        if (it != by_path_.end()) {
+            if (it->second->identity == identity) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                make_resident_locked(*it->second);
+                ++stats_.hits;
+                return it->second->data;
+            }
+            erase_locked(it->second); // Replaced on disk since it was mapped
+        }
+        ++stats_.misses;
+    }
+
+    // Map outside the lock; concurrent misses on the same path are resolved below
+    std::shared_ptr<MappedVectorData> data = read_vector_dump_file(path);
+    if (!data) {
+        return nullptr;
+    }
+    std::vector<Range> hot = hot_ranges(*data);
+    prefetch(hot);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_path_.find(path);
+    if (it != by_path_.end()) {
+        if (it->second->identity == identity) {
+            make_resident_locked(*it->second);
+            return it->second->data;
+        }
+        erase_locked(it->second);
+    }
+    Node node{path, identity, data, std::move(hot)};
+    for (const auto &range: node.hot) {
+        node.hot_bytes += range.size;
+    }
+    lru_.push_front(std::move(node));
+    by_path_[path] = lru_.begin();
+    stats_.bytes += data->file_size;
+    stats_.resident_bytes += lru_.front().hot_bytes;
+    if (lock_in_memory_) {
+        lock_node_locked(lru_.front());
+    }
+    evict_locked();
+    return data;
+}
+
+void DumpMappingCache::touch(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_path_.find(path);
+    if (it != by_path_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        if (!it->second->resident) {
+            make_resident_locked(*it->second);
+            evict_locked();
+        }
+    }
+}
+
+void DumpMappingCache::forget(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_path_.find(path);
+    if (it != by_path_.end()) {
+        erase_locked(it->second);
+    }
+}
+
+size_t DumpMappingCache::warm_up(const std::vector<std::string> &paths) {
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t resident = 0;
+    for (const auto &path: paths) {
+        std::shared_ptr<MappedVectorData> data = acquire(path);
+        if (!data) continue;
+
+        // Fault the scanned pages in now rather than during the first queries
+        uint8_t sink = 0;
+        for (const auto &range: hot_ranges(*data)) {
+            const volatile uint8_t *bytes = static_cast<const uint8_t *>(range.begin);
+            for (size_t offset = 0; offset < range.size; offset += page_size) {
+                sink ^= bytes[offset];
+            }
+            resident += range.size;
+        }
+        (void) sink;
+    }
+    return resident;
+}
+
+void DumpMappingCache::set_byte_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    byte_budget_ = bytes;
+    evict_locked();
+}
+
+void DumpMappingCache::set_lock_in_memory(bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lock_in_memory_ = enabled;
+    for (auto &node: lru_) {
+        if (enabled && node.resident) {
+            lock_node_locked(node);
+        } else {
+            unlock_node_locked(node);
+        }
+    }
+}
+
+DumpMappingCache::Stats DumpMappingCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.entries = lru_.size();
+    return stats;
+}
+
+void DumpMappingCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!lru_.empty()) {
+        erase_locked(std::prev(lru_.end()));
+    }
+}
+
+void DumpMappingCache::make_resident_locked(Node &node) {
+    if (node.resident) return;
+    node.resident = true;
+    stats_.resident_bytes += node.hot_bytes;
+    prefetch(node.hot);
+    if (lock_in_memory_) {
+        lock_node_locked(node);
+    }
+}
+
+void DumpMappingCache::lock_node_locked(Node &node) {
+    if (node.locked || mlock_failed_) return;
+    for (size_t i = 0; i < node.hot.size(); ++i) {
+        if (mlock(node.hot[i].begin, node.hot[i].size) != 0) {
+            std::cerr << "Dump cache: mlock of " << node.path << " failed (" << std::strerror(errno)
+                      << "), continuing without pinning" << std::endl;
+            while (i-- > 0) {
+                munlock(node.hot[i].begin, node.hot[i].size);
+            }
+            mlock_failed_ = true;
+            return;
+        }
+    }
+    node.locked = true;
+    stats_.locked_bytes += node.hot_bytes;
+}
+
+void DumpMappingCache::unlock_node_locked(Node &node) {
+    if (!node.locked) return;
+    for (const auto &range: node.hot) {
+        munlock(range.begin, range.size);
+    }
+    node.locked = false;
+    stats_.locked_bytes -= node.hot_bytes;
+}
+
+void DumpMappingCache::erase_locked(std::list<Node>::iterator it) {
+    unlock_node_locked(*it);
+    stats_.bytes -= it->data->file_size;
+    if (it->resident) {
+        stats_.resident_bytes -= it->hot_bytes;
+    }
+    by_path_.erase(it->path);
+    lru_.erase(it);
+}
+
+void DumpMappingCache::evict_locked() {
+    // Mappings nobody else holds are dropped. One still referenced by a live index entry
+    // or a query snapshot would stay mapped anyway, so only its pages are released; the
+    // file is read again as its rows are scanned. The most recent mapping always stays,
+    // even if it alone exceeds the budget.
+    if (lru_.empty()) return;
+    auto it = std::prev(lru_.end());
+    while (stats_.resident_bytes > byte_budget_ && it != lru_.begin()) {
+        auto victim = it--;
+        if (victim->data.use_count() == 1) {
+            erase_locked(victim);
+            ++stats_.evictions;
+        } else if (victim->resident) {
+            unlock_node_locked(*victim);
+            madvise(victim->data->mapped_memory, victim->data->file_size, MADV_DONTNEED);
+            victim->resident = false;
+            stats_.resident_bytes -= victim->hot_bytes;
+            ++stats_.releases;
+        }
+    }
+}
+
+} // namespace tldr
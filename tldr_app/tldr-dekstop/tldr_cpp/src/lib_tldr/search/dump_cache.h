@@ -0,0 +1,121 @@
+#ifndef TLDR_CPP_DUMP_CACHE_H
+#define TLDR_CPP_DUMP_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <sys/types.h>
+#include "../vec_dump.h"
+#include "../constants.h"
+
+namespace tldr {
+
+/**
+ * Process-wide cache of memory-mapped vector dumps.
+ *
+ * Mappings are keyed by path and validated against the file's identity
+ * (device, inode, size, mtime), so a dump replaced by an atomic rename is
+ * remapped on the next acquire. Only the sections scans read (header, hashes,
+ * scanned vectors, scales, norms, prefix codes) are prefetched with
+ * madvise(MADV_WILLNEED) (and MADV_HUGEPAGE where supported) or pinned with
+ * mlock for hot corpora; a float32 rescoring copy is left to fault in by row.
+ *
+ * The budget applies to the scanned sections of the resident mappings. Beyond
+ * it, the least recently used mappings are unpinned, and dropped if nobody
+ * else holds them; those still held (the live files of a SegmentedIndex, query
+ * snapshots) keep their mapping but have their pages released with
+ * MADV_DONTNEED, and count as resident again once touched.
+ */
+class DumpMappingCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t releases = 0;     // Pages of mappings in use released to stay within the budget
+        size_t entries = 0;
+        size_t bytes = 0;          // Mapped bytes held by the cache
+        size_t resident_bytes = 0; // Scanned sections of the mappings not released, held to the budget
+        size_t locked_bytes = 0;   // Of which pinned with mlock
+    };
+
+    static DumpMappingCache &instance();
+
+    // Map (or reuse the cached mapping of) a dump file, nullptr if it cannot be read
+    std::shared_ptr<MappedVectorData> acquire(const std::string &path);
+
+    // Mark a cached mapping as recently used
+    void touch(const std::string &path);
+
+    // Drop the mapping of a path, e.g. after the file was deleted
+    void forget(const std::string &path);
+
+    /**
+     * Map, prefetch and fault in the scanned sections of the given dumps (service start-up).
+     * @return Bytes made resident
+     */
+    size_t warm_up(const std::vector<std::string> &paths);
+
+    void set_byte_budget(size_t bytes);
+    // Pin cached mappings in RAM (mlock); failures (RLIMIT_MEMLOCK) are reported once
+    void set_lock_in_memory(bool enabled);
+
+    Stats stats() const;
+    void clear();
+
+private:
+    struct FileIdentity {
+        dev_t device = 0;
+        ino_t inode = 0;
+        off_t size = 0;
+        int64_t mtime_ns = 0;
+
+        bool operator==(const FileIdentity &other) const {
+            return device == other.device && inode == other.inode && size == other.size &&
+                   mtime_ns == other.mtime_ns;
+        }
+    };
+
+    // Page-aligned range of a mapping
+    struct Range {
+        void *begin;
+        size_t size;
+    };
+
+    struct Node {
+        std::string path;
+        FileIdentity identity;
+        std::shared_ptr<MappedVectorData> data;
+        std::vector<Range> hot; // Sections scans read
+        size_t hot_bytes = 0;
+        bool resident = true;
+        bool locked = false;
+    };
+
+    DumpMappingCache() = default;
+
+    static bool identify(const std::string &path, FileIdentity &identity);
+    static std::vector<Range> hot_ranges(const MappedVectorData &data);
+    static void prefetch(const std::vector<Range> &ranges);
+    void make_resident_locked(Node &node);
+    void lock_node_locked(Node &node);
+    void unlock_node_locked(Node &node);
+    void erase_locked(std::list<Node>::iterator it);
+    void evict_locked();
+
+    std::list<Node> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Node>::iterator> by_path_;
+    size_t byte_budget_ = DUMP_CACHE_BUDGET_BYTES;
+    bool lock_in_memory_ = DUMP_CACHE_MLOCK;
+    bool mlock_failed_ = false;
+    Stats stats_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_DUMP_CACHE_H
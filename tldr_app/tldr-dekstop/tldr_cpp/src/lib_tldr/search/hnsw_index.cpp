@@ -0,0 +1,543 @@
+#include "hnsw_index.h"
+#include "segmented_index.h"
+#include "simd_dot.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace tldr {
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t HNSW_FILE_VERSION = 1;
+static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+// Index of a corpus root, opened (or built) once by the first caller, outside the registry lock
+struct HnswSlot {
+    std::once_flag opened;
+    std::shared_ptr<HnswIndex> index;
+};
+
+static std::mutex g_hnsw_registry_mutex;
+static std::map<std::string, std::shared_ptr<HnswSlot> > g_hnsw_registry;
+
+// Visited marks for graph traversal, reused across searches of a thread
+struct VisitedList {
+    std::vector<uint32_t> marks;
+    uint32_t epoch = 0;
+
+    void reset(size_t nodes) {
+        if (marks.size() < nodes) marks.resize(nodes, 0);
+        if (++epoch == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    // Returns true the first time a node is seen since reset()
+    bool visit(uint32_t id) {
+        if (marks[id] == epoch) return false;
+        marks[id] = epoch;
+        return true;
+    }
+};
+
+static thread_local VisitedList t_visited;
+
+std::shared_ptr<HnswIndex> HnswIndex::open(const std::string &corpus_root, size_t dims, bool create,
+                                           const HnswParams &params) {
+    std::error_code ec;
+    if (!fs::is_directory(corpus_root, ec)) {
+        return nullptr;
+    }
+    std::string root = fs::weakly_canonical(corpus_root, ec).string();
+    std::string path = (fs::path(root) / "_vecdump" / HNSW_INDEX_FILE).string();
+
+    std::shared_ptr<HnswSlot> slot;
+    {
+        std::lock_guard<std::mutex> lock(g_hnsw_registry_mutex);
+        auto &entry = g_hnsw_registry[root];
+        if (!entry) {
+            entry = std::make_shared<HnswSlot>();
+        }
+        slot = entry;
+    }
+
+    // Building a new index reads the whole corpus: other roots are opened meanwhile,
+    // and callers for the same root wait for this one's result
+    std::call_once(slot->opened, [&] {
+        slot->index = load(root, path, dims, create, params);
+    });
+
+    if (!slot->index) {
+        // Let a later call try again (e.g. with create set)
+        std::lock_guard<std::mutex> lock(g_hnsw_registry_mutex);
+        auto it = g_hnsw_registry.find(root);
+        if (it != g_hnsw_registry.end() && it->second == slot) {
+            g_hnsw_registry.erase(it);
+        }
+        return nullptr;
+    }
+    if (slot->index->dims() != dims) {
+        std::cerr << "HNSW index of " << root << " has " << slot->index->dims() << " dims, expected " << dims
+                  << std::endl;
+        return nullptr;
+    }
+    return slot->index;
+}
+
+std::shared_ptr<HnswIndex> HnswIndex::load(const std::string &root, const std::string &path, size_t dims,
+                                           bool create, const HnswParams &params) {
+    std::error_code ec;
+    bool exists = fs::exists(path, ec);
+    if (!exists && !create) {
+        return nullptr;
+    }
+
+    std::shared_ptr<HnswIndex> index(new HnswIndex(path, params));
+    if (!index->open_file(dims, !exists)) {
+        return nullptr;
+    }
+
+    if (!exists) {
+        // Populate a new index with everything the corpus already holds
+        if (auto segments = SegmentedIndex::open(root)) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (const auto &entry: segments->live_entries()) {
+                const auto *h = entry.data->header;
+                if (h->vector_dimensions != dims) continue;
+                std::vector<float> vector(dims);
+                for (uint32_t i = 0; i < h->num_entries; ++i) {
+                    decode_vector(*entry.data, i, vector.data());
+                    index->insert(vector.data(), entry.data->hashes[i]);
+                }
+            }
+            index->save();
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << "HNSW index built with " << index->size() << " vectors in "
+                      << std::chrono::duration<double>(end - start).count() << "s" << std::endl;
+        }
+    }
+    return index;
+}
+
+void HnswIndex::close_all() {
+    std::lock_guard<std::mutex> lock(g_hnsw_registry_mutex);
+    g_hnsw_registry.clear();
+}
+
+HnswIndex::HnswIndex(std::string path, const HnswParams &params)
+    : path_(std::move(path)), params_(params) {
+}
+
+HnswIndex::~HnswIndex() {
+    if (mapped_) {
+        save();
+        munmap(mapped_, mapped_size_);
+    }
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+bool HnswIndex::open_file(size_t dims, bool create) {
+    std::error_code ec;
+    fs::create_directories(fs::path(path_).parent_path(), ec);
+
+    fd_ = ::open(path_.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (fd_ == -1) {
+        std::cerr << "Error: Could not open HNSW index " << path_ << std::endl;
+        return false;
+    }
+
+    HnswFileHeader h{};
+    if (create) {
+        std::memcpy(h.magic, "HNSW", 4);
+        h.version = HNSW_FILE_VERSION;
+        h.dims = static_cast<uint32_t>(dims);
+        h.M = params_.M;
+        h.M0 = 2 * params_.M;
+        h.ef_construction = params_.ef_construction;
+        h.entry_point = NO_NODE;
+        // hash, level, link count, level-0 links, vector; 8-byte aligned
+        h.record_size = (16 + 4 * h.M0 + 4 * h.dims + 7) & ~uint64_t{7};
+        if (pwrite(fd_, &h, sizeof(h), 0) != sizeof(h)) {
+            std::cerr << "Error: Could not write HNSW index header " << path_ << std::endl;
+            return false;
+        }
+    } else if (pread(fd_, &h, sizeof(h), 0) != sizeof(h) || std::memcmp(h.magic, "HNSW", 4) != 0 ||
+               h.version != HNSW_FILE_VERSION) {
+        std::cerr << "Error: " << path_ << " is not a HNSW index" << std::endl;
+        return false;
+    } else if (h.dims != dims) {
+        std::cerr << "Error: HNSW index " << path_ << " has " << h.dims << " dims, expected " << dims << std::endl;
+        return false;
+    }
+
+    // Graph parameters of an existing index win over the requested ones
+    dims_ = h.dims;
+    params_.M = h.M;
+    params_.ef_construction = h.ef_construction;
+    M0_ = h.M0;
+    count_ = static_cast<uint32_t>(h.count);
+    max_level_ = h.max_level;
+    entry_point_ = h.entry_point;
+
+    mapped_size_ = sizeof(HnswFileHeader) + h.capacity * h.record_size;
+    if (ftruncate(fd_, static_cast<off_t>(mapped_size_)) != 0) {
+        return false;
+    }
+    mapped_ = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapped_ == MAP_FAILED) {
+        mapped_ = nullptr;
+        std::cerr << "Error: Could not map HNSW index " << path_ << std::endl;
+        return false;
+    }
+
+    if (!create && !load_upper_links()) {
+        std::cerr << "Warning: Upper level links of " << path_ << " are missing, search quality may degrade"
+                  << std::endl;
+    }
+    std::cout << "HNSW index " << path_ << " opened with " << count_ << " vectors" << std::endl;
+    return true;
+}
+
+bool HnswIndex::ensure_capacity(uint64_t nodes) {
+    HnswFileHeader *h = header();
+    if (nodes <= h->capacity) {
+        return true;
+    }
+
+    uint64_t capacity = std::max<uint64_t>(1024, h->capacity);
+    while (capacity < nodes) capacity *= 2;
+    const uint64_t record_size = h->record_size;
+
+    size_t new_size = sizeof(HnswFileHeader) + capacity * record_size;
+    if (ftruncate(fd_, static_cast<off_t>(new_size)) != 0) {
+        std::cerr << "Error: Could not grow HNSW index " << path_ << std::endl;
+        return false;
+    }
+    void *remapped = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (remapped == MAP_FAILED) {
+        std::cerr << "Error: Could not remap HNSW index " << path_ << std::endl;
+        return false;
+    }
+    munmap(mapped_, mapped_size_);
+    mapped_ = remapped;
+    mapped_size_ = new_size;
+    header()->capacity = capacity;
+    return true;
+}
+
+uint8_t *HnswIndex::record(uint32_t id) const {
+    return static_cast<uint8_t *>(mapped_) + sizeof(HnswFileHeader) + static_cast<size_t>(id) * header()->record_size;
+}
+
+uint64_t HnswIndex::hash_at(uint32_t id) const {
+    uint64_t hash;
+    std::memcpy(&hash, record(id), sizeof(hash));
+    return hash;
+}
+
+uint32_t HnswIndex::level_at(uint32_t id) const {
+    return *reinterpret_cast<const uint32_t *>(record(id) + 8);
+}
+
+const float *HnswIndex::vector_at(uint32_t id) const {
+    return reinterpret_cast<const float *>(record(id) + 16 + 4 * M0_);
+}
+
+const uint32_t *HnswIndex::links_at(uint32_t id, uint32_t level) const {
+    static const uint32_t no_links[1] = {0};
+    if (level == 0) {
+        return reinterpret_cast<const uint32_t *>(record(id) + 12);
+    }
+    auto it = upper_links_.find(id);
+    if (it == upper_links_.end() || it->second.size() < static_cast<size_t>(level) * (params_.M + 1)) {
+        return no_links; // Upper links lost by a crash before save()
+    }
+    return it->second.data() + static_cast<size_t>(level - 1) * (params_.M + 1);
+}
+
+uint32_t *HnswIndex::mutable_links_at(uint32_t id, uint32_t level) {
+    if (level == 0) {
+        return reinterpret_cast<uint32_t *>(record(id) + 12);
+    }
+    std::vector<uint32_t> &upper = upper_links_[id];
+    size_t needed = static_cast<size_t>(std::max(level, level_at(id))) * (params_.M + 1);
+    if (upper.size() < needed) {
+        upper.resize(needed, 0);
+    }
+    return upper.data() + static_cast<size_t>(level - 1) * (params_.M + 1);
+}
+
+float HnswIndex::distance(const float *query, uint32_t id) const {
+    return 1.0f - simd::dot_f32(query, vector_at(id), dims_);
+}
+
+uint32_t HnswIndex::random_level() {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double r = -std::log(std::max(uniform(level_rng_), 1e-12)) / std::log(static_cast<double>(params_.M));
+    return static_cast<uint32_t>(r);
+}
+
+std::vector<std::pair<float, uint32_t> > HnswIndex::search_layer(const float *query, uint32_t entry, size_t ef,
+                                                                 uint32_t level, const HashFilter *filter) const {
+    using Candidate = std::pair<float, uint32_t>;
+    // candidates: closest first; results: farthest first, bounded by ef
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<> > candidates;
+    std::priority_queue<Candidate> results;
+    auto passes = [&](uint32_t id) { return !filter || (*filter)(hash_at(id)); };
+
+    t_visited.reset(count_);
+    t_visited.visit(entry);
+    float d = distance(query, entry);
+    candidates.emplace(d, entry);
+    if (passes(entry)) results.emplace(d, entry);
+
+    while (!candidates.empty()) {
+        auto [dist, id] = candidates.top();
+        if (results.size() >= ef && dist > results.top().first) break;
+        candidates.pop();
+
+        const uint32_t *links = links_at(id, level);
+        for (uint32_t i = 1; i <= links[0]; ++i) {
+            uint32_t neighbor = links[i];
+            if (neighbor >= count_ || !t_visited.visit(neighbor)) continue;
+            float nd = distance(query, neighbor);
+            if (results.size() < ef || nd < results.top().first) {
+                candidates.emplace(nd, neighbor);
+                if (!passes(neighbor)) continue;
+                results.emplace(nd, neighbor);
+                if (results.size() > ef) results.pop();
+            }
+        }
+    }
+
+    std::vector<Candidate> sorted(results.size());
+    for (size_t i = sorted.size(); i-- > 0;) {
+        sorted[i] = results.top();
+        results.pop();
+    }
+    return sorted;
+}
+
+std::vector<uint32_t> HnswIndex::select_neighbors(const std::vector<std::pair<float, uint32_t> > &candidates,
+                                                  size_t max_links) const {
+    // Keep a candidate only if it is closer to the new node than to every neighbour
+    // kept so far, which spreads links across clusters instead of bunching them
+    std::vector<uint32_t> selected;
+    for (const auto &[dist, id]: candidates) {
+        if (selected.size() >= max_links) break;
+        bool diverse = true;
+        for (uint32_t s: selected) {
+            if (distance(vector_at(id), s) < dist) {
+                diverse = false;
+                break;
+            }
+        }
+        if (diverse) selected.push_back(id);
+    }
+    return selected;
+}
+
+void HnswIndex::connect(uint32_t id, uint32_t level, const std::vector<uint32_t> &neighbors) {
+    uint32_t *links = mutable_links_at(id, level);
+    links[0] = static_cast<uint32_t>(neighbors.size());
+    std::copy(neighbors.begin(), neighbors.end(), links + 1);
+    for (uint32_t neighbor: neighbors) {
+        add_link(neighbor, id, level);
+    }
+}
+
+void HnswIndex::add_link(uint32_t from, uint32_t to, uint32_t level) {
+    const size_t max_links = level == 0 ? M0_ : params_.M;
+    uint32_t *links = mutable_links_at(from, level);
+    if (links[0] < max_links) {
+        links[links[0] + 1] = to;
+        ++links[0];
+        return;
+    }
+
+    // Full: re-select the neighbours of 'from' among its links plus the new one
+    const float *base = vector_at(from);
+    std::vector<std::pair<float, uint32_t> > candidates;
+    candidates.reserve(links[0] + 1);
+    candidates.emplace_back(distance(base, to), to);
+    for (uint32_t i = 1; i <= links[0]; ++i) {
+        candidates.emplace_back(distance(base, links[i]), links[i]);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<uint32_t> kept = select_neighbors(candidates, max_links);
+    links = mutable_links_at(from, level);
+    links[0] = static_cast<uint32_t>(kept.size());
+    std::copy(kept.begin(), kept.end(), links + 1);
+}
+
+bool HnswIndex::insert(const float *vector, uint64_t hash) {
+    float norm = std::sqrt(simd::dot_f32(vector, vector, dims_));
+    if (norm <= 0.0f) {
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(rw_mutex_);
+    if (!ensure_capacity(static_cast<uint64_t>(count_) + 1)) {
+        return false;
+    }
+
+    const uint32_t id = count_;
+    const uint32_t level = random_level();
+    uint8_t *rec = record(id);
+    std::memset(rec, 0, header()->record_size);
+    std::memcpy(rec, &hash, sizeof(hash));
+    std::memcpy(rec + 8, &level, sizeof(level));
+    float *stored = reinterpret_cast<float *>(rec + 16 + 4 * M0_);
+    for (size_t d = 0; d < dims_; ++d) {
+        stored[d] = vector[d] / norm;
+    }
+    if (level > 0) {
+        upper_links_[id].assign(static_cast<size_t>(level) * (params_.M + 1), 0);
+    }
+    count_ = id + 1;
+
+    if (entry_point_ == NO_NODE) {
+        entry_point_ = id;
+        max_level_ = level;
+        return true;
+    }
+
+    // Greedy descent through the levels above the new node
+    uint32_t current = entry_point_;
+    for (uint32_t l = max_level_; l > level; --l) {
+        current = search_layer(stored, current, 1, l).front().second;
+    }
+
+    for (uint32_t l = std::min(level, max_level_) + 1; l-- > 0;) {
+        auto candidates = search_layer(stored, current, params_.ef_construction, l);
+        connect(id, l, select_neighbors(candidates, l == 0 ? M0_ : params_.M));
+        current = candidates.front().second;
+    }
+
+    if (level > max_level_) {
+        max_level_ = level;
+        entry_point_ = id;
+    }
+    return true;
+}
+
+std::vector<SimilarityResult> HnswIndex::search(const float *query, size_t k, size_t ef_search,
+                                                const HashFilter *filter) const {
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+    if (entry_point_ == NO_NODE || k == 0) {
+        return {};
+    }
+
+    std::vector<float> q(query, query + dims_);
+    float norm = std::sqrt(simd::dot_f32(q.data(), q.data(), dims_));
+    if (norm <= 0.0f) {
+        return {};
+    }
+    for (float &x: q) x /= norm;
+
+    uint32_t current = entry_point_;
+    for (uint32_t l = max_level_; l > 0; --l) {
+        current = search_layer(q.data(), current, 1, l).front().second;
+    }
+    size_t ef = std::max(k, ef_search ? ef_search : static_cast<size_t>(params_.ef_search));
+    auto candidates = search_layer(q.data(), current, ef, 0, filter);
+
+    // The same chunk can be inserted more than once (e.g. a re-ingested file)
+    std::vector<SimilarityResult> results;
+    std::unordered_set<uint64_t> seen;
+    for (const auto &[dist, id]: candidates) {
+        if (results.size() >= k) break;
+        uint64_t hash = hash_at(id);
+        if (seen.insert(hash).second) {
+            results.push_back({hash, 1.0f - dist});
+        }
+    }
+    return results;
+}
+
+size_t HnswIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+    return count_;
+}
+
+bool HnswIndex::load_upper_links() {
+    std::ifstream in(path_ + ".upper", std::ios::binary);
+    if (!in) {
+        return max_level_ == 0;
+    }
+    uint32_t nodes = 0;
+    in.read(reinterpret_cast<char *>(&nodes), sizeof(nodes));
+    for (uint32_t n = 0; n < nodes && in; ++n) {
+        uint32_t id = 0, level = 0;
+        in.read(reinterpret_cast<char *>(&id), sizeof(id));
+        in.read(reinterpret_cast<char *>(&level), sizeof(level));
+        std::vector<uint32_t> links(static_cast<size_t>(level) * (params_.M + 1));
+        in.read(reinterpret_cast<char *>(links.data()), static_cast<std::streamsize>(links.size() * sizeof(uint32_t)));
+        if (id < count_) {
+            upper_links_[id] = std::move(links);
+        }
+    }
+    return static_cast<bool>(in);
+}
+
+bool HnswIndex::save_upper_links() const {
+    std::string tmp_path = path_ + ".upper.tmp";
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    uint32_t nodes = static_cast<uint32_t>(upper_links_.size());
+    out.write(reinterpret_cast<const char *>(&nodes), sizeof(nodes));
+    for (const auto &[id, links]: upper_links_) {
+        uint32_t level = static_cast<uint32_t>(links.size() / (params_.M + 1));
+        out.write(reinterpret_cast<const char *>(&id), sizeof(id));
+        out.write(reinterpret_cast<const char *>(&level), sizeof(level));
+        out.write(reinterpret_cast<const char *>(links.data()),
+                  static_cast<std::streamsize>(links.size() * sizeof(uint32_t)));
+    }
+    out.close();
+    if (!out) {
+        return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path_ + ".upper", ec);
+    return !ec;
+}
+
+bool HnswIndex::save() {
+    std::unique_lock<std::shared_mutex> lock(rw_mutex_);
+    // Links of existing nodes only change when nodes are inserted
+    if (count_ == header()->count) {
+        return true;
+    }
+    // Records and upper links first, so the header never refers to unsaved nodes
+    msync(mapped_, mapped_size_, MS_SYNC);
+    if (!save_upper_links()) {
+        std::cerr << "Error: Could not save upper level links of " << path_ << std::endl;
+        return false;
+    }
+    HnswFileHeader *h = header();
+    h->count = count_;
+    h->max_level = max_level_;
+    h->entry_point = entry_point_;
+    msync(mapped_, sizeof(HnswFileHeader), MS_SYNC);
+    return true;
+}
+
+} // namespace tldr
@@ -0,0 +1,139 @@
+#ifndef TLDR_CPP_HNSW_INDEX_H
+#define TLDR_CPP_HNSW_INDEX_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <random>
+#include <cstdint>
+#include "npu_accelerator.h"
+#include "../constants.h"
+#include "search_filter.h"
+
+namespace tldr {
+
+// Tunables of the HNSW graph. M and ef_construction are fixed when the index
+// file is created; ef_search can be changed per query.
+struct HnswParams {
+    uint32_t M = HNSW_M;                             // Links per node on upper levels (2*M on level 0)
+    uint32_t ef_construction = HNSW_EF_CONSTRUCTION; // Candidate list size while inserting
+    uint32_t ef_search = HNSW_EF_SEARCH;             // Default candidate list size while searching
+};
+
+// On-disk header of <root>/_vecdump/index.hnsw
+struct HnswFileHeader {
+    char magic[4];            // "HNSW"
+    uint32_t version;
+    uint32_t dims;
+    uint32_t M;
+    uint32_t M0;              // Level-0 links per node
+    uint32_t ef_construction;
+    uint32_t max_level;
+    uint32_t entry_point;
+    uint64_t count;           // Nodes persisted by the last save()
+    uint64_t capacity;        // Node records allocated in the file
+    uint64_t record_size;     // Bytes per node record
+    uint64_t reserved;
+};
+
+/**
+ * Approximate nearest-neighbour index (HNSW) over the vectors of a corpus.
+ *
+ * The index file holds the header followed by fixed-size node records
+ * {hash, level, level-0 link count, level-0 links, normalized vector}. It is
+ * memory mapped read/write and grown by doubling, so the level-0 graph and the
+ * vectors are never copied into the heap. Links of the few nodes on higher
+ * levels are kept in memory and persisted to index.hnsw.upper on save().
+ * Similarity is cosine, computed as the dot product of normalized vectors.
+ */
+class HnswIndex {
+public:
+    /**
+     * Get the process-wide HNSW index of a corpus root.
+     * @param create Create the index file if it does not exist yet; a new index is
+     *               populated from the corpus' segmented index
+     * @return nullptr if the index does not exist (and create is false) or cannot be opened
+     */
+    static std::shared_ptr<HnswIndex> open(const std::string &corpus_root, size_t dims, bool create,
+                                           const HnswParams &params = {});
+
+    // Close every open index, saving pending inserts
+    static void close_all();
+
+    ~HnswIndex();
+
+    // Insert one vector. Call save() to persist a batch of inserts.
+    bool insert(const float *vector, uint64_t hash);
+
+    // Persist the graph (msync of the records, upper-level links and header); a no-op without new inserts
+    bool save();
+
+    /**
+     * Top-k search by cosine similarity
+     * @param ef_search Candidate list size, 0 uses the index default (clamped to >= k)
+     * @param filter Only nodes whose hash passes are returned; the graph is still
+     *               traversed through the others, so the result is not cut short
+     */
+    std::vector<SimilarityResult> search(const float *query, size_t k, size_t ef_search = 0,
+                                         const HashFilter *filter = nullptr) const;
+
+    size_t size() const;
+    size_t dims() const { return dims_; }
+
+private:
+    HnswIndex(std::string path, const HnswParams &params);
+
+    // Open the index file at path, creating and populating it from the corpus if needed (and create is set)
+    static std::shared_ptr<HnswIndex> load(const std::string &root, const std::string &path, size_t dims,
+                                           bool create, const HnswParams &params);
+    bool open_file(size_t dims, bool create);
+    bool ensure_capacity(uint64_t nodes);
+
+    HnswFileHeader *header() const { return static_cast<HnswFileHeader *>(mapped_); }
+    uint8_t *record(uint32_t id) const;
+    const float *vector_at(uint32_t id) const;
+    uint64_t hash_at(uint32_t id) const;
+    uint32_t level_at(uint32_t id) const;
+    // Link list of a node on a level: [count, link...]
+    const uint32_t *links_at(uint32_t id, uint32_t level) const;
+    uint32_t *mutable_links_at(uint32_t id, uint32_t level);
+
+    float distance(const float *query, uint32_t id) const;
+    uint32_t random_level();
+
+    // Best-first search on one level, returns (distance, id) sorted ascending.
+    // Nodes rejected by the filter are expanded but never enter the results.
+    std::vector<std::pair<float, uint32_t> > search_layer(const float *query, uint32_t entry, size_t ef,
+                                                          uint32_t level, const HashFilter *filter = nullptr) const;
+    // Keep up to max_links diverse neighbours out of candidates sorted ascending
+    std::vector<uint32_t> select_neighbors(const std::vector<std::pair<float, uint32_t> > &candidates,
+                                           size_t max_links) const;
+    void connect(uint32_t id, uint32_t level, const std::vector<uint32_t> &neighbors);
+    void add_link(uint32_t from, uint32_t to, uint32_t level);
+
+    bool load_upper_links();
+    bool save_upper_links() const;
+
+    std::string path_;
+    HnswParams params_;
+    size_t dims_ = 0;
+    uint32_t M0_ = 0;
+
+    int fd_ = -1;
+    void *mapped_ = nullptr;
+    size_t mapped_size_ = 0;
+
+    uint32_t count_ = 0;       // Live nodes (>= header()->count until saved)
+    uint32_t max_level_ = 0;
+    uint32_t entry_point_ = UINT32_MAX;
+    std::unordered_map<uint32_t, std::vector<uint32_t> > upper_links_;
+    std::mt19937 level_rng_{100};
+
+    mutable std::shared_mutex rw_mutex_; // Searches share, inserts are exclusive
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_HNSW_INDEX_H
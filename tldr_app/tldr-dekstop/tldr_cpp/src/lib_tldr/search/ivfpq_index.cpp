@@ -0,0 +1,686 @@
+#include "ivfpq_index.h"
+#include "segmented_index.h"
+#include "simd_dot.h"
+#include "top_k.h"
+#include "../task_pool.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <random>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace tldr {
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t IVFPQ_FILE_VERSION = 2;
+static constexpr uint32_t IVFPQ_KSUB = 256;
+
+static std::mutex g_ivfpq_registry_mutex;
+static std::map<std::string, std::shared_ptr<IvfPqIndex> > g_ivfpq_registry;
+
+// Run fn(begin, end) over [0, n) as tasks of the shared pool
+static void parallel_for(size_t n, const std::function<void(size_t, size_t)> &fn) {
+    tldr::parallel_for(n, IVFPQ_TASK_ROWS, fn);
+}
+
+// Index of the centroid closest (L2) to x
+static uint32_t nearest_centroid(const float *x, const float *centroids, const float *centroid_norms,
+                                 size_t k, size_t d) {
+    // argmin |x - c|^2 = argmax 2<x, c> - |c|^2
+    uint32_t best = 0;
+    float best_score = -std::numeric_limits<float>::infinity();
+    for (size_t c = 0; c < k; ++c) {
+        float score = 2.0f * simd::dot_f32(x, centroids + c * d, d) - centroid_norms[c];
+        if (score > best_score) {
+            best_score = score;
+            best = static_cast<uint32_t>(c);
+        }
+    }
+    return best;
+}
+
+static void squared_norms(const float *centroids, size_t k, size_t d, std::vector<float> &norms) {
+    norms.resize(k);
+    for (size_t c = 0; c < k; ++c) {
+        norms[c] = simd::dot_f32(centroids + c * d, centroids + c * d, d);
+    }
+}
+
+// Lloyd's k-means over n points of d dims (row-major), returns k x d centroids
+static std::vector<float> kmeans(const float *data, size_t n, size_t d, size_t k, size_t iters, std::mt19937 &rng) {
+    std::vector<float> centroids(k * d);
+    std::uniform_int_distribution<size_t> pick(0, n - 1);
+    for (size_t c = 0; c < k; ++c) {
+        std::memcpy(&centroids[c * d], data + pick(rng) * d, d * sizeof(float));
+    }
+
+    std::vector<uint32_t> assignment(n);
+    std::vector<float> norms;
+    for (size_t it = 0; it < iters; ++it) {
+        squared_norms(centroids.data(), k, d, norms);
+        parallel_for(n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                assignment[i] = nearest_centroid(data + i * d, centroids.data(), norms.data(), k, d);
+            }
+        });
+
+        std::vector<double> sums(k * d, 0.0);
+        std::vector<size_t> counts(k, 0);
+        for (size_t i = 0; i < n; ++i) {
+            const float *x = data + i * d;
+            double *sum = &sums[assignment[i] * d];
+            for (size_t j = 0; j < d; ++j) sum[j] += x[j];
+            ++counts[assignment[i]];
+        }
+        for (size_t c = 0; c < k; ++c) {
+            if (counts[c] == 0) {
+                // Re-seed empty clusters with a random point
+                std::memcpy(&centroids[c * d], data + pick(rng) * d, d * sizeof(float));
+                continue;
+            }
+            for (size_t j = 0; j < d; ++j) {
+                centroids[c * d + j] = static_cast<float>(sums[c * d + j] / counts[c]);
+            }
+        }
+    }
+    return centroids;
+}
+
+static bool normalize_into(const float *src, size_t d, float *dst) {
+    float norm = std::sqrt(simd::dot_f32(src, src, d));
+    if (norm <= 0.0f) return false;
+    for (size_t j = 0; j < d; ++j) dst[j] = src[j] / norm;
+    return true;
+}
+
+// Row of the corpus' live files holding the vector of a code, false if its document no longer holds it there
+static bool locate_row(const SegmentedIndex &segments, const std::string &document, uint32_t row, uint64_t hash,
+                       SegmentedIndex::RowRef &out) {
+    if (document.empty() || !segments.locate(document, out)) {
+        return false;
+    }
+    out.row += row;
+    if (out.row >= out.data->header->num_entries || out.data->hashes[out.row] != hash) {
+        out = {}; // Re-added with other chunks since the code was written
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<IvfPqIndex> IvfPqIndex::open(const std::string &corpus_root, size_t dims, bool create,
+                                             const IvfPqParams &params) {
+    std::error_code ec;
+    if (!fs::is_directory(corpus_root, ec)) {
+        return nullptr;
+    }
+    std::string root = fs::weakly_canonical(corpus_root, ec).string();
+    std::string path = (fs::path(root) / "_vecdump" / IVFPQ_INDEX_FILE).string();
+
+    std::lock_guard<std::mutex> lock(g_ivfpq_registry_mutex);
+    auto it = g_ivfpq_registry.find(root);
+    if (it != g_ivfpq_registry.end()) {
+        return it->second->dims() == dims ? it->second : nullptr;
+    }
+
+    std::shared_ptr<IvfPqIndex> index(new IvfPqIndex(root, path, params));
+    bool mapped = fs::exists(path, ec) && index->map_file(true);
+    if (mapped && index->dims() != dims) {
+        std::cerr << "Error: IVF-PQ index " << path << " has " << index->dims() << " dims, expected " << dims
+                  << std::endl;
+        return nullptr;
+    }
+    if (!mapped) {
+        // Missing, unreadable or written by an older version: built from the corpus
+        index.reset(new IvfPqIndex(root, path, params));
+        if (!create || !index->train(dims)) {
+            return nullptr;
+        }
+    }
+
+    g_ivfpq_registry[root] = index;
+    return index;
+}
+
+void IvfPqIndex::close_all() {
+    std::lock_guard<std::mutex> lock(g_ivfpq_registry_mutex);
+    g_ivfpq_registry.clear();
+}
+
+IvfPqIndex::IvfPqIndex(std::string corpus_root, std::string path, const IvfPqParams &params)
+    : root_(std::move(corpus_root)), path_(std::move(path)), params_(params) {
+}
+
+IvfPqIndex::~IvfPqIndex() {
+    bool has_pending = std::any_of(pending_hashes_.begin(), pending_hashes_.end(),
+                                   [](const auto &list) { return !list.empty(); });
+    if (has_pending) {
+        save();
+    }
+    unmap_file();
+}
+
+bool IvfPqIndex::train(size_t dims) {
+    if (params_.m == 0 || dims % params_.m != 0) {
+        std::cerr << "Error: IVF-PQ needs the " << dims << " dims to split evenly into " << params_.m
+                  << " sub-quantizers" << std::endl;
+        return false;
+    }
+
+    std::shared_ptr<SegmentedIndex> segments = SegmentedIndex::open(root_);
+    if (!segments) {
+        return false;
+    }
+    std::vector<SegmentedIndex::Entry> entries;
+    size_t total = 0;
+    for (auto &entry: segments->live_entries()) {
+        if (entry.data->header->vector_dimensions != dims) continue;
+        total += entry.data->header->num_entries;
+        entries.push_back(std::move(entry));
+    }
+    if (total == 0) {
+        std::cerr << "IVF-PQ: no vectors to train on in " << root_ << std::endl;
+        return false;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    dims_ = dims;
+    dsub_ = dims / params_.m;
+    std::mt19937 rng(1234);
+
+    // Uniform sample of the corpus, normalized like every encoded vector
+    const size_t sample_size = std::min<size_t>(total, params_.train_sample);
+    std::vector<size_t> rows(total);
+    for (size_t i = 0; i < total; ++i) rows[i] = i;
+    std::shuffle(rows.begin(), rows.end(), rng);
+    rows.resize(sample_size);
+    std::sort(rows.begin(), rows.end());
+
+    std::vector<float> sample(sample_size * dims);
+    size_t n = 0, base = 0;
+    auto row_it = rows.begin();
+    std::vector<float> decoded(dims);
+    for (const auto &entry: entries) {
+        const size_t entry_rows = entry.data->header->num_entries;
+        for (; row_it != rows.end() && *row_it < base + entry_rows; ++row_it) {
+            decode_vector(*entry.data, *row_it - base, decoded.data());
+            if (normalize_into(decoded.data(), dims, &sample[n * dims])) ++n;
+        }
+        base += entry_rows;
+    }
+    sample.resize(n * dims);
+    if (n == 0) {
+        return false;
+    }
+
+    // Too many lists for a small corpus leaves most of them empty
+    params_.nlist = static_cast<uint32_t>(std::clamp<size_t>(n / 16, 1, params_.nlist));
+    centroids_ = kmeans(sample.data(), n, dims, params_.nlist, params_.kmeans_iters, rng);
+
+    // Residuals to the coarse centroids, then one codebook per sub-space
+    squared_norms(centroids_.data(), params_.nlist, dims, centroid_norms_);
+    std::vector<float> residuals(sample.size());
+    parallel_for(n, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t list = nearest_list(&sample[i * dims]);
+            for (size_t j = 0; j < dims; ++j) {
+                residuals[i * dims + j] = sample[i * dims + j] - centroids_[list * dims + j];
+            }
+        }
+    });
+
+    codebooks_.assign(static_cast<size_t>(params_.m) * IVFPQ_KSUB * dsub_, 0.0f);
+    std::vector<float> sub(n * dsub_);
+    for (uint32_t s = 0; s < params_.m; ++s) {
+        for (size_t i = 0; i < n; ++i) {
+            std::memcpy(&sub[i * dsub_], &residuals[i * dims + s * dsub_], dsub_ * sizeof(float));
+        }
+        std::vector<float> codebook = kmeans(sub.data(), n, dsub_, IVFPQ_KSUB, params_.kmeans_iters, rng);
+        std::copy(codebook.begin(), codebook.end(), codebooks_.begin() + static_cast<size_t>(s) * IVFPQ_KSUB * dsub_);
+    }
+
+    auto trained = std::chrono::high_resolution_clock::now();
+    std::cout << "IVF-PQ trained " << params_.nlist << " lists x " << params_.m << " sub-quantizers on " << n
+              << " vectors in " << std::chrono::duration<double>(trained - start).count() << "s" << std::endl;
+
+    pending_codes_.assign(params_.nlist, {});
+    pending_hashes_.assign(params_.nlist, {});
+    pending_locations_.assign(params_.nlist, {});
+    std::vector<float> block;
+    for (const auto &entry: entries) {
+        const size_t entry_rows = entry.data->header->num_entries;
+        // Added document by document so that every code records its row; the rows of
+        // files with unknown document bounds are added without a location
+        const size_t docs = entry.doc_starts.empty() ? 1 : entry.doc_starts.size();
+        for (size_t d = 0; d < docs; ++d) {
+            const std::string file_hash = entry.doc_starts.empty() ? std::string() : entry.file_hashes[d];
+            const size_t doc_begin = entry.doc_starts.empty() ? 0 : entry.doc_starts[d];
+            const size_t doc_end = d + 1 < entry.doc_starts.size() ? entry.doc_starts[d + 1] : entry_rows;
+            for (size_t begin = doc_begin; begin < doc_end; begin += IVFPQ_TRAIN_SAMPLE) {
+                const size_t count = std::min<size_t>(IVFPQ_TRAIN_SAMPLE, doc_end - begin);
+                const float *vectors = entry.data->vectors ? entry.data->vectors + begin * dims : nullptr;
+                if (!vectors) {
+                    // Quantized-only dumps are decoded in blocks
+                    block.resize(count * dims);
+                    for (size_t i = 0; i < count; ++i) decode_vector(*entry.data, begin + i, &block[i * dims]);
+                    vectors = block.data();
+                }
+                add(vectors, entry.data->hashes + begin, count, file_hash, static_cast<uint32_t>(begin - doc_begin));
+            }
+        }
+    }
+    if (!save()) {
+        return false;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "IVF-PQ index built with " << count_ << " vectors ("
+              << params_.m + sizeof(uint64_t) + sizeof(IvfPqLocation) << " bytes each) in " << std::chrono::duration<double>(end - start).count() << "s" << std::endl;
+    return true;
+}
+
+uint32_t IvfPqIndex::nearest_list(const float *vector) const {
+    return nearest_centroid(vector, centroids_.data(), centroid_norms_.data(), params_.nlist, dims_);
+}
+
+void IvfPqIndex::encode_residual(const float *vector, uint32_t list, uint8_t *code) const {
+    const float *centroid = &centroids_[static_cast<size_t>(list) * dims_];
+    std::vector<float> residual(dsub_);
+    for (uint32_t s = 0; s < params_.m; ++s) {
+        for (size_t j = 0; j < dsub_; ++j) {
+            residual[j] = vector[s * dsub_ + j] - centroid[s * dsub_ + j];
+        }
+        const float *codebook = &codebooks_[static_cast<size_t>(s) * IVFPQ_KSUB * dsub_];
+        uint32_t best = 0;
+        float best_dist = std::numeric_limits<float>::infinity();
+        for (uint32_t c = 0; c < IVFPQ_KSUB; ++c) {
+            float dist = 0.0f;
+            for (size_t j = 0; j < dsub_; ++j) {
+                float diff = residual[j] - codebook[c * dsub_ + j];
+                dist += diff * diff;
+            }
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = c;
+            }
+        }
+        code[s] = static_cast<uint8_t>(best);
+    }
+}
+
+void IvfPqIndex::add(const float *vectors, const uint64_t *hashes, size_t count, const std::string &file_hash,
+                     uint32_t first_row) {
+    // Encoding only reads the quantizers, which are not written once the index is
+    // published (save() remaps the lists only), so it runs outside the lock
+    std::vector<uint32_t> lists(count, UINT32_MAX);
+    std::vector<uint8_t> codes(count * params_.m);
+    parallel_for(count, [&](size_t begin, size_t end) {
+        std::vector<float> normalized(dims_);
+        for (size_t i = begin; i < end; ++i) {
+            if (!normalize_into(vectors + i * dims_, dims_, normalized.data())) continue;
+            lists[i] = nearest_list(normalized.data());
+            encode_residual(normalized.data(), lists[i], &codes[i * params_.m]);
+        }
+    });
+
+    std::unique_lock<std::shared_mutex> lock(rw_mutex_);
+    uint32_t document = IVFPQ_NO_DOCUMENT;
+    if (!file_hash.empty()) {
+        auto [it, added] = document_ids_.try_emplace(file_hash, static_cast<uint32_t>(documents_.size()));
+        if (added) {
+            documents_.push_back(file_hash);
+        }
+        document = it->second;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (lists[i] == UINT32_MAX) continue;
+        auto &list_codes = pending_codes_[lists[i]];
+        list_codes.insert(list_codes.end(), &codes[i * params_.m], &codes[(i + 1) * params_.m]);
+        pending_hashes_[lists[i]].push_back(hashes[i]);
+        pending_locations_[lists[i]].push_back({document, first_row + static_cast<uint32_t>(i)});
+    }
+}
+
+bool IvfPqIndex::save() {
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    // The file is written under the shared lock, so searches go on meanwhile.
+    // Additions made after it is released stay pending for the next save.
+    std::shared_lock<std::shared_mutex> read_lock(rw_mutex_);
+    std::vector<size_t> written(params_.nlist);
+    size_t pending = 0;
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        written[l] = pending_hashes_[l].size();
+        pending += written[l];
+    }
+    if (pending == 0 && mapped_) {
+        return true;
+    }
+
+    IvfPqFileHeader header{};
+    std::memcpy(header.magic, "IVPQ", 4);
+    header.version = IVFPQ_FILE_VERSION;
+    header.dims = static_cast<uint32_t>(dims_);
+    header.nlist = params_.nlist;
+    header.m = params_.m;
+    header.ksub = IVFPQ_KSUB;
+
+    std::vector<uint64_t> offsets(params_.nlist + 1, 0);
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        uint64_t mapped = list_offsets_ ? list_offsets_[l + 1] - list_offsets_[l] : 0;
+        offsets[l + 1] = offsets[l] + mapped + written[l];
+    }
+    header.count = offsets[params_.nlist];
+    for (const auto &document: documents_) {
+        header.documents_size += document.size() + 1;
+    }
+
+    std::string tmp_path = path_ + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << tmp_path << " for writing" << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(centroids_.data()), centroids_.size() * sizeof(float));
+    out.write(reinterpret_cast<const char *>(codebooks_.data()), codebooks_.size() * sizeof(float));
+    out.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        if (list_offsets_) {
+            out.write(reinterpret_cast<const char *>(codes_ + list_offsets_[l] * params_.m),
+                      (list_offsets_[l + 1] - list_offsets_[l]) * params_.m);
+        }
+        out.write(reinterpret_cast<const char *>(pending_codes_[l].data()), written[l] * params_.m);
+    }
+    // Keep the hash section 8-byte aligned
+    const uint64_t code_bytes = header.count * params_.m;
+    const char padding[8] = {};
+    out.write(padding, (8 - code_bytes % 8) % 8);
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        if (list_offsets_) {
+            out.write(reinterpret_cast<const char *>(hashes_ + list_offsets_[l]),
+                      (list_offsets_[l + 1] - list_offsets_[l]) * sizeof(uint64_t));
+        }
+        out.write(reinterpret_cast<const char *>(pending_hashes_[l].data()), written[l] * sizeof(uint64_t));
+    }
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        if (list_offsets_) {
+            out.write(reinterpret_cast<const char *>(locations_ + list_offsets_[l]),
+                      (list_offsets_[l + 1] - list_offsets_[l]) * sizeof(IvfPqLocation));
+        }
+        out.write(reinterpret_cast<const char *>(pending_locations_[l].data()), written[l] * sizeof(IvfPqLocation));
+    }
+    for (const auto &document: documents_) {
+        out << document << '\n';
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed writing IVF-PQ index " << tmp_path << std::endl;
+        fs::remove(tmp_path);
+        return false;
+    }
+
+    read_lock.unlock();
+
+    std::unique_lock<std::shared_mutex> lock(rw_mutex_);
+    unmap_file();
+    fs::rename(tmp_path, path_);
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        pending_codes_[l].erase(pending_codes_[l].begin(), pending_codes_[l].begin() + written[l] * params_.m);
+        pending_hashes_[l].erase(pending_hashes_[l].begin(), pending_hashes_[l].begin() + written[l]);
+        pending_locations_[l].erase(pending_locations_[l].begin(), pending_locations_[l].begin() + written[l]);
+    }
+    return map_file(false);
+}
+
+bool IvfPqIndex::map_file(bool load_quantizers) {
+    int fd = ::open(path_.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "Error: Could not open IVF-PQ index " << path_ << std::endl;
+        return false;
+    }
+    struct stat sb{};
+    fstat(fd, &sb);
+    mapped_size_ = static_cast<size_t>(sb.st_size);
+    mapped_ = mapped_size_ >= sizeof(IvfPqFileHeader)
+                  ? mmap(nullptr, mapped_size_, PROT_READ, MAP_PRIVATE, fd, 0)
+                  : MAP_FAILED;
+    close(fd); // The mapping keeps the file alive
+    if (mapped_ == MAP_FAILED) {
+        mapped_ = nullptr;
+        std::cerr << "Error: Could not map IVF-PQ index " << path_ << std::endl;
+        return false;
+    }
+
+    const auto *header = static_cast<const IvfPqFileHeader *>(mapped_);
+    if (std::memcmp(header->magic, "IVPQ", 4) == 0 && header->version != IVFPQ_FILE_VERSION) {
+        std::cerr << "IVF-PQ index " << path_ << " has version " << header->version << ", expected "
+                  << IVFPQ_FILE_VERSION << std::endl;
+        unmap_file();
+        return false;
+    }
+    if (std::memcmp(header->magic, "IVPQ", 4) != 0 || header->ksub != IVFPQ_KSUB || header->m == 0 || header->dims % header->m != 0) {
+        std::cerr << "Error: " << path_ << " is not an IVF-PQ index" << std::endl;
+        unmap_file();
+        return false;
+    }
+    if (!load_quantizers && (header->dims != dims_ || header->nlist != params_.nlist || header->m != params_.m)) {
+        std::cerr << "Error: IVF-PQ index " << path_ << " was replaced by an index of another shape" << std::endl;
+        unmap_file();
+        return false;
+    }
+
+    if (load_quantizers) {
+        dims_ = header->dims;
+        params_.nlist = header->nlist;
+        params_.m = header->m;
+        dsub_ = dims_ / params_.m;
+    }
+    count_ = header->count;
+
+    const size_t centroid_floats = static_cast<size_t>(params_.nlist) * dims_;
+    const size_t codebook_floats = static_cast<size_t>(params_.m) * IVFPQ_KSUB * dsub_;
+    const size_t code_bytes = count_ * params_.m;
+    const size_t needed = sizeof(IvfPqFileHeader) + (centroid_floats + codebook_floats) * sizeof(float) +
+                          (params_.nlist + 1) * sizeof(uint64_t) + code_bytes + (8 - code_bytes % 8) % 8 +
+                          count_ * (sizeof(uint64_t) + sizeof(IvfPqLocation)) + header->documents_size;
+    if (mapped_size_ < needed) {
+        std::cerr << "Error: IVF-PQ index " << path_ << " is truncated" << std::endl;
+        unmap_file();
+        return false;
+    }
+
+    const auto *cursor = static_cast<const uint8_t *>(mapped_) + sizeof(IvfPqFileHeader);
+    if (load_quantizers) {
+        const auto *floats = reinterpret_cast<const float *>(cursor);
+        centroids_.assign(floats, floats + centroid_floats);
+        codebooks_.assign(floats + centroid_floats, floats + centroid_floats + codebook_floats);
+        squared_norms(centroids_.data(), params_.nlist, dims_, centroid_norms_);
+    }
+    cursor += (centroid_floats + codebook_floats) * sizeof(float);
+    list_offsets_ = reinterpret_cast<const uint64_t *>(cursor);
+    cursor += (params_.nlist + 1) * sizeof(uint64_t);
+    codes_ = cursor;
+    cursor += code_bytes + (8 - code_bytes % 8) % 8;
+    hashes_ = reinterpret_cast<const uint64_t *>(cursor);
+    cursor += count_ * sizeof(uint64_t);
+    locations_ = reinterpret_cast<const IvfPqLocation *>(cursor);
+    cursor += count_ * sizeof(IvfPqLocation);
+
+    // A remapped file holds the table this instance wrote, which add() may have grown since
+    if (load_quantizers) {
+        documents_.clear();
+        document_ids_.clear();
+        const char *table = reinterpret_cast<const char *>(cursor);
+        const char *table_end = table + header->documents_size;
+        while (table < table_end) {
+            const char *line_end = std::find(table, table_end, '\n');
+            document_ids_.emplace(std::string(table, line_end), static_cast<uint32_t>(documents_.size()));
+            documents_.emplace_back(table, line_end);
+            table = line_end + 1;
+        }
+    }
+
+    if (pending_hashes_.size() != params_.nlist) {
+        pending_codes_.assign(params_.nlist, {});
+        pending_hashes_.assign(params_.nlist, {});
+        pending_locations_.assign(params_.nlist, {});
+    }
+    return true;
+}
+
+void IvfPqIndex::unmap_file() {
+    if (mapped_) {
+        munmap(mapped_, mapped_size_);
+    }
+    mapped_ = nullptr;
+    mapped_size_ = 0;
+    list_offsets_ = nullptr;
+    codes_ = nullptr;
+    hashes_ = nullptr;
+    locations_ = nullptr;
+}
+
+std::vector<SimilarityResult> IvfPqIndex::search(const float *query, size_t k, size_t nprobe, size_t rerank,
+                                                 const CompiledFilter *filter,
+                                                 std::vector<SegmentedIndex::RowRef> *rows) const {
+    std::vector<float> q(dims_);
+    if (k == 0 || !normalize_into(query, dims_, q.data())) {
+        return {};
+    }
+
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+
+    // Coarse step: the nprobe lists whose centroids score highest (every list
+    // ranked when filtering, in case the probed ones hold too few passing codes)
+    nprobe = std::min<size_t>(nprobe ? nprobe : params_.nprobe, params_.nlist);
+    BoundedTopK probe(filter ? params_.nlist : nprobe);
+    for (uint32_t l = 0; l < params_.nlist; ++l) {
+        probe.push(simd::dot_f32(q.data(), &centroids_[static_cast<size_t>(l) * dims_], dims_), l);
+    }
+
+    // ADC table: inner product of each query sub-vector with every sub-centroid
+    std::vector<float> lut(static_cast<size_t>(params_.m) * IVFPQ_KSUB);
+    for (uint32_t s = 0; s < params_.m; ++s) {
+        const float *codebook = &codebooks_[static_cast<size_t>(s) * IVFPQ_KSUB * dsub_];
+        for (uint32_t c = 0; c < IVFPQ_KSUB; ++c) {
+            lut[s * IVFPQ_KSUB + c] = simd::dot_f32(&q[s * dsub_], codebook + c * dsub_, dsub_);
+        }
+    }
+
+    // <q, x> ~ <q, centroid> + sum_s lut[s][code_s]. Candidates are kept by position,
+    // in the mapped lists or (top bit set) list and position in the pending ones.
+    auto pending_key = [](uint32_t list, size_t i) {
+        return uint64_t{1} << 63 | static_cast<uint64_t>(list) << 32 | i;
+    };
+    // Codes are filtered by their row, not their hash: equal chunks of other documents share it
+    std::vector<CompiledFilter::FileRows> document_rows(filter ? documents_.size() : 0);
+    for (size_t d = 0; d < document_rows.size(); ++d) {
+        document_rows[d] = filter->file_rows(documents_[d]);
+    }
+    auto passes = [&](const IvfPqLocation &location) {
+        return location.document < document_rows.size() && document_rows[location.document].allows(location.row);
+    };
+    const size_t candidates = std::max(k, rerank);
+    BoundedTopK top(candidates);
+    size_t probed = 0;
+    for (const auto &list: probe.sorted()) {
+        if (probed++ >= nprobe && top.size() >= k) break;
+        const uint32_t l = static_cast<uint32_t>(list.hash);
+        if (list_offsets_) {
+            for (uint64_t i = list_offsets_[l]; i < list_offsets_[l + 1]; ++i) {
+                if (filter && !passes(locations_[i])) continue;
+                top.push(list.score + simd::adc_sum_u8(lut.data(), codes_ + i * params_.m, params_.m), i);
+            }
+        }
+        const auto &pending = pending_codes_[l];
+        for (size_t i = 0; i < pending_hashes_[l].size(); ++i) {
+            if (filter && !passes(pending_locations_[l][i])) continue;
+            top.push(list.score + simd::adc_sum_u8(lut.data(), &pending[i * params_.m], params_.m),
+                     pending_key(l, i));
+        }
+    }
+
+    std::vector<SimilarityResult> results = top.sorted();
+    std::vector<IvfPqLocation> locations(results.size());
+    std::vector<std::string> documents(rerank || rows ? results.size() : 0);
+    for (size_t c = 0; c < results.size(); ++c) {
+        const uint64_t key = results[c].hash;
+        if (key >> 63) {
+            const auto l = static_cast<uint32_t>(key >> 32 & 0x7FFFFFFF);
+            const size_t i = key & 0xFFFFFFFF;
+            results[c].hash = pending_hashes_[l][i];
+            locations[c] = pending_locations_[l][i];
+        } else {
+            results[c].hash = hashes_[key];
+            locations[c] = locations_[key];
+        }
+        if (!documents.empty() && locations[c].document < documents_.size()) {
+            documents[c] = documents_[locations[c].document];
+        }
+    }
+    lock.unlock();
+
+    // Rows of the candidates in the corpus' live files
+    std::vector<SegmentedIndex::RowRef> refs(documents.size());
+    auto segments = documents.empty() ? nullptr : SegmentedIndex::open(root_);
+    for (size_t c = 0; segments && c < documents.size(); ++c) {
+        locate_row(*segments, documents[c], locations[c].row, results[c].hash, refs[c]);
+    }
+
+    if (rerank == 0) {
+        results.resize(std::min(results.size(), k));
+        if (rows) {
+            refs.resize(results.size());
+            *rows = std::move(refs);
+        }
+        return results;
+    }
+
+    // Exact re-rank against the full-precision vectors at the candidates' rows;
+    // candidates whose vector is no longer there keep their approximate score
+    BoundedTopK exact(k);
+    std::vector<float> vector(dims_);
+    for (size_t c = 0; c < results.size(); ++c) {
+        float score = results[c].score;
+        if (refs[c].data && refs[c].data->header->vector_dimensions == dims_) {
+            decode_vector(*refs[c].data, refs[c].row, vector.data());
+            float dot, norm_sq;
+            simd::dot_norm_f32(q.data(), vector.data(), dims_, &dot, &norm_sq);
+            score = norm_sq > 0.0f ? dot / std::sqrt(norm_sq) : 0.0f;
+        }
+        exact.push(score, c);
+    }
+    std::vector<SimilarityResult> reranked = exact.sorted();
+    if (rows) {
+        rows->clear();
+    }
+    for (auto &result: reranked) {
+        const size_t c = result.hash;
+        result.hash = results[c].hash;
+        if (rows) {
+            rows->push_back(refs[c]);
+        }
+    }
+    return reranked;
+}
+
+size_t IvfPqIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(rw_mutex_);
+    size_t pending = 0;
+    for (const auto &list: pending_hashes_) pending += list.size();
+    return count_ + pending;
+}
+
+} // namespace tldr
@@ -0,0 +1,157 @@
+#ifndef TLDR_CPP_IVFPQ_INDEX_H
+#define TLDR_CPP_IVFPQ_INDEX_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <cstdint>
+#include "npu_accelerator.h"
+#include "../constants.h"
+#include "search_filter.h"
+#include "segmented_index.h"
+
+namespace tldr {
+
+// Shape of the quantizers, fixed when the index is trained, and search defaults
+struct IvfPqParams {
+    uint32_t nlist = IVFPQ_NLIST;               // Coarse (inverted) lists
+    uint32_t m = IVFPQ_M;                       // Sub-quantizers, one byte of code each; must divide dims
+    uint32_t train_sample = IVFPQ_TRAIN_SAMPLE; // Vectors sampled from the corpus for training
+    uint32_t kmeans_iters = IVFPQ_KMEANS_ITERS;
+    uint32_t nprobe = IVFPQ_NPROBE;             // Lists scanned per query by default
+};
+
+// On-disk header of <root>/_vecdump/index.ivfpq
+struct IvfPqFileHeader {
+    char magic[4];    // "IVPQ"
+    uint32_t version;
+    uint32_t dims;
+    uint32_t nlist;
+    uint32_t m;
+    uint32_t ksub;    // Centroids per sub-quantizer (256, one byte per code)
+    uint64_t count;   // Encoded vectors
+    uint64_t documents_size; // Bytes of the document table
+};
+
+constexpr uint32_t IVFPQ_NO_DOCUMENT = UINT32_MAX;
+
+// Where the vector of a code lives: row of a document in the corpus' segmented index.
+// Unlike a (file, row) pair this survives the merging of dumps into segments.
+struct IvfPqLocation {
+    uint32_t document; // Index into the document table, IVFPQ_NO_DOCUMENT if unknown
+    uint32_t row;      // Row within the document's vectors
+};
+
+/**
+ * Inverted-file index with product-quantized residuals (IVF-PQ).
+ *
+ * Vectors are normalized, assigned to the nearest of nlist coarse centroids and
+ * the residual is encoded with m sub-quantizers of 256 centroids each, so a
+ * vector costs m bytes of code plus its 8-byte hash instead of dims * 4 bytes.
+ * The file (header, centroids, codebooks, list offsets, codes, hashes, locations,
+ * document table; codes, hashes and locations grouped by list) is memory mapped
+ * read-only. The document table holds the file hashes locations refer to, one
+ * per line.
+ *
+ * Queries score inner products with asymmetric distance computation: one
+ * m x 256 lookup table per query, accumulated with SIMD gathers. Optionally,
+ * the best candidates are re-ranked exactly against the full-precision vectors
+ * of the corpus' segmented index, read at their stored location.
+ */
+class IvfPqIndex {
+public:
+    /**
+     * Get the process-wide IVF-PQ index of a corpus root.
+     * @param create Train and build the index from the corpus' vectors if it does not exist
+     * @return nullptr if the index does not exist (and create is false) or cannot be built
+     */
+    static std::shared_ptr<IvfPqIndex> open(const std::string &corpus_root, size_t dims, bool create,
+                                            const IvfPqParams &params = {});
+
+    // Close every open index, saving pending additions
+    static void close_all();
+
+    ~IvfPqIndex();
+
+    /**
+     * Encode and add vectors with the trained quantizers. They are searchable at once; call save() to persist them.
+     * @param file_hash Document the vectors belong to, they are its rows first_row, first_row + 1, ...
+     *                  Empty if unknown: such vectors are not re-ranked.
+     */
+    void add(const float *vectors, const uint64_t *hashes, size_t count, const std::string &file_hash,
+             uint32_t first_row = 0);
+
+    /**
+     * Rewrite the index file with the pending additions merged into their lists.
+     * This copies the whole file, so it is called once per ingest run rather than
+     * per document; searches are only blocked while the new file is mapped.
+     */
+    bool save();
+
+    /**
+     * Top-k search by cosine similarity
+     * @param nprobe Lists to scan, 0 uses the index default
+     * @param rerank Candidates re-scored against the full-precision vectors, 0 disables re-ranking
+     * @param filter Only codes whose row (document and row in it) passes are scored.
+     *               Lists beyond nprobe are scanned in centroid order until k codes have passed.
+     * @param rows If given, receives the row of the corpus' live files each result was
+     *             found at (same order; data is null where its document no longer holds it)
+     */
+    std::vector<SimilarityResult> search(const float *query, size_t k, size_t nprobe = 0, size_t rerank = 0,
+                                         const CompiledFilter *filter = nullptr,
+                                         std::vector<SegmentedIndex::RowRef> *rows = nullptr) const;
+
+    size_t size() const;
+    size_t dims() const { return dims_; }
+
+private:
+    IvfPqIndex(std::string corpus_root, std::string path, const IvfPqParams &params);
+
+    bool train(size_t dims);
+    // Map the index file; the quantizers are read from it only when load_quantizers is set
+    bool map_file(bool load_quantizers);
+    void unmap_file();
+
+    uint32_t nearest_list(const float *vector) const;
+    void encode_residual(const float *vector, uint32_t list, uint8_t *code) const;
+
+    std::string root_;
+    std::string path_;
+    IvfPqParams params_;
+    size_t dims_ = 0;
+    size_t dsub_ = 0;
+
+    // Quantizers (copied from the file so training and searching share them). Only written
+    // before the index is published by open(), so encoding reads them without the lock.
+    std::vector<float> centroids_; // nlist x dims
+    std::vector<float> centroid_norms_;
+    std::vector<float> codebooks_; // m x 256 x dsub
+
+    // Mapped lists
+    void *mapped_ = nullptr;
+    size_t mapped_size_ = 0;
+    const uint64_t *list_offsets_ = nullptr; // nlist + 1
+    const uint8_t *codes_ = nullptr;
+    const uint64_t *hashes_ = nullptr;
+    const IvfPqLocation *locations_ = nullptr;
+    uint64_t count_ = 0;
+
+    // Document table, grown by add()
+    std::vector<std::string> documents_;
+    std::unordered_map<std::string, uint32_t> document_ids_;
+
+    // Additions not yet written to the file, per list
+    std::vector<std::vector<uint8_t> > pending_codes_;
+    std::vector<std::vector<uint64_t> > pending_hashes_;
+    std::vector<std::vector<IvfPqLocation> > pending_locations_;
+
+    mutable std::shared_mutex rw_mutex_;
+    std::mutex save_mutex_; // One save at a time
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_IVFPQ_INDEX_H
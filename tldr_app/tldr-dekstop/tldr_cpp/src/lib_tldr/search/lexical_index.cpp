@@ -0,0 +1,512 @@
+#include "lexical_index.h"
+#include "segmented_index.h"
+#include "top_k.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+namespace tldr {
+
+static std::mutex g_lexical_registry_mutex;
+static std::map<std::string, std::shared_ptr<LexicalIndex> > g_lexical_registry;
+
+constexpr uint32_t LEXICAL_FILE_MAGIC = 0x58454C54; // "TLEX"
+
+static void put_varint(std::vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Decode a varint at pos, false if it runs past end
+static bool get_varint(const uint8_t *data, size_t end, size_t &pos, uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && pos < end; shift += 7) {
+        uint8_t byte = data[pos++];
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+std::vector<std::string> lexical_tokens(std::string_view text) {
+    std::vector<std::string> tokens;
+    // Bytes >= 0x80 belong to UTF-8 sequences and are kept inside words
+    auto is_word = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || static_cast<unsigned char>(c) >= 0x80; };
+    auto is_joiner = [](char c) { return c == '-' || c == '_' || c == '.' || c == ':' || c == '/'; };
+    auto emit = [&](std::string_view token) {
+        if (token.size() > LEXICAL_MAX_TOKEN_LENGTH) return;
+        std::string lowered(token);
+        for (char &c: lowered) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        tokens.push_back(std::move(lowered));
+    };
+
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!is_word(text[i])) {
+            ++i;
+            continue;
+        }
+        const size_t start = i;
+        size_t parts = 0;
+        while (true) {
+            const size_t run = i;
+            while (i < text.size() && is_word(text[i])) ++i;
+            emit(text.substr(run, i - run));
+            ++parts;
+            if (i + 1 < text.size() && is_joiner(text[i]) && is_word(text[i + 1])) {
+                ++i;
+                continue;
+            }
+            break;
+        }
+        if (parts > 1) {
+            emit(text.substr(start, i - start));
+        }
+    }
+    return tokens;
+}
+
+void LexicalIndex::PostingList::append(uint32_t doc, uint32_t tf, uint32_t length) {
+    if (count % LEXICAL_SKIP_INTERVAL == 0) {
+        skips.push_back({doc, last_doc, static_cast<uint32_t>(bytes.size())});
+    }
+    put_varint(bytes, doc - last_doc);
+    put_varint(bytes, tf);
+    last_doc = doc;
+    ++count;
+    max_tf = std::max(max_tf, tf);
+    min_length = std::min(min_length, length);
+}
+
+void LexicalIndex::Cursor::next() {
+    if (index >= list->count) {
+        done = true;
+        return;
+    }
+    uint32_t gap = 0;
+    get_varint(list->bytes.data(), list->bytes.size(), pos, gap);
+    get_varint(list->bytes.data(), list->bytes.size(), pos, tf);
+    doc += gap;
+    ++index;
+}
+
+void LexicalIndex::Cursor::seek(uint32_t target) {
+    if (done || doc >= target) return;
+    // Jump to the last block starting at or before the target, if it is ahead of the cursor
+    const auto &skips = list->skips;
+    auto block = std::upper_bound(skips.begin(), skips.end(), target,
+                                  [](uint32_t t, const PostingList::Skip &s) { return t < s.first_doc; });
+    if (block != skips.begin()) {
+        const size_t b = static_cast<size_t>(block - skips.begin()) - 1;
+        if (b * LEXICAL_SKIP_INTERVAL >= index) {
+            pos = skips[b].offset;
+            doc = skips[b].prev_doc;
+            index = static_cast<uint32_t>(b * LEXICAL_SKIP_INTERVAL);
+            next();
+        }
+    }
+    while (!done && doc < target) next();
+}
+
+LexicalIndex::LexicalIndex(std::string corpus_root)
+    : root_(std::move(corpus_root)),
+      dir_((fs::path(root_) / "_vecdump" / LEXICAL_INDEX_DIR).string()) {
+}
+
+std::shared_ptr<LexicalIndex> LexicalIndex::open(const std::string &corpus_root) {
+    std::error_code ec;
+    if (!fs::is_directory(corpus_root, ec)) {
+        return nullptr;
+    }
+    std::string root = fs::weakly_canonical(corpus_root, ec).string();
+
+    std::lock_guard<std::mutex> lock(g_lexical_registry_mutex);
+    auto it = g_lexical_registry.find(root);
+    if (it != g_lexical_registry.end()) {
+        return it->second;
+    }
+
+    std::shared_ptr<LexicalIndex> index(new LexicalIndex(root));
+    if (fs::is_directory(index->dir_, ec)) {
+        std::unique_lock<std::shared_mutex> index_lock(index->mutex_);
+        index->load_all_locked();
+    } else {
+        fs::create_directories(index->dir_, ec);
+        index->bootstrap_from_docstores();
+    }
+    Stats stats = index->stats();
+    std::cout << "Lexical index of " << root << ": " << stats.files << " files, " << stats.chunks << " chunks, "
+              << stats.terms << " terms, " << stats.posting_bytes << " posting bytes" << std::endl;
+    g_lexical_registry[root] = index;
+    return index;
+}
+
+std::string LexicalIndex::file_path(const std::string &file_hash) const {
+    return (fs::path(dir_) / (file_hash + ".lex")).string();
+}
+
+bool LexicalIndex::add_file(const std::string &file_hash, const std::vector<std::string_view> &chunks,
+                            const std::vector<uint64_t> &hashes) {
+    if (chunks.size() != hashes.size()) {
+        std::cerr << "Error: " << chunks.size() << " chunks but " << hashes.size() << " hashes for lexical index"
+                  << std::endl;
+        return false;
+    }
+
+    // Tokenize outside the lock; postings of a file are in chunk order by construction
+    FilePostings postings;
+    std::vector<uint32_t> lengths(chunks.size());
+    std::unordered_map<std::string, uint32_t> frequencies;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        frequencies.clear();
+        std::vector<std::string> tokens = lexical_tokens(chunks[c]);
+        lengths[c] = static_cast<uint32_t>(tokens.size());
+        for (auto &token: tokens) {
+            ++frequencies[std::move(token)];
+        }
+        for (const auto &[term, tf]: frequencies) {
+            postings[term].emplace_back(static_cast<uint32_t>(c), tf);
+        }
+    }
+
+    if (!write_file(file_hash, hashes, lengths, postings)) {
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    append_locked(file_hash, hashes, lengths, postings);
+    const size_t dead = doc_hashes_.size() - live_chunks_;
+    if (dead > doc_hashes_.size() * LEXICAL_REBUILD_DEAD_FRACTION) {
+        load_all_locked();
+    }
+    return true;
+}
+
+void LexicalIndex::append_locked(const std::string &file_hash, const std::vector<uint64_t> &hashes,
+                                 const std::vector<uint32_t> &lengths, const FilePostings &postings) {
+    // Tombstone the chunks of an earlier version of the file
+    auto it = files_.find(file_hash);
+    if (it != files_.end()) {
+        for (uint32_t d = it->second.first_doc; d < it->second.first_doc + it->second.count; ++d) {
+            if (doc_alive_[d]) {
+                doc_alive_[d] = 0;
+                --live_chunks_;
+                live_length_ -= doc_lengths_[d];
+            }
+        }
+    }
+
+    const uint32_t base = static_cast<uint32_t>(doc_hashes_.size());
+    files_[file_hash] = {base, static_cast<uint32_t>(hashes.size())};
+    file_starts_.emplace_back(base, file_hash);
+    for (size_t c = 0; c < hashes.size(); ++c) {
+        doc_hashes_.push_back(hashes[c]);
+        doc_lengths_.push_back(lengths[c]);
+        doc_alive_.push_back(1);
+        live_length_ += lengths[c];
+    }
+    live_chunks_ += hashes.size();
+
+    for (const auto &[term, list]: postings) {
+        PostingList &target = postings_[term];
+        for (const auto &[chunk, tf]: list) {
+            target.append(base + chunk, tf, lengths[chunk]);
+        }
+    }
+}
+
+bool LexicalIndex::write_file(const std::string &file_hash, const std::vector<uint64_t> &hashes,
+                              const std::vector<uint32_t> &lengths, const FilePostings &postings) const {
+    // Header, (hash, length) per chunk, then per term: name and (chunk gap, tf) varints
+    std::vector<uint8_t> body;
+    for (const auto &[term, list]: postings) {
+        put_varint(body, static_cast<uint32_t>(term.size()));
+        body.insert(body.end(), term.begin(), term.end());
+        put_varint(body, static_cast<uint32_t>(list.size()));
+        uint32_t prev = 0;
+        for (const auto &[chunk, tf]: list) {
+            put_varint(body, chunk - prev);
+            put_varint(body, tf);
+            prev = chunk;
+        }
+    }
+
+    const uint32_t header[4] = {LEXICAL_FILE_MAGIC, 1, static_cast<uint32_t>(hashes.size()),
+                                static_cast<uint32_t>(postings.size())};
+    std::string path = file_path(file_hash);
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << tmp_path << " for writing" << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    for (size_t c = 0; c < hashes.size(); ++c) {
+        out.write(reinterpret_cast<const char *>(&hashes[c]), sizeof(uint64_t));
+        out.write(reinterpret_cast<const char *>(&lengths[c]), sizeof(uint32_t));
+    }
+    out.write(reinterpret_cast<const char *>(body.data()), static_cast<std::streamsize>(body.size()));
+    out.close();
+    std::error_code ec;
+    if (!out) {
+        std::cerr << "Error: Failed writing " << tmp_path << std::endl;
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "Error: Could not move " << tmp_path << " into place: " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool LexicalIndex::load_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return false;
+    }
+    std::vector<uint8_t> data(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size()));
+
+    uint32_t header[4];
+    constexpr size_t chunk_record = sizeof(uint64_t) + sizeof(uint32_t);
+    if (!in || data.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(header, data.data(), sizeof(header));
+    if (header[0] != LEXICAL_FILE_MAGIC || header[1] != 1 ||
+        data.size() < sizeof(header) + static_cast<size_t>(header[2]) * chunk_record) {
+        return false;
+    }
+
+    std::vector<uint64_t> hashes(header[2]);
+    std::vector<uint32_t> lengths(header[2]);
+    size_t pos = sizeof(header);
+    for (size_t c = 0; c < hashes.size(); ++c, pos += chunk_record) {
+        std::memcpy(&hashes[c], data.data() + pos, sizeof(uint64_t));
+        std::memcpy(&lengths[c], data.data() + pos + sizeof(uint64_t), sizeof(uint32_t));
+    }
+
+    FilePostings postings;
+    for (uint32_t t = 0; t < header[3]; ++t) {
+        uint32_t length = 0, count = 0;
+        if (!get_varint(data.data(), data.size(), pos, length) || length > data.size() - pos) {
+            return false;
+        }
+        auto &list = postings[std::string(reinterpret_cast<const char *>(data.data() + pos), length)];
+        pos += length;
+        if (!get_varint(data.data(), data.size(), pos, count)) {
+            return false;
+        }
+        uint32_t chunk = 0;
+        for (uint32_t p = 0; p < count; ++p) {
+            uint32_t gap = 0, tf = 0;
+            if (!get_varint(data.data(), data.size(), pos, gap) || !get_varint(data.data(), data.size(), pos, tf)) {
+                return false;
+            }
+            chunk += gap;
+            if (chunk >= hashes.size()) {
+                return false;
+            }
+            list.emplace_back(chunk, tf);
+        }
+    }
+
+    append_locked(fs::path(path).stem().string(), hashes, lengths, postings);
+    return true;
+}
+
+void LexicalIndex::load_all_locked() {
+    doc_hashes_.clear();
+    doc_lengths_.clear();
+    doc_alive_.clear();
+    files_.clear();
+    file_starts_.clear();
+    postings_.clear();
+    live_chunks_ = 0;
+    live_length_ = 0;
+
+    std::error_code ec;
+    for (const auto &entry: fs::directory_iterator(dir_, ec)) {
+        if (entry.path().extension() != ".lex") continue;
+        if (!load_file(entry.path().string())) {
+            std::cerr << "Skipping malformed lexical index file " << entry.path() << std::endl;
+        }
+    }
+}
+
+void LexicalIndex::bootstrap_from_docstores() {
+    auto index = SegmentedIndex::open(root_);
+    if (!index) {
+        return;
+    }
+    // Rows of every live file grouped by the document they came from
+    size_t skipped = 0;
+    for (const auto &entry: index->live_entries()) {
+        const MappedDocstore *docs = entry.docs.get();
+        if (!docs || docs->header->num_chunks != entry.data->header->num_entries) {
+            skipped += entry.data->header->num_entries;
+            continue;
+        }
+        std::vector<std::vector<std::string_view> > chunks(docs->header->num_documents);
+        std::vector<std::vector<uint64_t> > hashes(docs->header->num_documents);
+        for (uint32_t row = 0; row < docs->header->num_chunks; ++row) {
+            const DocstoreChunkRecord &record = docs->chunks[row];
+            if (record.document >= docs->header->num_documents) {
+                ++skipped;
+                continue;
+            }
+            chunks[record.document].emplace_back(docs->string(record.text));
+            hashes[record.document].push_back(record.hash);
+        }
+        for (uint32_t d = 0; d < docs->header->num_documents; ++d) {
+            if (!chunks[d].empty()) {
+                add_file(std::string(docs->string(docs->documents[d].file_hash)), chunks[d], hashes[d]);
+            }
+        }
+    }
+    if (skipped > 0) {
+        std::cerr << "Lexical index: " << skipped
+                  << " chunks have no docstore record and are not indexed, re-add their files to index them"
+                  << std::endl;
+    }
+}
+
+float LexicalIndex::bm25(float idf, uint32_t tf, uint32_t length, float avg_length) const {
+    const float norm = LEXICAL_BM25_K1 * (1.0f - LEXICAL_BM25_B + LEXICAL_BM25_B * length / avg_length);
+    return idf * tf * (LEXICAL_BM25_K1 + 1.0f) / (tf + norm);
+}
+
+std::vector<SimilarityResult> LexicalIndex::search(std::string_view query, size_t k, const CompiledFilter *filter,
+                                                   std::vector<SegmentedIndex::RowRef> *rows) const {
+    std::vector<std::string> terms = lexical_tokens(query);
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (k == 0 || live_chunks_ == 0) {
+        return {};
+    }
+    const float n = static_cast<float>(live_chunks_);
+    const float avg_length = std::max(1.0f, static_cast<float>(live_length_) / n);
+
+    std::vector<Cursor> cursors;
+    for (const auto &term: terms) {
+        auto it = postings_.find(term);
+        if (it == postings_.end() || it->second.count == 0) continue;
+        const PostingList &list = it->second;
+        // Document frequencies still count tombstoned chunks until the next rebuild
+        const float df = static_cast<float>(list.count);
+        const float idf = std::log(1.0f + std::max(0.0f, n - df + 0.5f) / (df + 0.5f));
+        Cursor cursor{&list, idf, bm25(idf, list.max_tf, list.min_length, avg_length)};
+        cursor.next();
+        cursors.push_back(cursor);
+    }
+
+    // Chunks are filtered by their row, not their hash: equal chunks of other files share it
+    std::vector<CompiledFilter::FileRows> file_rows(filter ? file_starts_.size() : 0);
+    for (size_t f = 0; f < file_rows.size(); ++f) {
+        file_rows[f] = filter->file_rows(file_starts_[f].second);
+    }
+    auto file_of = [this](uint32_t doc) {
+        return std::upper_bound(file_starts_.begin(), file_starts_.end(), doc,
+                                [](uint32_t d, const auto &start) { return d < start.first; }) - 1;
+    };
+    auto passes = [&](uint32_t doc) {
+        auto file = file_of(doc);
+        return file_rows[file - file_starts_.begin()].allows(doc - file->first);
+    };
+
+    // WAND: with cursors ordered by doc, the pivot is the first doc whose
+    // preceding upper bounds add up to more than the current k-th score
+    BoundedTopK top(k);
+    auto by_doc = [](const Cursor &a, const Cursor &b) { return a.doc < b.doc; };
+    while (true) {
+        cursors.erase(std::remove_if(cursors.begin(), cursors.end(), [](const Cursor &c) { return c.done; }),
+                      cursors.end());
+        if (cursors.empty()) break;
+        std::sort(cursors.begin(), cursors.end(), by_doc);
+
+        const float threshold = top.threshold();
+        float bound = 0.0f;
+        size_t pivot = 0;
+        for (; pivot < cursors.size(); ++pivot) {
+            bound += cursors[pivot].upper_bound;
+            if (bound > threshold) break;
+        }
+        if (pivot == cursors.size()) break;
+        const uint32_t pivot_doc = cursors[pivot].doc;
+
+        if (cursors[0].doc != pivot_doc) {
+            // No doc before the pivot can make the cut; skip the lists ahead to it
+            for (size_t i = 0; i < pivot; ++i) {
+                cursors[i].seek(pivot_doc);
+            }
+            continue;
+        }
+
+        float score = 0.0f;
+        for (Cursor &cursor: cursors) {
+            if (cursor.doc != pivot_doc) break;
+            score += bm25(cursor.idf, cursor.tf, doc_lengths_[pivot_doc], avg_length);
+            cursor.next();
+        }
+        if (doc_alive_[pivot_doc] && (!filter || passes(pivot_doc))) {
+            top.push(score, pivot_doc);
+        }
+    }
+
+    // Chunk c of a file is row c of its document's vectors
+    std::vector<SimilarityResult> results = top.sorted();
+    std::vector<std::pair<std::string, uint32_t> > documents;
+    for (auto &result: results) {
+        const auto doc = static_cast<uint32_t>(result.hash);
+        result.hash = doc_hashes_[doc];
+        if (rows) {
+            auto file = file_of(doc);
+            documents.emplace_back(file->second, doc - file->first);
+        }
+    }
+    lock.unlock();
+
+    if (rows) {
+        rows->assign(results.size(), {});
+        auto segments = SegmentedIndex::open(root_);
+        for (size_t i = 0; segments && i < results.size(); ++i) {
+            SegmentedIndex::RowRef &ref = (*rows)[i];
+            if (segments->locate(documents[i].first, ref)) {
+                ref.row += documents[i].second;
+            }
+        }
+    }
+    return results;
+}
+
+LexicalIndex::Stats LexicalIndex::stats() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    Stats stats;
+    stats.files = files_.size();
+    stats.chunks = live_chunks_;
+    stats.dead_chunks = doc_hashes_.size() - live_chunks_;
+    stats.terms = postings_.size();
+    for (const auto &[term, list]: postings_) {
+        stats.posting_bytes += list.bytes.size();
+    }
+    return stats;
+}
+
+} // namespace tldr
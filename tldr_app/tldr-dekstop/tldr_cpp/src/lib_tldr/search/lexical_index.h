@@ -0,0 +1,131 @@
+#ifndef TLDR_CPP_LEXICAL_INDEX_H
+#define TLDR_CPP_LEXICAL_INDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <cstdint>
+#include "npu_accelerator.h"
+#include "../constants.h"
+#include "search_filter.h"
+#include "segmented_index.h"
+
+namespace tldr {
+
+// Lexical tokens of a text: lowercased alphanumeric runs, plus runs joined by
+// single '-', '_', '.', ':' or '/' kept whole (error codes, identifiers, versions)
+std::vector<std::string> lexical_tokens(std::string_view text);
+
+/**
+ * In-process BM25 inverted index over the chunks of one corpus root.
+ *
+ * Every chunk is a document of the index, identified by its embedding hash,
+ * so lexical results fuse with vector results and hydrate the same way.
+ * Posting lists hold (doc gap, term frequency) varint pairs with a skip entry
+ * every LEXICAL_SKIP_INTERVAL postings, and know the upper bound of their BM25
+ * contribution, so queries run WAND: documents that cannot beat the current
+ * k-th score are skipped over without being scored.
+ *
+ * Each ingested file is persisted on its own (<root>/_vecdump/lexical/<file hash>.lex)
+ * and loaded into the in-memory lists on open. Re-adding a file tombstones its
+ * old chunks; the lists are rebuilt from the files once LEXICAL_REBUILD_DEAD_FRACTION
+ * of the indexed chunks are dead. A corpus without a lexical directory is
+ * bootstrapped once from the docstores of its live vector files.
+ */
+class LexicalIndex {
+public:
+    struct Stats {
+        size_t files = 0;
+        size_t chunks = 0;        // Live chunks
+        size_t dead_chunks = 0;   // Replaced chunks still in the posting lists
+        size_t terms = 0;
+        size_t posting_bytes = 0;
+    };
+
+    // Get the process-wide index of a corpus root, nullptr if the root does not exist
+    static std::shared_ptr<LexicalIndex> open(const std::string &corpus_root);
+
+    // Index the chunks of one file, replacing an earlier version of it, and persist them
+    bool add_file(const std::string &file_hash, const std::vector<std::string_view> &chunks,
+                  const std::vector<uint64_t> &hashes);
+
+    // Top-k chunks by BM25 score; chunks whose row (file and chunk index) the filter rejects are not
+    // returned. rows, if given, receives the row of the corpus' live files holding each result (data null where unknown).
+    std::vector<SimilarityResult> search(std::string_view query, size_t k, const CompiledFilter *filter = nullptr,
+                                         std::vector<SegmentedIndex::RowRef> *rows = nullptr) const;
+
+    Stats stats() const;
+
+private:
+    // Postings of one term in increasing doc order
+    struct PostingList {
+        struct Skip {
+            uint32_t first_doc; // First doc of the block
+            uint32_t prev_doc;  // Doc the block's first gap is relative to
+            uint32_t offset;    // Byte offset of the block
+        };
+        std::vector<uint8_t> bytes;
+        std::vector<Skip> skips;
+        uint32_t count = 0;
+        uint32_t last_doc = 0;
+        uint32_t max_tf = 0;
+        uint32_t min_length = UINT32_MAX; // Shortest chunk of the list, bounds the BM25 score with max_tf
+
+        void append(uint32_t doc, uint32_t tf, uint32_t length);
+    };
+
+    // Reads one posting list in doc order
+    struct Cursor {
+        const PostingList *list;
+        float idf;
+        float upper_bound;
+        size_t pos = 0;
+        uint32_t index = 0; // Postings consumed
+        uint32_t doc = 0;
+        uint32_t tf = 0;
+        bool done = false;
+
+        void next();
+        void seek(uint32_t target); // First posting with doc >= target
+    };
+
+    struct FileRange {
+        uint32_t first_doc;
+        uint32_t count;
+    };
+
+    // Postings of one file keyed by term, in chunk order
+    using FilePostings = std::unordered_map<std::string, std::vector<std::pair<uint32_t, uint32_t> > >;
+
+    explicit LexicalIndex(std::string corpus_root);
+
+    std::string file_path(const std::string &file_hash) const;
+    bool write_file(const std::string &file_hash, const std::vector<uint64_t> &hashes,
+                    const std::vector<uint32_t> &lengths, const FilePostings &postings) const;
+    bool load_file(const std::string &path);
+    void load_all_locked();
+    void bootstrap_from_docstores();
+    void append_locked(const std::string &file_hash, const std::vector<uint64_t> &hashes,
+                       const std::vector<uint32_t> &lengths, const FilePostings &postings);
+    float bm25(float idf, uint32_t tf, uint32_t length, float avg_length) const;
+
+    std::string root_;
+    std::string dir_;
+
+    mutable std::shared_mutex mutex_;
+    std::vector<uint64_t> doc_hashes_;
+    std::vector<uint32_t> doc_lengths_;
+    std::vector<uint8_t> doc_alive_;
+    std::unordered_map<std::string, FileRange> files_;
+    std::vector<std::pair<uint32_t, std::string> > file_starts_; // (first doc, file hash) in doc order
+    std::unordered_map<std::string, PostingList> postings_;
+    size_t live_chunks_ = 0;
+    uint64_t live_length_ = 0;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_LEXICAL_INDEX_H
@@ -0,0 +1,137 @@
+//
+// Portable C++ implementation of the npu_accelerator.h C ABI.
+// Built instead of linking libnpu-accelerator.a (the CoreML/Swift version)
+// when TLDR_CPU_SIMILARITY is enabled, e.g. on Linux servers. The modelPath
+// arguments are accepted for ABI compatibility and ignored.
+//
+
+#include "npu_accelerator.h"
+#include "cpu_similarity.h"
+#include "dump_cache.h"
+#include "../vec_dump.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Number of results returned by the single-file / raw-vector entry points,
+// matching the Swift implementation
+static constexpr size_t DEFAULT_TOP_RESULTS = 5;
+
+// Copy results into a malloc'd array owned by the caller (released with free_similarity_results)
+static SimilarityResult *to_c_results(const std::vector<SimilarityResult> &results, int32_t *resultCountPtr) {
+    if (results.empty()) {
+        return nullptr;
+    }
+    auto *out = static_cast<SimilarityResult *>(std::malloc(results.size() * sizeof(SimilarityResult)));
+    if (!out) {
+        return nullptr;
+    }
+    std::memcpy(out, results.data(), results.size() * sizeof(SimilarityResult));
+    *resultCountPtr = static_cast<int32_t>(results.size());
+    return out;
+}
+
+extern "C" {
+
+SimilarityResult *perform_similarity_check(
+    const char *modelPath,
+    const char *vectorDumpPath,
+    const float *queryVectorPtr,
+    int32_t queryVectorDimensions,
+    int32_t *resultCountPtr) {
+    (void) modelPath;
+    *resultCountPtr = 0;
+
+    auto dump = tldr::DumpMappingCache::instance().acquire(vectorDumpPath);
+    if (!dump || dump->header->num_entries == 0) {
+        std::cerr << "Error: Failed to open vector dump file: " << vectorDumpPath << std::endl;
+        return nullptr;
+    }
+
+    const size_t dims = dump->header->vector_dimensions;
+    const bool use_first_vector = queryVectorPtr == nullptr || queryVectorDimensions <= 0;
+    if (!use_first_vector && static_cast<size_t>(queryVectorDimensions) != dims) {
+        std::cerr << "Error: Query has " << queryVectorDimensions << " dims, dump has " << dims << std::endl;
+        return nullptr;
+    }
+
+    // Quantized dumps without a float32 section are decoded for the exact scan
+    std::vector<float> decoded;
+    const float *vectors = dump->vectors;
+    if (!vectors) {
+        decoded.resize(static_cast<size_t>(dump->header->num_entries) * dims);
+        for (size_t row = 0; row < dump->header->num_entries; ++row) {
+            tldr::decode_vector(*dump, row, &decoded[row * dims]);
+        }
+        vectors = decoded.data();
+    }
+
+    // As in the Swift version, the first vector doubles as the query when none is given
+    // and is then excluded from the results
+    const float *query = use_first_vector ? vectors : queryVectorPtr;
+    const size_t skip = use_first_vector ? 1 : 0;
+
+    auto results = tldr::cpu_search_vectors(query, dims,
+                                            vectors + skip * dims, dump->hashes + skip,
+                                            dump->header->num_entries - skip, DEFAULT_TOP_RESULTS);
+    return to_c_results(results, resultCountPtr);
+}
+
+SimilarityResult *compute_cosine_similarity(
+    const char *modelPath,
+    const float *queryVectorPtr,
+    int32_t queryVectorDimensions,
+    const float *vectorsPtr,
+    int32_t vectorCount,
+    int32_t vectorDimensions,
+    const uint64_t *hashesPtr,
+    int32_t *resultCountPtr) {
+    (void) modelPath;
+    *resultCountPtr = 0;
+
+    if (!queryVectorPtr || !vectorsPtr || vectorCount <= 0 || queryVectorDimensions != vectorDimensions) {
+        std::cerr << "Error: Invalid arguments to compute_cosine_similarity" << std::endl;
+        return nullptr;
+    }
+
+    // Without hashes the row index is reported instead, as in the Swift version
+    std::vector<uint64_t> index_hashes;
+    if (!hashesPtr) {
+        index_hashes.resize(vectorCount);
+        for (int32_t i = 0; i < vectorCount; ++i) index_hashes[i] = static_cast<uint64_t>(i);
+        hashesPtr = index_hashes.data();
+    }
+
+    auto results = tldr::cpu_search_vectors(queryVectorPtr, vectorDimensions, vectorsPtr, hashesPtr,
+                                            vectorCount, DEFAULT_TOP_RESULTS);
+    return to_c_results(results, resultCountPtr);
+}
+
+SimilarityResult *retrieve_similar_vectors_from_corpus(
+    const char *modelPath,
+    const char *corpusDir,
+    const float *queryVectorPtr,
+    int32_t queryVectorDimensions,
+    int32_t k,
+    int32_t *resultCountPtr) {
+    (void) modelPath;
+    *resultCountPtr = 0;
+
+    if (!queryVectorPtr || queryVectorDimensions <= 0 || k <= 0) {
+        std::cerr << "Error: Invalid arguments to retrieve_similar_vectors_from_corpus" << std::endl;
+        return nullptr;
+    }
+
+    auto results = tldr::cpu_search_corpus(corpusDir, queryVectorPtr, queryVectorDimensions, k);
+    if (results.empty()) {
+        std::cout << "No similarity results found in corpus" << std::endl;
+    }
+    return to_c_results(results, resultCountPtr);
+}
+
+void free_similarity_results(void *ptr) {
+    std::free(ptr);
+}
+
+} // extern "C"
@@ -0,0 +1,197 @@
+#include "search_filter.h"
+#include "../constants.h"
+#include <iostream>
+#include <list>
+#include <algorithm>
+#include <bit>
+
+namespace tldr {
+
+namespace {
+
+struct CachedFilter {
+    std::string root;
+    uint64_t generation;
+    std::string key;
+    std::shared_ptr<const CompiledFilter> filter;
+};
+
+std::mutex g_filter_cache_mutex;
+std::list<CachedFilter> g_filter_cache; // Most recently used first
+
+// Fields of a filter as one string; the order of the file hashes does not matter
+std::string filter_key(const SearchFilter &filter) {
+    std::vector<std::string> file_hashes = filter.file_hashes;
+    std::sort(file_hashes.begin(), file_hashes.end());
+    std::string key;
+    for (const auto &hash: file_hashes) {
+        key += hash;
+        key += ',';
+    }
+    key += '\n' + filter.author + '\n' + filter.title + '\n' + std::to_string(filter.page_min) + ',' +
+            std::to_string(filter.page_max);
+    return key;
+}
+
+} // namespace
+
+CompiledFilter::CompiledFilter(const SearchFilter &filter, const std::vector<SegmentedIndex::Entry> &entries)
+    : entries_(entries), masks_(entries.size()) {
+    const std::unordered_set<std::string> file_hashes(filter.file_hashes.begin(), filter.file_hashes.end());
+    const bool hashes_only = filter.author.empty() && filter.title.empty() && filter.page_min <= 0 &&
+                             filter.page_max <= 0;
+    size_t undecided = 0;
+
+    for (size_t e = 0; e < entries_.size(); ++e) {
+        const SegmentedIndex::Entry &entry = entries_[e];
+        const size_t num_rows = entry.data->header->num_entries;
+        Mask &mask = masks_[e];
+        const MappedDocstore *docs = entry.docs.get();
+
+        if (!docs || docs->header->num_chunks != num_rows) {
+            // No per-row metadata: decide the file as a whole where the filter allows it
+            bool listed = hashes_only && !entry.file_hashes.empty();
+            for (const auto &hash: entry.file_hashes) {
+                listed = listed && file_hashes.count(hash) > 0;
+            }
+            if (listed) {
+                mask.matches = num_rows;
+            } else if (!hashes_only) {
+                undecided += num_rows;
+            }
+            matches_ += mask.matches;
+            continue;
+        }
+
+        // Document fields once per document record
+        std::vector<char> document_passes(docs->header->num_documents, 0);
+        bool any_document = false;
+        for (uint32_t d = 0; d < docs->header->num_documents; ++d) {
+            const DocstoreDocumentRecord &record = docs->documents[d];
+            bool passes = (file_hashes.empty() || file_hashes.count(std::string(docs->string(record.file_hash)))) &&
+                          (filter.author.empty() || docs->string(record.author) == filter.author) &&
+                          (filter.title.empty() || docs->string(record.title) == filter.title);
+            document_passes[d] = passes;
+            any_document = any_document || passes;
+        }
+        if (!any_document) {
+            continue;
+        }
+
+        mask.bits.assign((num_rows + 63) / 64, 0);
+        for (size_t row = 0; row < num_rows; ++row) {
+            const DocstoreChunkRecord &chunk = docs->chunks[row];
+            if (chunk.document >= docs->header->num_documents) {
+                ++undecided; // Merged in from a file without a docstore
+                continue;
+            }
+            if (!document_passes[chunk.document] ||
+                (filter.page_min > 0 && chunk.page_number < filter.page_min) ||
+                (filter.page_max > 0 && chunk.page_number > filter.page_max)) {
+                continue;
+            }
+            mask.bits[row / 64] |= uint64_t{1} << (row % 64);
+        }
+        for (uint64_t word: mask.bits) {
+            mask.matches += std::popcount(word);
+        }
+        if (mask.matches == num_rows) {
+            mask.bits.clear();
+            mask.bits.shrink_to_fit();
+        }
+        matches_ += mask.matches;
+    }
+
+    // Rows of each document, where the entry records them (as SegmentedIndex::locate)
+    for (size_t e = 0; e < entries_.size(); ++e) {
+        const SegmentedIndex::Entry &entry = entries_[e];
+        if (skips(e)) continue;
+        const size_t num_rows = entry.data->header->num_entries;
+        for (size_t d = 0; d < entry.doc_starts.size() && d < entry.file_hashes.size(); ++d) {
+            const size_t first = entry.doc_starts[d];
+            const size_t end = d + 1 < entry.doc_starts.size() ? entry.doc_starts[d + 1] : num_rows;
+            if (first < end && end <= num_rows) {
+                files_[entry.file_hashes[d]] = {rows(e), first, end - first};
+            }
+        }
+    }
+
+    if (undecided > 0) {
+        std::cerr << "Search filter: skipped " << undecided
+                << " rows without a docstore record, re-add their files to filter them" << std::endl;
+    }
+}
+
+CompiledFilter::FileRows CompiledFilter::file_rows(const std::string &file_hash) const {
+    auto it = files_.find(file_hash);
+    return it == files_.end() ? FileRows{} : it->second;
+}
+
+const std::unordered_map<uint64_t, uint64_t> &CompiledFilter::hash_rows() const {
+    std::call_once(hashes_built_, [this] {
+        hash_rows_.reserve(matches_);
+        for (size_t e = 0; e < entries_.size(); ++e) {
+            if (skips(e)) continue;
+            const uint64_t *bits = rows(e);
+            const uint64_t *row_hashes = entries_[e].data->hashes;
+            const size_t num_rows = entries_[e].data->header->num_entries;
+            for (size_t row = 0; row < num_rows; ++row) {
+                if (row_allowed(bits, row)) {
+                    hash_rows_.emplace(row_hashes[row], static_cast<uint64_t>(e) << 32 | row);
+                }
+            }
+        }
+    });
+    return hash_rows_;
+}
+
+bool CompiledFilter::allows(uint64_t hash) const {
+    return hash_rows().count(hash) > 0;
+}
+
+bool CompiledFilter::locate(uint64_t hash, SegmentedIndex::RowRef &out) const {
+    const auto &rows = hash_rows();
+    auto it = rows.find(hash);
+    if (it == rows.end()) {
+        return false;
+    }
+    const SegmentedIndex::Entry &entry = entries_[it->second >> 32];
+    out.data = entry.data;
+    out.docs = entry.docs;
+    out.row = static_cast<uint32_t>(it->second & 0xFFFFFFFFu);
+    return true;
+}
+
+HashFilter CompiledFilter::hash_filter(std::shared_ptr<const CompiledFilter> filter) {
+    return [filter = std::move(filter)](uint64_t hash) { return filter->allows(hash); };
+}
+
+std::shared_ptr<const CompiledFilter> CompiledFilter::cached(const SearchFilter &filter, const SegmentedIndex &index) {
+    // Read before the snapshot, so a filter is never cached under a newer generation than its files
+    const uint64_t generation = index.generation();
+    const std::string key = filter_key(filter);
+    {
+        std::lock_guard<std::mutex> lock(g_filter_cache_mutex);
+        // Filters compiled against earlier live files of this index are stale, and pin those files
+        g_filter_cache.remove_if([&](const CachedFilter &c) {
+            return c.root == index.root() && c.generation != generation;
+        });
+        auto it = std::find_if(g_filter_cache.begin(), g_filter_cache.end(), [&](const CachedFilter &c) {
+            return c.root == index.root() && c.key == key;
+        });
+        if (it != g_filter_cache.end()) {
+            g_filter_cache.splice(g_filter_cache.begin(), g_filter_cache, it);
+            return it->filter;
+        }
+    }
+
+    auto compiled = std::make_shared<const CompiledFilter>(filter, index.live_entries());
+    std::lock_guard<std::mutex> lock(g_filter_cache_mutex);
+    g_filter_cache.push_front({index.root(), generation, key, compiled});
+    while (g_filter_cache.size() > SEARCH_FILTER_CACHE_SIZE) {
+        g_filter_cache.pop_back();
+    }
+    return compiled;
+}
+
+} // namespace tldr
@@ -0,0 +1,100 @@
+#ifndef TLDR_CPP_SEARCH_FILTER_H
+#define TLDR_CPP_SEARCH_FILTER_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#include "../definitions.h"
+#include "segmented_index.h"
+
+namespace tldr {
+
+// Filter on embedding hashes, for indexes whose ids are not rows of the vector files
+using HashFilter = std::function<bool(uint64_t hash)>;
+
+/**
+ * A SearchFilter evaluated against one snapshot of live files.
+ *
+ * Document fields are matched once per document record of each file's
+ * docstore, then every row gets one bit telling whether its chunk passes, so
+ * scans test a bit per row instead of the filter. Files without a docstore
+ * can only be decided whole: they pass if the filter is limited to file hashes
+ * and every document of the file is listed, and are skipped otherwise.
+ */
+// Whether row r is set in a bitset of CompiledFilter::rows
+inline bool row_allowed(const uint64_t *bits, size_t row) {
+    return !bits || (bits[row / 64] >> (row % 64)) & 1;
+}
+
+class CompiledFilter {
+public:
+    CompiledFilter(const SearchFilter &filter, const std::vector<SegmentedIndex::Entry> &entries);
+
+    // Row bitset of an entry (bit r of word r / 64), nullptr if every row passes
+    const uint64_t *rows(size_t entry) const { return masks_[entry].bits.empty() ? nullptr : masks_[entry].bits.data(); }
+
+    // Whether no row of an entry passes
+    bool skips(size_t entry) const { return masks_[entry].matches == 0; }
+
+    // Rows passing over all entries
+    size_t matches() const { return matches_; }
+
+    // Rows of one live file within the bitset of its entry
+    struct FileRows {
+        const uint64_t *bits = nullptr; // nullptr if every row of the entry passes
+        size_t first = 0;
+        size_t count = 0;               // 0 if the file is not live or no row passes
+
+        // Whether row r of the file passes
+        bool allows(size_t row) const { return row < count && row_allowed(bits, first + row); }
+    };
+
+    // Where the rows of a file are, for indexes that store (file hash, row in file)
+    FileRows file_rows(const std::string &file_hash) const;
+
+    /**
+     * Whether some passing row holds the chunk of an embedding hash, for indexes
+     * that only store hashes (map built on first use). Equal chunk text has an
+     * equal hash in every document, so results must be read from the row found
+     * by locate(), not from any row holding the hash.
+     */
+    bool allows(uint64_t hash) const;
+
+    // A passing row holding the chunk of an embedding hash, false if there is none
+    bool locate(uint64_t hash, SegmentedIndex::RowRef &out) const;
+
+    // allows() as a callable that keeps this filter alive
+    static HashFilter hash_filter(std::shared_ptr<const CompiledFilter> filter);
+
+    /**
+     * Filter compiled against the live files of an index, shared by the queries
+     * using the same filter until the index changes, so that ANN lookups are not
+     * preceded by a pass over the whole corpus. The SEARCH_FILTER_CACHE_SIZE most
+     * recently used filters are kept.
+     */
+    static std::shared_ptr<const CompiledFilter> cached(const SearchFilter &filter, const SegmentedIndex &index);
+
+private:
+    struct Mask {
+        std::vector<uint64_t> bits; // Empty if every row passes
+        size_t matches = 0;
+    };
+
+    const std::unordered_map<uint64_t, uint64_t> &hash_rows() const;
+
+    std::vector<SegmentedIndex::Entry> entries_;
+    std::vector<Mask> masks_;
+    size_t matches_ = 0;
+    std::unordered_map<std::string, FileRows> files_;
+
+    mutable std::once_flag hashes_built_;
+    mutable std::unordered_map<uint64_t, uint64_t> hash_rows_; // Hash -> entry << 32 | row of a passing row
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_SEARCH_FILTER_H
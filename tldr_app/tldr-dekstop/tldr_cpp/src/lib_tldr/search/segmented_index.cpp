@@ -0,0 +1,563 @@
+#include "segmented_index.h"
+#include "dump_cache.h"
+#include "../constants.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <chrono>
+#include <atomic>
+#include <nlohmann/json.hpp>
+
+namespace tldr {
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+static std::mutex g_index_registry_mutex;
+static std::map<std::string, std::shared_ptr<SegmentedIndex> > g_index_registry;
+// Shared by every index, so a reopened index never repeats the generation of an earlier one
+static std::atomic<uint64_t> g_next_generation{1};
+
+std::shared_ptr<SegmentedIndex> SegmentedIndex::open(const std::string &corpus_root) {
+    std::error_code ec;
+    if (!fs::is_directory(corpus_root, ec)) {
+        return nullptr;
+    }
+    std::string root = fs::weakly_canonical(corpus_root, ec).string();
+
+    std::lock_guard<std::mutex> lock(g_index_registry_mutex);
+    auto it = g_index_registry.find(root);
+    if (it != g_index_registry.end()) {
+        return it->second;
+    }
+
+    std::shared_ptr<SegmentedIndex> index(new SegmentedIndex(root));
+    if (!index->load_manifest()) {
+        index->bootstrap_from_walk();
+    }
+    index->compaction_thread_ = std::thread(&SegmentedIndex::compaction_loop, index.get());
+    g_index_registry[root] = index;
+    return index;
+}
+
+void SegmentedIndex::close_all() {
+    std::lock_guard<std::mutex> lock(g_index_registry_mutex);
+    g_index_registry.clear();
+}
+
+SegmentedIndex::SegmentedIndex(std::string corpus_root)
+    : root_(std::move(corpus_root)), generation_(g_next_generation++) {
+    fs::path vecdump_dir = fs::path(root_) / "_vecdump";
+    manifest_path_ = (vecdump_dir / SEGMENT_MANIFEST_NAME).string();
+    segments_dir_ = (vecdump_dir / "segments").string();
+}
+
+SegmentedIndex::~SegmentedIndex() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (compaction_thread_.joinable()) {
+        compaction_thread_.join();
+    }
+}
+
+std::string SegmentedIndex::abs_path(const std::string &rel_path) const {
+    return (fs::path(root_) / rel_path).string();
+}
+
+bool SegmentedIndex::map_entry(Entry &entry) const {
+    std::string path = abs_path(entry.rel_path);
+    std::shared_ptr<MappedVectorData> data = DumpMappingCache::instance().acquire(path);
+    if (!data) {
+        std::cerr << "Segmented index: could not map " << path << std::endl;
+        return false;
+    }
+    entry.data = std::move(data);
+    entry.hash_rows = std::make_shared<HashRows>();
+
+    std::unique_ptr<MappedBinaryCodes> bits = read_binary_codes_file(binary_codes_path_for(path));
+    if (bits && bits->header->num_entries == entry.data->header->num_entries &&
+        bits->header->vector_dimensions == entry.data->header->vector_dimensions) {
+        entry.bits = std::move(bits);
+    } else {
+        entry.bits.reset();
+    }
+
+    std::unique_ptr<MappedDocstore> docs = read_docstore_file(docstore_path_for(path));
+    if (docs && docs->header->num_chunks == entry.data->header->num_entries) {
+        entry.docs = std::move(docs);
+    } else {
+        entry.docs.reset();
+    }
+    return true;
+}
+
+bool SegmentedIndex::find_row(const Entry &entry, uint64_t hash, uint32_t &row) {
+    HashRows &index = *entry.hash_rows;
+    std::call_once(index.built, [&] {
+        const uint32_t rows = entry.data->header->num_entries;
+        index.rows.reserve(rows);
+        for (uint32_t row = 0; row < rows; ++row) {
+            index.rows.emplace_back(entry.data->hashes[row], row);
+        }
+        std::sort(index.rows.begin(), index.rows.end());
+    });
+
+    auto it = std::lower_bound(index.rows.begin(), index.rows.end(), std::make_pair(hash, uint32_t{0}));
+    if (it == index.rows.end() || it->first != hash) {
+        return false;
+    }
+    row = it->second;
+    return true;
+}
+
+bool SegmentedIndex::find_vector(const Entry &entry, uint64_t hash, float *out) {
+    uint32_t row;
+    if (!find_row(entry, hash, row)) {
+        return false;
+    }
+    decode_vector(*entry.data, row, out);
+    return true;
+}
+
+bool SegmentedIndex::find_chunk(const Entry &entry, uint64_t hash, CtxChunkMeta &out) {
+    uint32_t row;
+    if (!entry.docs || !find_row(entry, hash, row) || entry.docs->chunks[row].hash != hash) {
+        return false;
+    }
+    return entry.docs->hydrate(row, out);
+}
+
+bool SegmentedIndex::load_manifest() {
+    std::ifstream in(manifest_path_);
+    if (!in) {
+        return false;
+    }
+
+    try {
+        json manifest = json::parse(in);
+        next_segment_id_ = manifest.value("next_segment_id", 1ULL);
+        for (const auto &item: manifest.at("entries")) {
+            Entry entry;
+            entry.rel_path = item.at("path").get<std::string>();
+            entry.is_segment = item.value("segment", false);
+            entry.file_hashes = item.value("file_hashes", std::vector<std::string>{});
+            entry.doc_starts = item.value("doc_starts", std::vector<uint32_t>{});
+            if (entry.doc_starts.size() != entry.file_hashes.size()) {
+                entry.doc_starts.clear();
+            }
+            if (!map_entry(entry)) {
+                continue; // Dropped from the manifest on the next write
+            }
+            file_hashes_.insert(entry.file_hashes.begin(), entry.file_hashes.end());
+            entries_.push_back(std::move(entry));
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Segmented index: ignoring unreadable manifest " << manifest_path_ << ": " << e.what() << std::endl;
+        entries_.clear();
+        file_hashes_.clear();
+        return false;
+    }
+
+    std::cout << "Segmented index: loaded " << entries_.size() << " live files for " << root_ << std::endl;
+    return true;
+}
+
+void SegmentedIndex::bootstrap_from_walk() {
+    std::cout << "Segmented index: no manifest in " << root_ << ", scanning for vector dumps" << std::endl;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root_, ec); !ec && it != fs::recursive_directory_iterator();
+         it.increment(ec)) {
+        if (!it->is_regular_file()) continue;
+        const fs::path &path = it->path();
+        bool is_dump = path.extension() == ".vecdump";
+        bool is_segment = path.extension() == ".vecseg";
+        if (!is_dump && !is_segment) continue;
+
+        Entry entry;
+        entry.rel_path = fs::relative(path, root_).string();
+        entry.is_segment = is_segment;
+        if (is_dump) {
+            entry.file_hashes.push_back(path.stem().string()); // <fileHash>.vecdump
+            entry.doc_starts.push_back(0);
+        }
+        if (!map_entry(entry)) continue;
+        if (is_segment && !recover_documents(entry)) {
+            std::cerr << "Segmented index: documents of " << entry.rel_path << " are not all recorded in its "
+                      << "docstore; their files will be ingested again next to the segment" << std::endl;
+        }
+        file_hashes_.insert(entry.file_hashes.begin(), entry.file_hashes.end());
+        entries_.push_back(std::move(entry));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_manifest_locked();
+}
+
+bool SegmentedIndex::recover_documents(Entry &entry) {
+    const MappedDocstore *docs = entry.docs.get();
+    if (!docs) {
+        return false;
+    }
+    // Merged rows keep the order of their inputs, so each document's rows are contiguous
+    bool complete = true;
+    std::vector<char> seen(docs->header->num_documents, 0);
+    uint32_t current = DOCSTORE_NO_DOCUMENT;
+    for (uint32_t row = 0; row < docs->header->num_chunks; ++row) {
+        const uint32_t document = docs->chunks[row].document;
+        if (document >= docs->header->num_documents) {
+            complete = false; // Merged in from a dump without a docstore
+            current = DOCSTORE_NO_DOCUMENT;
+            continue;
+        }
+        if (document == current) continue;
+        if (seen[document]) {
+            complete = false;
+        } else {
+            seen[document] = 1;
+            entry.file_hashes.emplace_back(docs->string(docs->documents[document].file_hash));
+            entry.doc_starts.push_back(row);
+        }
+        current = document;
+    }
+    if (!complete) {
+        entry.doc_starts.clear(); // Rows of the listed documents are not known
+    }
+    return complete;
+}
+
+bool SegmentedIndex::write_manifest_locked() const {
+    json manifest;
+    manifest["version"] = 1;
+    manifest["next_segment_id"] = next_segment_id_;
+    manifest["entries"] = json::array();
+    for (const auto &entry: entries_) {
+        manifest["entries"].push_back({
+            {"path", entry.rel_path},
+            {"segment", entry.is_segment},
+            {"entries", entry.data ? entry.data->header->num_entries : 0},
+            {"file_hashes", entry.file_hashes},
+            {"doc_starts", entry.doc_starts}
+        });
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(manifest_path_).parent_path(), ec);
+    std::string tmp_path = manifest_path_ + ".tmp";
+    {
+        std::ofstream out(tmp_path);
+        if (!out) {
+            std::cerr << "Segmented index: could not write " << tmp_path << std::endl;
+            return false;
+        }
+        out << manifest.dump(2);
+    }
+    fs::rename(tmp_path, manifest_path_, ec);
+    if (ec) {
+        std::cerr << "Segmented index: could not replace manifest: " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SegmentedIndex::register_dump(const std::string &dump_path, const std::string &file_hash) {
+    Entry entry;
+    entry.rel_path = fs::relative(fs::weakly_canonical(dump_path), root_).string();
+    entry.file_hashes = {file_hash};
+    entry.doc_starts = {0};
+    if (!map_entry(entry)) {
+        return false;
+    }
+
+    size_t pending_dumps = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto existing = std::find_if(entries_.begin(), entries_.end(), [&](const Entry &e) {
+            return e.rel_path == entry.rel_path;
+        });
+        if (existing != entries_.end()) {
+            // The sign-bit tier, hash rows and docstore describe the new file too
+            *existing = entry;
+        } else if (file_hashes_.count(file_hash)) {
+            // The caller should have checked contains_file; the new files would never be read
+            std::cout << "Segmented index: " << file_hash << " is already part of a segment" << std::endl;
+            remove_files(entry.rel_path);
+            return true;
+        } else {
+            entries_.push_back(entry);
+            file_hashes_.insert(file_hash);
+        }
+        doc_rows_stale_ = true;
+        generation_ = g_next_generation++;
+        write_manifest_locked();
+        pending_dumps = std::count_if(entries_.begin(), entries_.end(), [](const Entry &e) {
+            return !e.is_segment;
+        });
+    }
+
+    if (pending_dumps >= SEGMENT_MERGE_MIN_DUMPS) {
+        cv_.notify_all();
+    }
+    return true;
+}
+
+bool SegmentedIndex::locate(const std::string &file_hash, RowRef &out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (doc_rows_stale_) {
+        doc_rows_.clear();
+        for (size_t e = 0; e < entries_.size(); ++e) {
+            const Entry &entry = entries_[e];
+            for (size_t d = 0; d < entry.doc_starts.size(); ++d) {
+                doc_rows_[entry.file_hashes[d]] = {e, entry.doc_starts[d]};
+            }
+        }
+        doc_rows_stale_ = false;
+    }
+
+    auto it = doc_rows_.find(file_hash);
+    if (it == doc_rows_.end()) {
+        return false;
+    }
+    const Entry &entry = entries_[it->second.first];
+    out.data = entry.data;
+    out.docs = entry.docs;
+    out.row = it->second.second;
+    return true;
+}
+
+bool SegmentedIndex::contains_file(const std::string &file_hash) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return file_hashes_.count(file_hash) > 0;
+}
+
+std::vector<SegmentedIndex::Entry> SegmentedIndex::live_entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Queried files are the hot ones for the mapping cache's LRU
+    DumpMappingCache &cache = DumpMappingCache::instance();
+    for (const auto &entry: entries_) {
+        cache.touch(abs_path(entry.rel_path));
+    }
+    return entries_;
+}
+
+uint64_t SegmentedIndex::generation() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
+std::vector<std::string> SegmentedIndex::live_paths() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> paths;
+    for (const auto &entry: entries_) {
+        paths.push_back(abs_path(entry.rel_path));
+    }
+    return paths;
+}
+
+std::vector<SegmentedIndex::Entry> SegmentedIndex::pick_merge_inputs_locked(bool force) const {
+    // Level 0: per-document dumps are merged as soon as enough of them piled up
+    std::vector<Entry> dumps;
+    for (const auto &entry: entries_) {
+        if (!entry.is_segment) dumps.push_back(entry);
+    }
+    if (dumps.size() >= SEGMENT_MERGE_MIN_DUMPS || (force && !dumps.empty())) {
+        return dumps;
+    }
+
+    // Higher levels: merge the smallest segments once FANOUT of them are below the size cap
+    std::vector<Entry> small_segments;
+    for (const auto &entry: entries_) {
+        if (entry.is_segment && entry.data->header->num_entries < SEGMENT_MAX_ENTRIES) {
+            small_segments.push_back(entry);
+        }
+    }
+    std::sort(small_segments.begin(), small_segments.end(), [](const Entry &a, const Entry &b) {
+        return a.data->header->num_entries < b.data->header->num_entries;
+    });
+    if (small_segments.size() >= SEGMENT_MERGE_FANOUT) {
+        small_segments.resize(SEGMENT_MERGE_FANOUT);
+        return small_segments;
+    }
+    if (force && small_segments.size() >= 2) {
+        return small_segments;
+    }
+    return {};
+}
+
+void SegmentedIndex::remove_files(const std::string &rel_path) const {
+    std::error_code ec;
+    DumpMappingCache::instance().forget(abs_path(rel_path));
+    fs::remove(abs_path(rel_path), ec);
+    fs::remove(binary_codes_path_for(abs_path(rel_path)), ec);
+    fs::remove(docstore_path_for(abs_path(rel_path)), ec);
+}
+
+SegmentedIndex::MergeResult SegmentedIndex::merge_entries(const std::vector<Entry> &inputs) {
+    uint64_t segment_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        segment_id = next_segment_id_++;
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg-%06llu.vecseg", static_cast<unsigned long long>(segment_id));
+    std::error_code ec;
+    fs::create_directories(segments_dir_, ec);
+
+    Entry segment;
+    segment.is_segment = true;
+    segment.rel_path = fs::relative(fs::path(segments_dir_) / name, root_).string();
+
+    // Rows follow the inputs in order, so each document keeps its rows as one block
+    std::vector<const MappedVectorData *> sources;
+    bool starts_known = true;
+    uint32_t base = 0;
+    for (const auto &input: inputs) {
+        sources.push_back(input.data.get());
+        segment.file_hashes.insert(segment.file_hashes.end(), input.file_hashes.begin(), input.file_hashes.end());
+        starts_known = starts_known && input.doc_starts.size() == input.file_hashes.size();
+        for (uint32_t start: input.doc_starts) {
+            segment.doc_starts.push_back(base + start);
+        }
+        base += input.data->header->num_entries;
+    }
+    if (!starts_known) {
+        segment.doc_starts.clear();
+    }
+
+    if (!merge_vector_dumps(sources, abs_path(segment.rel_path)) || !map_entry(segment)) {
+        std::cerr << "Segmented index: merge into " << segment.rel_path << " failed" << std::endl;
+        remove_files(segment.rel_path);
+        return MergeResult::Failed;
+    }
+
+    // Keep the binary tier when the inputs had one
+    bool inputs_have_bits = std::any_of(inputs.begin(), inputs.end(), [](const Entry &e) { return e.bits != nullptr; });
+    if (inputs_have_bits) {
+        const MappedVectorData &merged = *segment.data;
+        std::string bits_path = binary_codes_path_for(abs_path(segment.rel_path));
+        if (write_binary_codes(bits_path, merged.header->num_entries, merged.header->vector_dimensions,
+                               [&](size_t row, float *out) { decode_vector(merged, row, out); })) {
+            segment.bits = read_binary_codes_file(bits_path);
+        }
+    }
+
+    // Likewise the docstore, in the row order of the merged file
+    bool inputs_have_docs = std::any_of(inputs.begin(), inputs.end(), [](const Entry &e) { return e.docs != nullptr; });
+    if (inputs_have_docs) {
+        std::vector<const MappedDocstore *> docs;
+        for (const auto &input: inputs) {
+            docs.push_back(input.docs.get());
+        }
+        std::string docs_path = docstore_path_for(abs_path(segment.rel_path));
+        if (merge_docstores(docs, sources, docs_path)) {
+            segment.docs = read_docstore_file(docs_path);
+        }
+    }
+
+    bool inputs_live;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A dump re-registered while the merge was running has new data: the segment
+        // would hold its old vectors next to the new ones, so it is only installed
+        // if every input is still live as it was picked
+        inputs_live = std::all_of(inputs.begin(), inputs.end(), [&](const Entry &input) {
+            return std::any_of(entries_.begin(), entries_.end(), [&](const Entry &e) {
+                return e.rel_path == input.rel_path && e.data == input.data;
+            });
+        });
+        if (inputs_live) {
+            entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [&](const Entry &e) {
+                return std::any_of(inputs.begin(), inputs.end(), [&](const Entry &input) {
+                    return e.rel_path == input.rel_path;
+                });
+            }), entries_.end());
+            entries_.push_back(segment);
+            doc_rows_stale_ = true;
+            generation_ = g_next_generation++;
+            write_manifest_locked();
+        }
+    }
+
+    if (!inputs_live) {
+        std::cout << "Segmented index: inputs of " << segment.rel_path << " changed during the merge, dropping it"
+                  << std::endl;
+        const std::string rel_path = segment.rel_path;
+        segment = Entry(); // Release the mappings before unlinking
+        remove_files(rel_path);
+        return MergeResult::Stale;
+    }
+
+    // Existing query snapshots keep their mappings of the unlinked files alive
+    for (const auto &input: inputs) {
+        remove_files(input.rel_path);
+    }
+
+    std::cout << "Segmented index: merged " << inputs.size() << " files into " << segment.rel_path
+              << " (" << segment.data->header->num_entries << " vectors)" << std::endl;
+    return MergeResult::Merged;
+}
+
+void SegmentedIndex::compact_now() {
+    std::lock_guard<std::mutex> compaction_lock(compaction_mutex_);
+    while (true) {
+        std::vector<Entry> inputs;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            inputs = pick_merge_inputs_locked(true);
+        }
+        if (inputs.size() < 2 && !(inputs.size() == 1 && !inputs[0].is_segment)) {
+            return;
+        }
+        if (merge_entries(inputs) == MergeResult::Failed) {
+            return;
+        }
+    }
+}
+
+void SegmentedIndex::compaction_loop() {
+    int64_t retry_ms = 0; // Backoff after failed merges, 0 while they succeed
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (retry_ms > 0) {
+                // The inputs are still due: wait out the backoff instead of failing again right away
+                cv_.wait_for(lock, std::chrono::milliseconds(retry_ms), [&] { return stop_; });
+            }
+            cv_.wait(lock, [&] { return stop_ || !pick_merge_inputs_locked(false).empty(); });
+            if (stop_) return;
+        }
+
+        // Inputs are picked again under compaction_mutex_, so a concurrent compact_now()
+        // cannot have merged them already
+        std::lock_guard<std::mutex> compaction_lock(compaction_mutex_);
+        std::vector<Entry> inputs;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            inputs = pick_merge_inputs_locked(false);
+        }
+        if (inputs.empty()) {
+            continue;
+        }
+        switch (merge_entries(inputs)) {
+            case MergeResult::Merged:
+                retry_ms = 0;
+                break;
+            case MergeResult::Failed:
+                retry_ms = std::min<int64_t>(retry_ms > 0 ? retry_ms * 2 : SEGMENT_MERGE_RETRY_MS,
+                                             SEGMENT_MERGE_RETRY_MAX_MS);
+                std::cerr << "Segmented index: retrying the merge in " << retry_ms << " ms" << std::endl;
+                break;
+            case MergeResult::Stale:
+                break; // Picked again from the current entries
+        }
+    }
+}
+
+} // namespace tldr
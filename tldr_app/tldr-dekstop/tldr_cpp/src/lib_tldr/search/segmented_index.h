@@ -0,0 +1,156 @@
+#ifndef TLDR_CPP_SEGMENTED_INDEX_H
+#define TLDR_CPP_SEGMENTED_INDEX_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
+#include <unordered_map>
+#include "../vec_dump.h"
+#include "../docstore.h"
+
+namespace tldr {
+
+/**
+ * LSM-style index over the vector dumps of one corpus root.
+ *
+ * Small per-document dumps written by dump_vectors_to_file are registered as
+ * level-0 entries. A background thread merges them into large contiguous
+ * segment files (<root>/_vecdump/segments/seg-NNNNNN.vecseg, same binary layout
+ * as a vecdump), and merges similarly sized segments further. The set of live
+ * files is recorded in <root>/_vecdump/MANIFEST.json, so queries never walk the
+ * corpus tree. Live files are mapped through the process-wide DumpMappingCache
+ * and stay mapped for the lifetime of the index, together with their optional
+ * sign-bit tier (.vecbin) and chunk docstore (.vecdoc), which merges carry over.
+ */
+class SegmentedIndex {
+public:
+    // Rows of a mapped file sorted by hash, built on the first lookup
+    struct HashRows {
+        std::once_flag built;
+        std::vector<std::pair<uint64_t, uint32_t> > rows;
+    };
+
+    // A live file of the index together with its mapping
+    struct Entry {
+        std::string rel_path;                    // Relative to the corpus root
+        std::vector<std::string> file_hashes;    // Documents whose vectors the file contains
+        std::vector<uint32_t> doc_starts;        // First row of each of file_hashes, empty if unknown
+        std::shared_ptr<MappedVectorData> data;
+        std::shared_ptr<HashRows> hash_rows;
+        std::shared_ptr<MappedBinaryCodes> bits; // Sign-bit tier (.vecbin), nullptr if the file has none
+        std::shared_ptr<MappedDocstore> docs;    // Chunk text and metadata (.vecdoc), nullptr if none
+        bool is_segment = false;
+    };
+
+    /**
+     * Get the process-wide index for a corpus root, loading its manifest.
+     * A corpus without a manifest is bootstrapped once from a directory walk.
+     * @return nullptr if the root does not exist
+     */
+    static std::shared_ptr<SegmentedIndex> open(const std::string &corpus_root);
+
+    // Close every open index (stops their compaction threads)
+    static void close_all();
+
+    ~SegmentedIndex();
+
+    /**
+     * Register a freshly written per-document dump. Replaces an earlier dump of
+     * the same document and wakes the compaction thread when enough small
+     * dumps have accumulated.
+     */
+    bool register_dump(const std::string &dump_path, const std::string &file_hash);
+
+    // Whether vectors for this document are already part of the index
+    bool contains_file(const std::string &file_hash) const;
+
+    // Row of a live file, pinned for as long as the caller holds it
+    struct RowRef {
+        std::shared_ptr<MappedVectorData> data;
+        std::shared_ptr<MappedDocstore> docs;
+        uint32_t row = 0;
+
+        // Chunk text and document metadata of the row, false if the file has no docstore
+        // or the row does not hold the chunk of this embedding hash
+        bool hydrate(uint64_t hash, CtxChunkMeta &out) const {
+            return docs && row < docs->header->num_chunks && docs->chunks[row].hash == hash &&
+                   docs->hydrate(row, out);
+        }
+    };
+
+    // File holding the vectors of a document, with row set to its first one; false if the
+    // document is not part of the index or its rows are unknown (segments of older manifests)
+    bool locate(const std::string &file_hash, RowRef &out) const;
+
+    // Snapshot of the live files. The mappings remain valid for as long as the
+    // caller holds the snapshot, even if a compaction replaces them meanwhile.
+    std::vector<Entry> live_entries() const;
+
+    // Changes whenever the set of live files changes
+    uint64_t generation() const;
+
+    // Absolute paths of the live files
+    std::vector<std::string> live_paths() const;
+
+    // Merge pending level-0 dumps and small segments synchronously
+    void compact_now();
+
+    // Full-precision (or dequantized) vector of an embedding hash in one live file, false if absent
+    static bool find_vector(const Entry &entry, uint64_t hash, float *out);
+
+    // Chunk text and document metadata of an embedding hash from the docstore of one live file
+    static bool find_chunk(const Entry &entry, uint64_t hash, CtxChunkMeta &out);
+
+    const std::string &root() const { return root_; }
+
+private:
+    explicit SegmentedIndex(std::string corpus_root);
+
+    bool load_manifest();
+    void bootstrap_from_walk();
+    bool write_manifest_locked() const;
+    bool map_entry(Entry &entry) const;
+    static bool find_row(const Entry &entry, uint64_t hash, uint32_t &row);
+    std::string abs_path(const std::string &rel_path) const;
+
+    enum class MergeResult {
+        Merged,
+        Failed, // Writing the segment failed (e.g. disk full)
+        Stale   // An input was merged or replaced meanwhile; the segment was dropped
+    };
+
+    // Pick the next group of entries to merge, empty if nothing is due
+    std::vector<Entry> pick_merge_inputs_locked(bool force) const;
+    // Merge inputs into a new segment; the caller holds compaction_mutex_
+    MergeResult merge_entries(const std::vector<Entry> &inputs);
+    void remove_files(const std::string &rel_path) const;
+    // file_hashes and doc_starts of a segment from its docstore, false if some rows have no document
+    static bool recover_documents(Entry &entry);
+    void compaction_loop();
+
+    std::string root_;
+    std::string manifest_path_;
+    std::string segments_dir_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Entry> entries_;
+    std::unordered_set<std::string> file_hashes_;
+    // Document -> (index into entries_, first row), rebuilt on the first locate() after entries_ changed
+    mutable std::unordered_map<std::string, std::pair<size_t, uint32_t> > doc_rows_;
+    mutable bool doc_rows_stale_ = true;
+    uint64_t generation_;
+    uint64_t next_segment_id_ = 1;
+
+    std::mutex compaction_mutex_; // Serializes background and explicit compactions
+    bool stop_ = false;
+    std::thread compaction_thread_;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_SEGMENTED_INDEX_H
@@ -0,0 +1,804 @@
+#include "simd_dot.h"
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TLDR_SIMD_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TLDR_SIMD_NEON 1
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#endif
+
+namespace tldr::simd {
+
+// ---- Scalar fallback ----
+
+static float dot_f32_scalar(const float *a, const float *b, size_t n) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static void dot_norm_f32_scalar(const float *q, const float *v, size_t n, float *dot, float *v_norm_sq) {
+    float d = 0.0f, nn = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        d += q[i] * v[i];
+        nn += v[i] * v[i];
+    }
+    *dot = d;
+    *v_norm_sq = nn;
+}
+
+// Scores of a 4-query x 2-row block, out[q * 2 + r]
+static void dot_4x2_f32_scalar(const float *q, const float *r, size_t n, float *out) {
+    for (size_t a = 0; a < 4; ++a) {
+        for (size_t b = 0; b < 2; ++b) {
+            out[a * 2 + b] = dot_f32_scalar(q + a * n, r + b * n, n);
+        }
+    }
+}
+
+uint16_t f32_to_f16(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFFu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+
+    if (((bits >> 23) & 0xFFu) == 0xFFu) { // Inf / NaN
+        return static_cast<uint16_t>(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+    }
+    if (exponent >= 31) { // Overflow to infinity
+        return static_cast<uint16_t>(sign | 0x7C00u);
+    }
+    if (exponent <= 0) { // Subnormal or zero
+        if (exponent < -10) return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000u;
+        const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1u))) ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1FFFu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) ++half; // May carry into the exponent, which is correct
+    return static_cast<uint16_t>(half);
+}
+
+float f16_to_f32(uint16_t value) {
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+    uint32_t exponent = (value >> 10) & 0x1Fu;
+    uint32_t mantissa = value & 0x3FFu;
+    uint32_t bits;
+    if (exponent == 0x1Fu) {
+        bits = sign | 0x7F800000u | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else { // Subnormal: normalize
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static float dot_f32_i8_scalar(const float *q, const int8_t *v, size_t n) {
+    float s0 = 0.0f, s1 = 0.0f;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        s0 += q[i] * v[i];
+        s1 += q[i + 1] * v[i + 1];
+    }
+    for (; i < n; ++i) s0 += q[i] * v[i];
+    return s0 + s1;
+}
+
+static float dot_f32_f16_scalar(const float *q, const uint16_t *v, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) sum += q[i] * f16_to_f32(v[i]);
+    return sum;
+}
+
+static uint32_t hamming_u64_scalar(const uint64_t *a, const uint64_t *b, size_t words) {
+    uint32_t distance = 0;
+    for (size_t i = 0; i < words; ++i) distance += static_cast<uint32_t>(__builtin_popcountll(a[i] ^ b[i]));
+    return distance;
+}
+
+// Byte-wise table for the reflected Castagnoli polynomial
+static const uint32_t *crc32c_table() {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; ++bit) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1u)));
+            t[i] = c;
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const void *data, size_t n) {
+    const uint32_t *table = crc32c_table();
+    const auto *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = (crc >> 8) ^ table[(crc ^ p[i]) & 0xFFu];
+    return ~crc;
+}
+
+static float adc_sum_u8_scalar(const float *lut, const uint8_t *codes, size_t m) {
+    float s0 = 0.0f, s1 = 0.0f;
+    size_t j = 0;
+    for (; j + 2 <= m; j += 2) {
+        s0 += lut[j * 256 + codes[j]];
+        s1 += lut[(j + 1) * 256 + codes[j + 1]];
+    }
+    for (; j < m; ++j) s0 += lut[j * 256 + codes[j]];
+    return s0 + s1;
+}
+
+#if TLDR_SIMD_X86
+
+// ---- AVX2 + FMA ----
+
+__attribute__((target("avx2,fma")))
+static inline float hsum256(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_f32_avx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_4x2_f32_avx2(const float *q, const float *r, size_t n, float *out) {
+    // Each row load feeds four FMAs and each query load two, so the block is
+    // bound by FMA throughput rather than by loads
+    __m256 acc[4][2];
+    for (auto &row: acc) row[0] = row[1] = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 r0 = _mm256_loadu_ps(r + i);
+        const __m256 r1 = _mm256_loadu_ps(r + n + i);
+        for (size_t a = 0; a < 4; ++a) {
+            const __m256 qa = _mm256_loadu_ps(q + a * n + i);
+            acc[a][0] = _mm256_fmadd_ps(qa, r0, acc[a][0]);
+            acc[a][1] = _mm256_fmadd_ps(qa, r1, acc[a][1]);
+        }
+    }
+    for (size_t a = 0; a < 4; ++a) {
+        for (size_t b = 0; b < 2; ++b) {
+            float sum = hsum256(acc[a][b]);
+            for (size_t j = i; j < n; ++j) sum += q[a * n + j] * r[b * n + j];
+            out[a * 2 + b] = sum;
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_norm_f32_avx2(const float *q, const float *v, size_t n, float *dot, float *v_norm_sq) {
+    __m256 d = _mm256_setzero_ps();
+    __m256 nn = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vv = _mm256_loadu_ps(v + i);
+        d = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), vv, d);
+        nn = _mm256_fmadd_ps(vv, vv, nn);
+    }
+    float ds = hsum256(d), ns = hsum256(nn);
+    for (; i < n; ++i) {
+        ds += q[i] * v[i];
+        ns += v[i] * v[i];
+    }
+    *dot = ds;
+    *v_norm_sq = ns;
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_f32_i8_avx2(const float *q, const int8_t *v, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i codes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i));
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(codes, 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), lo, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), hi, acc1);
+    }
+    float sum = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) sum += q[i] * v[i];
+    return sum;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float dot_f32_f16_avx2(const float *q, const uint16_t *v, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 lo = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i)));
+        __m256 hi = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i + 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), lo, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), hi, acc1);
+    }
+    float sum = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) sum += q[i] * f16_to_f32(v[i]);
+    return sum;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *data, size_t n) {
+    const auto *p = static_cast<const uint8_t *>(data);
+    uint64_t c = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, p + i, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    for (; i < n; ++i) c32 = _mm_crc32_u8(c32, p[i]);
+    return ~c32;
+}
+
+// POPCNT is independent of AVX2, but present on every CPU that has it
+__attribute__((target("popcnt")))
+static uint32_t hamming_u64_popcnt(const uint64_t *a, const uint64_t *b, size_t words) {
+    uint64_t d0 = 0, d1 = 0;
+    size_t i = 0;
+    for (; i + 2 <= words; i += 2) {
+        d0 += static_cast<uint64_t>(_mm_popcnt_u64(a[i] ^ b[i]));
+        d1 += static_cast<uint64_t>(_mm_popcnt_u64(a[i + 1] ^ b[i + 1]));
+    }
+    for (; i < words; ++i) d0 += static_cast<uint64_t>(_mm_popcnt_u64(a[i] ^ b[i]));
+    return static_cast<uint32_t>(d0 + d1);
+}
+
+__attribute__((target("avx2,fma")))
+static float adc_sum_u8_avx2(const float *lut, const uint8_t *codes, size_t m) {
+    // Widen 8 codes to 32-bit table offsets and gather their entries in one go
+    const __m256i row_step = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+    __m256 acc = _mm256_setzero_ps();
+    size_t j = 0;
+    for (; j + 8 <= m; j += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(codes + j)));
+        idx = _mm256_add_epi32(idx, row_step);
+        acc = _mm256_add_ps(acc, _mm256_i32gather_ps(lut + j * 256, idx, 4));
+    }
+    float sum = hsum256(acc);
+    for (; j < m; ++j) sum += lut[j * 256 + codes[j]];
+    return sum;
+}
+
+// ---- AVX-512F ----
+
+__attribute__((target("avx512f")))
+static float dot_f32_avx512(const float *a, const float *b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static void dot_4x2_f32_avx512(const float *q, const float *r, size_t n, float *out) {
+    __m512 acc[4][2];
+    for (auto &row: acc) row[0] = row[1] = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        const __mmask16 m = n - i >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                        : static_cast<__mmask16>((1u << (n - i)) - 1);
+        const __m512 r0 = _mm512_maskz_loadu_ps(m, r + i);
+        const __m512 r1 = _mm512_maskz_loadu_ps(m, r + n + i);
+        for (size_t a = 0; a < 4; ++a) {
+            const __m512 qa = _mm512_maskz_loadu_ps(m, q + a * n + i);
+            acc[a][0] = _mm512_fmadd_ps(qa, r0, acc[a][0]);
+            acc[a][1] = _mm512_fmadd_ps(qa, r1, acc[a][1]);
+        }
+    }
+    for (size_t a = 0; a < 4; ++a) {
+        out[a * 2] = _mm512_reduce_add_ps(acc[a][0]);
+        out[a * 2 + 1] = _mm512_reduce_add_ps(acc[a][1]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void dot_norm_f32_avx512(const float *q, const float *v, size_t n, float *dot, float *v_norm_sq) {
+    __m512 d = _mm512_setzero_ps();
+    __m512 nn = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vv = _mm512_loadu_ps(v + i);
+        d = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), vv, d);
+        nn = _mm512_fmadd_ps(vv, vv, nn);
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 vv = _mm512_maskz_loadu_ps(m, v + i);
+        d = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + i), vv, d);
+        nn = _mm512_fmadd_ps(vv, vv, nn);
+    }
+    *dot = _mm512_reduce_add_ps(d);
+    *v_norm_sq = _mm512_reduce_add_ps(nn);
+}
+
+__attribute__((target("avx512f")))
+static float dot_f32_i8_avx512(const float *q, const int8_t *v, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 lo = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i))));
+        __m512 hi = _mm512_cvtepi32_ps(
+            _mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i + 16))));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), lo, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), hi, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 lo = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i))));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), lo, acc0);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < n; ++i) sum += q[i] * v[i];
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static float dot_f32_f16_avx512(const float *q, const uint16_t *v, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 lo = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)));
+        __m512 hi = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i + 16)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), lo, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), hi, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 lo = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), lo, acc0);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < n; ++i) sum += q[i] * f16_to_f32(v[i]);
+    return sum;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint32_t hamming_u64_avx512(const uint64_t *a, const uint64_t *b, size_t words) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    if (i < words) {
+        const __mmask8 mask = static_cast<__mmask8>((1u << (words - i)) - 1);
+        __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(mask, a + i), _mm512_maskz_loadu_epi64(mask, b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    return static_cast<uint32_t>(_mm512_reduce_add_epi64(acc));
+}
+
+__attribute__((target("avx512f")))
+static float adc_sum_u8_avx512(const float *lut, const uint8_t *codes, size_t m) {
+    const __m512i row_step = _mm512_mullo_epi32(
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(256));
+    __m512 acc = _mm512_setzero_ps();
+    size_t j = 0;
+    for (; j + 16 <= m; j += 16) {
+        __m512i idx = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + j)));
+        idx = _mm512_add_epi32(idx, row_step);
+        acc = _mm512_add_ps(acc, _mm512_i32gather_ps(idx, lut + j * 256, 4));
+    }
+    float sum = _mm512_reduce_add_ps(acc);
+    for (; j < m; ++j) sum += lut[j * 256 + codes[j]];
+    return sum;
+}
+
+#endif // TLDR_SIMD_X86
+
+#if TLDR_SIMD_NEON
+
+// ---- NEON (baseline on aarch64, so no runtime check is needed) ----
+
+static float dot_f32_neon(const float *a, const float *b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+static void dot_4x2_f32_neon(const float *q, const float *r, size_t n, float *out) {
+    float32x4_t acc[4][2];
+    for (auto &row: acc) row[0] = row[1] = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t r0 = vld1q_f32(r + i);
+        const float32x4_t r1 = vld1q_f32(r + n + i);
+        for (size_t a = 0; a < 4; ++a) {
+            const float32x4_t qa = vld1q_f32(q + a * n + i);
+            acc[a][0] = vfmaq_f32(acc[a][0], qa, r0);
+            acc[a][1] = vfmaq_f32(acc[a][1], qa, r1);
+        }
+    }
+    for (size_t a = 0; a < 4; ++a) {
+        for (size_t b = 0; b < 2; ++b) {
+            float sum = vaddvq_f32(acc[a][b]);
+            for (size_t j = i; j < n; ++j) sum += q[a * n + j] * r[b * n + j];
+            out[a * 2 + b] = sum;
+        }
+    }
+}
+
+static void dot_norm_f32_neon(const float *q, const float *v, size_t n, float *dot, float *v_norm_sq) {
+    float32x4_t d = vdupq_n_f32(0.0f);
+    float32x4_t nn = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t vv = vld1q_f32(v + i);
+        d = vfmaq_f32(d, vld1q_f32(q + i), vv);
+        nn = vfmaq_f32(nn, vv, vv);
+    }
+    float ds = vaddvq_f32(d), ns = vaddvq_f32(nn);
+    for (; i < n; ++i) {
+        ds += q[i] * v[i];
+        ns += v[i] * v[i];
+    }
+    *dot = ds;
+    *v_norm_sq = ns;
+}
+
+static float dot_f32_i8_neon(const float *q, const int8_t *v, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t wide = vmovl_s8(vld1_s8(v + i));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q + i), vcvtq_f32_s32(vmovl_s16(vget_low_s16(wide))));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(q + i + 4), vcvtq_f32_s32(vmovl_s16(vget_high_s16(wide))));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) sum += q[i] * v[i];
+    return sum;
+}
+
+static float dot_f32_f16_neon(const float *q, const uint16_t *v, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q + i), vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(v + i))));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(q + i + 4), vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(v + i + 4))));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) sum += q[i] * f16_to_f32(v[i]);
+    return sum;
+}
+
+static uint32_t hamming_u64_neon(const uint64_t *a, const uint64_t *b, size_t words) {
+    uint32_t distance = 0;
+    size_t i = 0;
+    for (; i + 2 <= words; i += 2) {
+        uint8x16_t x = veorq_u8(vreinterpretq_u8_u64(vld1q_u64(a + i)), vreinterpretq_u8_u64(vld1q_u64(b + i)));
+        distance += vaddlvq_u8(vcntq_u8(x));
+    }
+    for (; i < words; ++i) distance += static_cast<uint32_t>(__builtin_popcountll(a[i] ^ b[i]));
+    return distance;
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_arm(uint32_t crc, const void *data, size_t n) {
+    const auto *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, p + i, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; i < n; ++i) crc = __crc32cb(crc, p[i]);
+    return ~crc;
+}
+#endif
+
+#endif // TLDR_SIMD_NEON
+
+// ---- Runtime dispatch ----
+
+struct KernelTable {
+    float (*dot)(const float *, const float *, size_t);
+    void (*dot_norm)(const float *, const float *, size_t, float *, float *);
+    void (*dot_4x2)(const float *, const float *, size_t, float *);
+    float (*dot_i8)(const float *, const int8_t *, size_t);
+    float (*dot_f16)(const float *, const uint16_t *, size_t);
+    float (*adc)(const float *, const uint8_t *, size_t);
+    uint32_t (*hamming)(const uint64_t *, const uint64_t *, size_t);
+    const char *isa;
+};
+
+static uint32_t (*resolve_crc32c())(uint32_t, const void *, size_t) {
+#if TLDR_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) return crc32c_sse42;
+#elif TLDR_SIMD_NEON && defined(__ARM_FEATURE_CRC32)
+    return crc32c_arm;
+#endif
+    return crc32c_scalar;
+}
+
+static KernelTable resolve_kernels() {
+#if TLDR_SIMD_X86
+    __builtin_cpu_init();
+    auto hamming = __builtin_cpu_supports("popcnt") ? hamming_u64_popcnt : hamming_u64_scalar;
+    if (__builtin_cpu_supports("avx512f")) {
+        if (__builtin_cpu_supports("avx512vpopcntdq")) hamming = hamming_u64_avx512;
+        return {dot_f32_avx512, dot_norm_f32_avx512, dot_4x2_f32_avx512, dot_f32_i8_avx512, dot_f32_f16_avx512,
+                adc_sum_u8_avx512, hamming, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        // F16C shipped with every AVX2 CPU, but is reported separately
+        auto dot_f16 = __builtin_cpu_supports("f16c") ? dot_f32_f16_avx2 : dot_f32_f16_scalar;
+        return {dot_f32_avx2, dot_norm_f32_avx2, dot_4x2_f32_avx2, dot_f32_i8_avx2, dot_f16, adc_sum_u8_avx2, hamming,
+                "avx2"};
+    }
+    return {dot_f32_scalar, dot_norm_f32_scalar, dot_4x2_f32_scalar, dot_f32_i8_scalar, dot_f32_f16_scalar,
+            adc_sum_u8_scalar, hamming, "scalar"};
+#elif TLDR_SIMD_NEON
+    return {dot_f32_neon, dot_norm_f32_neon, dot_4x2_f32_neon, dot_f32_i8_neon, dot_f32_f16_neon, adc_sum_u8_scalar,
+            hamming_u64_neon, "neon"};
+#endif
+    return {dot_f32_scalar, dot_norm_f32_scalar, dot_4x2_f32_scalar, dot_f32_i8_scalar, dot_f32_f16_scalar,
+            adc_sum_u8_scalar, hamming_u64_scalar, "scalar"};
+}
+
+static const KernelTable &kernels() {
+    static const KernelTable table = resolve_kernels();
+    return table;
+}
+
+float dot_f32(const float *a, const float *b, size_t n) {
+    return kernels().dot(a, b, n);
+}
+
+void dot_norm_f32(const float *q, const float *v, size_t n, float *dot, float *v_norm_sq) {
+    kernels().dot_norm(q, v, n, dot, v_norm_sq);
+}
+
+void dot_tile_f32(const float *queries, size_t nq, const float *rows, size_t nr, size_t n, float *out) {
+    const KernelTable &k = kernels();
+    float block[8];
+    size_t a = 0;
+    for (; a + 4 <= nq; a += 4) {
+        const float *q = queries + a * n;
+        size_t b = 0;
+        for (; b + 2 <= nr; b += 2) {
+            k.dot_4x2(q, rows + b * n, n, block);
+            for (size_t i = 0; i < 4; ++i) {
+                out[(a + i) * nr + b] = block[i * 2];
+                out[(a + i) * nr + b + 1] = block[i * 2 + 1];
+            }
+        }
+        for (; b < nr; ++b) {
+            for (size_t i = 0; i < 4; ++i) {
+                out[(a + i) * nr + b] = k.dot(q + i * n, rows + b * n, n);
+            }
+        }
+    }
+    for (; a < nq; ++a) {
+        for (size_t b = 0; b < nr; ++b) {
+            out[a * nr + b] = k.dot(queries + a * n, rows + b * n, n);
+        }
+    }
+}
+
+float dot_f32_i8(const float *q, const int8_t *v, size_t n) {
+    return kernels().dot_i8(q, v, n);
+}
+
+float dot_f32_f16(const float *q, const uint16_t *v, size_t n) {
+    return kernels().dot_f16(q, v, n);
+}
+
+float adc_sum_u8(const float *lut, const uint8_t *codes, size_t m) {
+    return kernels().adc(lut, codes, m);
+}
+
+uint32_t hamming_u64(const uint64_t *a, const uint64_t *b, size_t words) {
+    return kernels().hamming(a, b, words);
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t n) {
+    static const auto kernel = resolve_crc32c();
+    return kernel(crc, data, n);
+}
+
+const char *active_isa() {
+    return kernels().isa;
+}
+
+bool test_kernels() {
+    std::cout << "=== Testing " << active_isa() << " Kernels Against the Scalar Fallback ===" << std::endl;
+
+    uint64_t state = 0x853c49e6748fea9bull;
+    auto next = [&state]() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<uint32_t>(state >> 32);
+    };
+    auto next_float = [&next]() { return static_cast<float>(static_cast<int32_t>(next())) / 2147483648.0f; };
+    // Sums are accumulated in a different order, so they agree up to rounding relative to
+    // the magnitude of their terms (bound, the sum of their absolute values)
+    auto close = [](float expected, float actual, float bound) {
+        return std::fabs(expected - actual) <= 1e-5f * std::max(1.0f, bound);
+    };
+    auto bound_of = [](const float *q, auto value_at, size_t n) {
+        float bound = 0.0f;
+        for (size_t i = 0; i < n; ++i) bound += std::fabs(q[i] * value_at(i));
+        return bound;
+    };
+
+    bool all_passed = true;
+    auto report = [&all_passed](const char *name, bool passed) {
+        std::cout << "  " << name << ": " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    };
+
+    // Lengths around every vector width, with the tail loops exercised
+    const size_t lengths[] = {1, 3, 7, 8, 15, 16, 17, 31, 33, 63, 64, 65, 127, 384, 769};
+    bool dot = true, dot_norm = true, dot_i8 = true, dot_f16 = true, tile = true;
+    for (size_t n: lengths) {
+        std::vector<float> a(n), b(n);
+        std::vector<int8_t> codes(n);
+        std::vector<uint16_t> halves(n);
+        for (size_t i = 0; i < n; ++i) {
+            a[i] = next_float();
+            b[i] = next_float();
+            codes[i] = static_cast<int8_t>(next());
+            halves[i] = f32_to_f16(next_float());
+        }
+        const float bound = bound_of(a.data(), [&](size_t i) { return b[i]; }, n);
+        dot = dot && close(dot_f32_scalar(a.data(), b.data(), n), dot_f32(a.data(), b.data(), n), bound);
+
+        float expected_dot, expected_norm, actual_dot, actual_norm;
+        dot_norm_f32_scalar(a.data(), b.data(), n, &expected_dot, &expected_norm);
+        dot_norm_f32(a.data(), b.data(), n, &actual_dot, &actual_norm);
+        dot_norm = dot_norm && close(expected_dot, actual_dot, bound) &&
+                   close(expected_norm, actual_norm, expected_norm);
+
+        dot_i8 = dot_i8 && close(dot_f32_i8_scalar(a.data(), codes.data(), n), dot_f32_i8(a.data(), codes.data(), n),
+                                 bound_of(a.data(), [&](size_t i) { return static_cast<float>(codes[i]); }, n));
+        dot_f16 = dot_f16 && close(dot_f32_f16_scalar(a.data(), halves.data(), n),
+                                   dot_f32_f16(a.data(), halves.data(), n),
+                                   bound_of(a.data(), [&](size_t i) { return f16_to_f32(halves[i]); }, n));
+
+        // 6 queries x 5 rows covers the 4 x 2 blocks and both remainders
+        const size_t nq = 6, nr = 5;
+        std::vector<float> queries(nq * n), rows(nr * n), out(nq * nr);
+        for (auto &value: queries) value = next_float();
+        for (auto &value: rows) value = next_float();
+        dot_tile_f32(queries.data(), nq, rows.data(), nr, n, out.data());
+        for (size_t q = 0; q < nq; ++q) {
+            for (size_t r = 0; r < nr; ++r) {
+                const float *query = queries.data() + q * n, *row = rows.data() + r * n;
+                tile = tile && close(dot_f32_scalar(query, row, n), out[q * nr + r],
+                                     bound_of(query, [&](size_t i) { return row[i]; }, n));
+            }
+        }
+    }
+    report("dot_f32", dot);
+    report("dot_norm_f32", dot_norm);
+    report("dot_f32_i8", dot_i8);
+    report("dot_f32_f16", dot_f16);
+    report("dot_tile_f32", tile);
+
+    bool halves = true;
+    for (float value: {0.0f, 1.0f, -2.5f, 0.333333f, 65504.0f, 6.1035156e-05f}) {
+        halves = halves && std::fabs(f16_to_f32(f32_to_f16(value)) - value) <= std::fabs(value) * 1e-3f;
+    }
+    report("f16 conversion", halves);
+
+    bool hamming = true, adc = true;
+    for (size_t words: {1, 2, 3, 6, 12}) {
+        std::vector<uint64_t> x(words), y(words);
+        for (size_t w = 0; w < words; ++w) {
+            x[w] = static_cast<uint64_t>(next()) << 32 | next();
+            y[w] = static_cast<uint64_t>(next()) << 32 | next();
+        }
+        hamming = hamming && hamming_u64_scalar(x.data(), y.data(), words) == hamming_u64(x.data(), y.data(), words);
+    }
+    for (size_t m: {1, 7, 8, 16, 33, 64}) {
+        std::vector<float> lut(m * 256);
+        std::vector<uint8_t> pq_codes(m);
+        for (auto &value: lut) value = next_float();
+        for (auto &code: pq_codes) code = static_cast<uint8_t>(next());
+        float bound = 0.0f;
+        for (size_t j = 0; j < m; ++j) bound += std::fabs(lut[j * 256 + pq_codes[j]]);
+        adc = adc && close(adc_sum_u8_scalar(lut.data(), pq_codes.data(), m), adc_sum_u8(lut.data(), pq_codes.data(), m),
+                           bound);
+    }
+    report("hamming_u64", hamming);
+    report("adc_sum_u8", adc);
+
+    // Unaligned starts and lengths, and a checksum continued over two calls
+    std::vector<uint8_t> bytes(1031);
+    for (auto &byte: bytes) byte = static_cast<uint8_t>(next());
+    bool crc = crc32c(0, "123456789", 9) == 0xE3069283u;
+    for (size_t offset: {0, 1, 3, 7}) {
+        for (size_t n: {0, 1, 5, 8, 63, 1024}) {
+            const uint32_t expected = crc32c_scalar(0, bytes.data() + offset, n);
+            crc = crc && crc32c(0, bytes.data() + offset, n) == expected &&
+                  crc32c(crc32c(0, bytes.data() + offset, n / 2), bytes.data() + offset + n / 2, n - n / 2) == expected;
+        }
+    }
+    report("crc32c", crc);
+
+    std::cout << "\nTest result: " << (all_passed ? "PASSED" : "FAILED") << std::endl;
+    return all_passed;
+}
+
+} // namespace tldr::simd
@@ -0,0 +1,50 @@
+#ifndef TLDR_CPP_SIMD_DOT_H
+#define TLDR_CPP_SIMD_DOT_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tldr::simd {
+
+// Dot product of two float32 vectors of length n
+float dot_f32(const float *a, const float *b, size_t n);
+
+// Computes dot(q, v) and dot(v, v) in a single pass over v, so cosine scoring
+// does not have to stream every corpus vector twice
+void dot_norm_f32(const float *q, const float *v, size_t n, float *dot, float *v_norm_sq);
+
+// Dot products of a tile of queries against a tile of rows (both row-major,
+// length n): out[q * nr + r] = dot(queries[q], rows[r]). Blocks of 4 queries x
+// 2 rows are accumulated in registers so each row is loaded once per 4 queries.
+void dot_tile_f32(const float *queries, size_t nq, const float *rows, size_t nr, size_t n, float *out);
+
+// Dot product of a float32 query with an int8 / IEEE fp16 vector, widened to
+// float32 in registers so quantized rows are streamed at 1/4 or 1/2 the bandwidth
+float dot_f32_i8(const float *q, const int8_t *v, size_t n);
+float dot_f32_f16(const float *q, const uint16_t *v, size_t n);
+
+// Scalar IEEE half conversions (round to nearest even)
+uint16_t f32_to_f16(float value);
+float f16_to_f32(uint16_t value);
+
+// Asymmetric distance computation for product-quantized codes: sums
+// lut[j * 256 + codes[j]] over the m sub-quantizers of one encoded vector
+float adc_sum_u8(const float *lut, const uint8_t *codes, size_t m);
+
+// Hamming distance between two sign-bit codes of `words` 64-bit words
+uint32_t hamming_u64(const uint64_t *a, const uint64_t *b, size_t words);
+
+// CRC32C (Castagnoli) of n bytes, continuing from crc (0 for a new checksum).
+// Uses the SSE4.2 / ARMv8 CRC instructions when available.
+uint32_t crc32c(uint32_t crc, const void *data, size_t n);
+
+// Name of the instruction set picked at runtime ("avx512", "avx2", "neon" or "scalar")
+const char *active_isa();
+
+// Compare every dispatched kernel with the scalar fallback on random inputs of
+// lengths around each vector width
+bool test_kernels();
+
+} // namespace tldr::simd
+
+#endif // TLDR_CPP_SIMD_DOT_H
@@ -0,0 +1,67 @@
+#ifndef TLDR_CPP_TOP_K_H
+#define TLDR_CPP_TOP_K_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include "npu_accelerator.h"
+
+namespace tldr {
+
+/**
+ * Fixed-capacity top-k collector backed by a min-heap on score.
+ * The weakest kept result sits at the root, so rejecting a candidate that
+ * cannot make the cut is a single comparison. Not thread safe: each scanning
+ * thread keeps its own instance and the instances are merged at the end.
+ */
+class BoundedTopK {
+public:
+    explicit BoundedTopK(size_t k) : k_(k) {
+        heap_.reserve(k);
+    }
+
+    // Lowest score that would still be accepted (-inf until the heap is full)
+    float threshold() const {
+        return heap_.size() < k_ ? -std::numeric_limits<float>::infinity() : heap_.front().score;
+    }
+
+    void push(float score, uint64_t hash) {
+        if (k_ == 0) return;
+        if (heap_.size() < k_) {
+            heap_.push_back({hash, score});
+            std::push_heap(heap_.begin(), heap_.end(), greater);
+        } else if (score > heap_.front().score) {
+            std::pop_heap(heap_.begin(), heap_.end(), greater);
+            heap_.back() = {hash, score};
+            std::push_heap(heap_.begin(), heap_.end(), greater);
+        }
+    }
+
+    void merge(const BoundedTopK &other) {
+        for (const auto &r: other.heap_) {
+            push(r.score, r.hash);
+        }
+    }
+
+    size_t size() const { return heap_.size(); }
+
+    // Results ordered by descending score
+    std::vector<SimilarityResult> sorted() const {
+        std::vector<SimilarityResult> out(heap_);
+        std::sort(out.begin(), out.end(), greater);
+        return out;
+    }
+
+private:
+    static bool greater(const SimilarityResult &a, const SimilarityResult &b) {
+        return a.score > b.score;
+    }
+
+    size_t k_;
+    std::vector<SimilarityResult> heap_;
+};
+
+} // namespace tldr
+
+#endif // TLDR_CPP_TOP_K_H
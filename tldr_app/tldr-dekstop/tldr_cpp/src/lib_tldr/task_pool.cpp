@@ -0,0 +1,225 @@
+#include "task_pool.h"
+#include "constants.h"
+#include <iostream>
+#include <random>
+
+namespace tldr {
+
+// Pool and deque index of the calling thread when it is a pool worker
+static thread_local TaskPool *t_pool = nullptr;
+static thread_local size_t t_index = 0;
+
+TaskPool &TaskPool::instance() {
+    static TaskPool pool(TASK_POOL_THREADS > 0
+                             ? static_cast<size_t>(TASK_POOL_THREADS)
+                             : std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+TaskPool::TaskPool(size_t num_threads) {
+    num_threads = std::max<size_t>(1, num_threads);
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers_[i]->thread = std::thread(&TaskPool::worker_loop, this, i);
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker: workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+void TaskPool::submit(std::function<void()> task) {
+    push(Task{std::move(task), nullptr});
+}
+
+TaskPool::Stats TaskPool::stats() const {
+    return {workers_.size(), executed_.load(), stolen_.load()};
+}
+
+void TaskPool::push(Task task) {
+    if (t_pool == this) {
+        Worker &worker = *workers_[t_index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    } else {
+        std::lock_guard<std::mutex> lock(injected_mutex_);
+        injected_.push_back(std::move(task));
+    }
+    {
+        // Under the sleep mutex, so a worker about to sleep either sees the task or gets the notification
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        ++queued_;
+    }
+    wake_.notify_one();
+}
+
+bool TaskPool::pop_local(size_t index, Task &task) {
+    Worker &worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    --queued_;
+    return true;
+}
+
+bool TaskPool::pop_local_of(TaskGroup *group, Task &task) {
+    if (t_pool != this) {
+        return false;
+    }
+    Worker &worker = *workers_[t_index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty() || worker.tasks.back().group != group) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    --queued_;
+    return true;
+}
+
+bool TaskPool::pop_injected(Task &task) {
+    std::lock_guard<std::mutex> lock(injected_mutex_);
+    if (injected_.empty()) {
+        return false;
+    }
+    task = std::move(injected_.front());
+    injected_.pop_front();
+    --queued_;
+    return true;
+}
+
+bool TaskPool::steal(size_t thief, Task &task) {
+    thread_local std::minstd_rand rng(std::random_device{}());
+    const size_t n = workers_.size();
+    const size_t start = rng() % n;
+    for (size_t i = 0; i < n; ++i) {
+        const size_t victim = (start + i) % n;
+        if (victim == thief) continue;
+        Worker &worker = *workers_[victim];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) continue;
+        // The oldest task is the largest remaining piece of the victim's work
+        task = std::move(worker.tasks.front());
+        worker.tasks.pop_front();
+        --queued_;
+        ++stolen_;
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::run(Task &task) {
+    TaskGroup *group = task.group;
+    std::exception_ptr error;
+    try {
+        task.fn();
+    } catch (const std::exception &e) {
+        if (!group) std::cerr << "Task pool: task failed: " << e.what() << std::endl;
+        error = std::current_exception();
+    } catch (...) {
+        if (!group) std::cerr << "Task pool: task failed" << std::endl;
+        error = std::current_exception();
+    }
+    task.fn = nullptr; // Release captures before the group is told it is done
+    ++executed_;
+    if (group) {
+        group->finish(error);
+    }
+}
+
+void TaskPool::worker_loop(size_t index) {
+    t_pool = this;
+    t_index = index;
+    Task task;
+    while (true) {
+        if (pop_local(index, task) || pop_injected(task) || steal(index, task)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+TaskGroup::TaskGroup(TaskPool &pool) : pool_(pool) {}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // Already reported by the owner's own wait(), or dropped with the group
+    }
+}
+
+void TaskGroup::run(std::function<void()> fn) {
+    ++pending_;
+    pool_.push(TaskPool::Task{std::move(fn), this});
+}
+
+void TaskGroup::finish(std::exception_ptr error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error && !error_) {
+        error_ = error;
+    }
+    if (--pending_ == 0) {
+        done_.notify_all();
+    }
+}
+
+void TaskGroup::wait() {
+    TaskPool::Task task;
+    while (pending_ > 0) {
+        if (pool_.pop_local_of(this, task)) {
+            pool_.run(task);
+            continue;
+        }
+        // The remaining tasks run (or were stolen) elsewhere
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)> &fn) {
+    if (n == 0) {
+        return;
+    }
+    grain = std::max<size_t>(1, grain);
+    if (n <= grain) {
+        fn(0, n);
+        return;
+    }
+    TaskGroup group;
+    for (size_t begin = grain; begin < n; begin += grain) {
+        const size_t end = std::min(n, begin + grain);
+        group.run([&fn, begin, end] { fn(begin, end); });
+    }
+    // The caller takes the first range instead of idling
+    fn(0, grain);
+    group.wait();
+}
+
+} // namespace tldr
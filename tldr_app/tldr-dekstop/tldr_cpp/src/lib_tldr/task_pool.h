@@ -0,0 +1,129 @@
+#ifndef TLDR_CPP_TASK_POOL_H
+#define TLDR_CPP_TASK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace tldr {
+
+class TaskGroup;
+
+/**
+ * Work-stealing thread pool shared by ingestion, embedding and search.
+ *
+ * The process-wide pool (instance()) holds TASK_POOL_THREADS workers, one per
+ * core by default, and is the CPU budget of the library: subsystems submit
+ * tasks (a file, an embedding batch, a search shard) instead of starting
+ * their own threads, so concurrent ingestion and queries never oversubscribe
+ * the machine.
+ *
+ * Every worker owns a deque. Tasks submitted from a worker go to the back of
+ * its own deque and are run LIFO (cache-warm, depth first); tasks submitted
+ * from other threads go to a shared injection queue. An idle worker takes from
+ * its own deque, then the injection queue, then steals the oldest task of
+ * another worker, so a large file or a dense shard never holds up the rest of
+ * the work behind it.
+ */
+class TaskPool {
+public:
+    struct Stats {
+        size_t threads = 0;
+        uint64_t executed = 0;
+        uint64_t stolen = 0; // Tasks taken from another worker's deque
+    };
+
+    static TaskPool &instance();
+
+    explicit TaskPool(size_t num_threads);
+    ~TaskPool();
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    // Run a task asynchronously; exceptions are logged and dropped
+    void submit(std::function<void()> task);
+
+    size_t concurrency() const { return workers_.size(); }
+
+    Stats stats() const;
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup *group = nullptr;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void push(Task task);
+    bool pop_local(size_t index, Task &task);
+    bool pop_injected(Task &task);
+    bool steal(size_t thief, Task &task);
+    // The newest task of the calling worker if it belongs to group (waiting on a group only runs its own tasks)
+    bool pop_local_of(TaskGroup *group, Task &task);
+    void run(Task &task);
+    void worker_loop(size_t index);
+
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::mutex injected_mutex_;
+    std::deque<Task> injected_;
+
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<bool> stopping_{false};
+
+    std::atomic<uint64_t> executed_{0};
+    std::atomic<uint64_t> stolen_{0};
+};
+
+/**
+ * Fork/join scope over a TaskPool: run() forks tasks, wait() joins them and
+ * rethrows the first exception one of them threw. A pool worker that waits
+ * runs the group's own queued tasks instead of idling, and never unrelated
+ * ones, so a waiting task cannot end up blocked under a task that waits on it.
+ * The destructor waits.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskPool &pool = TaskPool::instance());
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    void run(std::function<void()> fn);
+    void wait();
+
+private:
+    friend class TaskPool;
+
+    void finish(std::exception_ptr error);
+
+    TaskPool &pool_;
+    std::atomic<size_t> pending_{0};
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::exception_ptr error_;
+};
+
+// fn(begin, end) over [0, n) in ranges of at most grain indices, as tasks of the shared pool
+void parallel_for(size_t n, size_t grain, const std::function<void(size_t, size_t)> &fn);
+
+} // namespace tldr
+
+#endif // TLDR_CPP_TASK_POOL_H
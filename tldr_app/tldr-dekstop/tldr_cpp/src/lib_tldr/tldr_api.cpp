@@ -18,13 +18,18 @@ void addCorpus(const std::string& sourcePath) {
     ::addCorpus(sourcePath);
 }
 
+bool warmupCorpus(const std::string& corpusPath, bool lockInMemory) {
+    return !::warmupCorpus(corpusPath, lockInMemory).error;
+}
+
 void deleteCorpus(const std::string& corpusId) {
     ::deleteCorpus(corpusId);
 }
 
-RagResult queryRag(const std::string& user_query, const std::string& corpus_dir, const std::string& npu_model_path) {
+RagResult queryRag(const std::string& user_query, const std::string& corpus_dir, const std::string& npu_model_path,
+                   const SearchOptions& options) {
     // Call the global queryRag function
-    return ::queryRag(user_query, corpus_dir, npu_model_path);
+    return ::queryRag(user_query, corpus_dir, npu_model_path, options);
 }
 
 std::string printRagResult(const RagResult& result) {
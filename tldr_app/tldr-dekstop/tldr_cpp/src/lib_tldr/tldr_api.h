@@ -34,6 +34,14 @@ void cleanupSystem();
  */
 void addCorpus(const std::string& sourcePath);
 
+/**
+ * @brief Load the vector index of a corpus into memory ahead of the first query (e.g. at service start)
+ * @param corpusPath Directory of the corpus
+ * @param lockInMemory Pin the mapped vectors in RAM (mlock) so they are never paged out
+ * @return true if the corpus index was found and loaded
+ */
+bool warmupCorpus(const std::string& corpusPath, bool lockInMemory = false);
+
 /**
  * @brief Delete a document from the corpus
  * @param corpusId ID of the corpus to delete
@@ -45,9 +53,11 @@ void deleteCorpus(const std::string& corpusId);
  * @param user_query The user's question
  * @param corpus_dir Directory containing the corpus (defaults to current corpus)
  * @param npu_model_path Path to the NPU model for cosine similarity search
+ * @param options Search backend and its tuning (exhaustive search by default)
  * @return RagResult containing the response and context chunks
  */
-RagResult queryRag(const std::string& user_query, const std::string& corpus_dir, const std::string& npu_model_path);
+RagResult queryRag(const std::string& user_query, const std::string& corpus_dir, const std::string& npu_model_path,
+                   const SearchOptions& options = {});
 
 /**
  * @brief Format the RAG result and its context metadata into a single string
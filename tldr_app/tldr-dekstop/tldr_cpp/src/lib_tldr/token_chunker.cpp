@@ -0,0 +1,135 @@
+#include "token_chunker.h"
+#include "task_pool.h"
+#include <algorithm>
+#include <cctype>
+
+namespace tldr {
+
+namespace {
+
+// A sentence (or a word of an overlong sentence) with its tokens. It starts at the
+// whitespace before it, so that tokenizers that mark word starts see the text as in context.
+struct Unit {
+    size_t begin = 0;
+    size_t end = 0;
+    int page = 0;
+    std::vector<int32_t> tokens;
+};
+
+bool is_space(char c) {
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+// Sentences of the document; a page break always ends a sentence
+std::vector<Unit> split_sentences(const DocumentData &doc) {
+    std::vector<Unit> units;
+    const std::string &text = doc.text;
+    size_t start = 0;
+    for (size_t p = 0; p < doc.pageEnds.size(); ++p) {
+        const size_t page_end = doc.pageEnds[p];
+        const int page = static_cast<int>(p + 1);
+        for (size_t i = start; i < page_end; ++i) {
+            const char c = text[i];
+            if ((c == '.' || c == '!' || c == '?') && (i + 1 == page_end || is_space(text[i + 1]))) {
+                units.push_back({start, i + 1, page, {}});
+                start = i + 1;
+            }
+        }
+        if (start < page_end) {
+            units.push_back({start, page_end, page, {}});
+        }
+        start = page_end;
+    }
+    return units;
+}
+
+// Words of a sentence that does not fit in a chunk, each with its tokens
+void split_words(const DocumentData &doc, const Unit &sentence, const ChunkTokenizer &tokenize, size_t budget,
+                 std::vector<Unit> &out) {
+    const std::string &text = doc.text;
+    size_t begin = sentence.begin;
+    while (begin < sentence.end) {
+        size_t end = begin;
+        while (end < sentence.end && is_space(text[end])) ++end;
+        while (end < sentence.end && !is_space(text[end])) ++end;
+
+        Unit word{begin, end, sentence.page, tokenize(std::string_view(text).substr(begin, end - begin))};
+        if (word.tokens.size() > budget) {
+            word.tokens.resize(budget); // A single "word" longer than a chunk (e.g. a run of symbols)
+        }
+        if (!word.tokens.empty()) {
+            out.push_back(std::move(word));
+        }
+        begin = end;
+    }
+}
+
+} // namespace
+
+void split_into_token_chunks(DocumentData &doc, const ChunkTokenizer &tokenize, size_t budget, size_t overlap) {
+    doc.chunks.clear();
+    doc.chunkTokens.clear();
+    if (budget == 0) {
+        return;
+    }
+
+    std::vector<Unit> sentences = split_sentences(doc);
+    parallel_for(sentences.size(), 64, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Unit &unit = sentences[i];
+            unit.tokens = tokenize(std::string_view(doc.text).substr(unit.begin, unit.end - unit.begin));
+        }
+    });
+
+    std::vector<Unit> units;
+    units.reserve(sentences.size());
+    for (auto &sentence: sentences) {
+        if (sentence.tokens.size() > budget) {
+            split_words(doc, sentence, tokenize, budget, units);
+        } else if (!sentence.tokens.empty()) {
+            units.push_back(std::move(sentence));
+        }
+    }
+
+    // Pack whole units up to the budget; the tail of a chunk of at most `overlap` tokens opens the next one
+    size_t total_tokens = 0;
+    for (const auto &unit: units) {
+        total_tokens += unit.tokens.size();
+    }
+    doc.chunkTokens.reserve(total_tokens + total_tokens * overlap / budget);
+
+    size_t first = 0;
+    while (first < units.size()) {
+        size_t last = first;
+        size_t tokens = 0;
+        while (last < units.size() && tokens + units[last].tokens.size() <= budget) {
+            tokens += units[last++].tokens.size();
+        }
+
+        TextSpan span;
+        span.offset = units[first].begin;
+        while (span.offset < units[last - 1].end && is_space(doc.text[span.offset])) ++span.offset;
+        span.length = units[last - 1].end - span.offset;
+        span.page = units[first].page;
+        span.token_offset = doc.chunkTokens.size();
+        span.token_count = tokens;
+        for (size_t u = first; u < last; ++u) {
+            doc.chunkTokens.insert(doc.chunkTokens.end(), units[u].tokens.begin(), units[u].tokens.end());
+        }
+        doc.chunks.push_back(span);
+
+        if (last == units.size()) {
+            break;
+        }
+        // The repeated units leave room for the next new one, so every chunk moves forward
+        size_t next = last;
+        size_t repeated = 0;
+        while (next > first + 1 && repeated + units[next - 1].tokens.size() <= overlap &&
+               repeated + units[next - 1].tokens.size() + units[last].tokens.size() <= budget) {
+            repeated += units[--next].tokens.size();
+        }
+        first = next;
+    }
+}
+
+} // namespace tldr
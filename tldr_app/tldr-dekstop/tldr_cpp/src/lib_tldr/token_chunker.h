@@ -0,0 +1,31 @@
+#ifndef TLDR_CPP_TOKEN_CHUNKER_H
+#define TLDR_CPP_TOKEN_CHUNKER_H
+
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include "definitions.h"
+
+namespace tldr {
+
+// Token ids of a piece of text, without special tokens
+using ChunkTokenizer = std::function<std::vector<int32_t>(std::string_view)>;
+
+/**
+ * Split DocumentData::text into chunks of at most `budget` tokens of the
+ * embedding model, filling DocumentData::chunks and DocumentData::chunkTokens.
+ *
+ * The text is cut into sentences (which never span a page break), each sentence
+ * is tokenized once, and whole sentences are packed into a chunk until the next
+ * one would exceed the budget. A sentence longer than the budget is split at
+ * word boundaries instead, and a single word longer than the budget is cut. The
+ * trailing sentences of a chunk holding at most `overlap` tokens are repeated at
+ * the start of the next one. The token ids of every chunk are kept, so the
+ * embedding step does not tokenize the chunk text again.
+ */
+void split_into_token_chunks(DocumentData &doc, const ChunkTokenizer &tokenize, size_t budget, size_t overlap);
+
+} // namespace tldr
+
+#endif // TLDR_CPP_TOKEN_CHUNKER_H
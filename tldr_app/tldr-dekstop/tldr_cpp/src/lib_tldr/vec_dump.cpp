@@ -4,80 +4,648 @@
 #include <filesystem>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <cstddef>
 #include "constants.h"
+#include "search/simd_dot.h"
 
 namespace tldr {
 
+// Location of the vecdump written for a source document: <dir of source>/_vecdump/<fileHash>.vecdump
+std::string vector_dump_path_for(const std::string& source_path, const std::string& fileHash) {
+    std::filesystem::path corpusDir = std::filesystem::path(source_path).parent_path();
+    return (corpusDir / "_vecdump" / (fileHash + ".vecdump")).string();
+}
+
+static size_t element_size(VectorElementType type) {
+    switch (type) {
+        case VectorElementType::Float16: return sizeof(uint16_t);
+        case VectorElementType::Int8: return sizeof(int8_t);
+        default: return sizeof(float);
+    }
+}
+
+static const char* element_type_name(VectorElementType type) {
+    switch (type) {
+        case VectorElementType::Float16: return "fp16";
+        case VectorElementType::Int8: return "int8";
+        default: return "float32";
+    }
+}
+
+static uint64_t align_up(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static float l2_norm(const float* v, size_t dims) {
+    return std::sqrt(simd::dot_f32(v, v, dims));
+}
+
+// Offset of the per-row scales of a prefix section, after the codes
+static uint64_t prefix_scales_offset(uint64_t prefix_offset, uint64_t rows, uint64_t prefix_dims, uint64_t alignment) {
+    return align_up(prefix_offset + rows * prefix_dims, alignment);
+}
+
+bool normalize_vector(float* v, size_t dims) {
+    const float norm = l2_norm(v, dims);
+    if (norm <= 0.0f) return false;
+    const float inv = 1.0f / norm;
+    for (size_t d = 0; d < dims; ++d) v[d] *= inv;
+    return true;
+}
+
+// Streams the sections of a dump, padding each one to the section alignment
+// and keeping the CRC32C of the bytes written since the section began
+class SectionWriter {
+public:
+    SectionWriter(std::ofstream& out, uint64_t alignment) : out_(out), alignment_(alignment) {}
+
+    void begin_section(uint64_t expected_offset) {
+        static const char zeros[64] = {};
+        uint64_t aligned = align_up(offset_, alignment_);
+        while (offset_ < aligned) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(sizeof(zeros), aligned - offset_));
+            out_.write(zeros, static_cast<std::streamsize>(n));
+            offset_ += n;
+        }
+        if (offset_ != expected_offset) {
+            out_.setstate(std::ios::failbit); // Layout bug, fail the write instead of producing a corrupt file
+        }
+        crc_ = 0;
+    }
+
+    void write(const void* data, size_t n) {
+        out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(n));
+        crc_ = simd::crc32c(crc_, data, n);
+        offset_ += n;
+    }
+
+    void skip_header(size_t n) {
+        std::vector<char> zeros(n, 0);
+        out_.write(zeros.data(), static_cast<std::streamsize>(n));
+        offset_ += n;
+    }
+
+    uint32_t crc() const { return crc_; }
+
+private:
+    std::ofstream& out_;
+    uint64_t alignment_;
+    uint64_t offset_ = 0;
+    uint32_t crc_ = 0;
+};
+
+bool write_vector_dump(const std::string& path, size_t num_entries, size_t dims,
+                       const std::function<void(size_t row, float* out)>& source,
+                       const uint64_t* hashes, const VectorDumpFormat& format) {
+    if (num_entries == 0 || dims == 0 || num_entries > UINT32_MAX) {
+        std::cerr << "Error: Invalid vector dump shape (" << num_entries << " x " << dims << ")" << std::endl;
+        return false;
+    }
+
+    // Rows are scaled to unit length on the way in, so every section (and the
+    // normalized flag) describes the same vectors
+    std::function<void(size_t, float*)> row_source = source;
+    if (format.normalize) {
+        row_source = [&source, dims](size_t row, float* out) {
+            source(row, out);
+            normalize_vector(out, dims);
+        };
+    }
+
+    const VectorElementType type = format.element_type;
+    const bool per_dimension = type == VectorElementType::Int8 && format.int8_scaling == Int8Scaling::PerDimension;
+    const bool rescore = format.rescore_section && type != VectorElementType::Float32;
+    const size_t prefix_dims = format.prefix_dimensions < dims ? format.prefix_dimensions : 0;
+    uint64_t alignment = format.section_alignment;
+    if (alignment < 8 || (alignment & (alignment - 1)) != 0) {
+        alignment = VECDUMP_SECTION_ALIGNMENT;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << tmp_path << " for writing" << std::endl;
+        return false;
+    }
+
+    std::vector<float> row(dims);
+
+    // Per-dimension int8 needs the value range of every dimension first
+    std::vector<float> dim_min, dim_scale;
+    if (per_dimension) {
+        dim_min.assign(dims, std::numeric_limits<float>::max());
+        std::vector<float> dim_max(dims, std::numeric_limits<float>::lowest());
+        for (size_t i = 0; i < num_entries; ++i) {
+            row_source(i, row.data());
+            for (size_t d = 0; d < dims; ++d) {
+                dim_min[d] = std::min(dim_min[d], row[d]);
+                dim_max[d] = std::max(dim_max[d], row[d]);
+            }
+        }
+        dim_scale.resize(dims);
+        for (size_t d = 0; d < dims; ++d) {
+            dim_scale[d] = (dim_max[d] - dim_min[d]) / 255.0f;
+        }
+    }
+
+    VectorDumpHeader header{};
+    header.magic = VECDUMP_MAGIC;
+    header.version = prefix_dims > 0 ? 4 : 3;
+    header.num_entries = static_cast<uint32_t>(num_entries);
+    header.vector_dimensions = static_cast<uint32_t>(dims);
+    header.element_type = static_cast<uint32_t>(type);
+    header.int8_scaling = static_cast<uint32_t>(format.int8_scaling);
+    header.hash_size_bytes = sizeof(uint64_t);
+    header.section_alignment = static_cast<uint32_t>(alignment);
+    const size_t header_size = prefix_dims > 0 ? sizeof(VectorDumpHeader) : VECDUMP_V3_HEADER_SIZE;
+    header.header_size = static_cast<uint32_t>(header_size);
+
+    uint64_t offset = align_up(header_size, alignment);
+    header.vectors_offset = offset;
+    offset = align_up(offset + num_entries * dims * element_size(type), alignment);
+    if (type == VectorElementType::Int8) {
+        header.scales_offset = offset;
+        offset = align_up(offset + (per_dimension ? 2 * dims : num_entries) * sizeof(float), alignment);
+    }
+    header.norms_offset = offset;
+    offset = align_up(offset + num_entries * sizeof(float), alignment);
+    header.hashes_offset = offset;
+    offset = align_up(offset + num_entries * sizeof(uint64_t), alignment);
+    if (rescore) {
+        header.rescore_offset = offset;
+        offset = align_up(offset + num_entries * dims * sizeof(float), alignment);
+    }
+    if (prefix_dims > 0) {
+        header.prefix_offset = offset;
+        header.prefix_dimensions = static_cast<uint32_t>(prefix_dims);
+    }
+
+    // The header is rewritten once the checksums are known
+    SectionWriter writer(out, alignment);
+    writer.skip_header(header_size);
+
+    // Vectors; per-vector scales and norms are small enough to buffer
+    std::vector<float> row_scales(num_entries), norms(num_entries);
+    std::vector<int8_t> codes(dims);
+    std::vector<uint16_t> halves(dims);
+    bool normalized = true;
+    writer.begin_section(header.vectors_offset);
+    for (size_t i = 0; i < num_entries; ++i) {
+        row_source(i, row.data());
+        norms[i] = l2_norm(row.data(), dims);
+        // Zero vectors cannot be scaled; they score 0 against any query either way
+        normalized = normalized && (norms[i] == 0.0f || std::fabs(norms[i] - 1.0f) < 1e-3f);
+        if (type == VectorElementType::Float32) {
+            writer.write(row.data(), dims * sizeof(float));
+        } else if (type == VectorElementType::Float16) {
+            for (size_t d = 0; d < dims; ++d) halves[d] = simd::f32_to_f16(row[d]);
+            writer.write(halves.data(), dims * sizeof(uint16_t));
+        } else if (per_dimension) {
+            for (size_t d = 0; d < dims; ++d) {
+                float inv = dim_scale[d] > 0.0f ? 1.0f / dim_scale[d] : 0.0f;
+                long code = std::lround((row[d] - dim_min[d]) * inv) - 128;
+                codes[d] = static_cast<int8_t>(std::clamp(code, -128L, 127L));
+            }
+            writer.write(codes.data(), dims);
+        } else {
+            float max_abs = 0.0f;
+            for (size_t d = 0; d < dims; ++d) max_abs = std::max(max_abs, std::fabs(row[d]));
+            row_scales[i] = max_abs / 127.0f;
+            float inv = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+            for (size_t d = 0; d < dims; ++d) {
+                codes[d] = static_cast<int8_t>(std::clamp(std::lround(row[d] * inv), -127L, 127L));
+            }
+            writer.write(codes.data(), dims);
+        }
+    }
+    header.section_crc32c[VECDUMP_SECTION_VECTORS] = writer.crc();
+    header.flags = normalized ? VECDUMP_FLAG_NORMALIZED : 0;
+
+    if (type == VectorElementType::Int8) {
+        writer.begin_section(header.scales_offset);
+        if (per_dimension) {
+            // (scale, offset) pairs: v = scale * code + offset, offset = min + 128 * scale
+            for (size_t d = 0; d < dims; ++d) {
+                float pair[2] = {dim_scale[d], dim_min[d] + 128.0f * dim_scale[d]};
+                writer.write(pair, sizeof(pair));
+            }
+        } else {
+            writer.write(row_scales.data(), num_entries * sizeof(float));
+        }
+        header.section_crc32c[VECDUMP_SECTION_SCALES] = writer.crc();
+    }
+
+    writer.begin_section(header.norms_offset);
+    writer.write(norms.data(), num_entries * sizeof(float));
+    header.section_crc32c[VECDUMP_SECTION_NORMS] = writer.crc();
+
+    writer.begin_section(header.hashes_offset);
+    writer.write(hashes, num_entries * sizeof(uint64_t));
+    header.section_crc32c[VECDUMP_SECTION_HASHES] = writer.crc();
+
+    if (rescore) {
+        writer.begin_section(header.rescore_offset);
+        for (size_t i = 0; i < num_entries; ++i) {
+            row_source(i, row.data());
+            writer.write(row.data(), dims * sizeof(float));
+        }
+        header.section_crc32c[VECDUMP_SECTION_RESCORE] = writer.crc();
+    }
+
+    if (prefix_dims > 0) {
+        // Leading dimensions rescaled to unit length, so prefix dot products are cosines of the prefix
+        writer.begin_section(header.prefix_offset);
+        std::vector<float> prefix_scales(num_entries);
+        for (size_t i = 0; i < num_entries; ++i) {
+            row_source(i, row.data());
+            normalize_vector(row.data(), prefix_dims);
+            float max_abs = 0.0f;
+            for (size_t d = 0; d < prefix_dims; ++d) max_abs = std::max(max_abs, std::fabs(row[d]));
+            prefix_scales[i] = max_abs / 127.0f;
+            float inv = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+            for (size_t d = 0; d < prefix_dims; ++d) {
+                codes[d] = static_cast<int8_t>(std::clamp(std::lround(row[d] * inv), -127L, 127L));
+            }
+            writer.write(codes.data(), prefix_dims);
+        }
+        // One checksum over codes, padding and scales
+        const uint64_t scales_offset = prefix_scales_offset(header.prefix_offset, num_entries, prefix_dims, alignment);
+        static const char zeros[64] = {};
+        for (uint64_t pad = scales_offset - (header.prefix_offset + num_entries * prefix_dims); pad > 0;) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(sizeof(zeros), pad));
+            writer.write(zeros, n);
+            pad -= n;
+        }
+        writer.write(prefix_scales.data(), num_entries * sizeof(float));
+        header.prefix_crc32c = writer.crc();
+        header.extension_crc32c = simd::crc32c(0, &header.prefix_offset,
+                                               offsetof(VectorDumpHeader, extension_crc32c) -
+                                               offsetof(VectorDumpHeader, prefix_offset));
+    }
+
+    header.header_crc32c = simd::crc32c(0, &header, offsetof(VectorDumpHeader, header_crc32c));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), static_cast<std::streamsize>(header_size));
+
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed writing " << tmp_path << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "Error: Could not move " << tmp_path << " into place: " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
 // Dump vectors and hashes to a binary file for memory mapping
 bool dump_vectors_to_file(const std::string& source_path, 
                          const std::vector<std::vector<float>>& embeddings,
                          const std::vector<uint64_t>& hashes,
-                         const std::string& fileHash) {
+                         const std::string& fileHash,
+                         const VectorDumpFormat& format) {
     
     if (embeddings.empty() || hashes.empty() || embeddings.size() != hashes.size()) {
         std::cerr << "Error: Invalid embeddings or hashes for dumping to file" << std::endl;
         return false;
     }
 
-    // Extract the corpus directory from the source path
-    std::filesystem::path sourcePath(source_path);
-    std::filesystem::path corpusDir = sourcePath.parent_path();
-    
+    const size_t dims = embeddings[0].size();
+    for (const auto& embedding : embeddings) {
+        if (embedding.size() != dims) {
+            std::cerr << "Error: Inconsistent embedding vector dimensions" << std::endl;
+            return false;
+        }
+    }
+
     // Create _vecdump directory inside the corpus directory if it doesn't exist
-    std::filesystem::path vecdumpDir = corpusDir / "_vecdump";
+    std::filesystem::path vecdumpPath = vector_dump_path_for(source_path, fileHash);
+    std::filesystem::path vecdumpDir = vecdumpPath.parent_path();
     if (!std::filesystem::exists(vecdumpDir)) {
         std::filesystem::create_directory(vecdumpDir);
     }
 
-    // Create vecdump filename using the file hash
-    std::filesystem::path vecdumpPath = vecdumpDir / (fileHash + ".vecdump");
     std::string filename = vecdumpPath.string();
     
-    // Log the save operation
-    std::cout << "Vecdump saved to: " << filename << std::endl;
-    
-    std::ofstream out(filename, std::ios::binary);
-    if (!out) {
+    // Written to a temporary file and renamed into place, so that readers which
+    // still have the previous version mapped never observe a truncated file
+    bool written = write_vector_dump(filename, embeddings.size(), dims, [&](size_t row, float* out) {
+        std::copy(embeddings[row].begin(), embeddings[row].end(), out);
+    }, hashes.data(), format);
+    if (!written) {
         std::cerr << "Failed to save vecdump for " << source_path << std::endl;
-        std::cerr << "Error: Could not open file " << filename << " for writing" << std::endl;
         return false;
     }
+    if (format.binary_codes) {
+        write_binary_codes(binary_codes_path_for(filename), embeddings.size(), dims, [&](size_t row, float* out) {
+            std::copy(embeddings[row].begin(), embeddings[row].end(), out);
+        });
+    }
     
-    // Prepare the header
-    VectorCacheDumpHeader header;
-    header.num_entries = static_cast<uint32_t>(embeddings.size());
-    header.hash_size_bytes = sizeof(uint64_t);
-    header.vector_dimensions = static_cast<uint32_t>(embeddings[0].size());
-    header.vector_size_bytes = sizeof(float) * header.vector_dimensions;
+    std::error_code ec;
+    std::cout << "Successfully wrote vector cache to " << filename << std::endl;
+    std::cout << "  Entries: " << embeddings.size()
+              << ", Vector dim: " << dims
+              << ", Format: " << element_type_name(format.element_type)
+              << ", Total size: " << std::filesystem::file_size(filename, ec) << " bytes" << std::endl;
     
-    // Write the header
+    return true;
+}
+
+std::string binary_codes_path_for(const std::string& dump_path) {
+    return std::filesystem::path(dump_path).replace_extension(".vecbin").string();
+}
+
+void sign_bits(const float* vector, size_t dims, uint64_t* out) {
+    const size_t words = (dims + 63) / 64;
+    std::fill(out, out + words, 0);
+    for (size_t d = 0; d < dims; ++d) {
+        if (vector[d] > 0.0f) out[d / 64] |= uint64_t{1} << (d % 64);
+    }
+}
+
+bool write_binary_codes(const std::string& path, size_t num_entries, size_t dims,
+                        const std::function<void(size_t row, float* out)>& row_source) {
+    BinaryCodesHeader header{};
+    header.magic = VECBIN_MAGIC;
+    header.version = 1;
+    header.num_entries = static_cast<uint32_t>(num_entries);
+    header.vector_dimensions = static_cast<uint32_t>(dims);
+    header.words_per_vector = static_cast<uint32_t>((dims + 63) / 64);
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << tmp_path << " for writing" << std::endl;
+        return false;
+    }
     out.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    
-    // Write all embedding vectors as a continuous block
-    for (const auto& embedding : embeddings) {
-        if (embedding.size() != header.vector_dimensions) {
-            std::cerr << "Error: Inconsistent embedding vector dimensions" << std::endl;
+    out.write("\0\0\0\0\0\0\0\0", 8); // Codes start on a 32-byte boundary
+    std::vector<float> row(dims);
+    std::vector<uint64_t> bits(header.words_per_vector);
+    for (size_t i = 0; i < num_entries; ++i) {
+        row_source(i, row.data());
+        sign_bits(row.data(), dims, bits.data());
+        out.write(reinterpret_cast<const char*>(bits.data()), bits.size() * sizeof(uint64_t));
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed writing " << tmp_path << std::endl;
+        std::filesystem::remove(tmp_path);
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    return !ec;
+}
+
+std::unique_ptr<MappedBinaryCodes> read_binary_codes_file(const std::string& path) {
+    auto result = std::make_unique<MappedBinaryCodes>();
+    result->fd = open(path.c_str(), O_RDONLY);
+    if (result->fd == -1) {
+        return nullptr; // The tier is optional
+    }
+    struct stat sb;
+    if (fstat(result->fd, &sb) == -1 || static_cast<size_t>(sb.st_size) < sizeof(BinaryCodesHeader) + 8) {
+        return nullptr;
+    }
+    result->file_size = sb.st_size;
+    result->mapped_memory = mmap(NULL, result->file_size, PROT_READ, MAP_PRIVATE, result->fd, 0);
+    if (result->mapped_memory == MAP_FAILED) {
+        std::cerr << "Error memory mapping " << path << std::endl;
+        return nullptr;
+    }
+    result->header = static_cast<const BinaryCodesHeader*>(result->mapped_memory);
+    const auto* h = result->header;
+    const size_t codes_offset = sizeof(BinaryCodesHeader) + 8;
+    if (h->magic != VECBIN_MAGIC || h->version != 1 || h->words_per_vector != (h->vector_dimensions + 63) / 64 ||
+        result->file_size < codes_offset + static_cast<size_t>(h->num_entries) * h->words_per_vector * 8) {
+        std::cerr << "Error: Binary codes file " << path << " is truncated or malformed" << std::endl;
+        return nullptr;
+    }
+    result->codes = reinterpret_cast<const uint64_t*>(static_cast<const char*>(result->mapped_memory) + codes_offset);
+    return result;
+}
+
+VectorDumpFormat vector_dump_format_of(const MappedVectorData& data) {
+    VectorDumpFormat format;
+    format.element_type = data.element_type;
+    format.int8_scaling = data.int8_scaling;
+    format.rescore_section = data.element_type != VectorElementType::Float32 && data.vectors != nullptr;
+    if (data.version >= 3) {
+        format.section_alignment = data.dump_header->section_alignment;
+    }
+    // Older dumps pick up the default prefix section when rewritten
+    if (data.version >= 4) {
+        format.prefix_dimensions = data.prefix_dimensions;
+    }
+    return format;
+}
+
+void decode_vector(const MappedVectorData& data, size_t row, float* out) {
+    const size_t dims = data.header->vector_dimensions;
+    if (data.vectors) {
+        std::memcpy(out, data.vectors + row * dims, dims * sizeof(float));
+        return;
+    }
+    if (data.element_type == VectorElementType::Float16) {
+        const uint16_t* halves = static_cast<const uint16_t*>(data.quantized) + row * dims;
+        for (size_t d = 0; d < dims; ++d) out[d] = simd::f16_to_f32(halves[d]);
+        return;
+    }
+    const int8_t* codes = static_cast<const int8_t*>(data.quantized) + row * dims;
+    if (data.int8_scaling == Int8Scaling::PerDimension) {
+        for (size_t d = 0; d < dims; ++d) out[d] = data.scales[2 * d] * codes[d] + data.scales[2 * d + 1];
+    } else {
+        const float scale = data.scales[row];
+        for (size_t d = 0; d < dims; ++d) out[d] = scale * codes[d];
+    }
+}
+
+// Concatenate several mapped dumps into a single dump file at out_path
+bool merge_vector_dumps(const std::vector<const MappedVectorData*>& inputs, const std::string& out_path) {
+    if (inputs.empty()) {
+        std::cerr << "Error: No vector dumps to merge" << std::endl;
+        return false;
+    }
+
+    const size_t dims = inputs[0]->header->vector_dimensions;
+    size_t num_entries = 0;
+    bool all_float32 = true;
+    const MappedVectorData* format_source = nullptr;
+    for (const auto* input : inputs) {
+        if (input->header->vector_dimensions != dims || input->header->hash_size_bytes != sizeof(uint64_t)) {
+            std::cerr << "Error: Cannot merge vector dumps with different layouts" << std::endl;
+            return false;
+        }
+        // A corrupt input must not be baked into a segment with fresh checksums
+        if (!verify_vector_dump(*input, out_path + " input")) {
+            return false;
+        }
+        num_entries += input->header->num_entries;
+        if (!format_source && input->version >= 2) {
+            format_source = input; // Self-describing inputs decide the format, legacy v1 ones are upgraded
+        }
+        all_float32 = all_float32 && input->vectors != nullptr;
+    }
+
+    // Rows are re-encoded in the format of the first v2+ input (float32 if there is none)
+    VectorDumpFormat format;
+    if (format_source) {
+        format = vector_dump_format_of(*format_source);
+    } else {
+        format.element_type = VectorElementType::Float32;
+    }
+    format.rescore_section = format.rescore_section && all_float32;
+
+    std::vector<size_t> row_begin;
+    std::vector<uint64_t> hashes;
+    hashes.reserve(num_entries);
+    for (const auto* input : inputs) {
+        row_begin.push_back(hashes.size());
+        hashes.insert(hashes.end(), input->hashes, input->hashes + input->header->num_entries);
+    }
+    return write_vector_dump(out_path, num_entries, dims, [&](size_t row, float* out) {
+        size_t input = std::upper_bound(row_begin.begin(), row_begin.end(), row) - row_begin.begin() - 1;
+        decode_vector(*inputs[input], row - row_begin[input], out);
+    }, hashes.data(), format);
+}
+
+// Set up the section pointers of a v2-v4 file, false if it is malformed or truncated
+static bool map_sections(MappedVectorData& data, const std::string& path) {
+    const auto* header = static_cast<const VectorDumpHeader*>(data.mapped_memory);
+    const size_t header_size = header->version >= 4 ? sizeof(VectorDumpHeader)
+                             : header->version == 3 ? VECDUMP_V3_HEADER_SIZE : VECDUMP_V2_HEADER_SIZE;
+    if (data.file_size < header_size) {
+        std::cerr << "Error: Truncated vector dump header in " << path << std::endl;
+        return false;
+    }
+    if (header->version < 2 || header->version > 4 || header->hash_size_bytes != sizeof(uint64_t) ||
+        header->element_type > static_cast<uint32_t>(VectorElementType::Int8) ||
+        header->int8_scaling > static_cast<uint32_t>(Int8Scaling::PerDimension)) {
+        std::cerr << "Error: Unsupported vector dump format in " << path << " (version " << header->version << ")"
+                  << std::endl;
+        return false;
+    }
+    if (header->version >= 3 &&
+        header->header_crc32c != simd::crc32c(0, header, offsetof(VectorDumpHeader, header_crc32c))) {
+        std::cerr << "Error: Vector dump header checksum mismatch in " << path << std::endl;
+        return false;
+    }
+    if (header->version >= 4 &&
+        header->extension_crc32c != simd::crc32c(0, &header->prefix_offset,
+                                                 offsetof(VectorDumpHeader, extension_crc32c) -
+                                                 offsetof(VectorDumpHeader, prefix_offset))) {
+        std::cerr << "Error: Vector dump header checksum mismatch in " << path << std::endl;
+        return false;
+    }
+
+    const uint64_t rows = header->num_entries;
+    const uint64_t dims = header->vector_dimensions;
+    const auto type = static_cast<VectorElementType>(header->element_type);
+    const auto scaling = static_cast<Int8Scaling>(header->int8_scaling);
+    const char* base = static_cast<const char*>(data.mapped_memory);
+
+    // Every section must lie inside the file
+    auto section = [&](uint64_t offset, uint64_t bytes) -> const void* {
+        if (offset == 0 || offset % 8 != 0 || offset > data.file_size || bytes > data.file_size - offset) {
+            return nullptr;
+        }
+        return base + offset;
+    };
+    data.quantized = section(header->vectors_offset, rows * dims * element_size(type));
+    data.norms = static_cast<const float*>(section(header->norms_offset, rows * sizeof(float)));
+    data.hashes = static_cast<const uint64_t*>(section(header->hashes_offset, rows * sizeof(uint64_t)));
+    bool valid = data.quantized && data.norms && data.hashes;
+    if (type == VectorElementType::Int8) {
+        uint64_t scale_bytes = (scaling == Int8Scaling::PerDimension ? 2 * dims : rows) * sizeof(float);
+        data.scales = static_cast<const float*>(section(header->scales_offset, scale_bytes));
+        valid = valid && data.scales;
+    }
+    if (header->rescore_offset != 0) {
+        data.vectors = static_cast<const float*>(section(header->rescore_offset, rows * dims * sizeof(float)));
+        valid = valid && data.vectors;
+    }
+    if (header->version >= 4 && header->prefix_offset != 0) {
+        const uint64_t prefix_dims = header->prefix_dimensions;
+        const uint64_t alignment = header->section_alignment;
+        valid = valid && prefix_dims > 0 && prefix_dims < dims && alignment >= 8 && (alignment & (alignment - 1)) == 0;
+        if (valid) {
+            data.prefix = static_cast<const int8_t*>(section(header->prefix_offset, rows * prefix_dims));
+            data.prefix_scales = static_cast<const float*>(section(
+                prefix_scales_offset(header->prefix_offset, rows, prefix_dims, alignment), rows * sizeof(float)));
+            data.prefix_dimensions = header->prefix_dimensions;
+            valid = data.prefix && data.prefix_scales;
+        }
+    }
+    if (!valid) {
+        std::cerr << "Error: Vector dump " << path << " is truncated or has invalid section offsets" << std::endl;
+        return false;
+    }
+
+    data.dump_header = header;
+    data.version = header->version;
+    data.flags = header->version >= 3 ? header->flags : 0;
+    data.element_type = type;
+    data.int8_scaling = scaling;
+    if (type == VectorElementType::Float32) {
+        data.vectors = static_cast<const float*>(data.quantized);
+    }
+
+    // Consumers read the shape through the v1 header
+    data.v1_header.num_entries = header->num_entries;
+    data.v1_header.hash_size_bytes = header->hash_size_bytes;
+    data.v1_header.vector_size_bytes = static_cast<uint32_t>(dims * sizeof(float));
+    data.v1_header.vector_dimensions = header->vector_dimensions;
+    data.header = &data.v1_header;
+    return true;
+}
+
+bool verify_vector_dump(const MappedVectorData& data, const std::string& path) {
+    if (data.version < 3) {
+        return true;
+    }
+    const VectorDumpHeader& header = *data.dump_header;
+    const uint64_t rows = header.num_entries;
+    const uint64_t dims = header.vector_dimensions;
+    const auto type = static_cast<VectorElementType>(header.element_type);
+    const uint64_t offsets[VECDUMP_SECTION_COUNT] = {
+        header.vectors_offset, header.scales_offset, header.norms_offset, header.hashes_offset, header.rescore_offset
+    };
+    const uint64_t sizes[VECDUMP_SECTION_COUNT] = {
+        rows * dims * element_size(type),
+        (data.int8_scaling == Int8Scaling::PerDimension ? 2 * dims : rows) * sizeof(float),
+        rows * sizeof(float),
+        rows * sizeof(uint64_t),
+        rows * dims * sizeof(float)
+    };
+    static const char* names[VECDUMP_SECTION_COUNT] = {"vectors", "scales", "norms", "hashes", "rescore"};
+
+    const char* base = static_cast<const char*>(data.mapped_memory);
+    for (uint32_t s = 0; s < VECDUMP_SECTION_COUNT; ++s) {
+        if (offsets[s] == 0) continue;
+        if (simd::crc32c(0, base + offsets[s], sizes[s]) != header.section_crc32c[s]) {
+            std::cerr << "Error: Checksum mismatch in the " << names[s] << " section of " << path << std::endl;
+            return false;
+        }
+    }
+    if (data.prefix) {
+        const uint64_t prefix_bytes = prefix_scales_offset(header.prefix_offset, rows, data.prefix_dimensions,
+                                                           header.section_alignment) - header.prefix_offset +
+                                      rows * sizeof(float);
+        if (simd::crc32c(0, base + header.prefix_offset, prefix_bytes) != header.prefix_crc32c) {
+            std::cerr << "Error: Checksum mismatch in the prefix section of " << path << std::endl;
             return false;
         }
-        
-        out.write(reinterpret_cast<const char*>(embedding.data()), 
-                 header.vector_size_bytes);
     }
-    
-    // Write all hashes as a continuous block
-    out.write(reinterpret_cast<const char*>(hashes.data()), 
-              header.hash_size_bytes * header.num_entries);
-    
-    out.close();
-    
-    std::cout << "Successfully wrote vector cache to " << filename << std::endl;
-    std::cout << "  Entries: " << header.num_entries 
-              << ", Vector dim: " << header.vector_dimensions
-              << ", Total size: " << (sizeof(header) + 
-                                    header.num_entries * header.vector_size_bytes + 
-                                    header.num_entries * header.hash_size_bytes) 
-              << " bytes" << std::endl;
-    
     return true;
 }
 
@@ -99,6 +667,10 @@ std::unique_ptr<MappedVectorData> read_vector_dump_file(const std::string& dump_
         return nullptr;
     }
     result->file_size = sb.st_size;
+    if (result->file_size < sizeof(VectorCacheDumpHeader)) {
+        std::cerr << "Error: " << dump_file_path << " is too small to be a vector dump" << std::endl;
+        return nullptr;
+    }
     
     // Memory map the file
     result->mapped_memory = mmap(NULL, result->file_size, PROT_READ, MAP_PRIVATE, result->fd, 0);
@@ -107,12 +679,28 @@ std::unique_ptr<MappedVectorData> read_vector_dump_file(const std::string& dump_
         return nullptr;
     }
     
+    if (*static_cast<const uint32_t*>(result->mapped_memory) == VECDUMP_MAGIC) {
+        if (!map_sections(*result, dump_file_path)) {
+            return nullptr;
+        }
+        if (VECDUMP_VERIFY_ON_READ && !verify_vector_dump(*result, dump_file_path)) {
+            return nullptr;
+        }
+        return result;
+    }
+
     // Set up the header pointer
     result->header = static_cast<VectorCacheDumpHeader*>(result->mapped_memory);
     
     // Calculate offsets
     size_t header_size = sizeof(VectorCacheDumpHeader);
-    size_t vectors_section_size = result->header->num_entries * result->header->vector_size_bytes;
+    size_t vectors_section_size = static_cast<size_t>(result->header->num_entries) * result->header->vector_size_bytes;
+    size_t hashes_section_size = static_cast<size_t>(result->header->num_entries) * result->header->hash_size_bytes;
+    if (result->header->vector_size_bytes != result->header->vector_dimensions * sizeof(float) ||
+        result->file_size < header_size + vectors_section_size + hashes_section_size) {
+        std::cerr << "Error: Vector dump " << dump_file_path << " is truncated or malformed" << std::endl;
+        return nullptr;
+    }
     
     // Set up pointers to the vectors and hashes sections
     result->vectors = reinterpret_cast<const float*>(
@@ -132,6 +720,16 @@ void print_vector_dump_info(const MappedVectorData* data, const std::string& fil
     }
     
     std::cout << "=== Vector Cache File: " << file_path << " ===" << std::endl;
+    std::cout << "Format version: " << data->version << " (" << element_type_name(data->element_type)
+              << (data->element_type != VectorElementType::Float32 && data->vectors ? " + float32 rescore" : "")
+              << (data->normalized() ? ", normalized" : "") << ")" << std::endl;
+    if (data->prefix) {
+        std::cout << "Prefix section: first " << data->prefix_dimensions << " dimensions (int8)" << std::endl;
+    }
+    if (data->version >= 3) {
+        std::cout << "Section alignment: " << data->dump_header->section_alignment << " bytes, checksums "
+                  << (verify_vector_dump(*data, file_path) ? "OK" : "MISMATCH") << std::endl;
+    }
     std::cout << "Number of entries: " << data->header->num_entries << std::endl;
     std::cout << "Hash size (bytes): " << data->header->hash_size_bytes << std::endl;
     std::cout << "Vector size (bytes): " << data->header->vector_size_bytes << std::endl;
@@ -147,7 +745,8 @@ void print_vector_dump_info(const MappedVectorData* data, const std::string& fil
         
         // Print embedding vector for element at index 1
         std::cout << "Embedding vector (first 10 dimensions):" << std::endl;
-        const float* vector = data->vectors + (index * data->header->vector_dimensions);
+        std::vector<float> vector(data->header->vector_dimensions);
+        decode_vector(*data, index, vector.data());
         
         size_t dims_to_show = std::min(static_cast<size_t>(10), 
                                     static_cast<size_t>(data->header->vector_dimensions));
@@ -188,11 +787,15 @@ bool test_vector_cache() {
         test_hashes.push_back(1000000 + i * 10000); // Simple deterministic hash for testing
     }
     
-    // Test file path
-    std::string test_file = "vector_cache_test.bin";
+    // Source file path; the dump is written to <its directory>/_vecdump/<fileHash>.vecdump
+    const std::filesystem::path test_dir = std::filesystem::temp_directory_path() / "tldr_vector_cache_test";
+    std::string test_file = (test_dir / "vector_cache_test.bin").string();
+    std::string dump_file = vector_dump_path_for(test_file, "test_hash");
+    std::error_code ec;
+    std::filesystem::create_directories(test_dir, ec);
     
     // Step 1: Dump the test data
-    std::cout << "\nStep 1: Dumping test embeddings to " << test_file << std::endl;
+    std::cout << "\nStep 1: Dumping test embeddings to " << dump_file << std::endl;
     if (!dump_vectors_to_file(test_file, test_embeddings, test_hashes, "test_hash")) {
         std::cerr << "Error: Failed to dump test embeddings" << std::endl;
         return false;
@@ -200,14 +803,14 @@ bool test_vector_cache() {
     
     // Step 2: Read the dumped file
     std::cout << "\nStep 2: Reading the vector dump file" << std::endl;
-    auto mapped_data = read_vector_dump_file(test_file);
+    auto mapped_data = read_vector_dump_file(dump_file);
     if (!mapped_data) {
         std::cerr << "Error: Failed to read the vector dump file" << std::endl;
         return false;
     }
     
     // Step 3: Print info about the file
-    print_vector_dump_info(mapped_data.get(), test_file, false);
+    print_vector_dump_info(mapped_data.get(), dump_file, false);
     
     // Step 4: Verify contents
     std::cout << "\nStep 4: Verifying file contents" << std::endl;
@@ -220,45 +823,215 @@ bool test_vector_cache() {
     
     std::cout << "Header verification: " << (header_verified ? "PASSED" : "FAILED") << std::endl;
     
-    // Verify contents by checking values at index 1 (second element)
-    bool data_verified = true;
-    size_t test_idx = 1;
-    
-    if (test_idx < mapped_data->header->num_entries) {
-        std::cout << "\nVerifying element at index " << test_idx << ":" << std::endl;
-        
-        // Original hash and the one read from file
-        uint64_t original_hash = test_hashes[test_idx];
-        uint64_t read_hash = mapped_data->hashes[test_idx];
-        
-        std::cout << "Hash verification: Original = " << original_hash 
-                  << ", Read = " << read_hash 
-                  << " -> " << (original_hash == read_hash ? "MATCH" : "MISMATCH") << std::endl;
+    // Rows may be normalized and quantized on write, so every row is compared by direction:
+    // the cosine of the original and decoded vectors must be ~1
+    bool data_verified = header_verified;
+    std::vector<float> read_vector(dimensions);
+    for (size_t i = 0; data_verified && i < num_embeddings; i++) {
+        uint64_t original_hash = test_hashes[i];
+        uint64_t read_hash = mapped_data->hashes[i];
+        decode_vector(*mapped_data, i, read_vector.data());
         
-        // Check a few dimensions of the embedding vector
-        const float* read_vector = mapped_data->vectors + (test_idx * mapped_data->header->vector_dimensions);
-        
-        std::cout << "Vector verification (first 5 dimensions):" << std::endl;
-        bool vector_matches = true;
-        for (size_t i = 0; i < 5 && i < mapped_data->header->vector_dimensions; i++) {
-            float original_val = test_embeddings[test_idx][i];
-            float read_val = read_vector[i];
-            bool matches = (std::abs(original_val - read_val) < 0.000001f); // Floating point comparison with epsilon
-            
-            std::cout << "  Dim " << i << ": Original = " << original_val 
-                      << ", Read = " << read_val 
-                      << " -> " << (matches ? "MATCH" : "MISMATCH") << std::endl;
-            
-            if (!matches) vector_matches = false;
+        float dot = 0.0f, original_norm = 0.0f, read_norm = 0.0f;
+        for (size_t j = 0; j < dimensions; j++) {
+            dot += test_embeddings[i][j] * read_vector[j];
+            original_norm += test_embeddings[i][j] * test_embeddings[i][j];
+            read_norm += read_vector[j] * read_vector[j];
         }
+        float cosine = dot / std::sqrt(original_norm * read_norm);
+        bool matches = original_hash == read_hash && cosine > 0.999f;
         
-        data_verified = (original_hash == read_hash) && vector_matches;
+        std::cout << "  Row " << i << ": hash " << (original_hash == read_hash ? "MATCH" : "MISMATCH")
+                  << ", cosine to original = " << cosine << " -> " << (matches ? "MATCH" : "MISMATCH") << std::endl;
+        data_verified = matches;
     }
     
+    mapped_data.reset();
+    std::filesystem::remove_all(test_dir, ec);
+    
     // Print final result
     std::cout << "\nTest result: " << (header_verified && data_verified ? "PASSED" : "FAILED") << std::endl;
     
     return header_verified && data_verified;
 }
 
+// Cosine of an original vector and row `row` of a mapped dump, decoded
+static float decoded_cosine(const MappedVectorData& data, size_t row, const std::vector<float>& original) {
+    std::vector<float> decoded(original.size());
+    decode_vector(data, row, decoded.data());
+    float dot = 0.0f, original_norm = 0.0f, decoded_norm = 0.0f;
+    for (size_t j = 0; j < original.size(); j++) {
+        dot += original[j] * decoded[j];
+        original_norm += original[j] * original[j];
+        decoded_norm += decoded[j] * decoded[j];
+    }
+    return dot / std::sqrt(original_norm * decoded_norm);
+}
+
+bool test_vector_dump_formats() {
+    std::cout << "=== Testing Vector Dump Format Round Trips ===" << std::endl;
+
+    const size_t num_embeddings = 40;
+    const size_t dimensions = 48;
+    std::vector<std::vector<float>> test_embeddings(num_embeddings, std::vector<float>(dimensions));
+    std::vector<uint64_t> test_hashes(num_embeddings);
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < num_embeddings; i++) {
+        for (size_t j = 0; j < dimensions; j++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            test_embeddings[i][j] = static_cast<float>(static_cast<int32_t>(state >> 32)) / 2147483648.0f;
+        }
+        test_hashes[i] = 5000000 + i * 7919;
+    }
+    auto row_source = [&](size_t row, float* out) {
+        std::copy(test_embeddings[row].begin(), test_embeddings[row].end(), out);
+    };
+
+    const std::filesystem::path test_dir = std::filesystem::temp_directory_path() / "tldr_vector_format_test";
+    std::error_code ec;
+    std::filesystem::create_directories(test_dir, ec);
+
+    // Every row must come back with its hash and (nearly) its direction
+    auto verify_rows = [&](const MappedVectorData& data, float min_cosine) {
+        if (data.header->num_entries != num_embeddings || data.header->vector_dimensions != dimensions) {
+            return false;
+        }
+        for (size_t i = 0; i < num_embeddings; i++) {
+            if (data.hashes[i] != test_hashes[i] || decoded_cosine(data, i, test_embeddings[i]) < min_cosine) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    struct Case {
+        const char* name;
+        VectorDumpFormat format;
+        uint32_t version;
+        float min_cosine;
+    };
+    auto format_of = [](VectorElementType type, Int8Scaling scaling, bool rescore, uint32_t prefix_dims) {
+        VectorDumpFormat format;
+        format.element_type = type;
+        format.int8_scaling = scaling;
+        format.rescore_section = rescore;
+        format.binary_codes = false;
+        format.prefix_dimensions = prefix_dims;
+        return format;
+    };
+    const std::vector<Case> cases = {
+        {"v3 float32", format_of(VectorElementType::Float32, Int8Scaling::PerVector, false, 0), 3, 0.99999f},
+        {"v3 float16", format_of(VectorElementType::Float16, Int8Scaling::PerVector, false, 0), 3, 0.9999f},
+        {"v3 int8 per vector", format_of(VectorElementType::Int8, Int8Scaling::PerVector, false, 0), 3, 0.999f},
+        {"v3 int8 per dimension", format_of(VectorElementType::Int8, Int8Scaling::PerDimension, false, 0), 3, 0.999f},
+        {"v3 int8 + rescore", format_of(VectorElementType::Int8, Int8Scaling::PerVector, true, 0), 3, 0.99999f},
+        {"v4 int8 + prefix", format_of(VectorElementType::Int8, Int8Scaling::PerVector, false, 16), 4, 0.999f},
+    };
+
+    bool all_passed = true;
+    std::string v3_int8_path, v4_path;
+    std::cout << "\nStep 1: Writing and reading every dump version and element type" << std::endl;
+    for (const auto& c: cases) {
+        const std::string path = (test_dir / (std::string(c.name) + ".vecdump")).string();
+        bool passed = write_vector_dump(path, num_embeddings, dimensions, row_source, test_hashes.data(), c.format);
+        auto data = passed ? read_vector_dump_file(path) : nullptr;
+        passed = data && data->version == c.version && data->element_type == c.format.element_type &&
+                 verify_vector_dump(*data, path) && verify_rows(*data, c.min_cosine) &&
+                 (c.format.prefix_dimensions == 0 || data->prefix_dimensions == c.format.prefix_dimensions);
+        std::cout << "  " << c.name << ": " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+        if (c.version == 3 && c.format.element_type == VectorElementType::Int8 && !c.format.rescore_section &&
+            c.format.int8_scaling == Int8Scaling::PerVector) {
+            v3_int8_path = path;
+        }
+        if (c.version == 4) {
+            v4_path = path;
+        }
+    }
+
+    // v2 shares the v3 layout up to rescore_offset, without alignment or checksums
+    {
+        const std::string path = (test_dir / "v2 int8.vecdump").string();
+        std::filesystem::copy_file(v3_int8_path, path, std::filesystem::copy_options::overwrite_existing, ec);
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        const uint32_t version = 2;
+        file.seekp(offsetof(VectorDumpHeader, version));
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.close();
+        auto data = read_vector_dump_file(path);
+        bool passed = data && data->version == 2 && verify_rows(*data, 0.999f);
+        std::cout << "  v2 int8: " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+
+    // v1: header, float32 rows, then the hashes
+    {
+        const std::string path = (test_dir / "v1 float32.vecdump").string();
+        VectorCacheDumpHeader header{static_cast<uint32_t>(num_embeddings), sizeof(uint64_t),
+                                     static_cast<uint32_t>(dimensions * sizeof(float)),
+                                     static_cast<uint32_t>(dimensions)};
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& embedding: test_embeddings) {
+            file.write(reinterpret_cast<const char*>(embedding.data()), dimensions * sizeof(float));
+        }
+        file.write(reinterpret_cast<const char*>(test_hashes.data()), num_embeddings * sizeof(uint64_t));
+        file.close();
+        auto data = read_vector_dump_file(path);
+        bool passed = data && data->version == 1 && verify_rows(*data, 0.99999f);
+        std::cout << "  v1 float32: " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+
+    std::cout << "\nStep 2: Rejecting damaged dumps" << std::endl;
+    const std::string damaged = (test_dir / "damaged.vecdump").string();
+    auto damage = [&](uint64_t offset, size_t truncate_to) {
+        std::filesystem::copy_file(v4_path, damaged, std::filesystem::copy_options::overwrite_existing, ec);
+        if (truncate_to) {
+            std::filesystem::resize_file(damaged, truncate_to, ec);
+            return;
+        }
+        std::fstream file(damaged, std::ios::binary | std::ios::in | std::ios::out);
+        char byte = 0;
+        file.seekg(offset);
+        file.read(&byte, 1);
+        byte ^= 0x5a;
+        file.seekp(offset);
+        file.write(&byte, 1);
+    };
+    uint64_t vectors_offset = 0, prefix_offset = 0;
+    {
+        auto data = read_vector_dump_file(v4_path);
+        vectors_offset = data ? data->dump_header->vectors_offset : 0;
+        prefix_offset = data ? data->dump_header->prefix_offset : 0;
+    }
+    const size_t file_size = std::filesystem::file_size(v4_path, ec);
+
+    // A flipped byte in a section passes the mapping but fails the section checksum
+    for (const auto& [name, offset]: {std::pair<const char*, uint64_t>{"vectors section", vectors_offset},
+                                      {"prefix section", prefix_offset}}) {
+        damage(offset + 3, 0);
+        auto data = read_vector_dump_file(damaged);
+        bool passed = offset != 0 && (!data || !verify_vector_dump(*data, damaged));
+        std::cout << "  Corrupt " << name << ": " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+    {
+        damage(offsetof(VectorDumpHeader, num_entries), 0);
+        bool passed = !read_vector_dump_file(damaged);
+        std::cout << "  Corrupt header: " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+    for (size_t size: {file_size - 8, sizeof(VectorDumpHeader) - 4, sizeof(VectorCacheDumpHeader) - 1}) {
+        damage(0, size);
+        bool passed = !read_vector_dump_file(damaged);
+        std::cout << "  Truncated to " << size << " bytes: " << (passed ? "PASSED" : "FAILED") << std::endl;
+        all_passed = all_passed && passed;
+    }
+
+    std::filesystem::remove_all(test_dir, ec);
+    std::cout << "\nTest result: " << (all_passed ? "PASSED" : "FAILED") << std::endl;
+    return all_passed;
+}
+
 } // namespace tldr
@@ -3,12 +3,16 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
 #include <sys/mman.h>
 #include <unistd.h>
+#include "constants.h"
 
 namespace tldr {
 
-// Structure for the header of the vector cache dump file
+// Structure for the header of the vector cache dump file (format v1: float32 only)
 struct VectorCacheDumpHeader {
     uint32_t num_entries;        // Number of embedding vectors/hashes
     uint32_t hash_size_bytes;    // Size of each hash in bytes
@@ -16,15 +20,115 @@ struct VectorCacheDumpHeader {
     uint32_t vector_dimensions;  // Number of dimensions in each vector
 };
 
+// Element type of the scanned vector section
+enum class VectorElementType : uint32_t {
+    Float32 = 0,
+    Float16 = 1,
+    Int8 = 2
+};
+
+// How int8 codes map back to floats
+enum class Int8Scaling : uint32_t {
+    PerVector = 0,   // v = scale[row] * code (symmetric)
+    PerDimension = 1 // v[d] = scale[d] * code + offset[d]
+};
+
+// "TVEC" as the first four bytes; a v1 file would need ~1.4e9 entries to start with it
+constexpr uint32_t VECDUMP_MAGIC = 0x43455654;
+
+// Sections of a v2+ dump, in file order
+enum VectorDumpSection : uint32_t {
+    VECDUMP_SECTION_VECTORS = 0,
+    VECDUMP_SECTION_SCALES,
+    VECDUMP_SECTION_NORMS,
+    VECDUMP_SECTION_HASHES,
+    VECDUMP_SECTION_RESCORE,
+    VECDUMP_SECTION_COUNT
+};
+
+// Header flags (v3)
+constexpr uint32_t VECDUMP_FLAG_NORMALIZED = 1u << 0; // Every (non-zero) vector has unit L2 norm
+
+/**
+ * Self-describing dump header. Sections follow at the given offsets.
+ * v2: quantized sections on 8-byte boundaries, flags always 0.
+ * v3: adds the section alignment (cache line or page) and CRC32C checksums of
+ *     the header and of every section; written for all element types.
+ * v4: adds the coarse prefix section: the leading prefix_dimensions of every
+ *     row, rescaled to unit length and stored as int8 with a per-row scale,
+ *     so a first pass scans a fraction of the bytes (Matryoshka-style).
+ *     Dumps without a prefix section are still written as v3.
+ * Version 2 readers only need the fields up to rescore_offset, version 3
+ * readers the fields up to header_crc32c.
+ */
+struct VectorDumpHeader {
+    uint32_t magic;              // VECDUMP_MAGIC
+    uint32_t version;            // 2 or 3
+    uint32_t num_entries;
+    uint32_t vector_dimensions;
+    uint32_t element_type;       // VectorElementType of the vectors section
+    uint32_t int8_scaling;       // Int8Scaling, int8 only
+    uint32_t hash_size_bytes;
+    uint32_t flags;              // VECDUMP_FLAG_*
+    uint64_t vectors_offset;     // num_entries x dims elements
+    uint64_t scales_offset;      // int8: float scale per vector, or (scale, offset) per dimension; else 0
+    uint64_t norms_offset;       // float L2 norm of every original vector
+    uint64_t hashes_offset;
+    uint64_t rescore_offset;     // Optional float32 copy for rescoring, 0 if absent
+    // v3
+    uint32_t section_alignment;
+    uint32_t header_size;
+    uint32_t section_crc32c[VECDUMP_SECTION_COUNT]; // 0 for absent sections
+    uint32_t header_crc32c;      // Of every header byte before this field
+    // v4
+    uint64_t prefix_offset;      // num_entries x prefix_dimensions int8 codes, then num_entries float scales
+    uint32_t prefix_dimensions;
+    uint32_t prefix_crc32c;      // Of the prefix section
+    uint32_t extension_crc32c;   // Of the v4 fields before this one
+    uint32_t reserved;
+};
+
+// Size of the v2 header (fields up to rescore_offset)
+constexpr size_t VECDUMP_V2_HEADER_SIZE = 72;
+// Size of the v3 header (fields up to header_crc32c)
+constexpr size_t VECDUMP_V3_HEADER_SIZE = offsetof(VectorDumpHeader, prefix_offset);
+
+// Layout requested for a new dump
+struct VectorDumpFormat {
+    VectorElementType element_type = VECDUMP_ELEMENT_TYPE;
+    Int8Scaling int8_scaling = VECDUMP_INT8_SCALING;
+    bool rescore_section = VECDUMP_RESCORE_SECTION; // Keep a float32 copy next to the quantized vectors
+    bool binary_codes = VECDUMP_BINARY_CODES;       // Also write the sign-bit prefilter tier (.vecbin)
+    uint32_t section_alignment = VECDUMP_SECTION_ALIGNMENT; // Power of two, e.g. 64 or 4096
+    bool normalize = VECDUMP_NORMALIZE; // Scale rows to unit length, so cosine search is a plain dot product
+    uint32_t prefix_dimensions = VECDUMP_PREFIX_DIMS; // Coarse prefix section (v4), 0 or >= dims for none
+};
+
 // Structure to hold memory-mapped vector data
 struct MappedVectorData {
     void* mapped_memory = nullptr;         // Raw memory mapping pointer
     size_t file_size = 0;                  // Size of the mapped file
     int fd = -1;                           // File descriptor
-    VectorCacheDumpHeader* header = nullptr; // Pointer to the header
-    const float* vectors = nullptr;        // Pointer to the vectors array
+    VectorCacheDumpHeader* header = nullptr; // Pointer to the header (synthesized for v2+ files)
+    const float* vectors = nullptr;        // Pointer to the float32 vectors array, nullptr if the file has none
     const uint64_t* hashes = nullptr;        // Pointer to the hashes array
-    
+
+    // Self-describing (v2+) files
+    const VectorDumpHeader* dump_header = nullptr;
+    uint32_t version = 1;
+    uint32_t flags = 0;                    // VECDUMP_FLAG_*
+    VectorElementType element_type = VectorElementType::Float32;
+    Int8Scaling int8_scaling = Int8Scaling::PerVector;
+    const void* quantized = nullptr;       // Scanned vector section (int8 or fp16)
+    const float* scales = nullptr;         // int8 scales, see Int8Scaling
+    const float* norms = nullptr;          // L2 norms of the original vectors
+    const int8_t* prefix = nullptr;        // Coarse prefix codes (v4), nullptr if the file has none
+    const float* prefix_scales = nullptr;  // Per-row scale of the prefix codes
+    uint32_t prefix_dimensions = 0;
+    VectorCacheDumpHeader v1_header{};     // Backs header for v2+ files
+
+    bool normalized() const { return (flags & VECDUMP_FLAG_NORMALIZED) != 0; }
+
     // Cleanup resources
     ~MappedVectorData() {
         if (mapped_memory && mapped_memory != MAP_FAILED) {
@@ -36,19 +140,99 @@ struct MappedVectorData {
     }
 };
 
+// "TBIN": header of the sign-bit prefilter tier written next to a dump (<dump stem>.vecbin)
+constexpr uint32_t VECBIN_MAGIC = 0x4E494254;
+
+// Rows are in the same order as the vectors and hashes of the dump
+struct BinaryCodesHeader {
+    uint32_t magic;              // VECBIN_MAGIC
+    uint32_t version;            // 1
+    uint32_t num_entries;
+    uint32_t vector_dimensions;
+    uint32_t words_per_vector;   // ceil(dims / 64); bit d is set when component d > 0
+    uint32_t reserved;
+};
+
+// Memory-mapped .vecbin file
+struct MappedBinaryCodes {
+    void* mapped_memory = nullptr;
+    size_t file_size = 0;
+    int fd = -1;
+    const BinaryCodesHeader* header = nullptr;
+    const uint64_t* codes = nullptr; // num_entries x words_per_vector
+
+    ~MappedBinaryCodes() {
+        if (mapped_memory && mapped_memory != MAP_FAILED) {
+            munmap(mapped_memory, file_size);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+};
+
+// Path of the binary tier belonging to a .vecdump / .vecseg file
+std::string binary_codes_path_for(const std::string& dump_path);
+
+// Sign bits of one vector into words_per_vector words
+void sign_bits(const float* vector, size_t dims, uint64_t* out);
+
+// Write the sign-bit codes of num_entries rows, atomically (temp file + rename)
+bool write_binary_codes(const std::string& path, size_t num_entries, size_t dims,
+                        const std::function<void(size_t row, float* out)>& row_source);
+
+// Map a .vecbin file, nullptr if it is missing or malformed
+std::unique_ptr<MappedBinaryCodes> read_binary_codes_file(const std::string& path);
+
+// Format a mapped dump was written with (used to keep merged segments in the same format)
+VectorDumpFormat vector_dump_format_of(const MappedVectorData& data);
+
+// Scale a vector to unit L2 norm in place; false (and untouched) for a zero vector
+bool normalize_vector(float* v, size_t dims);
+
+// Decode one row to float32: the float32 section when present, otherwise dequantized
+void decode_vector(const MappedVectorData& data, size_t row, float* out);
+
+/**
+ * Write a v3 dump (v4 with a prefix section) of num_entries vectors with the given format,
+ * atomically (temp file + rename).
+ * Rows are pulled through row_source (possibly twice, e.g. for per-dimension int8 ranges)
+ * and normalized first if format.normalize is set, which also sets VECDUMP_FLAG_NORMALIZED.
+ */
+bool write_vector_dump(const std::string& path, size_t num_entries, size_t dims,
+                       const std::function<void(size_t row, float* out)>& row_source,
+                       const uint64_t* hashes, const VectorDumpFormat& format);
+
+// Path of the vecdump file dump_vectors_to_file writes for a source document
+std::string vector_dump_path_for(const std::string& source_path, const std::string& fileHash);
+
 // Dump vectors and hashes to a binary file for memory mapping
 bool dump_vectors_to_file(const std::string& source_path, 
                          const std::vector<std::vector<float>>& embeddings,
                          const std::vector<uint64_t>& hashes,
-                         const std::string& fileHash);
+                         const std::string& fileHash,
+                         const VectorDumpFormat& format = {});
+
+// Concatenate mapped dumps (same dimensions) into one v3/v4 dump file, written atomically.
+// Rows are re-encoded in the format of the first v2+ input (float32 for legacy v1 inputs);
+// inputs failing their checksums abort the merge.
+bool merge_vector_dumps(const std::vector<const MappedVectorData*>& inputs, const std::string& out_path);
 
-// Read a vector dump file using memory mapping and return pointers to the data
+// Read a vector dump file using memory mapping and return pointers to the data.
+// Checksums are verified when VECDUMP_VERIFY_ON_READ is set (reads every page).
 std::unique_ptr<MappedVectorData> read_vector_dump_file(const std::string& dump_file_path);
 
+// Check the header and section CRC32Cs of a v3+ dump (older files have none and pass)
+bool verify_vector_dump(const MappedVectorData& data, const std::string& path);
+
 // Print information about a mapped vector file
 void print_vector_dump_info(const MappedVectorData* data, const std::string& file_path, bool print_sample = true);
 
 // Test vector cache dump and read functionality
 bool test_vector_cache();
 
+// Round-trip every dump version (v1-v4) and element type, and check that
+// corrupted and truncated dumps are rejected
+bool test_vector_dump_formats();
+
 } // namespace tldr